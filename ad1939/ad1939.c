@@ -5,7 +5,6 @@
 */
 
 #include <linux/module.h>
-#include <linux/platform_device.h>
 #include <linux/io.h>
 #include <linux/fs.h>
 #include <linux/types.h>
@@ -14,7 +13,31 @@
 #include <linux/cdev.h>
 #include <linux/spi/spi.h>
 #include <linux/regmap.h>
-
+#include <linux/ktime.h>
+#include <linux/debugfs.h>
+#include <linux/slab.h>
+#include <linux/wait.h>
+#include <linux/atomic.h>
+#include <linux/mutex.h>
+#include <linux/workqueue.h>
+#include <linux/completion.h>
+#include <linux/hrtimer.h>
+#include <linux/math64.h>
+#include <linux/pm_runtime.h>
+#include <linux/idr.h>
+#include <linux/of.h>
+#include <sound/soc.h>
+#include <sound/pcm_params.h>
+#include <sound/tlv.h>
+#include "lat_hist.h"
+#include "fp_conversions.h"
+#include "avalon_regmap.h"
+#include "ad1939_ioctl.h"
+#include "ad1939_volume.h"
+#include "ad1939_clock.h"
+
+#define CREATE_TRACE_POINTS
+#include "ad1939_trace.h"
 
 // Define information about this kernel module
 MODULE_LICENSE("GPL");
@@ -22,29 +45,82 @@ MODULE_AUTHOR("Soos Qasem");
 MODULE_DESCRIPTION("Loadable kernel module for the ad1939");
 MODULE_VERSION("1.0");
 
+// AD1939 register addresses
+#define AD1939_REG_PLL_CTL0     0x00
+#define AD1939_REG_PLL_CTL1     0x01
+#define AD1939_REG_DAC_CTL0     0x02
+#define AD1939_REG_DAC_CTL1     0x03
+#define AD1939_REG_DAC_CTL2     0x04
+#define AD1939_REG_DAC_MUTE     0x05
+#define AD1939_REG_DAC1L_VOL    0x06
+#define AD1939_REG_DAC1R_VOL    0x07
+#define AD1939_REG_DAC2L_VOL    0x08
+#define AD1939_REG_DAC2R_VOL    0x09
+#define AD1939_REG_DAC3L_VOL    0x0A
+#define AD1939_REG_DAC3R_VOL    0x0B
+#define AD1939_REG_DAC4L_VOL    0x0C
+#define AD1939_REG_DAC4R_VOL    0x0D
+#define AD1939_REG_ADC_CTL0     0x0E
+#define AD1939_REG_ADC_CTL1     0x0F
+#define AD1939_REG_ADC_CTL2     0x10
+#define AD1939_NUM_REGS         17
+static_assert(AD1939_NUM_REGS == AD1939_PROFILE_SIZE);
+
+// PLL and clock control 0: power-down bit (stops the PLL, DACs and ADCs), MCLKI/XI to fs ratio
+// of the PLL input (bits 2:1: 256, 384, 512 or 768) and internal MCLK enable
+#define AD1939_PLL_PDN          0x01
+#define AD1939_PLL_MCLKI_MASK   0x06
+#define AD1939_PLL_MCLK_EN      0x80
+
+// MCLK assumed when the device tree doesn't give one (256 x 48 kHz)
+#define AD1939_DEFAULT_MCLK     12288000
+
+// Sample rates of the 32, 44.1 and 48 kHz families at 1x, 2x and 4x
+#define AD1939_MAX_RATES        9
+
+// Every register of the codec resets to 0x00
+#define AD1939_REG_DEFAULT      0x00
+
+// Volume ramps advance once per tick
+#define AD1939_RAMP_TICK_NS     (1 * NSEC_PER_MSEC)
+
+// How long the codec stays powered once idle, when runtime PM is allowed
+#define AD1939_AUTOSUSPEND_MS   2000
+
+// Sample rate fields of DAC control 0 (bits 2:1) and ADC control 0 (bits 7:6)
+#define AD1939_DAC_FS_MASK      0x06
+#define AD1939_ADC_FS_MASK      0xC0
+
+// Fastest CCLK the codec is rated for; also used when the node has no spi-max-frequency
+#define AD1939_MAX_SPI_HZ 10000000
+
 static uint8_t bits = 8;
-static uint32_t speed = 500000;
-static struct spi_device *spi_device;
 
+// Most codecs that can be bound at once (one char device minor each)
+#define AD1939_MAX_DEVICES 8
 
-struct fixed_num
-{
-    int integer;
-    int fraction;
-    int fraction_len;
-};
+static struct class *cl; // Device class shared by all codecs
+static dev_t dev_num;    // First of the AD1939_MAX_DEVICES reserved minors
+static DEFINE_IDA(ad1939_minors);
 
-static struct class *cl; // Global variable for the device class
-static dev_t dev_num;
+// <debugfs>/ad1939, with one directory per codec
+static struct dentry *ad1939_debugfs;
 
 // Function Prototypes
-static int ad1939_probe(struct platform_device *pdev);
-static int ad1939_remove(struct platform_device *pdev);
+static int ad1939_probe(struct spi_device *spi);
+static int ad1939_remove(struct spi_device *spi);
 static ssize_t ad1939_read(struct file *file, char *buffer, size_t len, loff_t *offset);
 static ssize_t ad1939_write(struct file *file, const char *buffer, size_t len, loff_t *offset);
+static long ad1939_ioctl(struct file *file, unsigned int cmd, unsigned long arg);
 static int ad1939_open(struct inode *inode, struct file *file);
 static int ad1939_release(struct inode *inode, struct file *file);
+static int ad1939_suspend(struct device *dev);
+static int ad1939_resume(struct device *dev);
 static ssize_t name_read(struct device *dev, struct device_attribute *attr, char *buf);
+static ssize_t reprogram_time_read(struct device *dev, struct device_attribute *attr, char *buf);
+static ssize_t reprogram_write(struct device *dev, struct device_attribute *attr, const char *buf, size_t count);
+static ssize_t init_time_read(struct device *dev, struct device_attribute *attr, char *buf);
+static ssize_t resume_time_read(struct device *dev, struct device_attribute *attr, char *buf);
 
 // SPI operation prototypes
 static ssize_t sample_frequency_write(struct device *dev, struct device_attribute *attr, const char *buf, size_t count);
@@ -65,13 +141,10 @@ static ssize_t dac4_left_volume_write(struct device *dev, struct device_attribut
 static ssize_t dac4_left_volume_read(struct device *dev, struct device_attribute *attr, char *buf);
 static ssize_t dac4_right_volume_write(struct device *dev, struct device_attribute *attr, const char *buf, size_t count);
 static ssize_t dac4_right_volume_read(struct device *dev, struct device_attribute *attr, char *buf);
-
-// Custom function declarations
-char *strcat2(char *dst, char *src);
-uint32_t set_fixed_num(const char *s);
-int fp_to_string(char *buf, uint32_t fp28_num);
-uint8_t find_volume_level(uint32_t fp28_num);
-uint32_t decode_volume(uint8_t volume_level);
+static ssize_t dac_volumes_write(struct device *dev, struct device_attribute *attr, const char *buf, size_t count);
+static ssize_t dac_volumes_read(struct device *dev, struct device_attribute *attr, char *buf);
+static ssize_t dac_ramp_write(struct device *dev, struct device_attribute *attr, const char *buf, size_t count);
+static ssize_t dac_ramp_read(struct device *dev, struct device_attribute *attr, char *buf);
 
 //Create the attributes that show up in /dev/class
 static DEVICE_ATTR(sample_frequency,          0664, sample_frequency_read,          sample_frequency_write);
@@ -83,38 +156,109 @@ static DEVICE_ATTR(dac1_right_volume,         0664, dac1_right_volume_read,
 static DEVICE_ATTR(dac2_right_volume,         0664, dac2_right_volume_read,         dac2_right_volume_write);
 static DEVICE_ATTR(dac3_right_volume,         0664, dac3_right_volume_read,         dac3_right_volume_write);
 static DEVICE_ATTR(dac4_right_volume,         0664, dac4_right_volume_read,         dac4_right_volume_write);
+static DEVICE_ATTR(dac_volumes,               0664, dac_volumes_read,               dac_volumes_write);
+static DEVICE_ATTR(dac_ramp,                  0664, dac_ramp_read,                  dac_ramp_write);
 
 static DEVICE_ATTR(name, 0444, name_read, NULL);
+static DEVICE_ATTR(reprogram_time, 0444, reprogram_time_read, NULL);
+static DEVICE_ATTR(reprogram, 0200, NULL, reprogram_write);
+static DEVICE_ATTR(init_time, 0444, init_time_read, NULL);
+static DEVICE_ATTR(resume_time, 0444, resume_time_read, NULL);
+
+// Created with the device, so they exist before udev announces it
+static struct attribute *ad1939_attrs[] =
+{
+    &dev_attr_sample_frequency.attr,
+    &dev_attr_dac1_left_volume.attr,
+    &dev_attr_dac2_left_volume.attr,
+    &dev_attr_dac3_left_volume.attr,
+    &dev_attr_dac4_left_volume.attr,
+    &dev_attr_dac1_right_volume.attr,
+    &dev_attr_dac2_right_volume.attr,
+    &dev_attr_dac3_right_volume.attr,
+    &dev_attr_dac4_right_volume.attr,
+    &dev_attr_dac_volumes.attr,
+    &dev_attr_dac_ramp.attr,
+    &dev_attr_name.attr,
+    &dev_attr_reprogram_time.attr,
+    &dev_attr_reprogram.attr,
+    &dev_attr_init_time.attr,
+    &dev_attr_resume_time.attr,
+    NULL
+};
+ATTRIBUTE_GROUPS(ad1939);
 
-/** An instance of this structure will be created for every fe_HA IP in the system
-    This structure holds the linux driver structure as well as a memory pointer to the hardwar and
-    shadow registers with the data stored on the device.
+/** A volume ramp of one DAC channel
+
+    The channel moves linearly in time from one attenuation code to another, so a late tick
+    catches up instead of stretching the ramp.
+*/
+struct ad1939_ramp
+{
+    bool active;                        ///< The channel is ramping
+    bool failed;                        ///< The ramp was stopped by a failed register write
+    uint8_t from;                       ///< Code when the ramp started
+    uint8_t to;                         ///< Target code
+    ktime_t start;                      ///< When the ramp started
+    unsigned int ms;                    ///< Duration of the ramp
+};
+
+/** An instance of this structure will be created for every AD1939 in the system
+    This structure holds the linux driver structure as well as everything needed to talk to one codec.
+    Codecs daisy-chained in TDM each get their own, so they are configured independently and in parallel.
 */
 struct al_ad1939_dev
 {
-    struct cdev cdev;           ///< The driver structure containing major/minor, etc
-    char *name;                 ///< This gets the name of the device when loading the driver
-    void __iomem *regs;         ///< Pointer to the registers on the device
-    int sample_frequency;
-    int dac1_left_volume;
-    int dac2_left_volume;
-    int dac3_left_volume;
-    int dac4_left_volume;
-    int dac1_right_volume;
-    int dac2_right_volume;
-    int dac3_right_volume;
-    int dac4_right_volume;
+    struct cdev cdev;                   ///< The driver structure containing major/minor, etc
+    char *name;                         ///< This gets the name of the device when loading the driver
+    struct spi_device *spi;             ///< The codec's SPI device, bound from its device tree node
+    dev_t devt;                         ///< Major/minor of the char device
+    struct regmap *regmap;              ///< Register cache, seeded by reading the codec back in init_work
+    struct mutex lock;                  ///< Serializes register updates; the cache is cache-only while staging
+    struct work_struct resync_work;     ///< Rewrites the codec from the register cache after a failed batch
+    atomic_t batches_in_flight;         ///< Async batches still owned by the SPI core
+    wait_queue_head_t batches_wq;       ///< Woken when batches_in_flight drops to zero
+    struct lat_hist spi_write_lat;      ///< Latency of every spi_message sent to the codec
+    struct dentry *debugfs;             ///< <debugfs>/ad1939/<spi device>
+    struct work_struct init_work;       ///< Brings the codec up after probe has returned
+    struct completion ready;            ///< Completed when init_work is done, whether it succeeded or not
+    int init_status;                    ///< Result of init_work
+    u64 probe_start;                    ///< When probe was entered
+    u64 init_ns;                        ///< From probe_start to the end of init_work
+    bool suspended;                     ///< Codec powered down; batches only update the register cache
+    uint8_t suspend_regs[AD1939_NUM_REGS];  ///< What the codec held when it was powered down
+    unsigned int mclk;                  ///< Rate of the clock on MCLKI/XI, from adi,mclk-frequency
+    unsigned int rates[AD1939_MAX_RATES];   ///< The sample rates that mclk can produce
+    struct snd_pcm_hw_constraint_list rate_constraint;  ///< rates, for PCM streams
+    struct ad1939_ramp ramp[AD1939_NUM_DACS];   ///< Volume ramps in register order; protected by lock
+    struct hrtimer ramp_timer;          ///< Ticks while any channel is ramping
+    struct work_struct ramp_work;       ///< Advances all ramping channels in one batch
+    u64 resume_ns;                      ///< How long the last resume took
+    u64 reprogram_ns;                   ///< How long the last reprogram through the reprogram attribute took
 };
 
 
 /** Typedef of the driver structure */
 typedef struct al_ad1939_dev al_ad1939_dev_t;   //Annoying but makes sonarqube not crash during the analysis in the container_of() lines
 
-/** Id matching structure for use in driver/device matching */
-static struct of_device_id al_ad1939_dt_ids[] =
+/** Id matching structure for use in driver/device matching
+
+    Every codec is a child node of its SPI controller, e.g. for two codecs sharing a TDM bus:
+
+        &spi0 {
+            codec0: ad1939@0 { compatible = "adi,ad1939"; reg = <0>; spi-max-frequency = <10000000>; spi-cpol; spi-cpha;
+                               adi,mclk-frequency = <12288000>; };
+            codec1: ad1939@1 { compatible = "adi,ad1939"; reg = <1>; spi-max-frequency = <10000000>; spi-cpol; spi-cpha; };
+        };
+
+    adi,mclk-frequency is the rate of the clock on MCLKI/XI in Hz (default 12288000); it picks the sample
+    rate family, see ad1939_clock_config(). spi-max-frequency is clamped to AD1939_MAX_SPI_HZ and defaults to it. The codec samples CDATA on
+    the rising edge of CCLK, so mode 3 and mode 0 both work; a node without spi-cpol/spi-cpha gets mode 3.
+*/
+static const struct of_device_id al_ad1939_dt_ids[] =
 {
     {
-        .compatible = "dev,al-ad1939"
+        .compatible = "adi,ad1939"
     },
     { }
 };
@@ -122,15 +266,38 @@ static struct of_device_id al_ad1939_dt_ids[] =
 /** Notify the kernel about the driver matching structure information */
 MODULE_DEVICE_TABLE(of, al_ad1939_dt_ids);
 
+static const struct spi_device_id al_ad1939_spi_ids[] =
+{
+    { "ad1939", 0 },
+    { }
+};
+MODULE_DEVICE_TABLE(spi, al_ad1939_spi_ids);
+
+/** Power management
+
+    Runtime PM powers the codec down through the power-down bit once nothing uses it: no PCM stream
+    and no open char device. The FPGA can stream to the codec outside of ALSA, so runtime PM starts out
+    forbidden; allow it with "echo auto > /sys/bus/spi/devices/<spi dev>/power/control". System sleep
+    goes through the same callbacks.
+*/
+static const struct dev_pm_ops ad1939_pm_ops =
+{
+    SET_SYSTEM_SLEEP_PM_OPS(pm_runtime_force_suspend, pm_runtime_force_resume)
+    SET_RUNTIME_PM_OPS(ad1939_suspend, ad1939_resume, NULL)
+};
+
 // Data structure with pointers to the externally important functions to be able to load the module
-static struct platform_driver ad1939_platform =
+static struct spi_driver ad1939_spi_driver =
 {
     .probe = ad1939_probe,
     .remove = ad1939_remove,
+    .id_table = al_ad1939_spi_ids,
     .driver = {
-        .name = "Audio Logic ad1939 Driver",
+        .name = "al_ad1939",
         .owner = THIS_MODULE,
-        .of_match_table = al_ad1939_dt_ids
+        .of_match_table = al_ad1939_dt_ids,
+        .probe_type = PROBE_PREFER_ASYNCHRONOUS,
+        .pm = &ad1939_pm_ops
     }
 };
 
@@ -142,1256 +309,2250 @@ static const struct file_operations al_ad1939_fops =
     .write = ad1939_write,             ///< Write the device contents for the entry in /dev
     .open = ad1939_open,               ///< Called when the device is opened
     .release = ad1939_release,         ///< Called when the device is closes
+    .unlocked_ioctl = ad1939_ioctl,    ///< Binary access to all eight DAC volumes
 };
 
-/** Function called initially on the driver loads
+/** Wait for the bring-up started by ad1939_probe() to finish
 
-    This function is called by the kernel when the driver module is loaded and currently just calls ad1939_probe()
+    The char device and the sysfs entries exist as soon as probe returns, while the register cache is
+    seeded and the initialization commands are sent from a work item. Every access waits here first.
 
-    @returns SUCCESS
+    @param devp The codec
+    @returns 0 when the codec is ready, -ERESTARTSYS when interrupted, or the bring-up's error code
 */
-static int ad1939_init(void)
+static int ad1939_wait_ready(al_ad1939_dev_t *devp)
 {
-    int ret_val = 0;
-    
-    // Add the spi master 
-    struct spi_master *master;
-    
-    pr_info("Initializing the Audio Logic ad1939 module\n");
+    if (wait_for_completion_interruptible(&devp->ready))
+        return -ERESTARTSYS;
 
-    // Register our driver with the "Platform Driver" bus
-    ret_val = platform_driver_register(&ad1939_platform);
-    if (ret_val != 0)
-    {
-        pr_err("platform_driver_register returned %d\n", ret_val);
-        return ret_val;
-    }
-    
-    /*------------------------------------------------------------------
-    This SPI initialization is based off code written by Piktas Zuikis
-    ------------------------------------------------------------------*/
-    
-    // Register the device
-    struct spi_board_info spi_device_info = {
-        .modalias = "al_ad1939_",     // Needs to be the same as the device name
-        .max_speed_hz = speed,
-        .bus_num = 0,             // Determined from /sys/class/spi_master                
-        .chip_select = 0,                     // check
-        .mode = 3,
-    };
-    
-    /*To send data we have to know what spi port/pins should be used. This information 
-      can be found in the device-tree. */
-    master = spi_busnum_to_master( spi_device_info.bus_num );
-    if( !master ){
-        printk("MASTER not found.\n");
-            return -ENODEV;
-    }
-     
-    // create a new slave device, given the master and device info
-    spi_device = spi_new_device( master, &spi_device_info );
- 
-    printk("Setting up new slave device\n");
-    if( !spi_device ) {
-        printk("FAILED to create slave.\n");
-        return -ENODEV;
-    }
-     
-    printk("Set the bits per word\n");
-    spi_device->bits_per_word = bits;
- 
-    printk("Setting up the device\n");
-    ret_val = spi_setup( spi_device );
-    //printk("%d\n",ret_val);
-    if( ret_val ){
-        printk("FAILED to setup slave.\n");
-        spi_unregister_device( spi_device );
-        return -ENODEV;
-    }  
-
-    printk("Sending SPI initialization commands...\n");
-
-    printk("\tUnmuting the channels\n");
-    // Set the unmute commands
-    char cmd[3] = {0x08,0x00,0x80};
-    ret_val = spi_write(spi_device,&cmd, sizeof(cmd));
-    //printk("%d\n",ret_val);
+    return devp->init_status;
+}
 
-    // Send the pll mode command
-    printk("\tSetting PLL mode\n");
-    cmd[1] = 0x01;
-    cmd[2] = 0x00;
-    ret_val = spi_write(spi_device,&cmd, sizeof(cmd));
-    //printk("%d\n",ret_val);
-    
-    cmd[1] = 0x10;
-    cmd[2] = 0xC8;
-    ret_val = spi_write(spi_device,&cmd, sizeof(cmd));
-    //printk("%d\n",ret_val);
-
-    // Set the sampling frequency (ADC control register 0)
-    printk("\tSetting sampling frequency to 48 kHz\n");
-    cmd[1] = 0x02;
-    cmd[2] = 0x00;
-    ret_val = spi_write(spi_device,&cmd, sizeof(cmd));
-    //printk("%d\n",ret_val);
-
-    cmd[1] = 14;
-    cmd[2] = 0x00;
-    ret_val = spi_write(spi_device,&cmd, sizeof(cmd));
-    //printk("%d\n",ret_val);
-
-    /*------------------------------------------------------------------
-    --------------------------------------------------------------------
-    ------------------------------------------------------------------*/
-    
-    pr_info("Audio Logic ad1939 module successfully initialized!\n");
+/** Command queue
 
-    return 0;
-}
+    Register writes are collected into an ad1939_batch and sent as one spi_message, one
+    3 byte spi_transfer per register with chip select toggled in between (the codec
+    latches a frame on the rising edge of CLATCH). That pays the controller setup and
+    scheduling cost once per update instead of once per register.
+
+    A batch is submitted with ad1939_batch_commit(), which waits for the transfer to
+    finish, or queues it with spi_async() and returns at once when the async_writes
+    module parameter is set. The SPI core sends the messages of a device in order, so
+    async writes are still applied in the order they were made.
+*/
 
+// Most frames ever queued in one message (the whole register map is 17)
+#define AD1939_BATCH_MAX 24
 
+static bool async_writes;
+module_param(async_writes, bool, 0644);
+MODULE_PARM_DESC(async_writes, "Queue register writes with spi_async() instead of waiting for them");
 
-/** Kernel module loading for platform devices
+struct ad1939_batch
+{
+    al_ad1939_dev_t *devp;                  ///< The codec the batch goes to
+    struct spi_message msg;
+    struct spi_transfer xfer[AD1939_BATCH_MAX];
+    uint8_t frame[AD1939_BATCH_MAX][3];     ///< kmalloc'ed with the batch, so DMA safe
+    unsigned int n;                         ///< Number of queued frames
+    u64 start;                              ///< When the batch was committed
+    bool ramp;                              ///< Sent by the ramp engine; other volume writes cancel ramps
+};
 
-    Called by the kernel when a module is loaded which matches a device tree overlay entry.
-    This function does all the setup of the device driver and creates the sysfs entries.
+// Rewrites the codec from the register cache after a failed batch
+static void ad1939_resync(struct work_struct *work);
 
-    @param pdev Pointer to a platform_device structure containing information from the overlay about the device to load
-    @returns SUCCESS or error code
+/** Allocate an empty batch
+    @param devp The codec the batch goes to
+    @returns The batch, or NULL when out of memory
 */
-static int ad1939_probe(struct platform_device *pdev)
+static struct ad1939_batch *ad1939_batch_alloc(al_ad1939_dev_t *devp)
 {
-    int ret_val = -EBUSY;
+    struct ad1939_batch *b = kzalloc(sizeof(struct ad1939_batch), GFP_KERNEL);
 
-    char deviceName[20] = "al_ad1939_";
-    char deviceMinor[20];
-    int status;
+    if (b)
+        b->devp = devp;
 
-    struct device *deviceObj;
-    al_ad1939_dev_t *al_ad1939_devp;
+    return b;
+}
 
-    pr_info("ad1939_probe enter\n");
+/** Queue a register write in a batch
+    @param b The batch
+    @param reg Register address
+    @param val Register value
+    @returns 0, or -ENOSPC when the batch is full
+*/
+static int ad1939_batch_add(struct ad1939_batch *b, uint8_t reg, uint8_t val)
+{
+    struct spi_transfer *t;
 
-    // Create structure to hold device-specific information (like the registers). Make size of &pdev->dev + sizeof(struct(al_ad1939_dev)).
-    al_ad1939_devp = devm_kzalloc(&pdev->dev, sizeof(al_ad1939_dev_t), GFP_KERNEL);
+    if (b->n == AD1939_BATCH_MAX)
+        return -ENOSPC;
 
-    // Give a pointer to the instance-specific data to the generic platform_device structure
-    // so we can access this data later on (for instance, in the read and write functions)
-    platform_set_drvdata(pdev, (void *)al_ad1939_devp);
+    b->frame[b->n][0] = 0x08;
+    b->frame[b->n][1] = reg;
+    b->frame[b->n][2] = val;
 
-    //Create a memory region to store the device name
-    al_ad1939_devp->name = devm_kzalloc(&pdev->dev, 50, GFP_KERNEL);
-    if (al_ad1939_devp->name == NULL)
-        goto bad_mem_alloc;
+    t = &b->xfer[b->n];
+    t->tx_buf = b->frame[b->n];
+    t->len = 3;
+    // Deassert chip select after every frame but the last one
+    if (b->n > 0)
+        b->xfer[b->n - 1].cs_change = 1;
 
-    //Copy the name from the overlay and stick it in the created memory region
-    strcpy(al_ad1939_devp->name, (char *)pdev->name);
-    pr_info("%s\n", (char *)pdev->name);
+    b->n++;
 
-    //Request a Major/Minor number for the driver
-    status = alloc_chrdev_region(&dev_num, 0, 1, "al_ad1939");
-    if (status != 0)
-        goto bad_alloc_chrdev_region;
+    return 0;
+}
 
-    //Create the device name with the information reserved above
-    sprintf(deviceMinor, "%d", MAJOR(dev_num));
-    strcat(deviceName, deviceMinor);
-    pr_info("%s\n", deviceName);
+/** Account a finished batch in the tracepoint and the latency histogram, then free it */
+static void ad1939_batch_done(struct ad1939_batch *b, int status)
+{
+    u64 ns = ktime_get_ns() - b->start;
+    unsigned int i;
 
-    //Create sysfs entries
-    cl = class_create(THIS_MODULE, deviceName); //"fe_HA");
-    if (cl == NULL)
-        goto bad_class_create;
+    lat_hist_add(&b->devp->spi_write_lat, ns);
+    for (i = 0; i < b->n; i++)
+        trace_ad1939_spi_write(dev_name(&b->devp->spi->dev), b->frame[i][1], b->frame[i][2], status, ns);
 
-    //Initialize a char dev structure
-    cdev_init(&al_ad1939_devp->cdev, &al_ad1939_fops);
+    kfree(b);
+}
 
-    //Registers the char driver with the kernel
-    status = cdev_add(&al_ad1939_devp->cdev, dev_num, 1);
-    if (status != 0)
-        goto bad_cdev_add;
+/** spi_async() completion callback; may run in atomic context */
+static void ad1939_batch_complete(void *context)
+{
+    struct ad1939_batch *b = context;
+    al_ad1939_dev_t *devp = b->devp;
 
-    //Creates the device entries in sysfs
-    deviceObj = device_create(cl, NULL, dev_num, NULL, deviceName);
-    if (deviceObj == NULL)
-        goto bad_device_create;
+    if (b->msg.status)
+        dev_err(&devp->spi->dev, "async register write failed (%d)\n", b->msg.status);
 
-    //Put a pointer to the fe_fir_dev struct that is created into the driver object so it can be accessed uniquely from elsewhere
-    dev_set_drvdata(deviceObj, al_ad1939_devp);
+    if (b->msg.status)
+        schedule_work(&devp->resync_work);
 
-    //---------------------------------------------------------
-    status = device_create_file(deviceObj, &dev_attr_sample_frequency);
-    if (status)
-        goto bad_device_create_file_1;
+    ad1939_batch_done(b, b->msg.status);
 
-    //---------------------------------------------------------
+    if (atomic_dec_and_test(&devp->batches_in_flight))
+        wake_up(&devp->batches_wq);
+}
 
-    status = device_create_file(deviceObj, &dev_attr_dac1_left_volume);
-    if (status)
-        goto bad_device_create_file_2;
+/** Send a batch to the codec as one spi_message
 
-    //---------------------------------------------------------
-    status = device_create_file(deviceObj, &dev_attr_dac2_left_volume);
-    if (status)
-        goto bad_device_create_file_3;
+    Takes ownership of the batch; it is freed once the message has been sent. The register
+    cache already holds the new values; if the message fails, the cache is written out again
+    register by register from a work item. Must be called with the codec's lock held.
 
-    //---------------------------------------------------------
+    @param b The batch
+    @returns 0 on success (for async writes: the message was queued), or a negative error code
+*/
+static int ad1939_batch_commit(struct ad1939_batch *b)
+{
+    al_ad1939_dev_t *devp = b->devp;
+    int ret_val;
 
-    status = device_create_file(deviceObj, &dev_attr_dac3_left_volume);
-    if (status)
-        goto bad_device_create_file_4;
+    // While suspended the cache is all that changes; ad1939_resume() sends it
+    if (b->n == 0 || devp->suspended)
+    {
+        kfree(b);
+        return 0;
+    }
 
-    //---------------------------------------------------------
+    spi_message_init_with_transfers(&b->msg, b->xfer, b->n);
+    b->start = ktime_get_ns();
 
-    status = device_create_file(deviceObj, &dev_attr_dac4_left_volume);
-    if (status)
-        goto bad_device_create_file_5;
+    if (async_writes)
+    {
+        b->msg.complete = ad1939_batch_complete;
+        b->msg.context = b;
 
-    //---------------------------------------------------------
+        atomic_inc(&devp->batches_in_flight);
+        ret_val = spi_async(devp->spi, &b->msg);
+        if (ret_val)
+        {
+            atomic_dec(&devp->batches_in_flight);
+            ad1939_batch_done(b, ret_val);
+            schedule_work(&devp->resync_work);
+        }
+        return ret_val;
+    }
 
-    status = device_create_file(deviceObj, &dev_attr_dac1_right_volume);
-    if (status)
-        goto bad_device_create_file_6;
+    ret_val = spi_sync(devp->spi, &b->msg);
+    ad1939_batch_done(b, ret_val);
+    if (ret_val)
+        schedule_work(&devp->resync_work);
 
-    //---------------------------------------------------------
+    return ret_val;
+}
 
-    status = device_create_file(deviceObj, &dev_attr_dac2_right_volume);
-    if (status)
-        goto bad_device_create_file_7;
+/** regmap description of the AD1939 SPI protocol
 
-    //---------------------------------------------------------
+    A frame is {0x08 | rw, register, value}. regmap puts the 16 bit register big endian on
+    the wire, so the chip address byte is the upper (always zero) register byte with the
+    write/read flag masks ORed in. The codec doesn't auto-increment, so every register is
+    read and written on its own.
+*/
+static const struct regmap_config ad1939_regmap_config = {
+    .name = "ad1939",
+    .reg_bits = 16,
+    .val_bits = 8,
+    .write_flag_mask = 0x08,
+    .read_flag_mask = 0x09,
+    .max_register = AD1939_REG_ADC_CTL2,
+    .use_single_read = true,
+    .use_single_write = true,
+    .cache_type = REGCACHE_RBTREE,
+    // No defaults table: read the registers back from the codec to seed the cache
+    .num_reg_defaults_raw = AD1939_NUM_REGS,
+};
 
-    status = device_create_file(deviceObj, &dev_attr_dac3_right_volume);
-    if (status)
-        goto bad_device_create_file_8;
+/** Stage a register update in a batch
 
-    //---------------------------------------------------------
+    The new value is computed and stored with regmap_update_bits() in cache-only mode, so the
+    cache is updated right away and a frame is only queued when a bit actually changes.
+    Writing a DAC volume outside of the ramp engine stops that channel's ramp.
+    Must be called with the codec's lock held.
 
-    status = device_create_file(deviceObj, &dev_attr_dac4_right_volume);
-    if (status)
-        goto bad_device_create_file_9;
+    @param b The batch
+    @param reg Register address
+    @param mask Bits to update
+    @param val New value of the bits in mask
+    @returns 0 on success, or a negative error code
+*/
+static int ad1939_batch_update(struct ad1939_batch *b, unsigned int reg, unsigned int mask, unsigned int val)
+{
+    struct regmap *map = b->devp->regmap;
+    unsigned int new_val;
+    bool changed;
+    int ret_val;
 
-    //---------------------------------------------------------    
-    status = device_create_file(deviceObj, &dev_attr_name);
-    if (status)
-        goto bad_device_create_file_10;
+    lockdep_assert_held(&b->devp->lock);
 
-    pr_info("ad1939_probe exit\n");
+    // A volume set any other way takes over from a ramp on that channel
+    if (!b->ramp && reg >= AD1939_REG_DAC1L_VOL && reg <= AD1939_REG_DAC4R_VOL)
+    {
+        b->devp->ramp[reg - AD1939_REG_DAC1L_VOL].active = false;
+        b->devp->ramp[reg - AD1939_REG_DAC1L_VOL].failed = false;
+    }
 
-    return 0;
+    regcache_cache_only(map, true);
+    ret_val = regmap_update_bits_check(map, reg, mask, val, &changed);
+    regcache_cache_only(map, false);
+    if (ret_val || !changed)
+        return ret_val;
 
-bad_device_create_file_10:
-    device_remove_file(deviceObj, &dev_attr_name);
-    
-bad_device_create_file_9:
-    device_remove_file(deviceObj, &dev_attr_dac4_right_volume);
-    
-bad_device_create_file_8:
-    device_remove_file(deviceObj, &dev_attr_dac3_right_volume);    
-    
-bad_device_create_file_7:
-    device_remove_file(deviceObj, &dev_attr_dac2_right_volume);
-    
-bad_device_create_file_6:
-    device_remove_file(deviceObj, &dev_attr_dac1_right_volume);
-    
-bad_device_create_file_5:
-    device_remove_file(deviceObj, &dev_attr_dac4_left_volume);
-    
-bad_device_create_file_4:
-    device_remove_file(deviceObj, &dev_attr_dac3_left_volume);    
-    
-bad_device_create_file_3:
-    device_remove_file(deviceObj, &dev_attr_dac2_left_volume);
-    
-bad_device_create_file_2:
-    device_remove_file(deviceObj, &dev_attr_dac1_left_volume);
-    
-bad_device_create_file_1:
-    device_remove_file(deviceObj, &dev_attr_sample_frequency); 
-    
-bad_device_create:
-    cdev_del(&al_ad1939_devp->cdev);
+    regmap_read(map, reg, &new_val);
 
-bad_cdev_add:
-    class_destroy(cl);
+    return ad1939_batch_add(b, reg, new_val);
+}
 
-bad_class_create:
-    unregister_chrdev_region(dev_num, 1);
+/** Write out the register cache one register at a time
 
-bad_alloc_chrdev_region:
-bad_mem_alloc:
+    Used when a batch couldn't be sent, so the codec ends up matching the cache again.
+*/
+static void ad1939_resync(struct work_struct *work)
+{
+    al_ad1939_dev_t *devp = container_of(work, al_ad1939_dev_t, resync_work);
+    int ret_val;
 
-//bad_ioremap:
-//    ret_val = PTR_ERR(al_ad1939_devp->regs);
+    mutex_lock(&devp->lock);
+    ret_val = regcache_sync(devp->regmap);
+    mutex_unlock(&devp->lock);
 
-    return ret_val;
+    if (ret_val)
+        dev_err(&devp->spi->dev, "register cache sync failed (%d)\n", ret_val);
 }
 
-/** Run when the device opens to create the file structure to read and write
+/** Update the bits of a single register
 
-    Beyond creating a structure which the other functions ca use to access the device, this function loads
-    the initial values into the shadow registers
+    Costs no bus traffic when the bits already have that value.
 
-    @param inode Pointer to the instance of the hardware driver to use
-    @param file Pointer to the file object opened
-    @return SUCCESS or error code
+    @param devp The codec
+    @param reg Register address
+    @param mask Bits to update
+    @param val New value of the bits in mask
+    @returns 0 on success, or a negative error code
 */
-static int ad1939_open(struct inode *inode, struct file *file)
+static int ad1939_update_bits(al_ad1939_dev_t *devp, unsigned int reg, unsigned int mask, unsigned int val)
 {
-    //Create a pointer to the driver instance
-    al_ad1939_dev_t *devp;
-
-    //Put it in the container_of structure so it can be used from anywhere
-    devp = container_of(inode->i_cdev, al_ad1939_dev_t, cdev);
-    file->private_data = devp;
+    struct ad1939_batch *b = ad1939_batch_alloc(devp);
+    int ret_val;
 
-    //Instantiate default values for the codec
-    devp->sample_frequency       = 48.0;
-    devp->dac1_left_volume       = 0.0;
-    devp->dac2_left_volume       = 0.0;
-    devp->dac3_left_volume       = 0.0;
-    devp->dac4_left_volume       = 0.0;
-    devp->dac1_right_volume      = 0.0;
-    devp->dac2_right_volume      = 0.0;
-    devp->dac3_right_volume      = 0.0;
-    devp->dac4_right_volume      = 0.0;
-    return 0;
-}
+    if (!b)
+        return -ENOMEM;
 
+    mutex_lock(&devp->lock);
+    ret_val = ad1939_batch_update(b, reg, mask, val);
+    if (ret_val)
+        kfree(b);
+    else
+        ret_val = ad1939_batch_commit(b);
+    mutex_unlock(&devp->lock);
 
+    return ret_val;
+}
 
-/** Called when the device is closed
+/** Stage the PLL input and the DAC and ADC sample rate fields in a batch
 
-    Currently this doesn't do anything, but as it is the opposite of open I created it for future use
+    Shared by the sample_frequency attribute, the ASoC hw_params callback and the bring-up. The PLL
+    comes first in the batch, so the codec sees the whole change in one message.
+    Must be called with the codec's lock held.
 
-    @param inode Instance of the driver opened
-    @param file Pointer to the file for this operation
-    @returns SUCCESS
+    @param b The batch
+    @param rate Sample rate in Hz
+    @returns 0 on success, or -EINVAL for a rate the codec's MCLK can't produce
 */
-static int ad1939_release(struct inode *inode, struct file *file)
+static int ad1939_stage_rate(struct ad1939_batch *b, unsigned int rate)
 {
-    return 0;
-}
+    unsigned int mclki, fs_sel;
+    int ret_val;
+
+    ret_val = ad1939_clock_config(b->devp->mclk, rate, &mclki, &fs_sel);
+    if (ret_val)
+        return ret_val;
 
+    ret_val = ad1939_batch_update(b, AD1939_REG_PLL_CTL0, AD1939_PLL_MCLKI_MASK, mclki << 1);
+    if (ret_val)
+        return ret_val;
 
+    ret_val = ad1939_batch_update(b, AD1939_REG_DAC_CTL0, AD1939_DAC_FS_MASK, fs_sel << 1);
+    if (ret_val)
+        return ret_val;
 
-/** Read the contents of the coefficients stucture
+    return ad1939_batch_update(b, AD1939_REG_ADC_CTL0, AD1939_ADC_FS_MASK, fs_sel << 6);
+}
 
-    This function will read the contents of the coefficient memory as stored in the shadow register and return then
-    to the calling function as a binary array of 32 length fixed point values.  If done in the terminal window, hexdump
-    can be used to see the values.
+/** Sample rate the codec is set to, from the register cache
 
-    @param file Pointer to the file being accessed
-    @param buffer Pointer to a buffer array to return the data on
-    @len Unused
-    @offset Pass-by-reference variable to hold where to start transmitting from in the array.
-    @returns ad1939_read Number of bits sent in buffer, and will return 0 for the last transaction.
+    @param devp The codec
+    @returns The rate in Hz, or a negative error code
 */
-static ssize_t ad1939_read(struct file *file, char *buffer, size_t len, loff_t *offset)
+static int ad1939_get_rate(al_ad1939_dev_t *devp)
 {
-    return 0;
-}
-
+    unsigned int pll_ctl0, dac_ctl0;
+    int ret_val;
 
+    ret_val = regmap_read(devp->regmap, AD1939_REG_PLL_CTL0, &pll_ctl0);
+    if (!ret_val)
+        ret_val = regmap_read(devp->regmap, AD1939_REG_DAC_CTL0, &dac_ctl0);
+    if (ret_val)
+        return ret_val;
 
-/** Write the contents of the coefficients stucture
+    return ad1939_clock_rate(devp->mclk, (pll_ctl0 & AD1939_PLL_MCLKI_MASK) >> 1, (dac_ctl0 & AD1939_DAC_FS_MASK) >> 1);
+}
 
-    This function will write the contents of the buffer as binary values to the coefficients register.
-    The length variable is used to set the length of the filter itself.  After updating the shadow register,
-    the values are then written to the device.  If the size of buffer is not a 4 bit multiple, the extra bytes
-    are ignored.
+/** Fill in the sample rates the codec's MCLK can produce
 
-    @param file Pointer to the file being written to
-    @param buffer Pointer to a buffer array containing the data to write
-    @len Number of bytes in the buffer variable
-    @offset Pass-by-reference variable to hold where to start transmitting from in the array.
-    @returns ad1939_read Number of bytes written
+    @param devp The codec
+    @returns The number of rates
 */
-static ssize_t ad1939_write(struct file *file, const char *buffer, size_t len, loff_t *offset)
+static int ad1939_init_rates(al_ad1939_dev_t *devp)
 {
-    return 0;
-}
+    static const unsigned int all_rates[AD1939_MAX_RATES] =
+    {
+        32000, 44100, 48000, 64000, 88200, 96000, 128000, 176400, 192000
+    };
+    unsigned int mclki, fs_sel;
+    int i, n = 0;
+
+    for (i = 0; i < AD1939_MAX_RATES; i++)
+        if (!ad1939_clock_config(devp->mclk, all_rates[i], &mclki, &fs_sel))
+            devp->rates[n++] = all_rates[i];
 
+    devp->rate_constraint.count = n;
+    devp->rate_constraint.list = devp->rates;
 
+    return n;
+}
 
-/** Function called when the platform device driver is deleted
+/** Set all eight DAC volumes
 
-    This function is called when the device driver is deleted.  It should cleans up the driver memory structures,
-    deallocate the driver addresses reserved for the driver, unallocate memory and the io mapping functions to the
-    hardware.  After this function, the device should be able to be added cleanly again without contention or memory
-    leaks.
+    Only the volumes that change are sent, all in one SPI message.
 
-    @param platform_device Pointer to the device structure being deleted
-    @returns SUCCESS
+    @param devp The codec
+    @param code Attenuation codes in register order (DAC1L, DAC1R, ... DAC4R)
+    @returns 0 on success, or a negative error code
 */
-static int ad1939_remove(struct platform_device *pdev)
+static int ad1939_set_volumes(al_ad1939_dev_t *devp, const uint8_t *code)
 {
-    // Grab the instance-specific information out of the platform device
-    al_ad1939_dev_t *dev = (al_ad1939_dev_t *)platform_get_drvdata(pdev);
-
-    //device_remove_file(deviceObj, &dev_attr_numCoefs);
-    //device_remove_file(deviceObj, &dev_attr_name);
-    //device_remove_file(deviceObj, &dev_attr_name);
-
-    //device_destroy(cl, dev_num);
-    //class_destroy(cl);
-
+    struct ad1939_batch *batch = ad1939_batch_alloc(devp);
+    int ret_val = 0;
+    int i;
 
-    pr_info("ad1939_remove enter\n");
+    if (!batch)
+        return -ENOMEM;
 
-    // Turn the HA off
-    //iowrite32(0x00, dev->regs);
+    mutex_lock(&devp->lock);
+    for (i = 0; i < AD1939_NUM_DACS && !ret_val; i++)
+        ret_val = ad1939_batch_update(batch, AD1939_REG_DAC1L_VOL + i, 0xFF, code[i]);
+    if (ret_val)
+        kfree(batch);
+    else
+        ret_val = ad1939_batch_commit(batch);
+    mutex_unlock(&devp->lock);
 
-    // Unregister the character file (remove it from /dev)
-    cdev_del(&dev->cdev);
+    return ret_val;
+}
 
-    //Tell the os that the major/minor pair is avalible again
-    unregister_chrdev_region(dev_num, 2);
+/** Read all eight DAC volumes from the register cache
 
-    //Remove the pointer to the registers so it doesn't leak
-    //iounmap(dev->regs);
+    @param devp The codec
+    @param code Filled with the attenuation codes in register order
+    @returns 0 on success, or a negative error code
+*/
+static int ad1939_get_volumes(al_ad1939_dev_t *devp, uint8_t *code)
+{
+    unsigned int val;
+    int ret_val;
+    int i;
 
-    pr_info("ad1939_remove exit\n");
+    for (i = 0; i < AD1939_NUM_DACS; i++)
+    {
+        ret_val = regmap_read(devp->regmap, AD1939_REG_DAC1L_VOL + i, &val);
+        if (ret_val)
+            return ret_val;
+        code[i] = val;
+    }
 
     return 0;
 }
 
+/** Send a batch synchronously, whatever async_writes says, and time it
 
+    Earlier async batches are waited for first, so they don't count towards the measured time.
+    Takes ownership of the batch. Must be called with the codec's lock held.
 
-// Called when the driver is removed
-static void ad1939_exit(void)
+    @param b The batch
+    @param ns Set to the time spi_sync() took
+    @returns 0 on success, or a negative error code
+*/
+static int ad1939_batch_commit_sync(struct ad1939_batch *b, u64 *ns)
 {
-    pr_info("Audio Logic ad1939 module exit\n");
+    al_ad1939_dev_t *devp = b->devp;
+    int ret_val;
 
-    // Unregister our driver from the "Platform Driver" bus
-    // This will cause "ad1939_remove" to be called for each connected device
-    platform_driver_unregister(&ad1939_platform);
- 
-    if( spi_device ){
-        spi_unregister_device( spi_device );
-    }
+    lockdep_assert_held(&devp->lock);
+    wait_event(devp->batches_wq, atomic_read(&devp->batches_in_flight) == 0);
 
-    pr_info("Audio Logic ad1939 module successfully unregistered\n");
+    spi_message_init_with_transfers(&b->msg, b->xfer, b->n);
+    b->start = ktime_get_ns();
+    ret_val = spi_sync(devp->spi, &b->msg);
+    *ns = ktime_get_ns() - b->start;
+    ad1939_batch_done(b, ret_val);
+
+    return ret_val;
 }
 
-/** Function to display the overlay name for the device in sysfs
+/*------------------------------------------------------------------
+  Volume ramps
 
-    @todo Better understand the inputs
+  A ramp is started per channel with a target attenuation and a
+  duration. Every AD1939_RAMP_TICK_NS the ramp timer queues
+  ramp_work, which moves every ramping channel one step closer to its
+  target, one 3/8 dB code or more as the elapsed time says, and sends
+  the changed volumes of all channels together in one batch.
+------------------------------------------------------------------*/
 
-    @param dev
-    @param attr
-    @param buf charactor buffer for the sysfs return
-    @returns Length of the buffer
-*/
-static ssize_t name_read(struct device *dev, struct device_attribute *attr, char *buf)
+// DAC channel names, in register order, as taken by the dac_ramp attribute
+static const char *const ad1939_dac_names[AD1939_NUM_DACS] =
 {
-    al_ad1939_dev_t *devp = (al_ad1939_dev_t *)dev_get_drvdata(dev);
+    "dac1_left", "dac1_right", "dac2_left", "dac2_right",
+    "dac3_left", "dac3_right", "dac4_left", "dac4_right",
+};
 
-    //Copy the name into the output buffer
-    sprintf(buf, "%s\n", devp->name);
+static enum hrtimer_restart ad1939_ramp_tick(struct hrtimer *timer)
+{
+    al_ad1939_dev_t *devp = container_of(timer, al_ad1939_dev_t, ramp_timer);
 
-    //Return the length of the buffer so it will print in the console
-    return strlen(buf);
+    // The SPI transfer sleeps, so the step runs from a work item
+    schedule_work(&devp->ramp_work);
+
+    return HRTIMER_NORESTART;
 }
 
-static ssize_t sample_frequency_write(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+/** Advance all ramping channels by one tick and send the new volumes in one batch
+
+    If the volumes can't be sent, the ramps of this step are stopped and marked failed rather
+    than retried on every tick; the register cache is resynced as for any failed batch.
+*/
+static void ad1939_ramp_step(struct work_struct *work)
 {
-    char substring[80];
-    char fs_string[6];
-    int substring_count = 0;
+    al_ad1939_dev_t *devp = container_of(work, al_ad1939_dev_t, ramp_work);
+    struct ad1939_batch *batch = ad1939_batch_alloc(devp);
+    struct ad1939_ramp *r;
+    ktime_t now = ktime_get();
+    bool ramping = false;
+    unsigned int stepped = 0;
+    int ret_val = 0;
+    s64 elapsed;
+    int code;
     int i;
-    int cmd_val;
-    char cmd[3] = {0x08,0x00,0x00};
 
-    al_ad1939_dev_t *devp = (al_ad1939_dev_t *)dev_get_drvdata(dev);
-
-    for (i = 0; i < count; i++)
+    if (!batch)
     {
-        //If its not a space or a comma, add the digit to the substring
-        if ((buf[i] != ',') && (buf[i] != ' ') && (buf[i] != '\0') && (buf[i] != '\r') && (buf[i] != '\n'))
-        {
-            substring[substring_count] = buf[i];
-            substring_count++;
-        }
+        // Try again on the next tick
+        hrtimer_start(&devp->ramp_timer, ns_to_ktime(AD1939_RAMP_TICK_NS), HRTIMER_MODE_REL);
+        return;
     }
+    batch->ramp = true;
 
-    substring[substring_count] = '\0';
-
-    // Determine which sample frequency to choose
-    if (strncmp(substring,"48",sizeof(substring)) == 0 || strncmp(substring,"48.0",sizeof(substring)) == 0)
-    {
-      printk("Setting sampling frequency to 48 kHz\n");
-      cmd[1] = 0x02;
-      cmd[2] = 0x00;
-      cmd_val = spi_write(spi_device,&cmd, sizeof(cmd));
-      cmd[1] = 14;
-      cmd[2] = 0x00;
-      cmd_val = spi_write(spi_device,&cmd, sizeof(cmd));
-      strcpy(fs_string,"48.0\0");
-    }
-    else if (strncmp(substring,"96",sizeof(substring)) == 0 || strncmp(substring,"96.0",sizeof(substring)) == 0)
+    mutex_lock(&devp->lock);
+    for (i = 0; i < AD1939_NUM_DACS; i++)
     {
-      printk("Setting sampling frequency to 96 kHz\n");
-      cmd[1] = 0x02;
-      cmd[2] = 0x02;
-      cmd_val = spi_write(spi_device,&cmd, sizeof(cmd));
-      cmd[1] = 0x0E;
-      cmd[2] = 0x40;
-      cmd_val = spi_write(spi_device,&cmd, sizeof(cmd));
-      strcpy(fs_string,"96.0\0");
+        r = &devp->ramp[i];
+        if (!r->active)
+            continue;
+
+        elapsed = ktime_ms_delta(now, r->start);
+        code = ad1939_ramp_code(r->from, r->to, elapsed, r->ms);
+        if (elapsed >= r->ms)
+            r->active = false;
+        else
+            ramping = true;
+
+        stepped |= BIT(i);
+        if (!ret_val)
+            ret_val = ad1939_batch_update(batch, AD1939_REG_DAC1L_VOL + i, 0xFF, code);
     }
-    else if (strncmp(substring,"192",sizeof(substring)) == 0 || strncmp(substring,"192.0",sizeof(substring)) == 0)
+    if (ret_val)
+        kfree(batch);
+    else
+        ret_val = ad1939_batch_commit(batch);
+
+    if (ret_val)
     {
-      printk("Setting sampling frequency to 192 kHz\n");
-      cmd[1] = 0x02;
-      cmd[2] = 0x04;
-      cmd_val = spi_write(spi_device,&cmd, sizeof(cmd));
-      cmd[1] = 0x0E;
-      cmd[2] = 0x80;
-      cmd_val = spi_write(spi_device,&cmd, sizeof(cmd));
-      strcpy(fs_string,"192.0\0");
+        for (i = 0; i < AD1939_NUM_DACS; i++)
+        {
+            if (!(stepped & BIT(i)))
+                continue;
+            devp->ramp[i].active = false;
+            devp->ramp[i].failed = true;
+        }
+        ramping = false;
     }
-    else
-      printk("Invalid value.  Please enter either '48','96', or '192'\n");
-     
+    mutex_unlock(&devp->lock);
 
-    //Convert the buffer to a fixed point value
-    devp->sample_frequency = set_fixed_num(fs_string);
+    if (ret_val)
+        dev_warn(&devp->spi->dev, "volume ramp stopped, write failed (%d)\n", ret_val);
 
-    return count;
+    if (ramping)
+        hrtimer_start(&devp->ramp_timer, ns_to_ktime(AD1939_RAMP_TICK_NS), HRTIMER_MODE_REL);
 }
-static ssize_t sample_frequency_read(struct device *dev, struct device_attribute *attr, char *buf)
-{
-    al_ad1939_dev_t *devp = (al_ad1939_dev_t *)dev_get_drvdata(dev);
 
-    // Copy the sample frequency to the output buffer
-    fp_to_string(buf, devp->sample_frequency);
+/** Start ramping a DAC channel
 
-    strcat2(buf, "\n");
+    Replaces a ramp already running on the channel, starting from wherever it got to.
 
-    //Return the length of the buffer so it will print in the console
-    return strlen(buf);
-}
-static ssize_t dac1_left_volume_write(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+    @param devp The codec
+    @param chan Channel in register order (0 = DAC1L, 7 = DAC4R)
+    @param code Target attenuation code
+    @param ms Duration of the ramp; 0 sets the target on the next tick
+    @returns 0 on success, or a negative error code
+*/
+static int ad1939_ramp_start(al_ad1939_dev_t *devp, int chan, uint8_t code, unsigned int ms)
 {
-    uint32_t tempValue = 0;
-    uint8_t volume_level;
-    char cmd[3] = {0x08,0x06,0x00};
-
-    char substring[80];
-    int substring_count = 0;
-    int i;
+    struct ad1939_ramp *r = &devp->ramp[chan];
+    unsigned int val;
+    int ret_val;
 
-    al_ad1939_dev_t *devp = (al_ad1939_dev_t *)dev_get_drvdata(dev);
-
-    for (i = 0; i < count; i++)
+    mutex_lock(&devp->lock);
+    ret_val = regmap_read(devp->regmap, AD1939_REG_DAC1L_VOL + chan, &val);
+    if (!ret_val)
     {
-        //If its not a space or a comma, add the digit to the substring
-        if ((buf[i] != ',') && (buf[i] != ' ') && (buf[i] != '\0') && (buf[i] != '\r') && (buf[i] != '\n'))
-        {
-            substring[substring_count] = buf[i];
-            substring_count++;
-        }
+        r->from = val;
+        r->to = code;
+        r->start = ktime_get();
+        r->ms = ms;
+        r->active = true;
+        r->failed = false;
     }
+    mutex_unlock(&devp->lock);
 
-    substring[substring_count] = '\0';
+    if (!ret_val)
+        schedule_work(&devp->ramp_work);
 
-    // If the first character is a negative sign
-    if (buf[0] == '-')
-    {
-      // Shift all the values "left" to remove it
-      for (i=0;i<79;i++)
-        substring[i] = substring[i+1];
-    }
-
-    //Convert the buffer to a fixed point value
-    tempValue = set_fixed_num(substring);
+    return ret_val;
+}
 
-    //printk("Entering conversion function\n");
-    volume_level = find_volume_level(tempValue);
-    tempValue = decode_volume(volume_level);
-    
-    //Write the value into the shadow register (and pray it works...)
-    devp->dac1_left_volume = -1*tempValue;
+/** Stop all ramps of a codec where they are */
+static void ad1939_ramp_stop(al_ad1939_dev_t *devp)
+{
+    int i;
 
-    // Write the SPI commands to the DAC
-    cmd[2] = volume_level;
-    spi_write(spi_device,&cmd, sizeof(cmd));
+    mutex_lock(&devp->lock);
+    for (i = 0; i < AD1939_NUM_DACS; i++)
+        devp->ramp[i].active = false;
+    mutex_unlock(&devp->lock);
 
-    return count;
+    // The work can re-arm the timer once more
+    hrtimer_cancel(&devp->ramp_timer);
+    cancel_work_sync(&devp->ramp_work);
+    hrtimer_cancel(&devp->ramp_timer);
 }
-static ssize_t dac1_left_volume_read(struct device *dev, struct device_attribute *attr, char *buf)
-{
-    al_ad1939_dev_t *devp = (al_ad1939_dev_t *)dev_get_drvdata(dev);
 
-    //Copy the name into the output buffer
-    //sprintf(buf, "%d\n", fe_HA_devp->threshold);
-    fp_to_string(buf, devp->dac1_left_volume);
+/** Write the whole register cache out to the codec and time it
 
-    strcat2(buf, "\n");
+    All AD1939_NUM_REGS registers go out in one spi_message, whether or not they changed, and the
+    message is always sent synchronously.
 
-    //Return the length of the buffer so it will print in the console
-    return strlen(buf);
-}
-static ssize_t dac2_left_volume_write(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+    @param devp The codec
+    @param ns Set to the time spi_sync() took
+    @returns 0 on success, or a negative error code
+*/
+static int ad1939_reprogram(al_ad1939_dev_t *devp, u64 *ns)
 {
-    uint32_t tempValue = 0;
-
-    char substring[80];
-    int substring_count = 0;
-    int i;
-    uint8_t volume_level;
-    char cmd[3] = {0x08,0x08,0x00};
+    struct ad1939_batch *b = ad1939_batch_alloc(devp);
+    unsigned int reg, val;
+    int ret_val = 0;
 
-    al_ad1939_dev_t *devp = (al_ad1939_dev_t *)dev_get_drvdata(dev);
+    if (!b)
+        return -ENOMEM;
 
-    for (i = 0; i < count; i++)
+    mutex_lock(&devp->lock);
+    for (reg = 0; reg < AD1939_NUM_REGS && !ret_val; reg++)
     {
-        //If its not a space or a comma, add the digit to the substring
-        if ((buf[i] != ',') && (buf[i] != ' ') && (buf[i] != '\0') && (buf[i] != '\r') && (buf[i] != '\n'))
-        {
-            substring[substring_count] = buf[i];
-            substring_count++;
-        }
+        ret_val = regmap_read(devp->regmap, reg, &val);
+        if (!ret_val)
+            ret_val = ad1939_batch_add(b, reg, val);
     }
 
-    substring[substring_count] = '\0';
+    if (!ret_val && devp->suspended)
+        ret_val = -EAGAIN;
+    if (ret_val)
+        kfree(b);
+    else
+        ret_val = ad1939_batch_commit_sync(b, ns);
+    mutex_unlock(&devp->lock);
+
+    return ret_val;
+}
+
+/** Power the codec down
+
+    Only the codec gets the power-down bit of PLL control 0; the register cache keeps the running value,
+    so ad1939_resume() turns the codec back on. Until then, register updates only go to the cache, and
+    suspend_regs remembers what the codec itself holds.
+
+    @param dev The SPI device
+    @returns 0 on success, or a negative error code
+*/
+static int ad1939_suspend(struct device *dev)
+{
+    al_ad1939_dev_t *devp = dev_get_drvdata(dev);
+    struct ad1939_batch *b = ad1939_batch_alloc(devp);
+    unsigned int reg, val;
+    u64 ns;
+    int ret_val = 0;
+
+    if (!b)
+        return -ENOMEM;
+
+    mutex_lock(&devp->lock);
+    for (reg = 0; reg < AD1939_NUM_REGS && !ret_val; reg++)
+    {
+        ret_val = regmap_read(devp->regmap, reg, &val);
+        devp->suspend_regs[reg] = val;
+    }
+    if (!ret_val)
+        ret_val = ad1939_batch_add(b, AD1939_REG_PLL_CTL0, devp->suspend_regs[AD1939_REG_PLL_CTL0] | AD1939_PLL_PDN);
+    if (ret_val)
+        kfree(b);
+    else
+        ret_val = ad1939_batch_commit_sync(b, &ns);
+    if (!ret_val)
+        devp->suspended = true;
+    mutex_unlock(&devp->lock);
+
+    return ret_val;
+}
+
+/** Power the codec up and restore its registers from the cache
+
+    Every register whose cached value differs from what the codec holds goes out in one spi_message in
+    address order, with PLL control 0 always included to clear the power-down bit. The power-down bit
+    read back from the codec tells which it holds: still set, the codec kept its registers and holds
+    suspend_regs; clear, it lost power and holds the reset defaults. If the read fails, everything is sent.
+
+    @param dev The SPI device
+    @returns 0 on success, or a negative error code
+*/
+static int ad1939_resume(struct device *dev)
+{
+    al_ad1939_dev_t *devp = dev_get_drvdata(dev);
+    u64 start = ktime_get_ns();
+    struct ad1939_batch *b = ad1939_batch_alloc(devp);
+    unsigned int reg, val, pll_ctl0;
+    bool kept, lost;
+    u64 ns;
+    int ret_val = 0;
+
+    if (!b)
+        return -ENOMEM;
+
+    mutex_lock(&devp->lock);
+
+    // Ask the codec itself whether it is still powered down
+    regcache_cache_bypass(devp->regmap, true);
+    ret_val = regmap_read(devp->regmap, AD1939_REG_PLL_CTL0, &pll_ctl0);
+    regcache_cache_bypass(devp->regmap, false);
+    kept = !ret_val && (pll_ctl0 & AD1939_PLL_PDN);
+    lost = !ret_val && !(pll_ctl0 & AD1939_PLL_PDN);
+    ret_val = 0;
+
+    for (reg = 0; reg < AD1939_NUM_REGS && !ret_val; reg++)
+    {
+        ret_val = regmap_read(devp->regmap, reg, &val);
+        if (ret_val)
+            break;
+        if (reg != AD1939_REG_PLL_CTL0 &&
+            ((kept && val == devp->suspend_regs[reg]) || (lost && val == AD1939_REG_DEFAULT)))
+            continue;
+        ret_val = ad1939_batch_add(b, reg, val);
+    }
+    if (ret_val)
+        kfree(b);
+    else
+        ret_val = ad1939_batch_commit_sync(b, &ns);
+    if (!ret_val)
+        devp->suspended = false;
+    mutex_unlock(&devp->lock);
+
+    devp->resume_ns = ktime_get_ns() - start;
+
+    return ret_val;
+}
+
+/*------------------------------------------------------------------
+  ASoC codec component
+
+  Each codec is registered as an ASoC component on its SPI device
+  (component name "spi0.<cs>", DAI "ad1939-hifi"), so any machine driver
+  can link it to a CPU DAI, e.g. the FPGA's I2S/TDM core or the ALSA
+  dummy platform for bring-up. Chained codecs show up as separate
+  components for a multi-codec DAI link. Register access goes through
+  the same cache and batch path as the sysfs attributes.
+------------------------------------------------------------------*/
+
+// DAC volume registers hold the attenuation: 0 = 0 dB, 255 = -95.625 dB in 3/8 dB steps
+static const DECLARE_TLV_DB_MINMAX(ad1939_dac_tlv, -9563, 0);
+
+static const struct snd_kcontrol_new ad1939_snd_controls[] =
+{
+    SOC_DOUBLE_R_TLV("DAC1 Playback Volume", AD1939_REG_DAC1L_VOL, AD1939_REG_DAC1R_VOL, 0, 0xFF, 1, ad1939_dac_tlv),
+    SOC_DOUBLE_R_TLV("DAC2 Playback Volume", AD1939_REG_DAC2L_VOL, AD1939_REG_DAC2R_VOL, 0, 0xFF, 1, ad1939_dac_tlv),
+    SOC_DOUBLE_R_TLV("DAC3 Playback Volume", AD1939_REG_DAC3L_VOL, AD1939_REG_DAC3R_VOL, 0, 0xFF, 1, ad1939_dac_tlv),
+    SOC_DOUBLE_R_TLV("DAC4 Playback Volume", AD1939_REG_DAC4L_VOL, AD1939_REG_DAC4R_VOL, 0, 0xFF, 1, ad1939_dac_tlv),
+};
+
+/* The DACs and ADCs stay powered whether or not a PCM stream is running (the FPGA
+   streams to the codec outside of ALSA), so the widgets have no power bits. */
+static const struct snd_soc_dapm_widget ad1939_dapm_widgets[] =
+{
+    SND_SOC_DAPM_DAC("DAC", "Playback", SND_SOC_NOPM, 0, 0),
+    SND_SOC_DAPM_ADC("ADC", "Capture", SND_SOC_NOPM, 0, 0),
+    SND_SOC_DAPM_OUTPUT("DAC1OUT"),
+    SND_SOC_DAPM_OUTPUT("DAC2OUT"),
+    SND_SOC_DAPM_OUTPUT("DAC3OUT"),
+    SND_SOC_DAPM_OUTPUT("DAC4OUT"),
+    SND_SOC_DAPM_INPUT("ADC1IN"),
+    SND_SOC_DAPM_INPUT("ADC2IN"),
+};
+
+static const struct snd_soc_dapm_route ad1939_dapm_routes[] =
+{
+    { "DAC1OUT", NULL, "DAC" },
+    { "DAC2OUT", NULL, "DAC" },
+    { "DAC3OUT", NULL, "DAC" },
+    { "DAC4OUT", NULL, "DAC" },
+    { "ADC", NULL, "ADC1IN" },
+    { "ADC", NULL, "ADC2IN" },
+};
+
+/** Configure the sample rate and word length of the serial ports for a stream */
+static int ad1939_hw_params(struct snd_pcm_substream *substream, struct snd_pcm_hw_params *params, struct snd_soc_dai *dai)
+{
+    al_ad1939_dev_t *devp = snd_soc_dai_get_drvdata(dai);
+    struct ad1939_batch *batch;
+    uint8_t dac_wl, adc_wl;
+    int ret_val;
+
+    // DAC control 2 bits 4:3 and ADC control 1 bits 1:0: 24, 20 or 16 bit words
+    switch (params_width(params))
+    {
+    case 16:
+        dac_wl = 0x18;
+        adc_wl = 0x03;
+        break;
+    case 20:
+        dac_wl = 0x08;
+        adc_wl = 0x01;
+        break;
+    case 24:
+    case 32:
+        dac_wl = 0x00;
+        adc_wl = 0x00;
+        break;
+    default:
+        return -EINVAL;
+    }
+
+    batch = ad1939_batch_alloc(devp);
+    if (!batch)
+        return -ENOMEM;
+
+    mutex_lock(&devp->lock);
+    ret_val = ad1939_stage_rate(batch, params_rate(params));
+    if (!ret_val)
+        ret_val = ad1939_batch_update(batch, AD1939_REG_DAC_CTL2, 0x18, dac_wl);
+    if (!ret_val)
+        ret_val = ad1939_batch_update(batch, AD1939_REG_ADC_CTL1, 0x03, adc_wl);
+    if (ret_val)
+        kfree(batch);
+    else
+        ret_val = ad1939_batch_commit(batch);
+    mutex_unlock(&devp->lock);
+
+    // Let the FPGA effects rescale their rate dependent registers
+    if (!ret_val)
+        ret_val = avalon_set_sample_rate(params_rate(params));
+
+    return ret_val;
+}
+
+/** Configure the serial data format and clock direction of both serial ports */
+static int ad1939_set_dai_fmt(struct snd_soc_dai *dai, unsigned int fmt)
+{
+    al_ad1939_dev_t *devp = snd_soc_dai_get_drvdata(dai);
+    struct ad1939_batch *batch;
+    unsigned int delay;
+    unsigned int dac_ctl1, adc_ctl2;
+    int ret_val;
+
+    // SDATA delay field: 0 = 1 BCLK (I2S, DSP A), 1 = no delay (left justified, DSP B)
+    switch (fmt & SND_SOC_DAIFMT_FORMAT_MASK)
+    {
+    case SND_SOC_DAIFMT_I2S:
+    case SND_SOC_DAIFMT_DSP_A:
+        delay = 0;
+        break;
+    case SND_SOC_DAIFMT_LEFT_J:
+    case SND_SOC_DAIFMT_DSP_B:
+        delay = 1;
+        break;
+    default:
+        return -EINVAL;
+    }
+
+    if ((fmt & SND_SOC_DAIFMT_INV_MASK) != SND_SOC_DAIFMT_NB_NF)
+        return -EINVAL;
+
+    // BCLK and LRCLK master bits of DAC control 1 and ADC control 2
+    switch (fmt & SND_SOC_DAIFMT_MASTER_MASK)
+    {
+    case SND_SOC_DAIFMT_CBM_CFM:
+        dac_ctl1 = 0x30;
+        adc_ctl2 = 0x48;
+        break;
+    case SND_SOC_DAIFMT_CBS_CFS:
+        dac_ctl1 = 0x00;
+        adc_ctl2 = 0x00;
+        break;
+    default:
+        return -EINVAL;
+    }
+
+    batch = ad1939_batch_alloc(devp);
+    if (!batch)
+        return -ENOMEM;
+
+    mutex_lock(&devp->lock);
+    ret_val = ad1939_batch_update(batch, AD1939_REG_DAC_CTL0, 0x38, delay << 3);
+    if (!ret_val)
+        ret_val = ad1939_batch_update(batch, AD1939_REG_ADC_CTL1, 0x1C, delay << 2);
+    if (!ret_val)
+        ret_val = ad1939_batch_update(batch, AD1939_REG_DAC_CTL1, 0x30, dac_ctl1);
+    if (!ret_val)
+        ret_val = ad1939_batch_update(batch, AD1939_REG_ADC_CTL2, 0x48, adc_ctl2);
+    if (ret_val)
+        kfree(batch);
+    else
+        ret_val = ad1939_batch_commit(batch);
+    mutex_unlock(&devp->lock);
+
+    return ret_val;
+}
+
+/** Configure TDM: 2 (plain stereo), 4, 8 or 16 slots of 32 BCLKs
+
+    The codec's channel to slot mapping is fixed, so tx_mask and rx_mask are ignored.
+*/
+static int ad1939_set_tdm_slot(struct snd_soc_dai *dai, unsigned int tx_mask, unsigned int rx_mask, int slots, int slot_width)
+{
+    al_ad1939_dev_t *devp = snd_soc_dai_get_drvdata(dai);
+    struct ad1939_batch *batch;
+    unsigned int frame;
+    bool tdm = slots > 2;
+    int ret_val;
+
+    if (slot_width && slot_width != 32)
+        return -EINVAL;
+
+    // BCLKs per frame field of DAC control 1 (bits 2:1) and ADC control 2 (bits 5:4)
+    switch (slots)
+    {
+    case 0:
+    case 2:
+        frame = 0;
+        break;
+    case 4:
+        frame = 1;
+        break;
+    case 8:
+        frame = 2;
+        break;
+    case 16:
+        frame = 3;
+        break;
+    default:
+        return -EINVAL;
+    }
+
+    batch = ad1939_batch_alloc(devp);
+    if (!batch)
+        return -ENOMEM;
+
+    mutex_lock(&devp->lock);
+    ret_val = ad1939_batch_update(batch, AD1939_REG_DAC_CTL1, 0x06, frame << 1);
+    if (!ret_val)
+        ret_val = ad1939_batch_update(batch, AD1939_REG_ADC_CTL2, 0x30, frame << 4);
+    // Serial format: stereo or TDM
+    if (!ret_val)
+        ret_val = ad1939_batch_update(batch, AD1939_REG_DAC_CTL0, 0xC0, tdm ? 0x40 : 0x00);
+    if (!ret_val)
+        ret_val = ad1939_batch_update(batch, AD1939_REG_ADC_CTL1, 0x60, tdm ? 0x20 : 0x00);
+    if (ret_val)
+        kfree(batch);
+    else
+        ret_val = ad1939_batch_commit(batch);
+    mutex_unlock(&devp->lock);
+
+    return ret_val;
+}
+
+/** Let the codec autosuspend once the stream is closed */
+static void ad1939_shutdown(struct snd_pcm_substream *substream, struct snd_soc_dai *dai)
+{
+    pm_runtime_mark_last_busy(dai->dev);
+    pm_runtime_put_autosuspend(dai->dev);
+}
+
+/** Keep the codec powered while a stream is open */
+static int ad1939_startup(struct snd_pcm_substream *substream, struct snd_soc_dai *dai)
+{
+    al_ad1939_dev_t *devp = snd_soc_dai_get_drvdata(dai);
+    int ret_val = pm_runtime_get_sync(dai->dev);
+
+    if (ret_val < 0)
+    {
+        pm_runtime_put_noidle(dai->dev);
+        return ret_val;
+    }
+
+    // Only the rates the codec's MCLK can produce
+    ret_val = snd_pcm_hw_constraint_list(substream->runtime, 0, SNDRV_PCM_HW_PARAM_RATE, &devp->rate_constraint);
+    if (ret_val < 0)
+        ad1939_shutdown(substream, dai);
+
+    return ret_val < 0 ? ret_val : 0;
+}
+
+static const struct snd_soc_dai_ops ad1939_dai_ops =
+{
+    .startup = ad1939_startup,
+    .shutdown = ad1939_shutdown,
+    .hw_params = ad1939_hw_params,
+    .set_fmt = ad1939_set_dai_fmt,
+    .set_tdm_slot = ad1939_set_tdm_slot,
+};
+
+// Everything the clock model can do; ad1939_startup() narrows it down to what MCLK allows
+#define AD1939_RATES (SNDRV_PCM_RATE_32000 | SNDRV_PCM_RATE_44100 | SNDRV_PCM_RATE_48000 | \
+                      SNDRV_PCM_RATE_64000 | SNDRV_PCM_RATE_88200 | SNDRV_PCM_RATE_96000 | \
+                      SNDRV_PCM_RATE_176400 | SNDRV_PCM_RATE_192000 | SNDRV_PCM_RATE_KNOT)
+#define AD1939_FORMATS (SNDRV_PCM_FMTBIT_S16_LE | SNDRV_PCM_FMTBIT_S20_3LE | \
+                        SNDRV_PCM_FMTBIT_S24_LE | SNDRV_PCM_FMTBIT_S32_LE)
+
+static struct snd_soc_dai_driver ad1939_dai =
+{
+    .name = "ad1939-hifi",
+    .playback = {
+        .stream_name = "Playback",
+        .channels_min = 2,
+        .channels_max = 8,
+        .rates = AD1939_RATES,
+        .formats = AD1939_FORMATS,
+    },
+    .capture = {
+        .stream_name = "Capture",
+        .channels_min = 2,
+        .channels_max = 4,
+        .rates = AD1939_RATES,
+        .formats = AD1939_FORMATS,
+    },
+    .ops = &ad1939_dai_ops,
+};
+
+static unsigned int ad1939_component_read(struct snd_soc_component *component, unsigned int reg)
+{
+    al_ad1939_dev_t *devp = snd_soc_component_get_drvdata(component);
+    unsigned int val = 0;
+
+    regmap_read(devp->regmap, reg, &val);
+
+    return val;
+}
+
+static int ad1939_component_write(struct snd_soc_component *component, unsigned int reg, unsigned int val)
+{
+    al_ad1939_dev_t *devp = snd_soc_component_get_drvdata(component);
+
+    return ad1939_update_bits(devp, reg, 0xFF, val);
+}
+
+static const struct snd_soc_component_driver ad1939_component_driver =
+{
+    .read = ad1939_component_read,
+    .write = ad1939_component_write,
+    .controls = ad1939_snd_controls,
+    .num_controls = ARRAY_SIZE(ad1939_snd_controls),
+    .dapm_widgets = ad1939_dapm_widgets,
+    .num_dapm_widgets = ARRAY_SIZE(ad1939_dapm_widgets),
+    .dapm_routes = ad1939_dapm_routes,
+    .num_dapm_routes = ARRAY_SIZE(ad1939_dapm_routes),
+    .idle_bias_on = 1,
+    .use_pmdown_time = 1,
+    .endianness = 1,
+    .non_legacy_dai_naming = 1,
+};
+
+/** Function called initially on the driver loads
+
+    This function is called by the kernel when the driver module is loaded. It reserves the char device
+    minors and the device class shared by all codecs, then registers the SPI driver, which calls
+    ad1939_probe() for every AD1939 node in the device tree.
+
+    @returns SUCCESS or error code
+*/
+static int ad1939_init(void)
+{
+    int ret_val = 0;
+
+    pr_info("Initializing the Audio Logic ad1939 module\n");
+
+    //Request a Major/Minor number range for all codecs
+    ret_val = alloc_chrdev_region(&dev_num, 0, AD1939_MAX_DEVICES, "al_ad1939");
+    if (ret_val != 0)
+    {
+        pr_err("alloc_chrdev_region returned %d\n", ret_val);
+        return ret_val;
+    }
+
+    //Create sysfs entries
+    cl = class_create(THIS_MODULE, "al_ad1939");
+    if (IS_ERR(cl))
+    {
+        ret_val = PTR_ERR(cl);
+        goto bad_class_create;
+    }
+
+    ad1939_debugfs = debugfs_create_dir("ad1939", NULL);
+
+    // Register our driver with the SPI bus
+    ret_val = spi_register_driver(&ad1939_spi_driver);
+    if (ret_val != 0)
+    {
+        pr_err("spi_register_driver returned %d\n", ret_val);
+        goto bad_spi_register_driver;
+    }
+
+    pr_info("Audio Logic ad1939 module successfully initialized!\n");
+
+    return 0;
+
+bad_spi_register_driver:
+    debugfs_remove_recursive(ad1939_debugfs);
+    class_destroy(cl);
+
+bad_class_create:
+    unregister_chrdev_region(dev_num, AD1939_MAX_DEVICES);
+
+    return ret_val;
+}
+
+
+
+/** Bring a codec up from a work item scheduled by ad1939_probe()
+
+    Seeds the register cache by reading the codec back, sends the initialization commands and registers
+    the ASoC component, so the sound card can't bind before the codec is set up. Completes devp->ready
+    either way; init_status then tells the waiters whether the codec can be used.
+*/
+static void ad1939_bringup(struct work_struct *work)
+{
+    al_ad1939_dev_t *devp = container_of(work, al_ad1939_dev_t, init_work);
+    struct spi_device *spi = devp->spi;
+    static const unsigned int boot_rates[] = {48000, 44100, 32000};
+    struct ad1939_batch *batch;
+    unsigned int rate = 0;
+    int ret_val;
+    int i;
+
+    // Read the codec's registers back to seed the register cache
+    devp->regmap = devm_regmap_init_spi(spi, &ad1939_regmap_config);
+    if (IS_ERR(devp->regmap))
+    {
+        dev_err(&spi->dev, "FAILED to set up the register map.\n");
+        ret_val = PTR_ERR(devp->regmap);
+        goto done;
+    }
+
+    batch = ad1939_batch_alloc(devp);
+    if (!batch)
+    {
+        ret_val = -ENOMEM;
+        goto done;
+    }
+
+    mutex_lock(&devp->lock);
+
+    // Set the unmute commands (internal MCLK on, PLL from MCLKI/XI)
+    ret_val = ad1939_batch_update(batch, AD1939_REG_PLL_CTL0, 0xFF, AD1939_PLL_MCLK_EN);
+
+    // Send the pll mode command
+    if (!ret_val)
+        ret_val = ad1939_batch_update(batch, AD1939_REG_PLL_CTL1, 0xFF, 0x00);
+    if (!ret_val)
+        ret_val = ad1939_batch_update(batch, AD1939_REG_ADC_CTL2, 0xFF, 0xC8);
+
+    // Set the sampling frequency to the first of 48, 44.1 and 32 kHz that MCLK allows (PLL control 0, DAC and ADC control 0)
+    if (!ret_val)
+        ret_val = ad1939_batch_update(batch, AD1939_REG_DAC_CTL0, 0xFF, 0x00);
+    if (!ret_val)
+        ret_val = ad1939_batch_update(batch, AD1939_REG_ADC_CTL0, 0xFF, 0x00);
+    for (i = 0; i < ARRAY_SIZE(boot_rates) && !rate && !ret_val; i++)
+        if (!ad1939_stage_rate(batch, boot_rates[i]))
+            rate = boot_rates[i];
+    if (!ret_val && !rate)
+        ret_val = -EINVAL;
+
+    // Whichever of the registers differ from the codec go out in one message
+    if (ret_val)
+        kfree(batch);
+    else
+        ret_val = ad1939_batch_commit(batch);
+    mutex_unlock(&devp->lock);
+    if (ret_val)
+    {
+        dev_err(&spi->dev, "initialization commands failed (%d)\n", ret_val);
+        goto done;
+    }
+
+    // The FPGA effects run at the codec's rate
+    ret_val = avalon_set_sample_rate(rate);
+    if (ret_val)
+    {
+        dev_err(&spi->dev, "FAILED to report the sample rate to the FPGA effects (%d)\n", ret_val);
+        goto done;
+    }
+
+    ret_val = snd_soc_register_component(&spi->dev, &ad1939_component_driver, &ad1939_dai, 1);
+    if (ret_val)
+    {
+        dev_err(&spi->dev, "FAILED to register the ASoC codec component.\n");
+        goto done;
+    }
+
+    // Powered now; suspending when idle is up to user space (see ad1939_pm_ops)
+    pm_runtime_set_active(&spi->dev);
+    pm_runtime_set_autosuspend_delay(&spi->dev, AD1939_AUTOSUSPEND_MS);
+    pm_runtime_use_autosuspend(&spi->dev);
+    pm_runtime_forbid(&spi->dev);
+    pm_runtime_enable(&spi->dev);
+
+done:
+    devp->init_ns = ktime_get_ns() - devp->probe_start;
+    devp->init_status = ret_val;
+    complete_all(&devp->ready);
+}
+
+
+
+/** Kernel module loading for SPI devices
+
+    Called by the kernel for every AD1939 child node of an SPI controller, asynchronously to other drivers.
+    Configures the SPI device and creates the codec's char device (/dev/al_ad1939_<n>) and sysfs entries,
+    then leaves all bus traffic to ad1939_bringup() so that boot doesn't wait for it.
+    Everything a codec needs lives in its own al_ad1939_dev, so any number of chained codecs
+    (up to AD1939_MAX_DEVICES) can be bound and configured independently.
+
+    @param spi Pointer to the SPI device created from the device tree node
+    @returns SUCCESS or error code
+*/
+static int ad1939_probe(struct spi_device *spi)
+{
+    int ret_val = -EBUSY;
+
+    char deviceName[20];
+    int status;
+    int minor;
+
+    struct device *deviceObj;
+    al_ad1939_dev_t *al_ad1939_devp;
+    u64 start = ktime_get_ns();
+
+    // Create structure to hold device-specific information (the SPI device, register cache and lock)
+    al_ad1939_devp = devm_kzalloc(&spi->dev, sizeof(al_ad1939_dev_t), GFP_KERNEL);
+    if (al_ad1939_devp == NULL)
+        return -ENOMEM;
+
+    al_ad1939_devp->spi = spi;
+    al_ad1939_devp->probe_start = start;
+    INIT_WORK(&al_ad1939_devp->init_work, ad1939_bringup);
+    init_completion(&al_ad1939_devp->ready);
+    mutex_init(&al_ad1939_devp->lock);
+    INIT_WORK(&al_ad1939_devp->resync_work, ad1939_resync);
+    INIT_WORK(&al_ad1939_devp->ramp_work, ad1939_ramp_step);
+    hrtimer_init(&al_ad1939_devp->ramp_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+    al_ad1939_devp->ramp_timer.function = ad1939_ramp_tick;
+    atomic_set(&al_ad1939_devp->batches_in_flight, 0);
+    init_waitqueue_head(&al_ad1939_devp->batches_wq);
+
+    // Give a pointer to the instance-specific data to the SPI device structure
+    // so we can access this data later on (ASoC callbacks and remove)
+    spi_set_drvdata(spi, al_ad1939_devp);
+
+    //Name the device after its device tree node
+    al_ad1939_devp->name = devm_kstrdup(&spi->dev, spi->dev.of_node ? spi->dev.of_node->name : dev_name(&spi->dev), GFP_KERNEL);
+    if (al_ad1939_devp->name == NULL)
+        return -ENOMEM;
+
+    //Bus speed and mode come from the device tree (the SPI core has parsed them already)
+    if (spi->max_speed_hz == 0 || spi->max_speed_hz > AD1939_MAX_SPI_HZ)
+        spi->max_speed_hz = AD1939_MAX_SPI_HZ;
+    if (!of_property_read_bool(spi->dev.of_node, "spi-cpol") && !of_property_read_bool(spi->dev.of_node, "spi-cpha"))
+        spi->mode |= SPI_MODE_3;
+    spi->bits_per_word = bits;
+
+    status = spi_setup(spi);
+    if (status)
+    {
+        dev_err(&spi->dev, "FAILED to setup slave (%d)\n", status);
+        return status;
+    }
+    dev_dbg(&spi->dev, "CCLK %u Hz, SPI mode %u\n", spi->max_speed_hz, spi->mode & SPI_MODE_3);
+
+    // The clock on MCLKI/XI decides which sample rates the codec can run at
+    al_ad1939_devp->mclk = AD1939_DEFAULT_MCLK;
+    of_property_read_u32(spi->dev.of_node, "adi,mclk-frequency", &al_ad1939_devp->mclk);
+    if (ad1939_init_rates(al_ad1939_devp) == 0)
+    {
+        dev_err(&spi->dev, "MCLK of %u Hz can't clock any sample rate\n", al_ad1939_devp->mclk);
+        return -EINVAL;
+    }
+
+    // Latency of every spi_message sent to this codec
+    al_ad1939_devp->debugfs = debugfs_create_dir(dev_name(&spi->dev), ad1939_debugfs);
+    lat_hist_debugfs_create("spi_write_latency", al_ad1939_devp->debugfs, &al_ad1939_devp->spi_write_lat);
+
+    //Request a minor number for the char device
+    minor = ida_simple_get(&ad1939_minors, 0, AD1939_MAX_DEVICES, GFP_KERNEL);
+    if (minor < 0)
+    {
+        ret_val = minor;
+        goto bad_ida_get;
+    }
+    al_ad1939_devp->devt = MKDEV(MAJOR(dev_num), minor);
+
+    //Create the device name with the information reserved above
+    snprintf(deviceName, sizeof(deviceName), "al_ad1939_%d", minor);
+
+    //Initialize a char dev structure
+    cdev_init(&al_ad1939_devp->cdev, &al_ad1939_fops);
+
+    //Registers the char driver with the kernel
+    status = cdev_add(&al_ad1939_devp->cdev, al_ad1939_devp->devt, 1);
+    if (status != 0)
+    {
+        ret_val = status;
+        goto bad_cdev_add;
+    }
+
+    //Creates the device entry in sysfs with its attributes; they reach the al_ad1939_dev struct through the drvdata
+    deviceObj = device_create_with_groups(cl, &spi->dev, al_ad1939_devp->devt, al_ad1939_devp, ad1939_groups, deviceName);
+    if (IS_ERR(deviceObj))
+    {
+        ret_val = PTR_ERR(deviceObj);
+        goto bad_device_create;
+    }
+
+    // The SPI traffic happens in the background; accesses wait in ad1939_wait_ready()
+    schedule_work(&al_ad1939_devp->init_work);
+
+    return 0;
+
+bad_device_create:
+    cdev_del(&al_ad1939_devp->cdev);
+
+bad_cdev_add:
+    ida_simple_remove(&ad1939_minors, minor);
+
+bad_ida_get:
+    debugfs_remove_recursive(al_ad1939_devp->debugfs);
+
+    return ret_val;
+}
+
+/** Run when the device opens to create the file structure to read and write
+
+    Creates a structure which the other functions can use to access the device. The register values
+    come from the register cache, so nothing is reset here.
+
+    @param inode Pointer to the instance of the hardware driver to use
+    @param file Pointer to the file object opened
+    @return SUCCESS or error code
+*/
+static int ad1939_open(struct inode *inode, struct file *file)
+{
+    //Create a pointer to the driver instance
+    al_ad1939_dev_t *devp;
+    int ret_val;
+
+    //Put it in the container_of structure so it can be used from anywhere
+    devp = container_of(inode->i_cdev, al_ad1939_dev_t, cdev);
+    file->private_data = devp;
+
+    // read(), write() and ioctl() all need the register cache
+    ret_val = ad1939_wait_ready(devp);
+    if (ret_val)
+        return ret_val;
+
+    // The codec stays powered while the char device is open
+    ret_val = pm_runtime_get_sync(&devp->spi->dev);
+    if (ret_val < 0)
+    {
+        pm_runtime_put_noidle(&devp->spi->dev);
+        return ret_val;
+    }
+
+    return 0;
+}
+
+
+
+/** Called when the device is closed
+
+    Drops the runtime PM reference taken in ad1939_open()
+
+    @param inode Instance of the driver opened
+    @param file Pointer to the file for this operation
+    @returns SUCCESS
+*/
+static int ad1939_release(struct inode *inode, struct file *file)
+{
+    al_ad1939_dev_t *devp = file->private_data;
+
+    pm_runtime_mark_last_busy(&devp->spi->dev);
+    pm_runtime_put_autosuspend(&devp->spi->dev);
+
+    return 0;
+}
+
+
+
+/** Read the register profile of the codec
+
+    Returns AD1939_PROFILE_SIZE bytes, the value of register 0x00 (PLL control 0) first and 0x10
+    (ADC control 2) last, from the register cache. The result can be written back with ad1939_write(),
+    e.g. "cat /dev/al_ad1939_0 > profile.bin".
+
+    @param file Pointer to the file being accessed
+    @param buffer Pointer to a buffer array to return the data on
+    @len Size of buffer
+    @offset Pass-by-reference variable to hold where to start transmitting from in the array.
+    @returns ad1939_read Number of bytes sent in buffer, and will return 0 for the last transaction.
+*/
+static ssize_t ad1939_read(struct file *file, char *buffer, size_t len, loff_t *offset)
+{
+    al_ad1939_dev_t *devp = file->private_data;
+    uint8_t profile[AD1939_PROFILE_SIZE];
+    unsigned int reg, val;
+    int ret_val;
+
+    if (*offset >= AD1939_PROFILE_SIZE)
+        return 0;
+
+    for (reg = 0; reg < AD1939_PROFILE_SIZE; reg++)
+    {
+        ret_val = regmap_read(devp->regmap, reg, &val);
+        if (ret_val)
+            return ret_val;
+        profile[reg] = val;
+    }
+
+    len = min_t(size_t, len, AD1939_PROFILE_SIZE - *offset);
+    if (copy_to_user(buffer, profile + *offset, len))
+        return -EFAULT;
+
+    *offset += len;
+
+    return len;
+}
+
+
+
+/** Load a register profile into the codec
+
+    Takes exactly AD1939_PROFILE_SIZE bytes in the layout ad1939_read() returns. The registers that differ
+    from the cache are sent in address order (PLL first, volumes before ADC control) in one spi_message, so
+    "cat profile.bin > /dev/al_ad1939_0" brings the codec to a known state in a single bus transaction.
+    When the profile changes the sample rate, the FPGA effects are told with avalon_set_sample_rate().
+
+    @param file Pointer to the file being written to
+    @param buffer Pointer to a buffer array containing the data to write
+    @len Number of bytes in the buffer variable; anything other than AD1939_PROFILE_SIZE is rejected
+    @offset Unused; every write is a complete profile
+    @returns ad1939_write Number of bytes written
+*/
+static ssize_t ad1939_write(struct file *file, const char *buffer, size_t len, loff_t *offset)
+{
+    al_ad1939_dev_t *devp = file->private_data;
+    uint8_t profile[AD1939_PROFILE_SIZE];
+    struct ad1939_batch *batch;
+    unsigned int reg;
+    int old_rate, new_rate = 0;
+    int ret_val = 0;
+
+    if (len != AD1939_PROFILE_SIZE)
+        return -EINVAL;
+
+    if (copy_from_user(profile, buffer, len))
+        return -EFAULT;
+
+    batch = ad1939_batch_alloc(devp);
+    if (!batch)
+        return -ENOMEM;
+
+    mutex_lock(&devp->lock);
+    old_rate = ad1939_get_rate(devp);
+    for (reg = 0; reg < AD1939_PROFILE_SIZE && !ret_val; reg++)
+        ret_val = ad1939_batch_update(batch, reg, 0xFF, profile[reg]);
+    // A profile can change PLL_CTL0[MCLKI] and the DAC_CTL0 rate field; the cache already holds them
+    if (!ret_val)
+        new_rate = ad1939_get_rate(devp);
+    if (ret_val)
+        kfree(batch);
+    else
+        ret_val = ad1939_batch_commit(batch);
+    mutex_unlock(&devp->lock);
+
+    if (ret_val)
+        return ret_val;
+
+    // Let the FPGA effects rescale their rate dependent registers
+    if (new_rate > 0 && new_rate != old_rate)
+    {
+        dev_dbg(&devp->spi->dev, "profile changed the sample frequency to %d Hz\n", new_rate);
+        ret_val = avalon_set_sample_rate(new_rate);
+        if (ret_val)
+            return ret_val;
+    }
+
+    return len;
+}
+
+
+
+/** ioctl interface of the char device; see ad1939_ioctl.h
+
+    @param file Pointer to the file being accessed
+    @param cmd AD1939_IOC_SET_VOLUMES or AD1939_IOC_GET_VOLUMES
+    @param arg User-space pointer to a struct ad1939_volumes
+    @returns 0 on success, or a negative error code
+*/
+static long ad1939_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
+{
+    al_ad1939_dev_t *devp = file->private_data;
+    struct ad1939_volumes vols;
+    void __user *uarg = (void __user *)arg;
+    int ret_val;
+
+    switch (cmd)
+    {
+    case AD1939_IOC_SET_VOLUMES:
+        if (copy_from_user(&vols, uarg, sizeof(vols)))
+            return -EFAULT;
+        return ad1939_set_volumes(devp, vols.code);
+
+    case AD1939_IOC_GET_VOLUMES:
+        ret_val = ad1939_get_volumes(devp, vols.code);
+        if (ret_val)
+            return ret_val;
+        if (copy_to_user(uarg, &vols, sizeof(vols)))
+            return -EFAULT;
+        return 0;
+
+    default:
+        return -ENOTTY;
+    }
+}
+
+
+
+/** Function called when a codec is unbound from the driver
+
+    This function is called for each codec when the driver is unregistered (or the device tree node goes away).
+    It waits for the bring-up, removes the char device and the ASoC component and waits for the codec's queued register writes. The
+    register cache and the instance structure are device managed and freed after this returns. After this
+    function, the device should be able to be added cleanly again without contention or memory leaks.
+
+    @param spi Pointer to the SPI device being removed
+    @returns SUCCESS
+*/
+static int ad1939_remove(struct spi_device *spi)
+{
+    // Grab the instance-specific information out of the SPI device
+    al_ad1939_dev_t *dev = (al_ad1939_dev_t *)spi_get_drvdata(spi);
+
+    // Let the bring-up finish; anyone waiting in ad1939_wait_ready() has to get out before the files go
+    flush_work(&dev->init_work);
+    if (dev->init_status == 0)
+    {
+        // Leave the codec powered up
+        pm_runtime_get_sync(&spi->dev);
+        pm_runtime_disable(&spi->dev);
+        pm_runtime_put_noidle(&spi->dev);
+        pm_runtime_dont_use_autosuspend(&spi->dev);
+
+        snd_soc_unregister_component(&spi->dev);
+    }
+
+    // Remove the sysfs entries and unregister the character file (remove it from /dev)
+    device_destroy(cl, dev->devt);
+    cdev_del(&dev->cdev);
+
+    //Tell the os that the minor is available again
+    ida_simple_remove(&ad1939_minors, MINOR(dev->devt));
+
+    ad1939_ramp_stop(dev);
+
+    // Let queued async writes finish before the device goes away
+    wait_event(dev->batches_wq, atomic_read(&dev->batches_in_flight) == 0);
+    cancel_work_sync(&dev->resync_work);
+
+    debugfs_remove_recursive(dev->debugfs);
+
+    return 0;
+}
+
+
+
+// Called when the driver is removed
+static void ad1939_exit(void)
+{
+    pr_info("Audio Logic ad1939 module exit\n");
+
+    // Unregister our driver from the SPI bus
+    // This will cause "ad1939_remove" to be called for each bound codec
+    spi_unregister_driver(&ad1939_spi_driver);
+
+    debugfs_remove_recursive(ad1939_debugfs);
+    class_destroy(cl);
+    unregister_chrdev_region(dev_num, AD1939_MAX_DEVICES);
+    ida_destroy(&ad1939_minors);
+
+    pr_info("Audio Logic ad1939 module successfully unregistered\n");
+}
+
+/** Function to display the overlay name for the device in sysfs
+
+    @todo Better understand the inputs
+
+    @param dev
+    @param attr
+    @param buf charactor buffer for the sysfs return
+    @returns Length of the buffer
+*/
+static ssize_t name_read(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    al_ad1939_dev_t *devp = (al_ad1939_dev_t *)dev_get_drvdata(dev);
+
+    //Copy the name into the output buffer
+    sprintf(buf, "%s\n", devp->name);
+
+    //Return the length of the buffer so it will print in the console
+    return strlen(buf);
+}
+
+/** Benchmark: write all registers to the codec and time it
+
+    Any write sends the full register map from the cache in one spi_message, so reprogram_time then
+    shows what the configured CCLK (spi-max-frequency) costs for a complete reprogram of the codec.
+*/
+static ssize_t reprogram_write(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+    al_ad1939_dev_t *devp = dev_get_drvdata(dev);
+    u64 ns;
+    int ret_val;
+
+    ret_val = ad1939_wait_ready(devp);
+    if (ret_val)
+        return ret_val;
+
+    ret_val = pm_runtime_get_sync(&devp->spi->dev);
+    if (ret_val >= 0)
+        ret_val = ad1939_reprogram(devp, &ns);
+    pm_runtime_mark_last_busy(&devp->spi->dev);
+    pm_runtime_put_autosuspend(&devp->spi->dev);
+    if (ret_val < 0)
+        return ret_val;
+
+    devp->reprogram_ns = ns;
+
+    return count;
+}
+
+/** How long the last write to reprogram took to send all registers, in ns; 0 before the first */
+static ssize_t reprogram_time_read(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    al_ad1939_dev_t *devp = dev_get_drvdata(dev);
+
+    return sprintf(buf, "%llu\n", devp->reprogram_ns);
+}
+
+/** Time from the start of probe until the codec was ready (or failed), in ns */
+static ssize_t init_time_read(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    al_ad1939_dev_t *devp = dev_get_drvdata(dev);
+
+    // Only the wait itself; the time is reported even when the bring-up failed
+    if (wait_for_completion_interruptible(&devp->ready))
+        return -ERESTARTSYS;
+
+    return sprintf(buf, "%llu\n", devp->init_ns);
+}
 
-    // If the first character is a negative sign
-    if (buf[0] == '-')
-    {
-      // Shift all the values "left" to remove it
-      for (i=0;i<79;i++)
-        substring[i] = substring[i+1];
-    }
+/** How long the last resume took, from entering ad1939_resume() until the registers were restored, in ns */
+static ssize_t resume_time_read(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    al_ad1939_dev_t *devp = dev_get_drvdata(dev);
+
+    return sprintf(buf, "%llu\n", devp->resume_ns);
+}
+
+static ssize_t sample_frequency_write(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+    al_ad1939_dev_t *devp = dev_get_drvdata(dev);
+    int32_t fs;
+    unsigned int rate;
+    int ret_val;
+    struct ad1939_batch *batch;
+
+    ret_val = ad1939_wait_ready(devp);
+    if (ret_val)
+        return ret_val;
+
+    //Convert the buffer to a fixed point value (kHz), then to Hz
+    ret_val = fp_parse(buf, 16, &fs);
+    if (ret_val)
+        return ret_val;
+    if (fs <= 0)
+        return -EINVAL;
+    rate = ((u64)fs * 1000 + (1 << 15)) >> 16;
+
+    batch = ad1939_batch_alloc(devp);
+    if (!batch)
+        return -ENOMEM;
+
+    // PLL control 0 and DAC and ADC control 0 go out in one message
+    mutex_lock(&devp->lock);
+    ret_val = ad1939_stage_rate(batch, rate);
+    if (ret_val)
+        kfree(batch);
+    else
+        ret_val = ad1939_batch_commit(batch);
+    mutex_unlock(&devp->lock);
 
-    //Convert the buffer to a fixed point value
-    tempValue = set_fixed_num(substring);
+    if (ret_val == -EINVAL)
+        dev_err(dev, "%u Hz can't be made from the %u Hz MCLK\n", rate, devp->mclk);
+    if (ret_val)
+        return ret_val;
 
-    //printk("Entering conversion function\n");
-    volume_level = find_volume_level(tempValue);
-    tempValue = decode_volume(volume_level);
-    
-    //Write the value into the shadow register (and pray it works...)
-    devp->dac2_left_volume = -1*tempValue;
+    dev_dbg(dev, "sample frequency set to %u Hz\n", rate);
 
-    // Write the SPI commands to the DAC
-    cmd[2] = volume_level;
-    spi_write(spi_device,&cmd, sizeof(cmd));
+    // Let the FPGA effects rescale their rate dependent registers
+    ret_val = avalon_set_sample_rate(rate);
+    if (ret_val)
+        return ret_val;
 
     return count;
 }
-static ssize_t dac2_left_volume_read(struct device *dev, struct device_attribute *attr, char *buf)
+static ssize_t sample_frequency_read(struct device *dev, struct device_attribute *attr, char *buf)
 {
-    al_ad1939_dev_t *devp = (al_ad1939_dev_t *)dev_get_drvdata(dev);
+    al_ad1939_dev_t *devp = dev_get_drvdata(dev);
+    int ret_val;
+    int len;
 
-    //Copy the name into the output buffer
-    //sprintf(buf, "%d\n", fe_HA_devp->threshold);
-    fp_to_string(buf, devp->dac2_left_volume);
+    ret_val = ad1939_wait_ready(devp);
+    if (ret_val)
+        return ret_val;
+
+    // Served from the register cache
+    ret_val = ad1939_get_rate(devp);
+    if (ret_val < 0)
+        return ret_val;
+
+    // Copy the sample frequency to the output buffer, in kHz (44.1, 48.0, ...)
+    len = fp_format(buf, PAGE_SIZE, div_u64((u64)ret_val << 16, 1000), 16, 1);
 
-    strcat2(buf, "\n");
+    buf[len++] = '\n';
 
     //Return the length of the buffer so it will print in the console
-    return strlen(buf);
+    return len;
 }
-static ssize_t dac3_left_volume_write(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+static ssize_t dac1_left_volume_write(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
 {
-    uint32_t tempValue = 0;
+    al_ad1939_dev_t *devp = dev_get_drvdata(dev);
+    int32_t value;
+    int ret_val;
     uint8_t volume_level;
-    char cmd[3] = {0x08,0x0A,0x00};
-    char substring[80];
-    int substring_count = 0;
-    int i;
 
-    al_ad1939_dev_t *devp = (al_ad1939_dev_t *)dev_get_drvdata(dev);
+    ret_val = ad1939_wait_ready(devp);
+    if (ret_val)
+        return ret_val;
 
-    for (i = 0; i < count; i++)
-    {
-        //If its not a space or a comma, add the digit to the substring
-        if ((buf[i] != ',') && (buf[i] != ' ') && (buf[i] != '\0') && (buf[i] != '\r') && (buf[i] != '\n'))
-        {
-            substring[substring_count] = buf[i];
-            substring_count++;
-        }
-    }
+    //Convert the buffer to a fixed point value ("-6" and "6" both mean 6 dB of attenuation)
+    ret_val = fp_parse(buf, 16, &value);
+    if (ret_val)
+        return ret_val;
 
-    substring[substring_count] = '\0';
+    volume_level = find_volume_level(abs(value));
 
-    // If the first character is a negative sign
-    if (buf[0] == '-')
-    {
-      // Shift all the values "left" to remove it
-      for (i=0;i<79;i++)
-        substring[i] = substring[i+1];
-    }
+    // Write the SPI commands to the DAC (nothing is sent if the level doesn't change)
+    ret_val = ad1939_update_bits(devp, AD1939_REG_DAC1L_VOL, 0xFF, volume_level);
+    if (ret_val)
+        return ret_val;
+
+    return count;
+}
+static ssize_t dac1_left_volume_read(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    al_ad1939_dev_t *devp = dev_get_drvdata(dev);
+    unsigned int volume_level;
+    int ret_val;
+    int len;
+
+    ret_val = ad1939_wait_ready(devp);
+    if (ret_val)
+        return ret_val;
+
+    // Served from the register cache
+    ret_val = regmap_read(devp->regmap, AD1939_REG_DAC1L_VOL, &volume_level);
+    if (ret_val)
+        return ret_val;
+
+    len = fp_format(buf, PAGE_SIZE, -(int32_t)decode_volume(volume_level), 16, 8);
+
+    buf[len++] = '\n';
+
+    //Return the length of the buffer so it will print in the console
+    return len;
+}
+static ssize_t dac2_left_volume_write(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+    al_ad1939_dev_t *devp = dev_get_drvdata(dev);
+    int32_t value;
+    int ret_val;
+    uint8_t volume_level;
+
+    ret_val = ad1939_wait_ready(devp);
+    if (ret_val)
+        return ret_val;
+
+    //Convert the buffer to a fixed point value ("-6" and "6" both mean 6 dB of attenuation)
+    ret_val = fp_parse(buf, 16, &value);
+    if (ret_val)
+        return ret_val;
+
+    volume_level = find_volume_level(abs(value));
+
+    // Write the SPI commands to the DAC (nothing is sent if the level doesn't change)
+    ret_val = ad1939_update_bits(devp, AD1939_REG_DAC2L_VOL, 0xFF, volume_level);
+    if (ret_val)
+        return ret_val;
+
+    return count;
+}
+static ssize_t dac2_left_volume_read(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    al_ad1939_dev_t *devp = dev_get_drvdata(dev);
+    unsigned int volume_level;
+    int ret_val;
+    int len;
+
+    ret_val = ad1939_wait_ready(devp);
+    if (ret_val)
+        return ret_val;
+
+    // Served from the register cache
+    ret_val = regmap_read(devp->regmap, AD1939_REG_DAC2L_VOL, &volume_level);
+    if (ret_val)
+        return ret_val;
+
+    len = fp_format(buf, PAGE_SIZE, -(int32_t)decode_volume(volume_level), 16, 8);
+
+    buf[len++] = '\n';
+
+    //Return the length of the buffer so it will print in the console
+    return len;
+}
+static ssize_t dac3_left_volume_write(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+    al_ad1939_dev_t *devp = dev_get_drvdata(dev);
+    int32_t value;
+    int ret_val;
+    uint8_t volume_level;
+
+    ret_val = ad1939_wait_ready(devp);
+    if (ret_val)
+        return ret_val;
+
+    //Convert the buffer to a fixed point value ("-6" and "6" both mean 6 dB of attenuation)
+    ret_val = fp_parse(buf, 16, &value);
+    if (ret_val)
+        return ret_val;
 
-    //Convert the buffer to a fixed point value
-    tempValue = set_fixed_num(substring);
+    volume_level = find_volume_level(abs(value));
 
-    //printk("Entering conversion function\n");
-    volume_level = find_volume_level(tempValue);
-    tempValue = decode_volume(volume_level);
-    
-    //Write the value into the shadow register (and pray it works...)
-    devp->dac3_left_volume = -1*tempValue;
+    // Write the SPI commands to the DAC (nothing is sent if the level doesn't change)
+    ret_val = ad1939_update_bits(devp, AD1939_REG_DAC3L_VOL, 0xFF, volume_level);
+    if (ret_val)
+        return ret_val;
 
-    // Write the SPI commands to the DAC
-    cmd[2] = volume_level;
-    spi_write(spi_device,&cmd, sizeof(cmd));
     return count;
 }
 static ssize_t dac3_left_volume_read(struct device *dev, struct device_attribute *attr, char *buf)
 {
-    al_ad1939_dev_t *devp = (al_ad1939_dev_t *)dev_get_drvdata(dev);
+    al_ad1939_dev_t *devp = dev_get_drvdata(dev);
+    unsigned int volume_level;
+    int ret_val;
+    int len;
 
-    //Copy the name into the output buffer
-    //sprintf(buf, "%d\n", fe_HA_devp->threshold);
-    fp_to_string(buf, devp->dac3_left_volume);
+    ret_val = ad1939_wait_ready(devp);
+    if (ret_val)
+        return ret_val;
+
+    // Served from the register cache
+    ret_val = regmap_read(devp->regmap, AD1939_REG_DAC3L_VOL, &volume_level);
+    if (ret_val)
+        return ret_val;
+
+    len = fp_format(buf, PAGE_SIZE, -(int32_t)decode_volume(volume_level), 16, 8);
 
-    strcat2(buf, "\n");
+    buf[len++] = '\n';
 
     //Return the length of the buffer so it will print in the console
-    return strlen(buf);
+    return len;
 }
 static ssize_t dac4_left_volume_write(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
 {
-    uint32_t tempValue = 0;
+    al_ad1939_dev_t *devp = dev_get_drvdata(dev);
+    int32_t value;
+    int ret_val;
     uint8_t volume_level;
-    char cmd[3] = {0x08,0x0C,0x00};
-    char substring[80];
-    int substring_count = 0;
-    int i;
 
-    al_ad1939_dev_t *devp = (al_ad1939_dev_t *)dev_get_drvdata(dev);
+    ret_val = ad1939_wait_ready(devp);
+    if (ret_val)
+        return ret_val;
 
-    for (i = 0; i < count; i++)
-    {
-        //If its not a space or a comma, add the digit to the substring
-        if ((buf[i] != ',') && (buf[i] != ' ') && (buf[i] != '\0') && (buf[i] != '\r') && (buf[i] != '\n'))
-        {
-            substring[substring_count] = buf[i];
-            substring_count++;
-        }
-    }
+    //Convert the buffer to a fixed point value ("-6" and "6" both mean 6 dB of attenuation)
+    ret_val = fp_parse(buf, 16, &value);
+    if (ret_val)
+        return ret_val;
 
-    substring[substring_count] = '\0';
+    volume_level = find_volume_level(abs(value));
 
-    // If the first character is a negative sign
-    if (buf[0] == '-')
-    {
-      // Shift all the values "left" to remove it
-      for (i=0;i<79;i++)
-        substring[i] = substring[i+1];
-    }
+    // Write the SPI commands to the DAC (nothing is sent if the level doesn't change)
+    ret_val = ad1939_update_bits(devp, AD1939_REG_DAC4L_VOL, 0xFF, volume_level);
+    if (ret_val)
+        return ret_val;
 
-    //Convert the buffer to a fixed point value
-    tempValue = set_fixed_num(substring);
-    //printk("Entering conversion function\n");
-    volume_level = find_volume_level(tempValue);
-    tempValue = decode_volume(volume_level);
-    
-    //Write the value into the shadow register (and pray it works...)
-    devp->dac4_left_volume = -1*tempValue;
-
-    // Write the SPI commands to the DAC
-    cmd[2] = volume_level;
-    spi_write(spi_device,&cmd, sizeof(cmd));
     return count;
 }
 static ssize_t dac4_left_volume_read(struct device *dev, struct device_attribute *attr, char *buf)
 {
-    al_ad1939_dev_t *devp = (al_ad1939_dev_t *)dev_get_drvdata(dev);
+    al_ad1939_dev_t *devp = dev_get_drvdata(dev);
+    unsigned int volume_level;
+    int ret_val;
+    int len;
 
-    //Copy the name into the output buffer
-    //sprintf(buf, "%d\n", fe_HA_devp->threshold);
-    fp_to_string(buf, devp->dac4_left_volume);
+    ret_val = ad1939_wait_ready(devp);
+    if (ret_val)
+        return ret_val;
+
+    // Served from the register cache
+    ret_val = regmap_read(devp->regmap, AD1939_REG_DAC4L_VOL, &volume_level);
+    if (ret_val)
+        return ret_val;
+
+    len = fp_format(buf, PAGE_SIZE, -(int32_t)decode_volume(volume_level), 16, 8);
 
-    strcat2(buf, "\n");
+    buf[len++] = '\n';
 
     //Return the length of the buffer so it will print in the console
-    return strlen(buf);
+    return len;
 }
 static ssize_t dac1_right_volume_write(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
 {
-    uint32_t tempValue = 0;
+    al_ad1939_dev_t *devp = dev_get_drvdata(dev);
+    int32_t value;
+    int ret_val;
     uint8_t volume_level;
-    char cmd[3] = {0x08,0x07,0x00};
-    char substring[80];
-    int substring_count = 0;
-    int i;
-
-    al_ad1939_dev_t *devp = (al_ad1939_dev_t *)dev_get_drvdata(dev);
-
-    for (i = 0; i < count; i++)
-    {
-        //If its not a space or a comma, add the digit to the substring
-        if ((buf[i] != ',') && (buf[i] != ' ') && (buf[i] != '\0') && (buf[i] != '\r') && (buf[i] != '\n'))
-        {
-            substring[substring_count] = buf[i];
-            substring_count++;
-        }
-    }
 
-    substring[substring_count] = '\0';
+    ret_val = ad1939_wait_ready(devp);
+    if (ret_val)
+        return ret_val;
 
-    // If the first character is a negative sign
-    if (buf[0] == '-')
-    {
-      // Shift all the values "left" to remove it
-      for (i=0;i<79;i++)
-        substring[i] = substring[i+1];
-    }
+    //Convert the buffer to a fixed point value ("-6" and "6" both mean 6 dB of attenuation)
+    ret_val = fp_parse(buf, 16, &value);
+    if (ret_val)
+        return ret_val;
 
-    //Convert the buffer to a fixed point value
-    tempValue = set_fixed_num(substring);
+    volume_level = find_volume_level(abs(value));
 
-    //printk("Entering conversion function\n");
-    volume_level = find_volume_level(tempValue);
-    tempValue = decode_volume(volume_level);
-    
-    //Write the value into the shadow register (and pray it works...)
-    devp->dac1_right_volume = -1*tempValue;
+    // Write the SPI commands to the DAC (nothing is sent if the level doesn't change)
+    ret_val = ad1939_update_bits(devp, AD1939_REG_DAC1R_VOL, 0xFF, volume_level);
+    if (ret_val)
+        return ret_val;
 
-    // Write the SPI commands to the DAC
-    cmd[2] = volume_level;
-    spi_write(spi_device,&cmd, sizeof(cmd));
     return count;
 }
 static ssize_t dac1_right_volume_read(struct device *dev, struct device_attribute *attr, char *buf)
 {
-    al_ad1939_dev_t *devp = (al_ad1939_dev_t *)dev_get_drvdata(dev);
+    al_ad1939_dev_t *devp = dev_get_drvdata(dev);
+    unsigned int volume_level;
+    int ret_val;
+    int len;
 
-    //Copy the name into the output buffer
-    //sprintf(buf, "%d\n", fe_HA_devp->threshold);
-    fp_to_string(buf, devp->dac1_right_volume);
+    ret_val = ad1939_wait_ready(devp);
+    if (ret_val)
+        return ret_val;
+
+    // Served from the register cache
+    ret_val = regmap_read(devp->regmap, AD1939_REG_DAC1R_VOL, &volume_level);
+    if (ret_val)
+        return ret_val;
+
+    len = fp_format(buf, PAGE_SIZE, -(int32_t)decode_volume(volume_level), 16, 8);
 
-    strcat2(buf, "\n");
+    buf[len++] = '\n';
 
     //Return the length of the buffer so it will print in the console
-    return strlen(buf);
+    return len;
 }
 static ssize_t dac2_right_volume_write(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
 {
-    uint32_t tempValue = 0;
+    al_ad1939_dev_t *devp = dev_get_drvdata(dev);
+    int32_t value;
+    int ret_val;
     uint8_t volume_level;
-    char cmd[3] = {0x08,0x09,0x00};
-    char substring[80];
-    int substring_count = 0;
-    int i;
 
-    al_ad1939_dev_t *devp = (al_ad1939_dev_t *)dev_get_drvdata(dev);
-
-    for (i = 0; i < count; i++)
-    {
-        //If its not a space or a comma, add the digit to the substring
-        if ((buf[i] != ',') && (buf[i] != ' ') && (buf[i] != '\0') && (buf[i] != '\r') && (buf[i] != '\n'))
-        {
-            substring[substring_count] = buf[i];
-            substring_count++;
-        }
-    }
-
-    substring[substring_count] = '\0';
+    ret_val = ad1939_wait_ready(devp);
+    if (ret_val)
+        return ret_val;
 
-    // If the first character is a negative sign
-    if (buf[0] == '-')
-    {
-      // Shift all the values "left" to remove it
-      for (i=0;i<79;i++)
-        substring[i] = substring[i+1];
-    }
+    //Convert the buffer to a fixed point value ("-6" and "6" both mean 6 dB of attenuation)
+    ret_val = fp_parse(buf, 16, &value);
+    if (ret_val)
+        return ret_val;
 
-    //Convert the buffer to a fixed point value
-    tempValue = set_fixed_num(substring);
+    volume_level = find_volume_level(abs(value));
 
-    //printk("Entering conversion function\n");
-    volume_level = find_volume_level(tempValue);
-    tempValue = decode_volume(volume_level);
-    
-    //Write the value into the shadow register (and pray it works...)
-    devp->dac2_right_volume = -1*tempValue;
+    // Write the SPI commands to the DAC (nothing is sent if the level doesn't change)
+    ret_val = ad1939_update_bits(devp, AD1939_REG_DAC2R_VOL, 0xFF, volume_level);
+    if (ret_val)
+        return ret_val;
 
-    // Write the SPI commands to the DAC
-    cmd[2] = volume_level;
-    spi_write(spi_device,&cmd, sizeof(cmd));
     return count;
 }
 static ssize_t dac2_right_volume_read(struct device *dev, struct device_attribute *attr, char *buf)
 {
-    al_ad1939_dev_t *devp = (al_ad1939_dev_t *)dev_get_drvdata(dev);
+    al_ad1939_dev_t *devp = dev_get_drvdata(dev);
+    unsigned int volume_level;
+    int ret_val;
+    int len;
 
-    //Copy the name into the output buffer
-    //sprintf(buf, "%d\n", fe_HA_devp->threshold);
-    fp_to_string(buf, devp->dac2_right_volume);
+    ret_val = ad1939_wait_ready(devp);
+    if (ret_val)
+        return ret_val;
+
+    // Served from the register cache
+    ret_val = regmap_read(devp->regmap, AD1939_REG_DAC2R_VOL, &volume_level);
+    if (ret_val)
+        return ret_val;
+
+    len = fp_format(buf, PAGE_SIZE, -(int32_t)decode_volume(volume_level), 16, 8);
 
-    strcat2(buf, "\n");
+    buf[len++] = '\n';
 
     //Return the length of the buffer so it will print in the console
-    return strlen(buf);
+    return len;
 }
 static ssize_t dac3_right_volume_write(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
 {
-    uint32_t tempValue = 0;
+    al_ad1939_dev_t *devp = dev_get_drvdata(dev);
+    int32_t value;
+    int ret_val;
     uint8_t volume_level;
-    char cmd[3] = {0x08,0x0B,0x00};
-    char substring[80];
-    int substring_count = 0;
-    int i;
-
-    al_ad1939_dev_t *devp = (al_ad1939_dev_t *)dev_get_drvdata(dev);
-
-    for (i = 0; i < count; i++)
-    {
-        //If its not a space or a comma, add the digit to the substring
-        if ((buf[i] != ',') && (buf[i] != ' ') && (buf[i] != '\0') && (buf[i] != '\r') && (buf[i] != '\n'))
-        {
-            substring[substring_count] = buf[i];
-            substring_count++;
-        }
-    }
 
-    substring[substring_count] = '\0';
+    ret_val = ad1939_wait_ready(devp);
+    if (ret_val)
+        return ret_val;
 
-    // If the first character is a negative sign
-    if (buf[0] == '-')
-    {
-      // Shift all the values "left" to remove it
-      for (i=0;i<79;i++)
-        substring[i] = substring[i+1];
-    }
+    //Convert the buffer to a fixed point value ("-6" and "6" both mean 6 dB of attenuation)
+    ret_val = fp_parse(buf, 16, &value);
+    if (ret_val)
+        return ret_val;
 
-    //Convert the buffer to a fixed point value
-    tempValue = set_fixed_num(substring);
+    volume_level = find_volume_level(abs(value));
 
-    //printk("Entering conversion function\n");
-    volume_level = find_volume_level(tempValue);
-    tempValue = decode_volume(volume_level);
-    
-    //Write the value into the shadow register (and pray it works...)
-    devp->dac3_right_volume = -1*tempValue;
+    // Write the SPI commands to the DAC (nothing is sent if the level doesn't change)
+    ret_val = ad1939_update_bits(devp, AD1939_REG_DAC3R_VOL, 0xFF, volume_level);
+    if (ret_val)
+        return ret_val;
 
-    // Write the SPI commands to the DAC
-    cmd[2] = volume_level;
-    spi_write(spi_device,&cmd, sizeof(cmd));
     return count;
 }
 static ssize_t dac3_right_volume_read(struct device *dev, struct device_attribute *attr, char *buf)
 {
-    al_ad1939_dev_t *devp = (al_ad1939_dev_t *)dev_get_drvdata(dev);
+    al_ad1939_dev_t *devp = dev_get_drvdata(dev);
+    unsigned int volume_level;
+    int ret_val;
+    int len;
 
-    //Copy the name into the output buffer
-    //sprintf(buf, "%d\n", fe_HA_devp->threshold);
-    fp_to_string(buf, devp->dac3_right_volume);
+    ret_val = ad1939_wait_ready(devp);
+    if (ret_val)
+        return ret_val;
+
+    // Served from the register cache
+    ret_val = regmap_read(devp->regmap, AD1939_REG_DAC3R_VOL, &volume_level);
+    if (ret_val)
+        return ret_val;
+
+    len = fp_format(buf, PAGE_SIZE, -(int32_t)decode_volume(volume_level), 16, 8);
 
-    strcat2(buf, "\n");
+    buf[len++] = '\n';
 
     //Return the length of the buffer so it will print in the console
-    return strlen(buf);
+    return len;
 }
 static ssize_t dac4_right_volume_write(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
 {
-    uint32_t tempValue = 0;
+    al_ad1939_dev_t *devp = dev_get_drvdata(dev);
+    int32_t value;
+    int ret_val;
     uint8_t volume_level;
-    char cmd[3] = {0x08,0x0D,0x00};
-    char substring[80];
-    int substring_count = 0;
-    int i;
 
-    al_ad1939_dev_t *devp = (al_ad1939_dev_t *)dev_get_drvdata(dev);
-
-    for (i = 0; i < count; i++)
-    {
-        //If its not a space or a comma, add the digit to the substring
-        if ((buf[i] != ',') && (buf[i] != ' ') && (buf[i] != '\0') && (buf[i] != '\r') && (buf[i] != '\n'))
-        {
-            substring[substring_count] = buf[i];
-            substring_count++;
-        }
-    }
-
-    substring[substring_count] = '\0';
+    ret_val = ad1939_wait_ready(devp);
+    if (ret_val)
+        return ret_val;
 
-    // If the first character is a negative sign
-    if (buf[0] == '-')
-    {
-      // Shift all the values "left" to remove it
-      for (i=0;i<79;i++)
-        substring[i] = substring[i+1];
-    }
+    //Convert the buffer to a fixed point value ("-6" and "6" both mean 6 dB of attenuation)
+    ret_val = fp_parse(buf, 16, &value);
+    if (ret_val)
+        return ret_val;
 
-    //Convert the buffer to a fixed point value
-    tempValue = set_fixed_num(substring);
+    volume_level = find_volume_level(abs(value));
 
-    //printk("Entering conversion function\n");
-    volume_level = find_volume_level(tempValue);
-    tempValue = decode_volume(volume_level);
-    
-    //Write the value into the shadow register (and pray it works...)
-    devp->dac4_right_volume = -1*tempValue;
+    // Write the SPI commands to the DAC (nothing is sent if the level doesn't change)
+    ret_val = ad1939_update_bits(devp, AD1939_REG_DAC4R_VOL, 0xFF, volume_level);
+    if (ret_val)
+        return ret_val;
 
-    // Write the SPI commands to the DAC
-    cmd[2] = volume_level;
-    spi_write(spi_device,&cmd, sizeof(cmd));
     return count;
 }
 static ssize_t dac4_right_volume_read(struct device *dev, struct device_attribute *attr, char *buf)
 {
-    al_ad1939_dev_t *devp = (al_ad1939_dev_t *)dev_get_drvdata(dev);
-
-    //Copy the name into the output buffer
-    //sprintf(buf, "%d\n", fe_HA_devp->threshold);
-    fp_to_string(buf, devp->dac4_right_volume);
-
-    strcat2(buf, "\n");
+    al_ad1939_dev_t *devp = dev_get_drvdata(dev);
+    unsigned int volume_level;
+    int ret_val;
+    int len;
 
-    //Return the length of the buffer so it will print in the console
-    return strlen(buf);
-}
-//---------------------------------------------------------------
+    ret_val = ad1939_wait_ready(devp);
+    if (ret_val)
+        return ret_val;
 
-char *strcat2(char *dst, char *src)
-{
-    char *cp = dst;
+    // Served from the register cache
+    ret_val = regmap_read(devp->regmap, AD1939_REG_DAC4R_VOL, &volume_level);
+    if (ret_val)
+        return ret_val;
 
-    while (*cp)
-        cp++; /* find end of dst */
+    len = fp_format(buf, PAGE_SIZE, -(int32_t)decode_volume(volume_level), 16, 8);
 
-    while (( *cp++ = *src++ ) != 0); /* Copy src to end of dst */
+    buf[len++] = '\n';
 
-    return dst; /* return dst */
+    //Return the length of the buffer so it will print in the console
+    return len;
 }
 
-/** Convert a string to a fixed point number structure
-    @param s String containing the string to convert to 32F16 representation
-    @return SUCCESS
+/** Set all eight DAC volumes at once
 
-    @todo This function is really ugly and could be cleaned up to make it clear what is happening....
+    Takes eight attenuations in dB, separated by spaces or commas, in register order:
+    DAC1L DAC1R DAC2L DAC2R DAC3L DAC3R DAC4L DAC4R. As for the single channel attributes
+    the sign is ignored. The volumes that change go out in one SPI message.
 */
-uint32_t set_fixed_num(const char *s)
+static ssize_t dac_volumes_write(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
 {
-    struct fixed_num num = {0, 0, 0};
-    int seen_point = 0;
-    int pointIndex;
-    int i;
-    int ii;
-    int frac_comp;
-    uint32_t acc = 0;
-    char s2[80];
-    int pointsSeen = 0;
-    int charIndex = 0;
-
-    //If no leading 0, add one (eg: .25 -> 0.25)
-    if (s[0] == '.')
-    {
-        s2[0] = '0';
-        charIndex++;
-    }
-
-    //This is a strcpy() to move the data a "const char *" to a "char *" and validate the data
-    for (i = 0; i < strlen(s); i++)
-    {
-        //Make sure the string contains an non-valid char (eg: not a number or a decimal point)
-        if ((s[i] == '.') || (s[i] >= '0' && s[i] <= '9'))
-        {
-            //Copy the data over and increment the pointer
-            s2[charIndex] = s[i];
-            charIndex++;
-        }
-        else
-        {
-            pr_info("Invalid char (c:%c x:%X) in number %s\n", s[i], s[i], s);
-            return 0x00000000;
-        }
-
-        //Count the number of decimals in the string
-        if (s[i] == '.')
-            pointsSeen++;
-    }
-
-    //If multiple decimals points in the number (eg: 1.1.4)
-    if (pointsSeen > 1)
-        pr_info("Invalid number format: %s\n", s);
-
-    //Turn 1 into 1.0
-    //if (pointsSeen == 0)
-    // {
-    //    printk("Adding the decimal...\n");
-    //    s2[i] = char(".");
-    //    s2[i+1] = char("0");
-    //    //strcat2(".0",s2);
-    //    i=i+2;
-    // }
-    //Make sure the string is terminated
-    s2[i] = '\0';
-
-    //Count the fractional digits
-    for (pointIndex = 0; pointIndex < strlen(s2); pointIndex++)
-    {
-        if (s2[pointIndex] == '.')
-            break;
-    }
+    al_ad1939_dev_t *devp = dev_get_drvdata(dev);
+    uint8_t code[AD1939_NUM_DACS];
+    char *str, *cur, *tok;
+    int32_t value;
+    int ret_val = 0;
+    int n = 0;
 
-    //String extend so that the output is accurate
-    while (strlen(s2) - pointIndex < 9)
-        strcat2(s2, "0");
+    ret_val = ad1939_wait_ready(devp);
+    if (ret_val)
+        return ret_val;
 
-    //Truncate the string if its longer
-    s2[strlen(s2) - pointIndex + 9] = '\0';
+    str = kstrndup(buf, count, GFP_KERNEL);
+    if (!str)
+        return -ENOMEM;
 
-    //Covert to fixed point
-    for (i = 0; i < 10; i++)
+    cur = str;
+    while ((tok = strsep(&cur, " ,\n")) != NULL && !ret_val)
     {
-        if (s2[i] == '.')
-        {
-            seen_point = 1;
+        // Skip the empty tokens between repeated separators
+        if (*tok == '\0')
             continue;
-        }
-        if (!seen_point)
-        {
-            num.integer *= 10;
-            num.integer += (int)(s2[i] - '0');
-        }
-        else
-        {
-            num.fraction_len++;
-            num.fraction *= 10;
-            num.fraction += (int)(s2[i] - '0');
-        }
-    }
 
-    //Turn the fixed point conversion into binary digits
-    for (ii = 0, frac_comp = 1; ii < num.fraction_len; ii++) frac_comp *= 10;
-    frac_comp /= 2;
-
-    // Get the fractional part (f28 hopefully)
-    for (ii = 0; i <= 36; i++)
-    {
-        if (num.fraction >= frac_comp)
-        {
-            acc |= 0x00000001;
-            num.fraction -= frac_comp;
-        }
-        frac_comp /= 2;
+        if (n == AD1939_NUM_DACS)
+            ret_val = -EINVAL;
+        else
+            ret_val = fp_parse(tok, 16, &value);
 
-        acc = acc << 1;
+        if (!ret_val)
+            code[n++] = find_volume_level(abs(value));
     }
+    kfree(str);
 
-    acc = acc >> 12;
-
-    //Combine the fractional part with the integer
-    acc += num.integer << 16;
+    if (!ret_val && n != AD1939_NUM_DACS)
+        ret_val = -EINVAL;
+    if (!ret_val)
+        ret_val = ad1939_set_volumes(devp, code);
+    if (ret_val)
+        return ret_val;
 
-    return acc;
+    return count;
 }
-
-/** Function to convert a fp16 to a string representation
-    @todo doesn't handle negative numbers
-*/
-int fp_to_string(char *buf, uint32_t fp28_num)
+/** Return all eight DAC volumes in dB, in the order dac_volumes_write() takes them */
+static ssize_t dac_volumes_read(struct device *dev, struct device_attribute *attr, char *buf)
 {
-    int buf_pos = 0;
+    al_ad1939_dev_t *devp = dev_get_drvdata(dev);
+    uint8_t code[AD1939_NUM_DACS];
+    int ret_val;
+    int len = 0;
     int i;
-    int fractionPart;
-    //int isNegative = 0;
-    int intPart = 1;
-    int i16 = 0;
 
-    if (fp28_num & 0x80000000)
-    {
-        fp28_num *= -1;
+    ret_val = ad1939_wait_ready(devp);
+    if (ret_val)
+        return ret_val;
 
-        buf[buf_pos] = '-';
-        buf_pos++;
-    }
+    // Served from the register cache
+    ret_val = ad1939_get_volumes(devp, code);
+    if (ret_val)
+        return ret_val;
 
-    //Convert the integer part
-    i16 = (fp28_num >> 16);
-    while ( (i16 / intPart) > 9)
+    // 3 decimals show every 3/8 dB step exactly
+    for (i = 0; i < AD1939_NUM_DACS; i++)
     {
-        intPart *= 10;
+        len += fp_format(buf + len, PAGE_SIZE - len, -(int32_t)decode_volume(code[i]), 16, 3);
+        buf[len++] = (i == AD1939_NUM_DACS - 1) ? '\n' : ' ';
     }
 
-    while (intPart > 0)
-    {
-        buf[buf_pos] = (char)((i16 / intPart) + '0');
-        buf_pos++;
-
-        i16 = i16 % intPart;
-        intPart = intPart / 10;
-    }
+    return len;
+}
+/** Ramp one DAC channel to a new volume
 
-    //buf[buf_pos] = (char)((fp28_num>>16) + '0');
-    //buf_pos++;
+    Takes "<channel> <dB> <ms>", e.g. "dac2_left -40 500" fades DAC2L to -40 dB over half a second.
+    As for the volume attributes the sign of the level is ignored. Ramps on different channels run
+    at the same time and share SPI messages; writing a channel's volume in any other way stops its ramp.
+*/
+static ssize_t dac_ramp_write(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+    al_ad1939_dev_t *devp = dev_get_drvdata(dev);
+    char name[16], level[FP_STR_MAX];
+    unsigned int ms;
+    int32_t value;
+    int ret_val;
+    int chan;
+
+    ret_val = ad1939_wait_ready(devp);
+    if (ret_val)
+        return ret_val;
 
-    buf[buf_pos] = '.';
-    buf_pos++;
+    if (sscanf(buf, "%15s %23s %u", name, level, &ms) != 3)
+        return -EINVAL;
+    if (ms > AD1939_RAMP_MAX_MS)
+        return -ERANGE;
 
-    //Mask the integer bits and dump 1 bit to make the conversion easier....
-    fractionPart = (0x0000FFFF & fp28_num) >> 1; // 32F27 so that 0-9 can fit in the high 5 bits)
+    chan = match_string(ad1939_dac_names, AD1939_NUM_DACS, name);
+    if (chan < 0)
+        return chan;
 
-    for (i = 0; i < 8; i++)
-    {
-        fractionPart *= 10;
-        buf[buf_pos] = (fractionPart >> 15) + '0';
-        buf_pos++;
-        fractionPart &= 0x00007FFF;
-    }
+    ret_val = fp_parse(level, 16, &value);
+    if (ret_val)
+        return ret_val;
 
-    buf[buf_pos] = '\0';
+    ret_val = ad1939_ramp_start(devp, chan, find_volume_level(abs(value)), ms);
+    if (ret_val)
+        return ret_val;
 
-    return 0;
+    return count;
 }
+/** List the running ramps, one "<channel> <target dB> <ms left>" line each
 
-/** Converts a 32 bit integer into an 8 bit volume level
-    @param fp28_num 32 bit representation of a fixed point number
-    @return volume_level an 8 bit representation of the attenuation
-*/
-uint8_t find_volume_level(uint32_t fp28_num)
-{
-  // Initialize the volume level
-  uint8_t volume_level = 0;
-
-  // Divide the input number by the reciprocal of the step size
-  uint32_t inputnum = fp28_num*10*8/3;
-  
-  // Find the integer portion and the tenths portion
-  // (Steps are in 3/8 increments so only that position is needed)
-  uint16_t upperval = (uint16_t)((inputnum)>>=16)/10;
-  uint16_t lowerval = inputnum-upperval*10;
-
-  // Catch whether the user exceeded the maximum attenuation
-  if (upperval > 255)
-  {
-    upperval = 255;
-    lowerval = 0;
-    printk("Input exceeds the maximum codec attenuation of -95.625 dB.\n");
-    printk("Setting attenuation to -95.625 dB.\n");
-  }
-
-  // Set the volume level to the integer portion
-  volume_level = (uint8_t)(upperval);
-  
-  // If the tenths portion is greater than five, round up
-  if (lowerval > 5)
-    volume_level += 1;
-
-  return volume_level;
-}
-
-/** Converts an 8 bit volume level representation to a 32 bit fixed point 28 number
-    @param volume_level an 8 bit representation of the attenuation
-    @return fp28_num 32 bit representation of a fixed point number
+    A ramp stopped by a failed register write is listed with "failed" instead of the time left,
+    until the channel's volume is set again.
 */
-uint32_t decode_volume(uint8_t volume_level)
+static ssize_t dac_ramp_read(struct device *dev, struct device_attribute *attr, char *buf)
 {
-  // Cast the volume level to a 32 bit number
-  uint32_t decodedDb = (uint32_t)volume_level;
+    al_ad1939_dev_t *devp = dev_get_drvdata(dev);
+    struct ad1939_ramp *r;
+    ktime_t now = ktime_get();
+    s64 left;
+    int len = 0;
+    int i;
+
+    mutex_lock(&devp->lock);
+    for (i = 0; i < AD1939_NUM_DACS; i++)
+    {
+        r = &devp->ramp[i];
+        if (!r->active && !r->failed)
+            continue;
+
+        len += scnprintf(buf + len, PAGE_SIZE - len, "%s ", ad1939_dac_names[i]);
+        len += fp_format(buf + len, PAGE_SIZE - len, -(int32_t)decode_volume(r->to), 16, 3);
+        if (r->failed)
+        {
+            len += scnprintf(buf + len, PAGE_SIZE - len, " failed\n");
+            continue;
+        }
+        left = max_t(s64, r->ms - ktime_ms_delta(now, r->start), 0);
+        len += scnprintf(buf + len, PAGE_SIZE - len, " %lld\n", left);
+    }
+    mutex_unlock(&devp->lock);
 
-  // Return the shifted and scaled number to keep with convention
-  return (decodedDb<<=16)*3/8;
+    return len;
 }
+//---------------------------------------------------------------
 
 /** Tell the kernel what the initialization function is */
 module_init(ad1939_init);
@@ -0,0 +1,69 @@
+/** @file
+
+    Clock model of the AD1939: the MCLKI/XI field of PLL and clock control 0 and the rate fields
+    of DAC and ADC control 0. Shared by the driver and its KUnit test.
+*/
+
+#ifndef AD1939_CLOCK_H
+#define AD1939_CLOCK_H
+
+#include <linux/kernel.h>
+#include <linux/errno.h>
+
+/** MCLKI/XI to base rate ratio of every value of the PLL control 0 MCLKI/XI field */
+static const unsigned int ad1939_mclk_ratios[] = {256, 384, 512, 768};
+
+/** Clock model: work out the PLL and rate settings for a sample rate
+
+    The PLL runs from MCLKI/XI, which has to be 256, 384, 512 or 768 times the base rate of the
+    sample rate's family (32, 44.1 or 48 kHz). The DACs and ADCs then run at 1x, 2x or 4x the base
+    rate. A 12.288 MHz MCLK gives the 48 kHz family (and the 32 kHz one at 384x), 11.2896 MHz the
+    44.1 kHz family.
+
+    @param mclk MCLK rate in Hz
+    @param rate Sample rate in Hz
+    @param mclki Set to the MCLKI/XI field of PLL control 0 (0 = 256 ... 3 = 768)
+    @param fs_sel Set to the sample rate field of DAC and ADC control 0 (0 = 1x, 1 = 2x, 2 = 4x)
+    @returns 0 on success, or -EINVAL when mclk can't clock that rate
+*/
+static inline int ad1939_clock_config(unsigned int mclk, unsigned int rate, unsigned int *mclki, unsigned int *fs_sel)
+{
+    unsigned int base;
+    int i, j;
+
+    for (j = 0; j < 3; j++)
+    {
+        if (rate & ((1 << j) - 1))
+            break;
+
+        base = rate >> j;
+        if (base != 32000 && base != 44100 && base != 48000)
+            continue;
+
+        for (i = 0; i < ARRAY_SIZE(ad1939_mclk_ratios); i++)
+        {
+            if (mclk == ad1939_mclk_ratios[i] * base)
+            {
+                *mclki = i;
+                *fs_sel = j;
+                return 0;
+            }
+        }
+    }
+
+    return -EINVAL;
+}
+
+/** Sample rate of a clock setting; the inverse of ad1939_clock_config()
+
+    @param mclk MCLK rate in Hz
+    @param mclki MCLKI/XI field of PLL control 0 (0 = 256 ... 3 = 768)
+    @param fs_sel Sample rate field of DAC control 0; 3 is reserved and reads as 4x like the codec does
+    @returns The sample rate in Hz
+*/
+static inline unsigned int ad1939_clock_rate(unsigned int mclk, unsigned int mclki, unsigned int fs_sel)
+{
+    return (mclk / ad1939_mclk_ratios[mclki & 3]) << min(fs_sel, 2U);
+}
+
+#endif // AD1939_CLOCK_H
@@ -0,0 +1,41 @@
+/** @file
+
+    read()/write() and ioctl interface of the ad1939 char device. Shared
+    between the driver and user-space programs.
+*/
+#ifndef AD1939_IOCTL_H
+#define AD1939_IOCTL_H
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+/** Size of a register profile, as read from and written to the char device
+
+    Byte n is the value of register n, from 0x00 (PLL control 0) to 0x10
+    (ADC control 2). A write() must carry exactly one whole profile.
+*/
+#define AD1939_PROFILE_SIZE 17
+
+/** Number of DAC channels */
+#define AD1939_NUM_DACS 8
+
+/** All eight DAC volumes at once
+
+    code[] is in register order: DAC1L, DAC1R, DAC2L, DAC2R, DAC3L, DAC3R,
+    DAC4L, DAC4R. Each entry is the raw attenuation code of the codec:
+    0 = 0 dB, 255 = -95.625 dB, in 3/8 dB steps.
+*/
+struct ad1939_volumes
+{
+    __u8 code[AD1939_NUM_DACS];
+};
+
+#define AD1939_IOC_MAGIC 0xAD
+
+/** Set all eight volumes; the changed ones go out in one SPI message */
+#define AD1939_IOC_SET_VOLUMES _IOW(AD1939_IOC_MAGIC, 1, struct ad1939_volumes)
+
+/** Read all eight volumes (from the register cache) */
+#define AD1939_IOC_GET_VOLUMES _IOR(AD1939_IOC_MAGIC, 2, struct ad1939_volumes)
+
+#endif /* AD1939_IOCTL_H */
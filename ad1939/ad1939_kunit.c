@@ -0,0 +1,200 @@
+/** @file
+
+    KUnit test of the AD1939 volume conversion and ramp arithmetic in ad1939_volume.h and the
+    clock model in ad1939_clock.h.
+
+    Built as its own module when the kernel has CONFIG_KUNIT; see Kbuild.
+*/
+
+#include <kunit/test.h>
+#include <linux/module.h>
+#include "ad1939_volume.h"
+#include "ad1939_clock.h"
+
+// One 3/8 dB step in Q16.16
+#define AD1939_VOL_STEP ((3 << 16) / 8)
+
+/** Every code decodes to its exact attenuation and converts back to itself */
+static void ad1939_volume_round_trip(struct kunit *test)
+{
+    int code;
+
+    for (code = 0; code <= 255; code++)
+    {
+        KUNIT_EXPECT_EQ(test, decode_volume(code), (uint32_t)code * AD1939_VOL_STEP);
+        KUNIT_EXPECT_EQ(test, (int)find_volume_level(decode_volume(code)), code);
+    }
+}
+
+/** Attenuations between two levels go to the nearest one, halves to the quieter */
+static void ad1939_volume_rounding(struct kunit *test)
+{
+    uint32_t half = AD1939_VOL_STEP / 2;
+    int code;
+
+    for (code = 0; code < 255; code++)
+    {
+        KUNIT_EXPECT_EQ(test, (int)find_volume_level(decode_volume(code) + half - 1), code);
+        KUNIT_EXPECT_EQ(test, (int)find_volume_level(decode_volume(code) + half), code + 1);
+    }
+}
+
+/** Attenuations past -95.625 dB clamp to code 255, even where the arithmetic is widest */
+static void ad1939_volume_clamp(struct kunit *test)
+{
+    KUNIT_EXPECT_EQ(test, (int)find_volume_level(0), 0);
+    KUNIT_EXPECT_EQ(test, (int)find_volume_level(decode_volume(255) + AD1939_VOL_STEP), 255);
+    KUNIT_EXPECT_EQ(test, (int)find_volume_level(100 << 16), 255);
+    KUNIT_EXPECT_EQ(test, (int)find_volume_level(U32_MAX), 255);
+}
+
+/** Every MCLK of 256, 384, 512 or 768 times a base rate clocks 1x, 2x and 4x of that base */
+static void ad1939_clock_matrix(struct kunit *test)
+{
+    static const unsigned int bases[] = {32000, 44100, 48000};
+    unsigned int mclk, rate, mclki, fs_sel;
+    int i, b, j;
+
+    for (i = 0; i < ARRAY_SIZE(ad1939_mclk_ratios); i++)
+    {
+        for (b = 0; b < ARRAY_SIZE(bases); b++)
+        {
+            mclk = ad1939_mclk_ratios[i] * bases[b];
+            for (j = 0; j < 3; j++)
+            {
+                rate = bases[b] << j;
+                mclki = fs_sel = ~0U;
+                KUNIT_EXPECT_EQ_MSG(test, ad1939_clock_config(mclk, rate, &mclki, &fs_sel), 0, "%u Hz from %u Hz", rate, mclk);
+                KUNIT_EXPECT_EQ(test, mclki, (unsigned int)i);
+                KUNIT_EXPECT_EQ(test, fs_sel, (unsigned int)j);
+                KUNIT_EXPECT_EQ(test, ad1939_clock_rate(mclk, mclki, fs_sel), rate);
+            }
+        }
+    }
+}
+
+/** Rates outside the MCLK's families, and MCLKs that are no valid multiple, are refused */
+static void ad1939_clock_rejects(struct kunit *test)
+{
+    static const struct
+    {
+        unsigned int mclk;
+        unsigned int rate;
+    } bad[] =
+    {
+        {12288000, 44100},      // 44.1 kHz family from a 48 kHz MCLK
+        {11289600, 48000},
+        {12288000, 24000},      // 0.5x
+        {12288000, 384000},     // 8x
+        {12288000, 96001},
+        {12288000, 0},
+        {12000000, 48000},      // Not a multiple of any base rate
+        {0, 48000},
+    };
+    unsigned int mclki, fs_sel;
+    int i;
+
+    for (i = 0; i < ARRAY_SIZE(bad); i++)
+        KUNIT_EXPECT_EQ_MSG(test, ad1939_clock_config(bad[i].mclk, bad[i].rate, &mclki, &fs_sel), -EINVAL,
+                            "%u Hz from %u Hz", bad[i].rate, bad[i].mclk);
+}
+
+/** An MCLK in two families clocks both: 12.288 MHz is 256 x 48 kHz and 384 x 32 kHz, 24.576 MHz 512 x 48 kHz and 768 x 32 kHz */
+static void ad1939_clock_two_families(struct kunit *test)
+{
+    unsigned int mclki, fs_sel;
+
+    KUNIT_EXPECT_EQ(test, ad1939_clock_config(12288000, 32000, &mclki, &fs_sel), 0);
+    KUNIT_EXPECT_EQ(test, mclki, 1U);
+    KUNIT_EXPECT_EQ(test, fs_sel, 0U);
+
+    KUNIT_EXPECT_EQ(test, ad1939_clock_config(24576000, 192000, &mclki, &fs_sel), 0);
+    KUNIT_EXPECT_EQ(test, mclki, 2U);
+    KUNIT_EXPECT_EQ(test, fs_sel, 2U);
+    KUNIT_EXPECT_EQ(test, ad1939_clock_config(24576000, 64000, &mclki, &fs_sel), 0);
+    KUNIT_EXPECT_EQ(test, mclki, 3U);
+    KUNIT_EXPECT_EQ(test, fs_sel, 1U);
+}
+
+/** The reserved rate field value 3 reads as 4x, like the codec runs it */
+static void ad1939_clock_reserved_fs(struct kunit *test)
+{
+    KUNIT_EXPECT_EQ(test, ad1939_clock_rate(12288000, 0, 3), 192000U);
+    KUNIT_EXPECT_EQ(test, ad1939_clock_rate(11289600, 0, 3), 176400U);
+}
+
+/** A ramp starts at its first code, ends exactly at the target, and a 0 ms ramp jumps there */
+static void ad1939_ramp_ends(struct kunit *test)
+{
+    KUNIT_EXPECT_EQ(test, (int)ad1939_ramp_code(0, 255, 0, 1000), 0);
+    KUNIT_EXPECT_EQ(test, (int)ad1939_ramp_code(0, 255, 1000, 1000), 255);
+    KUNIT_EXPECT_EQ(test, (int)ad1939_ramp_code(255, 0, 0, 1000), 255);
+    KUNIT_EXPECT_EQ(test, (int)ad1939_ramp_code(255, 0, 1000, 1000), 0);
+    KUNIT_EXPECT_EQ(test, (int)ad1939_ramp_code(40, 200, 0, 0), 200);
+    KUNIT_EXPECT_EQ(test, (int)ad1939_ramp_code(40, 40, 500, 1000), 40);
+}
+
+/** Codes move linearly with time and drop partial steps, up or down */
+static void ad1939_ramp_linear(struct kunit *test)
+{
+    KUNIT_EXPECT_EQ(test, (int)ad1939_ramp_code(0, 100, 500, 1000), 50);
+    KUNIT_EXPECT_EQ(test, (int)ad1939_ramp_code(100, 0, 500, 1000), 50);
+    KUNIT_EXPECT_EQ(test, (int)ad1939_ramp_code(0, 100, 9, 1000), 0);
+    KUNIT_EXPECT_EQ(test, (int)ad1939_ramp_code(0, 100, 10, 1000), 1);
+    KUNIT_EXPECT_EQ(test, (int)ad1939_ramp_code(100, 0, 9, 1000), 100);
+    KUNIT_EXPECT_EQ(test, (int)ad1939_ramp_code(100, 0, 10, 1000), 99);
+    KUNIT_EXPECT_EQ(test, (int)ad1939_ramp_code(0, 100, 999, 1000), 99);
+    KUNIT_EXPECT_EQ(test, (int)ad1939_ramp_code(100, 0, 999, 1000), 1);
+}
+
+/** A late tick catches up: the code depends only on the time since the start */
+static void ad1939_ramp_late_tick(struct kunit *test)
+{
+    KUNIT_EXPECT_EQ(test, (int)ad1939_ramp_code(0, 200, 750, 1000), 150);
+    KUNIT_EXPECT_EQ(test, (int)ad1939_ramp_code(0, 200, 5000, 1000), 200);
+}
+
+/** Every millisecond of the longest ramp over the full range moves monotonically, one code at most */
+static void ad1939_ramp_monotonic(struct kunit *test)
+{
+    int prev = 0, code;
+    s64 t;
+
+    for (t = 0; t <= AD1939_RAMP_MAX_MS; t++)
+    {
+        code = ad1939_ramp_code(0, 255, t, AD1939_RAMP_MAX_MS);
+        if (code < prev || code > prev + 1)
+        {
+            KUNIT_FAIL(test, "code %d after %d at %lld ms", code, prev, t);
+            return;
+        }
+        prev = code;
+    }
+    KUNIT_EXPECT_EQ(test, prev, 255);
+}
+
+static struct kunit_case ad1939_volume_cases[] =
+{
+    KUNIT_CASE(ad1939_volume_round_trip),
+    KUNIT_CASE(ad1939_volume_rounding),
+    KUNIT_CASE(ad1939_volume_clamp),
+    KUNIT_CASE(ad1939_clock_matrix),
+    KUNIT_CASE(ad1939_clock_rejects),
+    KUNIT_CASE(ad1939_clock_two_families),
+    KUNIT_CASE(ad1939_clock_reserved_fs),
+    KUNIT_CASE(ad1939_ramp_ends),
+    KUNIT_CASE(ad1939_ramp_linear),
+    KUNIT_CASE(ad1939_ramp_late_tick),
+    KUNIT_CASE(ad1939_ramp_monotonic),
+    {}
+};
+
+static struct kunit_suite ad1939_volume_suite =
+{
+    .name = "ad1939_volume",
+    .test_cases = ad1939_volume_cases,
+};
+kunit_test_suite(ad1939_volume_suite);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("KUnit test of the ad1939 volume conversion, ramps and clock model");
@@ -0,0 +1,53 @@
+/** @file
+
+    Tracepoints for the SPI traffic of the ad1939 driver
+
+    ad1939_spi_write fires for every command frame sent to the codec once the
+    spi_message carrying it has completed. ns is the time that whole message
+    took from commit to completion (queueing and bus lock wait included).
+    dev is the codec's SPI device, e.g. spi0.1:
+
+        echo 1 > /sys/kernel/tracing/events/ad1939/enable
+*/
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM ad1939
+
+#if !defined(AD1939_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define AD1939_TRACE_H
+
+#include <linux/tracepoint.h>
+
+TRACE_EVENT(ad1939_spi_write,
+
+    TP_PROTO(const char *dev, u8 reg, u8 val, int ret, u64 ns),
+
+    TP_ARGS(dev, reg, val, ret, ns),
+
+    TP_STRUCT__entry(
+        __string(dev, dev)
+        __field(u8, reg)
+        __field(u8, val)
+        __field(int, ret)
+        __field(u64, ns)
+    ),
+
+    TP_fast_assign(
+        __assign_str(dev, dev);
+        __entry->reg = reg;
+        __entry->val = val;
+        __entry->ret = ret;
+        __entry->ns = ns;
+    ),
+
+    TP_printk("%s reg=0x%02x val=0x%02x ret=%d ns=%llu",
+              __get_str(dev), __entry->reg, __entry->val, __entry->ret, __entry->ns)
+);
+
+#endif /* AD1939_TRACE_H */
+
+/* This part must be outside protection */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE ad1939_trace
+#include <trace/define_trace.h>
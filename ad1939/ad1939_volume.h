@@ -0,0 +1,72 @@
+/** @file
+
+    Volume conversion of the AD1939 DACs (datasheet table 20, DAC volume control).
+
+    The 256 attenuation levels are evenly spaced 3/8 dB apart from 0 dB (code 0) to
+    -95.625 dB (code 255), so the conversion is arithmetic rather than a table. The volume
+    ramps step through the same codes. Shared by the driver and its KUnit test.
+*/
+
+#ifndef AD1939_VOLUME_H
+#define AD1939_VOLUME_H
+
+#include <linux/types.h>
+#include <linux/printk.h>
+#include <linux/math64.h>
+
+// Longest ramp accepted, in ms
+#define AD1939_RAMP_MAX_MS      600000
+
+/** Converts an attenuation into an 8 bit volume level
+
+    The levels are evenly spaced, so this is arithmetic rather than a table: the nearest
+    3/8 dB step, rounding halves up.
+
+    @param fp16_num Attenuation in dB, Q16.16
+    @return volume_level an 8 bit representation of the attenuation
+*/
+static inline uint8_t find_volume_level(uint32_t fp16_num)
+{
+  // Divide the input number by the step size, rounding to the nearest step
+  uint64_t steps = div_u64((uint64_t)fp16_num * 8 + (3 << 15), 3 << 16);
+
+  // Catch whether the user exceeded the maximum attenuation
+  if (steps > 255)
+  {
+    printk("Input exceeds the maximum codec attenuation of -95.625 dB.\n");
+    printk("Setting attenuation to -95.625 dB.\n");
+    steps = 255;
+  }
+
+  return (uint8_t)steps;
+}
+
+/** Converts an 8 bit volume level representation to a Q16.16 attenuation in dB
+    @param volume_level an 8 bit representation of the attenuation
+    @return fp16_num the attenuation, exact since 3/8 dB is 24576 in Q16.16
+*/
+static inline uint32_t decode_volume(uint8_t volume_level)
+{
+  return (uint32_t)volume_level * ((3 << 16) / 8);
+}
+
+/** Code a volume ramp is at after some time
+
+    Linear in time from the start, so a late tick catches up instead of stretching the ramp.
+    Partial steps are dropped, so the code only reaches the target once the time is up.
+
+    @param from Code when the ramp started
+    @param to Target code
+    @param elapsed Time since the ramp started, in ms
+    @param ms Duration of the ramp
+    @return The code to send
+*/
+static inline uint8_t ad1939_ramp_code(uint8_t from, uint8_t to, s64 elapsed, unsigned int ms)
+{
+  if (elapsed >= ms)
+    return to;
+
+  return from + div_s64(((int)to - (int)from) * elapsed, ms);
+}
+
+#endif // AD1939_VOLUME_H
@@ -14,449 +14,265 @@
 #include <linux/platform_device.h>
 #include <linux/mod_devicetable.h>
 #include <linux/types.h>
-#include <linux/io.h>
-#include <linux/mutex.h>
-#include <linux/miscdevice.h>
-#include <linux/fs.h>
 #include <linux/kernel.h>
-#include <linux/uaccess.h>
-/*#include "fp_conversions.h"*/
+#include <linux/math64.h>
+#include <linux/notifier.h>
+#include "avalon_regmap.h"
+#include "fp_conversions.h"
 
 /*-----------------------------------------------------------------------*/
 /* DEFINE STATEMENTS                                                     */
 /*-----------------------------------------------------------------------*/
 /* Define the Component Register Offsets*/
 #define REG0_delayM_OFFSET 0x0
-/* #define REG1 (Add offset for b0) */
 #define REG1_b0_OFFSET 0x04
-
 #define REG2_bM_OFFSET 0x08
-/* #define REG3 (Add offset for wetDryMix) */
 #define REG3_wetDryMix_OFFSET 0x0C
 
 /* Memory span of all registers (used or not) in the                     */
 /* component CombFilter                                            */
 #define SPAN 0x10
 
-
 /*-----------------------------------------------------------------------*/
-/* CombFilter device structure                                     */
+/* CombFilter register map                                              */
 /*-----------------------------------------------------------------------*/
 /*
- * struct  CombFilter_dev - Private CombFilter device struct.
- * @miscdev: miscdevice used to create a char device
- *           for the CombFilter component
- * @base_addr: Base address of the CombFilter component
- * @lock: mutex used to prevent concurrent writes
- *        to the CombFilter component
- *
- * An CombFilter_dev struct gets created for each CombFilter
- * component in the system.
+ * Each entry becomes a sysfs attribute of the same name and a word of
+ * the /dev/CombFilter register window; see avalon_regmap.h.
  */
-struct CombFilter_dev {
-	struct miscdevice miscdev;
-	void __iomem *base_addr;
-	struct mutex lock;
+static const struct avalon_reg CombFilter_regs[] = {
+	AVALON_REG(delayM, REG0_delayM_OFFSET, 16, AVALON_REG_RW, AVALON_PARSE_U16),
+	AVALON_REG(b0, REG1_b0_OFFSET, 16, AVALON_REG_RW, AVALON_PARSE_U16),
+	AVALON_REG(bM, REG2_bM_OFFSET, 16, AVALON_REG_RW, AVALON_PARSE_U16),
+	AVALON_REG(wetDryMix, REG3_wetDryMix_OFFSET, 16, AVALON_REG_RW, AVALON_PARSE_U16),
 };
 
 /*-----------------------------------------------------------------------*/
-/* REG0: delayM register read function show()                   */
+/* Comb delay in ms                                                      */
 /*-----------------------------------------------------------------------*/
 /*
- * delayM_show() - Return the delayM value
- *                          to user-space via sysfs.
- * @dev: Device structure for the CombFilter component. This
- *       device struct is embedded in the CombFilter' device struct.
- * @attr: Unused.
- * @buf: Buffer that gets returned to user-space.
+ * struct CombFilter_priv - Sample rate independent state of a CombFilter
+ * @adev: The Avalon device.
+ * @rate_nb: Subscription to the core's sample rate notifier.
+ * @rate: Sample rate in Hz that delayM is scaled for.
+ * @delay_ms: The comb delay in ms, Q16.16; delayM is derived from it.
+ * @delayM: The delayM last derived from @delay_ms. When the register no
+ *          longer holds it, delayM was written directly (sysfs or the
+ *          char device) and @delay_ms is re-derived from the register.
  *
- * Return: The number of bytes read.
+ * Everything but @adev and @rate_nb is protected by adev->lock.
  */
-static ssize_t delayM_show(struct device *dev,
-	struct device_attribute *attr, char *buf)
-{
-	u16 delayM;
-
-	// Get the private CombFilter data out of the dev struct
-	struct CombFilter_dev *priv = dev_get_drvdata(dev);
-
-	delayM = ioread32(priv->base_addr + REG0_delayM_OFFSET);
+struct CombFilter_priv {
+	struct avalon_dev *adev;
+	struct notifier_block rate_nb;
+	unsigned int rate;
+	s32 delay_ms;
+	u32 delayM;
+};
 
-	return scnprintf(buf, PAGE_SIZE, "%u\n", delayM);
-}
-/*-----------------------------------------------------------------------*/
-/* REG0: delayM register write function store()                 */
-/*-----------------------------------------------------------------------*/
-/**
- * delayM_store() - Store the delayM value.
- * @dev: Device structure for the CombFilter component. This
- *       device struct is embedded in the CombFilter'
- *       platform device struct.
- * @attr: Unused.
- * @buf: Buffer that contains the delayM value being written.
- * @size: The number of bytes being written.
+/*
+ * CombFilter_sync_delay() - Pick up a delayM written behind our back
+ * @priv: The CombFilter.
  *
- * Return: The number of bytes stored.
+ * The caller must hold adev->lock.
+ *
+ * Return: 0 on success, or a negative error value.
  */
-static ssize_t delayM_store(struct device *dev,
-	struct device_attribute *attr, const char *buf, size_t size)
+static int CombFilter_sync_delay(struct CombFilter_priv *priv)
 {
-	u16 delayM;
+	unsigned int val;
 	int ret;
-	struct CombFilter_dev *priv = dev_get_drvdata(dev);
 
-	// Parse the string we received as a bool
-	// See https://elixir.bootlin.com/linux/latest/source/lib/kstrtox.c#L289
-	ret = kstrtou16(buf, 0, &delayM);
+	ret = regmap_read(priv->adev->regmap, REG0_delayM_OFFSET, &val);
 	if (ret < 0) {
-		// kstrtobool returned an error
 		return ret;
 	}
 
-	iowrite32(delayM, priv->base_addr + REG0_delayM_OFFSET);
+	val &= GENMASK(15, 0);
+	if (val != priv->delayM) {
+		priv->delayM = val;
+		priv->delay_ms = div_u64(((u64)val * 1000 << 16) + priv->rate / 2,
+		                         priv->rate);
+	}
 
-	// Write was succesful, so we return the number of bytes we wrote.
-	return size;
+	return 0;
 }
 
-
-/*-----------------------------------------------------------------------*/
-/* TODO: Add show() and store() functions for                            */
-/* Registers REG1 (b0) and REG2 (wetDryMix)                    */
-/* in component CombFilter                                         */
-/*-----------------------------------------------------------------------*/
-/* Add here...                                                           */
-/*-----------------------------------------------------------------------*/
-/* REG1: b0 register read function show()                      */
-/*-----------------------------------------------------------------------*/
-static ssize_t b0_show(struct device *dev,
-        struct device_attribute *attr, char *buf)
+/*
+ * CombFilter_set_delay() - Set the comb delay in ms
+ * @priv: The CombFilter.
+ * @delay_ms: The delay in ms, Q16.16; must not be negative.
+ *
+ * Writes delayM for the current sample rate. The caller must hold
+ * adev->lock.
+ *
+ * Return: 0 on success, -ERANGE if the delay doesn't fit delayM at this
+ * rate, or another negative error value.
+ */
+static int CombFilter_set_delay(struct CombFilter_priv *priv, s32 delay_ms)
 {
-        u16 b0;
-        struct CombFilter_dev *priv = dev_get_drvdata(dev);
-
-        b0 = ioread32(priv->base_addr + REG1_b0_OFFSET);
+	u64 samples;
+	int ret;
 
-        return scnprintf(buf, PAGE_SIZE, "%u\n", b0);
-}
-/*-----------------------------------------------------------------------*/
-/* REG1: b0 register write function store()                    */
-/*-----------------------------------------------------------------------*/
-static ssize_t b0_store(struct device *dev,
-        struct device_attribute *attr, const char *buf, size_t size)
-{
-        u16 b0;
-        int ret;
-        struct CombFilter_dev *priv = dev_get_drvdata(dev);
-
-        // Parse the string we received as a u8
-        // See https://elixir.bootlin.com/linux/latest/source/lib/kstrtox.c#L289
-        ret = kstrtou16(buf, 0, &b0);
-        if (ret < 0) {
-                // kstrtou16 returned an error
-                return ret;
-        }
-
-        iowrite32(b0, priv->base_addr + REG1_b0_OFFSET);
-
-        // Write was succesful, so we return the number of bytes we wrote.
-        return size;
-}
+	// Round to the nearest sample
+	samples = div_u64((u64)delay_ms * priv->rate + (500ULL << 16),
+	                  1000U << 16);
+	if (samples > U16_MAX) {
+		return -ERANGE;
+	}
 
-/*-----------------------------------------------------------------------*/
-/* REG3: wetDryMix register read function show()                      */
-/*-----------------------------------------------------------------------*/
-static ssize_t wetDryMix_show(struct device *dev,
-        struct device_attribute *attr, char *buf)
-{
-        u16 wetDryMix;
-        struct CombFilter_dev *priv = dev_get_drvdata(dev);
+	ret = regmap_write(priv->adev->regmap, REG0_delayM_OFFSET, samples);
+	if (ret < 0) {
+		return ret;
+	}
 
-        wetDryMix = ioread32(priv->base_addr + REG3_wetDryMix_OFFSET);
+	priv->delay_ms = delay_ms;
+	priv->delayM = samples;
 
-        return scnprintf(buf, PAGE_SIZE, "%u\n", wetDryMix);
-}
-/*-----------------------------------------------------------------------*/
-/* REG3: wetDryMix register write function store()                    */
-/*-----------------------------------------------------------------------*/
-static ssize_t wetDryMix_store(struct device *dev,
-        struct device_attribute *attr, const char *buf, size_t size)
-{
-        u16 wetDryMix;
-        int ret;
-        struct CombFilter_dev *priv = dev_get_drvdata(dev);
-
-        // Parse the string we received as a u8
-        // See https://elixir.bootlin.com/linux/latest/source/lib/kstrtox.c#L289
-        ret = kstrtou16(buf, 0, &wetDryMix);
-        if (ret < 0) {
-                // kstrtou16 returned an error
-                return ret;
-        }
-
-        iowrite32(wetDryMix, priv->base_addr + REG3_wetDryMix_OFFSET);
-
-        // Write was succesful, so we return the number of bytes we wrote.
-        return size;
+	return 0;
 }
 
-/*-----------------------------------------------------------------------*/
-/* REG2: bM register read function show()                           */
-/*-----------------------------------------------------------------------*/
 /*
- * bM_show() - Return the bM value to user-space via sysfs.
- * @dev: Device structure for the CombFilter component. This
- *       device struct is embedded in the CombFilter' platform
- *       device struct.
- * @attr: Unused.
- * @buf: Buffer that gets returned to user-space.
+ * CombFilter_rate_notify() - Rescale delayM to a new sample rate
+ * @nb: CombFilter_priv.rate_nb.
+ * @action: AVALON_RATE_CHANGE.
+ * @data: The struct avalon_rate_change.
  *
- * Return: The number of bytes read.
+ * The delay in ms stays the same. A delay that doesn't fit delayM at the
+ * new rate leaves the register alone; the delay comes back when the rate
+ * does.
+ *
+ * Return: NOTIFY_OK, so that the other components still get the change.
  */
-static ssize_t bM_show(struct device *dev,
-	struct device_attribute *attr, char *buf)
+static int CombFilter_rate_notify(struct notifier_block *nb,
+	unsigned long action, void *data)
 {
-	u16 bM;
-	struct CombFilter_dev *priv = dev_get_drvdata(dev);
+	struct CombFilter_priv *priv = container_of(nb, struct CombFilter_priv,
+	                                            rate_nb);
+	struct avalon_rate_change *change = data;
+	int ret;
+
+	if (action != AVALON_RATE_CHANGE) {
+		return NOTIFY_DONE;
+	}
 
-	bM = ioread32(priv->base_addr + REG2_bM_OFFSET);
+	mutex_lock(&priv->adev->lock);
+	ret = CombFilter_sync_delay(priv);
+	priv->rate = change->new_rate;
+	if (ret == 0) {
+		ret = CombFilter_set_delay(priv, priv->delay_ms);
+	}
+	mutex_unlock(&priv->adev->lock);
+
+	if (ret < 0) {
+		dev_warn(priv->adev->dev, "delayM not rescaled to %u Hz (%d)\n",
+		         change->new_rate, ret);
+	}
 
-	return scnprintf(buf, PAGE_SIZE, "%u\n", bM);
+	return NOTIFY_OK;
 }
-/*-----------------------------------------------------------------------*/
-/* REG2: bM register write function store()                         */
-/*-----------------------------------------------------------------------*/
+
 /*
- * bM_store() - Store the bM value.
- * @dev: Device structure for the CombFilter component. This
- *       device struct is embedded in the CombFilter' platform
- *       device struct.
+ * delay_ms_show() - Return the comb delay in ms to user-space via sysfs.
+ * @dev: Device structure for the component (platform or misc device).
  * @attr: Unused.
- * @buf: Buffer that contains the  CombFilter value being written.
- * @size: The number of bytes being written.
+ * @buf: Buffer that gets returned to user-space.
  *
- * Return: The number of bytes stored.
+ * Return: The number of bytes read.
  */
-static ssize_t bM_store(struct device *dev,
-	struct device_attribute *attr, const char *buf, size_t size)
+static ssize_t delay_ms_show(struct device *dev,
+	struct device_attribute *attr, char *buf)
 {
-	u16 bM;
+	struct avalon_dev *adev = avalon_get_dev(dev);
+	struct CombFilter_priv *priv = READ_ONCE(adev->drvdata);
+	int len;
 	int ret;
-	struct CombFilter_dev *priv = dev_get_drvdata(dev);
 
-	// Parse the string we received as a u8
-	// See https://elixir.bootlin.com/linux/latest/source/lib/kstrtox.c#L289
-	ret = kstrtou16(buf, 0, &bM);
+	if (!priv) {
+		return -ENODEV;
+	}
+
+	mutex_lock(&adev->lock);
+	ret = CombFilter_sync_delay(priv);
+	len = fp_format(buf, PAGE_SIZE, priv->delay_ms, 16, 3);
+	mutex_unlock(&adev->lock);
 	if (ret < 0) {
-		// kstrtou16 returned an error
 		return ret;
 	}
 
-	iowrite32(bM, priv->base_addr + REG2_bM_OFFSET);
+	buf[len++] = '\n';
 
-	// Write was succesful, so we return the number of bytes we wrote.
-	return size;
+	return len;
 }
 
-
-/*-----------------------------------------------------------------------*/
-/* sysfs Attributes                                                      */
-/*-----------------------------------------------------------------------*/
-// Define sysfs attributes
-static DEVICE_ATTR_RW(delayM);    // Attribute for REG0
-/* TODO: Add the attributes for REG1 and REG2 using register names       */
-static DEVICE_ATTR_RW(b0);            // Attribute for REG1
-static DEVICE_ATTR_RW(wetDryMix);            // Attribute for REG2
-static DEVICE_ATTR_RW(bM);            // Attribute for REG3
-
-// Create an atribute group so the device core can
-// export the attributes for us.
-static struct attribute *CombFilter_attrs[] = {
-	&dev_attr_delayM.attr,
-/* TODO: Add the attribute entries for REG1 and REG2 using register names*/
-	&dev_attr_bM.attr,
-	&dev_attr_b0.attr,
-        &dev_attr_wetDryMix.attr,
-
-	NULL,
-};
-ATTRIBUTE_GROUPS(CombFilter);
-
-
-/*-----------------------------------------------------------------------*/
-/* File Operations read()                                                */
-/*-----------------------------------------------------------------------*/
 /*
- * CombFilter_read() - Read method for the CombFilter char device
- * @file: Pointer to the char device file struct.
- * @buf: User-space buffer to read the value into.
- * @count: The number of bytes being requested.
- * @offset: The byte offset in the file being read from.
+ * delay_ms_store() - Set the comb delay in ms via sysfs.
+ * @dev: Device structure for the component (platform or misc device).
+ * @attr: Unused.
+ * @buf: Buffer that contains the delay, e.g. "12.5".
+ * @size: The number of bytes being written.
  *
- * Return: On success, the number of bytes written is returned and the
- * offset @offset is advanced by this number. On error, a negative error
- * value is returned.
+ * delayM is set for the current sample rate and follows later rate
+ * changes.
+ *
+ * Return: The number of bytes stored.
  */
-static ssize_t CombFilter_read(struct file *file, char __user *buf,
-	size_t count, loff_t *offset)
+static ssize_t delay_ms_store(struct device *dev,
+	struct device_attribute *attr, const char *buf, size_t size)
 {
-	size_t ret;
-	u32 val;
-
-	loff_t pos = *offset;
-
-	/*
-	 * Get the device's private data from the file struct's private_data
-	 * field. The private_data field is equal to the miscdev field in the
-	 * CombFilter_dev struct. container_of returns the
-     * CombFilter_dev struct that contains the miscdev in private_data.
-	 */
-	struct CombFilter_dev *priv = container_of(file->private_data,
-	                            struct CombFilter_dev, miscdev);
-
-	// Check file offset to make sure we are reading to a valid location.
-	if (pos < 0) {
-		// We can't read from a negative file position.
-		return -EINVAL;
-	}
-	if (pos >= SPAN) {
-		// We can't read from a position past the end of our device.
-		return 0;
-	}
-	if ((pos % 0x4) != 0) {
-		/*
-		 * Prevent unaligned access. Even though the hardware
-		 * technically supports unaligned access, we want to
-		 * ensure that we only access 32-bit-aligned addresses
-		 * because our registers are 32-bit-aligned.
-		 */
-		pr_warn("CombFilter_read: unaligned access\n");
-		return -EFAULT;
-	}
+	struct avalon_dev *adev = avalon_get_dev(dev);
+	struct CombFilter_priv *priv = READ_ONCE(adev->drvdata);
+	s32 delay_ms;
+	int ret;
 
-	// If the user didn't request any bytes, don't return any bytes :)
-	if (count == 0) {
-		return 0;
+	if (!priv) {
+		return -ENODEV;
 	}
 
-	// Read the value at offset pos.
-	val = ioread32(priv->base_addr + pos);
-
-	ret = copy_to_user(buf, &val, sizeof(val));
-	if (ret == sizeof(val)) {
-		// Nothing was copied to the user.
-		pr_warn("CombFilter_read: nothing copied\n");
-		return -EFAULT;
+	ret = fp_parse(buf, 16, &delay_ms);
+	if (ret < 0) {
+		return ret;
 	}
-
-	// Increment the file offset by the number of bytes we read.
-	*offset = pos + sizeof(val);
-
-	return sizeof(val);
-}
-/*-----------------------------------------------------------------------*/
-/* File Operations write()                                               */
-/*-----------------------------------------------------------------------*/
-/*
- * CombFilter_write() - Write method for the CombFilter char device
- * @file: Pointer to the char device file struct.
- * @buf: User-space buffer to read the value from.
- * @count: The number of bytes being written.
- * @offset: The byte offset in the file being written to.
- *
- * Return: On success, the number of bytes written is returned and the
- * offset @offset is advanced by this number. On error, a negative error
- * value is returned.
- */
-static ssize_t CombFilter_write(struct file *file, const char __user *buf,
-	size_t count, loff_t *offset)
-{
-	size_t ret;
-	u32 val;
-
-	loff_t pos = *offset;
-
-	/*
-	 * Get the device's private data from the file struct's private_data
-	 * field. The private_data field is equal to the miscdev field in the
-	 * CombFilter_dev struct. container_of returns the
-     * CombFilter_dev struct that contains the miscdev in private_data.
-	 */
-	struct CombFilter_dev *priv = container_of(file->private_data,
-	                              struct CombFilter_dev, miscdev);
-
-	// Check file offset to make sure we are writing to a valid location.
-	if (pos < 0) {
-		// We can't write to a negative file position.
+	if (delay_ms < 0) {
 		return -EINVAL;
 	}
-	if (pos >= SPAN) {
-		// We can't write to a position past the end of our device.
-		return 0;
-	}
-	if ((pos % 0x4) != 0) {
-		/*
-		 * Prevent unaligned access. Even though the hardware
-		 * technically supports unaligned access, we want to
-		 * ensure that we only access 32-bit-aligned addresses
-		 * because our registers are 32-bit-aligned.
-		 */
-		pr_warn("CombFilter_write: unaligned access\n");
-		return -EFAULT;
-	}
 
-	// If the user didn't request to write anything, return 0.
-	if (count == 0) {
-		return 0;
-	}
+	mutex_lock(&adev->lock);
+	ret = CombFilter_set_delay(priv, delay_ms);
+	mutex_unlock(&adev->lock);
 
-	mutex_lock(&priv->lock);
-
-	ret = copy_from_user(&val, buf, sizeof(val));
-	if (ret == sizeof(val)) {
-		// Nothing was copied from the user.
-		pr_warn("CombFilter_write: nothing copied from user space\n");
-		ret = -EFAULT;
-		goto unlock;
-	}
-
-	// Write the value we were given at the address offset given by pos.
-	iowrite32(val, priv->base_addr + pos);
+	return ret < 0 ? ret : size;
+}
 
-	// Increment the file offset by the number of bytes we wrote.
-	*offset = pos + sizeof(val);
+static DEVICE_ATTR_RW(delay_ms);
 
-	// Return the number of bytes we wrote.
-	ret = sizeof(val);
+static struct attribute *CombFilter_attrs[] = {
+	&dev_attr_delay_ms.attr,
+	NULL
+};
 
-unlock:
-	mutex_unlock(&priv->lock);
-	return ret;
-}
+static const struct attribute_group CombFilter_group = {
+	.attrs = CombFilter_attrs,
+};
 
+static const struct attribute_group *CombFilter_groups[] = {
+	&CombFilter_group,
+	NULL
+};
 
-/*-----------------------------------------------------------------------*/
-/* File Operations Supported                                             */
-/*-----------------------------------------------------------------------*/
 /*
- *  CombFilter_fops - File operations supported by the
- *                          CombFilter driver
- * @owner: The CombFilter driver owns the file operations; this
- *         ensures that the driver can't be removed while the
- *         character device is still in use.
- * @read: The read function.
- * @write: The write function.
- * @llseek: We use the kernel's default_llseek() function; this allows
- *          users to change what position they are writing/reading to/from.
+ * CombFilter_component - Description of the CombFilter component
+ *                   for the Avalon register-map core
  */
-static const struct file_operations  CombFilter_fops = {
+static const struct avalon_component CombFilter_component = {
 	.owner = THIS_MODULE,
-	.read = CombFilter_read,
-	.write = CombFilter_write,
-	.llseek = default_llseek,
+	.name = "CombFilter",
+	.regs = CombFilter_regs,
+	.num_regs = ARRAY_SIZE(CombFilter_regs),
+	.span = SPAN,
+	.groups = CombFilter_groups,
 };
 
-
 /*-----------------------------------------------------------------------*/
 /* Platform Driver Probe (Initialization) Function                       */
 /*-----------------------------------------------------------------------*/
@@ -467,57 +283,38 @@ static const struct file_operations  CombFilter_fops = {
  *        driver core based upon our CombFilter device tree node.
  *
  * When a device that is compatible with this CombFilter driver
- * is found, the driver's probe function is called. This probe function
- * gets called by the kernel when an CombFilter device is found
- * in the device tree.
+ * is found, the driver's probe function is called. The register-map
+ * core maps the registers, creates the sysfs attributes and registers
+ * the /dev/CombFilter char device for us. We then subscribe to sample
+ * rate changes so that delayM keeps its delay in ms.
  */
 static int CombFilter_probe(struct platform_device *pdev)
 {
-	struct CombFilter_dev *priv;
+	struct CombFilter_priv *priv;
+	struct avalon_dev *adev;
 	int ret;
 
-	/*
-	 * Allocate kernel memory for the CombFilter device and set it to 0.
-	 * GFP_KERNEL specifies that we are allocating normal kernel RAM;
-	 * see the kmalloc documentation for more info. The allocated memory
-	 * is automatically freed when the device is removed.
-	 */
-	priv = devm_kzalloc(&pdev->dev, sizeof(struct CombFilter_dev), GFP_KERNEL);
+	priv = devm_kzalloc(&pdev->dev, sizeof(*priv), GFP_KERNEL);
 	if (!priv) {
-		pr_err("Failed to allocate kernel memory for hps_led_pattern\n");
 		return -ENOMEM;
 	}
 
-	/*
-	 * Request and remap the device's memory region. Requesting the region
-	 * make sure nobody else can use that memory. The memory is remapped
-	 * into the kernel's virtual address space becuase we don't have access
-	 * to physical memory locations.
-	 */
-	priv->base_addr = devm_platform_ioremap_resource(pdev, 0);
-	if (IS_ERR(priv->base_addr)) {
-		pr_err("Failed to request/remap platform device resource (CombFilter)\n");
-		return PTR_ERR(priv->base_addr);
+	adev = avalon_probe(pdev, &CombFilter_component);
+	if (IS_ERR(adev)) {
+		pr_err("Failed to set up CombFilter (%ld)\n", PTR_ERR(adev));
+		return PTR_ERR(adev);
 	}
 
-	// Initialize the misc device parameters
-	priv->miscdev.minor = MISC_DYNAMIC_MINOR;
-	priv->miscdev.name = "CombFilter";
-	priv->miscdev.fops = &CombFilter_fops;
-	priv->miscdev.parent = &pdev->dev;
-	priv->miscdev.groups = CombFilter_groups;
-
-	// Register the misc device; this creates a char dev at
-    // /dev/CombFilter
-	ret = misc_register(&priv->miscdev);
+	// delayM as found is in samples at the current rate
+	priv->adev = adev;
+	priv->delayM = U32_MAX;
+	priv->rate_nb.notifier_call = CombFilter_rate_notify;
+	ret = avalon_rate_notifier_register(&priv->rate_nb, &priv->rate);
 	if (ret) {
-		pr_err("Failed to register misc device for CombFilter\n");
+		avalon_remove(pdev);
 		return ret;
 	}
-
-	// Attach the CombFilter' private data to the
-    // platform device's struct.
-	platform_set_drvdata(pdev, priv);
+	WRITE_ONCE(adev->drvdata, priv);
 
 	pr_info("CombFilter_probe successful\n");
 
@@ -536,11 +333,13 @@ static int CombFilter_probe(struct platform_device *pdev)
  */
 static int CombFilter_remove(struct platform_device *pdev)
 {
-	// Get theCombFilter' private data from the platform device.
-	struct CombFilter_dev *priv = platform_get_drvdata(pdev);
+	struct avalon_dev *adev = platform_get_drvdata(pdev);
+	struct CombFilter_priv *priv = adev->drvdata;
+
+	avalon_rate_notifier_unregister(&priv->rate_nb);
 
 	// Deregister the misc device and remove the /dev/CombFilter file.
-	misc_deregister(&priv->miscdev);
+	avalon_remove(pdev);
 
 	pr_info("CombFilter_remove successful\n");
 
@@ -575,9 +374,8 @@ MODULE_DEVICE_TABLE(of, combFilterProcessor);
  * @driver.owner: Which module owns this driver
  * @driver.name: Name of the CombFilter driver
  * @driver.of_match_table: Device tree match table
- * @driver.dev_groups: CombFilter sysfs attribute group; this
- *                     allows the driver core to create the
- *                     attribute(s) without race conditions.
+ * @driver.suppress_bind_attrs: No unbinding through sysfs; an open
+ *                              /dev/<name> would outlive our data
  */
 static struct platform_driver CombFilter_driver = {
 	.probe = CombFilter_probe,
@@ -586,7 +384,7 @@ static struct platform_driver CombFilter_driver = {
 		.owner = THIS_MODULE,
 		.name = "CombFilter",
 		.of_match_table = combFilterProcessor,
-		.dev_groups = CombFilter_groups,
+		.suppress_bind_attrs = true,
 	},
 };
 
@@ -0,0 +1,950 @@
+/* SPDX-License-Identifier: GPL-2.0 or MIT                               */
+/*-------------------------------------------------------------------------
+ * Description:  Register-map core shared by the Avalon component drivers
+ * ------------------------------------------------------------------------
+ * Every Avalon component driver used to carry its own copy of the same
+ * show/store/read/write/probe skeleton. This module implements that
+ * skeleton once, on top of regmap-mmio with a flat register cache. A
+ * component driver only declares a const table of its registers (see
+ * avalon_regmap.h) and calls avalon_probe()/avalon_remove().
+ *
+ * What every component gets from here:
+ *   - one sysfs attribute per register, parsed according to the table
+ *     and written under the device lock
+ *   - reads served from the register cache, so monitoring never stalls
+ *     on the HPS-to-FPGA bridge (volatile registers excepted), plus a
+ *     cache_bypass attribute for debugging
+ *   - a /dev/<name> char device with multi-register read()/write() and
+ *     an opt-in uncached mmap() of the span
+ *   - regmap's tracepoints and debugfs register dump, plus our own
+ *     avalon_reg_store/avalon_write tracepoints and a per-device log2
+ *     latency histogram in debugfs (avalon/<device>/write_latency)
+ *   - a sample rate notifier: the codec driver reports rate changes and
+ *     components with rate dependent registers rescale them
+ * ------------------------------------------------------------------------
+ * License : GPL-2.0 or MIT (opensource.org / licenses / MIT, GPL-2.0)
+-------------------------------------------------------------------------*/
+#include <linux/module.h>
+#include <linux/platform_device.h>
+#include <linux/mod_devicetable.h>
+#include <linux/types.h>
+#include <linux/io.h>
+#include <linux/mm.h>
+#include <linux/mutex.h>
+#include <linux/miscdevice.h>
+#include <linux/fs.h>
+#include <linux/kernel.h>
+#include <linux/uaccess.h>
+#include <linux/regmap.h>
+#include <linux/ktime.h>
+#include <linux/debugfs.h>
+#include <linux/notifier.h>
+#include "avalon_regmap.h"
+
+#define CREATE_TRACE_POINTS
+#include "avalon_trace.h"
+
+/*
+ * Mapping the register span into user space lets a real-time control
+ * thread update parameters without a syscall per write, but it also
+ * bypasses the driver's locking and register cache. Keep it off unless
+ * asked for.
+ */
+static bool allow_mmap;
+module_param(allow_mmap, bool, 0444);
+MODULE_PARM_DESC(allow_mmap, "Allow user space to mmap() the register span");
+
+// debugfs directory holding one subdirectory per device
+static struct dentry *avalon_debugfs_root;
+
+/*-----------------------------------------------------------------------*/
+/* Register table lookups                                                */
+/*-----------------------------------------------------------------------*/
+/*
+ * avalon_find_reg() - Find the register table entry at a byte offset
+ * @adev: The Avalon device.
+ * @offset: Byte offset of the register.
+ *
+ * Return: The table entry, or NULL if no register lives at @offset.
+ */
+static const struct avalon_reg *avalon_find_reg(struct avalon_dev *adev,
+	unsigned int offset)
+{
+	if (offset >= adev->comp->span || offset % sizeof(u32)) {
+		return NULL;
+	}
+
+	return adev->slots[offset / sizeof(u32)];
+}
+
+static bool avalon_readable_reg(struct device *dev, unsigned int offset)
+{
+	const struct avalon_reg *reg = avalon_find_reg(avalon_get_dev(dev), offset);
+
+	return reg && (reg->access & AVALON_REG_R);
+}
+
+static bool avalon_writeable_reg(struct device *dev, unsigned int offset)
+{
+	const struct avalon_reg *reg = avalon_find_reg(avalon_get_dev(dev), offset);
+
+	return reg && (reg->access & AVALON_REG_W);
+}
+
+static bool avalon_volatile_reg(struct device *dev, unsigned int offset)
+{
+	const struct avalon_reg *reg = avalon_find_reg(avalon_get_dev(dev), offset);
+
+	return !reg || (reg->access & AVALON_REG_VOLATILE);
+}
+
+/*-----------------------------------------------------------------------*/
+/* Register access for component drivers                                 */
+/*-----------------------------------------------------------------------*/
+/*
+ * avalon_reg_read() - Read a register, from the cache when possible
+ * @adev: The Avalon device.
+ * @offset: Byte offset of the register.
+ * @val: Where to store the value.
+ *
+ * Return: 0 on success, or a negative error value.
+ */
+int avalon_reg_read(struct avalon_dev *adev, unsigned int offset, u32 *val)
+{
+	unsigned int tmp;
+	int ret;
+
+	ret = regmap_read(adev->regmap, offset, &tmp);
+	if (ret == 0) {
+		*val = tmp;
+	}
+
+	return ret;
+}
+EXPORT_SYMBOL_GPL(avalon_reg_read);
+
+/*
+ * avalon_reg_write() - Write a register and its cached copy
+ * @adev: The Avalon device.
+ * @offset: Byte offset of the register.
+ * @val: Value to write.
+ *
+ * Return: 0 on success, or a negative error value.
+ */
+int avalon_reg_write(struct avalon_dev *adev, unsigned int offset, u32 val)
+{
+	int ret;
+
+	mutex_lock(&adev->lock);
+	ret = regmap_write(adev->regmap, offset, val);
+	mutex_unlock(&adev->lock);
+
+	return ret;
+}
+EXPORT_SYMBOL_GPL(avalon_reg_write);
+
+/*
+ * avalon_multi_reg_write() - Write several registers as one commit
+ * @adev: The Avalon device.
+ * @regs: Registers and values, written in array order.
+ * @num_regs: Number of entries in @regs.
+ *
+ * All writes happen under one hold of the device lock, so no other
+ * writer can interleave with them.
+ *
+ * Return: 0 on success, or a negative error value.
+ */
+int avalon_multi_reg_write(struct avalon_dev *adev,
+	const struct reg_sequence *regs, int num_regs)
+{
+	int ret;
+
+	mutex_lock(&adev->lock);
+	ret = regmap_multi_reg_write(adev->regmap, regs, num_regs);
+	mutex_unlock(&adev->lock);
+
+	return ret;
+}
+EXPORT_SYMBOL_GPL(avalon_multi_reg_write);
+
+/*-----------------------------------------------------------------------*/
+/* Sample rate notifier                                                  */
+/*-----------------------------------------------------------------------*/
+/*
+ * The fabric runs at the codec's sample rate, so registers holding delays
+ * in samples or frequencies relative to fs go wrong when it changes. The
+ * codec driver reports the rate here; it lives in the core rather than
+ * the codec driver so that components don't depend on a particular codec.
+ * avalon_rate_lock serializes changes, so subscribers see them in order.
+ */
+static BLOCKING_NOTIFIER_HEAD(avalon_rate_chain);
+static DEFINE_MUTEX(avalon_rate_lock);
+static unsigned int avalon_rate = AVALON_DEFAULT_RATE;
+
+/*
+ * avalon_rate_notifier_register() - Subscribe to sample rate changes
+ * @nb: Notifier block; called with AVALON_RATE_CHANGE and a
+ *      struct avalon_rate_change from the context of whoever changes the
+ *      rate, which may sleep.
+ * @rate: Set to the current sample rate in Hz, before any change can be
+ *        delivered to @nb, so the caller never misses one.
+ *
+ * Return: 0 on success, or a negative error value.
+ */
+int avalon_rate_notifier_register(struct notifier_block *nb,
+	unsigned int *rate)
+{
+	int ret;
+
+	mutex_lock(&avalon_rate_lock);
+	*rate = avalon_rate;
+	ret = blocking_notifier_chain_register(&avalon_rate_chain, nb);
+	mutex_unlock(&avalon_rate_lock);
+
+	return ret;
+}
+EXPORT_SYMBOL_GPL(avalon_rate_notifier_register);
+
+/*
+ * avalon_rate_notifier_unregister() - Undo avalon_rate_notifier_register()
+ * @nb: The notifier block.
+ *
+ * Return: 0 on success, or a negative error value.
+ */
+int avalon_rate_notifier_unregister(struct notifier_block *nb)
+{
+	return blocking_notifier_chain_unregister(&avalon_rate_chain, nb);
+}
+EXPORT_SYMBOL_GPL(avalon_rate_notifier_unregister);
+
+/*
+ * avalon_set_sample_rate() - Report the sample rate the fabric runs at
+ * @rate: Sample rate in Hz.
+ *
+ * Calls every subscriber when @rate differs from the current rate, and
+ * returns once they have all rescaled their registers.
+ *
+ * Return: 0 on success, or the first error a subscriber returned.
+ */
+int avalon_set_sample_rate(unsigned int rate)
+{
+	struct avalon_rate_change change;
+	int ret = NOTIFY_DONE;
+
+	if (rate == 0) {
+		return -EINVAL;
+	}
+
+	mutex_lock(&avalon_rate_lock);
+	if (rate != avalon_rate) {
+		change.old_rate = avalon_rate;
+		change.new_rate = rate;
+		WRITE_ONCE(avalon_rate, rate);
+		ret = blocking_notifier_call_chain(&avalon_rate_chain,
+		                                   AVALON_RATE_CHANGE, &change);
+	}
+	mutex_unlock(&avalon_rate_lock);
+
+	return notifier_to_errno(ret);
+}
+EXPORT_SYMBOL_GPL(avalon_set_sample_rate);
+
+/*
+ * avalon_get_sample_rate() - Get the sample rate the fabric runs at
+ *
+ * Return: The sample rate in Hz.
+ */
+unsigned int avalon_get_sample_rate(void)
+{
+	return READ_ONCE(avalon_rate);
+}
+EXPORT_SYMBOL_GPL(avalon_get_sample_rate);
+
+/*-----------------------------------------------------------------------*/
+/* Register attributes show() / store()                                  */
+/*-----------------------------------------------------------------------*/
+/*
+ * avalon_attr_reg() - Get the register behind one of our attributes
+ * @adev: The Avalon device.
+ * @attr: One of @adev->reg_attrs.
+ */
+static const struct avalon_reg *avalon_attr_reg(struct avalon_dev *adev,
+	struct device_attribute *attr)
+{
+	return &adev->comp->regs[attr - adev->reg_attrs];
+}
+
+/*
+ * avalon_reg_show() - Return a register value to user-space via sysfs.
+ * @dev: Device structure for the component (platform or misc device).
+ * @attr: The register's attribute.
+ * @buf: Buffer that gets returned to user-space.
+ *
+ * Return: The number of bytes read.
+ */
+static ssize_t avalon_reg_show(struct device *dev,
+	struct device_attribute *attr, char *buf)
+{
+	struct avalon_dev *adev = avalon_get_dev(dev);
+	const struct avalon_reg *reg = avalon_attr_reg(adev, attr);
+	u32 val;
+	int ret;
+
+	ret = avalon_reg_read(adev, reg->offset, &val);
+	if (ret < 0) {
+		return ret;
+	}
+
+	if (reg->width < 32) {
+		val &= GENMASK(reg->width - 1, 0);
+	}
+
+	return scnprintf(buf, PAGE_SIZE, "%u\n", val);
+}
+
+/*
+ * avalon_reg_store() - Store a register value written via sysfs.
+ * @dev: Device structure for the component (platform or misc device).
+ * @attr: The register's attribute.
+ * @buf: Buffer that contains the value being written.
+ * @size: The number of bytes being written.
+ *
+ * Return: The number of bytes stored.
+ */
+static ssize_t avalon_reg_store(struct device *dev,
+	struct device_attribute *attr, const char *buf, size_t size)
+{
+	struct avalon_dev *adev = avalon_get_dev(dev);
+	const struct avalon_reg *reg = avalon_attr_reg(adev, attr);
+	u64 start = ktime_get_ns();
+	u64 ns;
+	bool bval;
+	u8 u8val;
+	u16 u16val;
+	u32 val;
+	int ret;
+
+	// Parse the string as the register table says
+	// See https://elixir.bootlin.com/linux/latest/source/lib/kstrtox.c#L289
+	switch (reg->parse) {
+	case AVALON_PARSE_BOOL:
+		ret = kstrtobool(buf, &bval);
+		val = bval;
+		break;
+	case AVALON_PARSE_U8:
+		ret = kstrtou8(buf, 0, &u8val);
+		val = u8val;
+		break;
+	case AVALON_PARSE_U16:
+		ret = kstrtou16(buf, 0, &u16val);
+		val = u16val;
+		break;
+	default:
+		ret = kstrtou32(buf, 0, &val);
+		break;
+	}
+	if (ret < 0) {
+		return ret;
+	}
+
+	if (reg->width < 32 && (val >> reg->width)) {
+		return -ERANGE;
+	}
+
+	ret = avalon_reg_write(adev, reg->offset, val);
+
+	ns = ktime_get_ns() - start;
+	lat_hist_add(&adev->write_lat, ns);
+	trace_avalon_reg_store(dev_name(adev->dev), reg->name, reg->offset,
+	                       val, ret, ns);
+	if (ret < 0) {
+		return ret;
+	}
+
+	// Write was succesful, so we return the number of bytes we wrote.
+	return size;
+}
+
+/*-----------------------------------------------------------------------*/
+/* cache_bypass attribute                                                */
+/*-----------------------------------------------------------------------*/
+/*
+ * avalon_refresh_cache() - Reload the register cache from the hardware
+ * @adev: The Avalon device.
+ *
+ * The caller must hold adev->lock and have the cache bypassed.
+ */
+static int avalon_refresh_cache(struct avalon_dev *adev)
+{
+	const struct avalon_reg *reg;
+	unsigned int val;
+	unsigned int i;
+	int ret;
+
+	for (i = 0; i < adev->comp->num_regs; i++) {
+		reg = &adev->comp->regs[i];
+		if (reg->access & AVALON_REG_VOLATILE) {
+			continue;
+		}
+
+		ret = regmap_read(adev->regmap, reg->offset, &val);
+		if (ret < 0) {
+			return ret;
+		}
+
+		regcache_cache_bypass(adev->regmap, false);
+		regcache_cache_only(adev->regmap, true);
+		ret = regmap_write(adev->regmap, reg->offset, val);
+		regcache_cache_only(adev->regmap, false);
+		regcache_cache_bypass(adev->regmap, true);
+		if (ret < 0) {
+			return ret;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * cache_bypass_show() - Report whether register reads bypass the cache.
+ * @dev: Device structure for the component.
+ * @attr: Unused.
+ * @buf: Buffer that gets returned to user-space.
+ *
+ * Return: The number of bytes read.
+ */
+static ssize_t cache_bypass_show(struct device *dev,
+	struct device_attribute *attr, char *buf)
+{
+	struct avalon_dev *adev = avalon_get_dev(dev);
+
+	return scnprintf(buf, PAGE_SIZE, "%u\n", adev->cache_bypass);
+}
+
+/*
+ * cache_bypass_store() - Make register reads go to the hardware (1) or
+ *                        come from the register cache (0).
+ * @dev: Device structure for the component.
+ * @attr: Unused.
+ * @buf: Buffer that contains the bool being written.
+ * @size: The number of bytes being written.
+ *
+ * Turning the cache back on reloads it from the hardware, since the
+ * registers may have been changed behind our back while it was
+ * bypassed (e.g. through mmap()).
+ *
+ * Return: The number of bytes stored.
+ */
+static ssize_t cache_bypass_store(struct device *dev,
+	struct device_attribute *attr, const char *buf, size_t size)
+{
+	struct avalon_dev *adev = avalon_get_dev(dev);
+	bool cache_bypass;
+	int ret;
+
+	ret = kstrtobool(buf, &cache_bypass);
+	if (ret < 0) {
+		return ret;
+	}
+
+	mutex_lock(&adev->lock);
+	if (adev->cache_bypass && !cache_bypass) {
+		ret = avalon_refresh_cache(adev);
+	}
+	if (ret == 0) {
+		regcache_cache_bypass(adev->regmap, cache_bypass);
+		adev->cache_bypass = cache_bypass;
+	}
+	mutex_unlock(&adev->lock);
+
+	return ret < 0 ? ret : size;
+}
+
+static DEVICE_ATTR_RW(cache_bypass);
+
+/*-----------------------------------------------------------------------*/
+/* File Operations read()                                                */
+/*-----------------------------------------------------------------------*/
+/*
+ * avalon_read() - Read method for the component char device
+ * @file: Pointer to the char device file struct.
+ * @buf: User-space buffer to read the values into.
+ * @count: The number of bytes being requested.
+ * @offset: The byte offset in the file being read from.
+ *
+ * Every whole 32-bit register covered by @count is returned, up to the
+ * end of the span, so one pread() can fetch the whole register window.
+ * The read stops short of the first word that isn't a readable register
+ * (e.g. a FIFO that a read would pop); a read starting on one fails
+ * with -EIO.
+ *
+ * Return: On success, the number of bytes read is returned and the
+ * offset @offset is advanced by this number. On error, a negative error
+ * value is returned.
+ */
+static ssize_t avalon_read(struct file *file, char __user *buf,
+	size_t count, loff_t *offset)
+{
+	struct avalon_dev *adev = container_of(file->private_data,
+	                                       struct avalon_dev, miscdev);
+	u32 vals[AVALON_MAX_SPAN / sizeof(u32)];
+	loff_t pos = *offset;
+	size_t nregs;
+	size_t i;
+	int ret;
+
+	// Check file offset to make sure we are reading from a valid location.
+	if (pos < 0) {
+		return -EINVAL;
+	}
+	if (pos >= adev->comp->span) {
+		return 0;
+	}
+	if ((pos % 0x4) != 0) {
+		// Our registers are 32-bit-aligned; refuse unaligned access.
+		pr_warn("%s_read: unaligned access\n", adev->comp->name);
+		return -EFAULT;
+	}
+
+	nregs = min_t(size_t, count, adev->comp->span - pos) / sizeof(u32);
+	if (nregs == 0) {
+		return 0;
+	}
+
+	// Holes in the register table may have read side effects; stop there
+	for (i = 0; i < nregs; i++) {
+		if (!avalon_readable_reg(adev->dev, pos + i * sizeof(u32))) {
+			break;
+		}
+	}
+	if (i == 0) {
+		return -EIO;
+	}
+	nregs = i;
+
+	ret = regmap_bulk_read(adev->regmap, pos, vals, nregs);
+	if (ret < 0) {
+		return ret;
+	}
+
+	if (copy_to_user(buf, vals, nregs * sizeof(u32))) {
+		pr_warn("%s_read: nothing copied\n", adev->comp->name);
+		return -EFAULT;
+	}
+
+	*offset = pos + nregs * sizeof(u32);
+
+	return nregs * sizeof(u32);
+}
+
+/*-----------------------------------------------------------------------*/
+/* File Operations write()                                               */
+/*-----------------------------------------------------------------------*/
+/*
+ * avalon_write() - Write method for the component char device
+ * @file: Pointer to the char device file struct.
+ * @buf: User-space buffer to read the values from.
+ * @count: The number of bytes being written.
+ * @offset: The byte offset in the file being written to.
+ *
+ * Every whole 32-bit register covered by @count is written, up to the
+ * end of the span, under one hold of the device lock.
+ *
+ * Return: On success, the number of bytes written is returned and the
+ * offset @offset is advanced by this number. On error, a negative error
+ * value is returned.
+ */
+static ssize_t avalon_write(struct file *file, const char __user *buf,
+	size_t count, loff_t *offset)
+{
+	struct avalon_dev *adev = container_of(file->private_data,
+	                                       struct avalon_dev, miscdev);
+	u32 vals[AVALON_MAX_SPAN / sizeof(u32)];
+	u64 start = ktime_get_ns();
+	loff_t pos = *offset;
+	size_t nregs;
+	u64 ns;
+	int ret;
+
+	// Check file offset to make sure we are writing to a valid location.
+	if (pos < 0) {
+		return -EINVAL;
+	}
+	if (pos >= adev->comp->span) {
+		return 0;
+	}
+	if ((pos % 0x4) != 0) {
+		// Our registers are 32-bit-aligned; refuse unaligned access.
+		pr_warn("%s_write: unaligned access\n", adev->comp->name);
+		return -EFAULT;
+	}
+
+	nregs = min_t(size_t, count, adev->comp->span - pos) / sizeof(u32);
+	if (nregs == 0) {
+		return 0;
+	}
+
+	if (copy_from_user(vals, buf, nregs * sizeof(u32))) {
+		pr_warn("%s_write: nothing copied from user space\n",
+			adev->comp->name);
+		return -EFAULT;
+	}
+
+	mutex_lock(&adev->lock);
+	ret = regmap_bulk_write(adev->regmap, pos, vals, nregs);
+	mutex_unlock(&adev->lock);
+
+	ns = ktime_get_ns() - start;
+	lat_hist_add(&adev->write_lat, ns);
+	trace_avalon_write(dev_name(adev->dev), pos, nregs, ret, ns);
+	if (ret < 0) {
+		return ret;
+	}
+
+	*offset = pos + nregs * sizeof(u32);
+
+	return nregs * sizeof(u32);
+}
+
+/*-----------------------------------------------------------------------*/
+/* File Operations mmap()                                                */
+/*-----------------------------------------------------------------------*/
+/*
+ * avalon_mmap() - Map the register span into user space
+ * @file: Pointer to the char device file struct.
+ * @vma: The user-space virtual memory area to map the registers into.
+ *
+ * The registers are mapped uncached so every load and store from user
+ * space goes straight across the bridge. Memory standing in for them
+ * (struct avalon_platform_data) keeps the kernel's cacheable mapping
+ * instead, since an uncached alias wouldn't see the kernel's stores.
+ * Only available when the allow_mmap module parameter is set, the device
+ * has a MEM resource, and the resource starts on a page boundary and
+ * covers whole pages. Mappings are made in pages, so a
+ * smaller resource would expose whatever component follows it on the
+ * same page. Stores through the mapping can't update the register
+ * cache, so mapping the span switches the device to cache_bypass.
+ *
+ * Return: 0 on success, or a negative error value.
+ */
+static int avalon_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct avalon_dev *adev = container_of(file->private_data,
+	                                       struct avalon_dev, miscdev);
+	unsigned long size = vma->vm_end - vma->vm_start;
+	unsigned long pfn;
+	bool was_bypassed;
+	int ret;
+
+	if (!allow_mmap) {
+		return -EPERM;
+	}
+	if (!adev->res) {
+		return -ENODEV;
+	}
+	if ((adev->res->start | resource_size(adev->res)) & ~PAGE_MASK) {
+		pr_warn("%s_mmap: register span doesn't own whole pages\n",
+			adev->comp->name);
+		return -ENODEV;
+	}
+	if (vma->vm_pgoff != 0 || size > resource_size(adev->res)) {
+		return -EINVAL;
+	}
+
+	pfn = adev->res->start >> PAGE_SHIFT;
+	if (!pfn_valid(pfn)) {
+		vma->vm_page_prot = pgprot_noncached(vma->vm_page_prot);
+	}
+	vma->vm_flags |= VM_IO | VM_DONTEXPAND | VM_DONTDUMP;
+
+	mutex_lock(&adev->lock);
+	was_bypassed = adev->cache_bypass;
+	regcache_cache_bypass(adev->regmap, true);
+	adev->cache_bypass = true;
+
+	ret = io_remap_pfn_range(vma, vma->vm_start, pfn, size,
+	                         vma->vm_page_prot);
+	if (ret < 0 && !was_bypassed) {
+		// Nothing got mapped, so the cache is still good
+		regcache_cache_bypass(adev->regmap, false);
+		adev->cache_bypass = false;
+	}
+	mutex_unlock(&adev->lock);
+
+	return ret;
+}
+
+/*-----------------------------------------------------------------------*/
+/* File Operations unlocked_ioctl()                                      */
+/*-----------------------------------------------------------------------*/
+static long avalon_ioctl(struct file *file, unsigned int cmd,
+	unsigned long arg)
+{
+	struct avalon_dev *adev = container_of(file->private_data,
+	                                       struct avalon_dev, miscdev);
+
+	if (!adev->comp->ioctl) {
+		return -ENOTTY;
+	}
+
+	return adev->comp->ioctl(adev, cmd, arg);
+}
+
+/*-----------------------------------------------------------------------*/
+/* File Operations Supported                                             */
+/*-----------------------------------------------------------------------*/
+/*
+ * avalon_fops - File operations supported by every component char device
+ * @read: The read function.
+ * @write: The write function.
+ * @mmap: The mmap function; maps the register span into user space.
+ * @unlocked_ioctl: Passed on to the component's ioctl handler, if any.
+ * @llseek: We use the kernel's default_llseek() function; this allows
+ *          users to change what position they are writing/reading to/from.
+ *
+ * Every device gets a copy with .owner set to the component driver's
+ * module (see avalon_probe()). An open file pins that module, so the
+ * avalon_dev and component data the file operations use can't be freed
+ * by unloading it. The component drivers also hide their unbind
+ * attribute, which would free them just the same.
+ */
+static const struct file_operations avalon_fops = {
+	.read = avalon_read,
+	.write = avalon_write,
+	.mmap = avalon_mmap,
+	.unlocked_ioctl = avalon_ioctl,
+	.llseek = default_llseek,
+};
+
+/*-----------------------------------------------------------------------*/
+/* Probe (Initialization) / Remove                                       */
+/*-----------------------------------------------------------------------*/
+/*
+ * avalon_init_attrs() - Build the sysfs attributes from the register table
+ * @adev: The Avalon device.
+ *
+ * Return: 0 on success, or a negative error value.
+ */
+static int avalon_init_attrs(struct avalon_dev *adev)
+{
+	const struct avalon_component *comp = adev->comp;
+	const struct avalon_reg *reg;
+	struct device_attribute *dattr;
+	struct attribute **attrs;
+	unsigned int nextra = 0;
+	unsigned int i;
+
+	adev->reg_attrs = devm_kcalloc(adev->dev, comp->num_regs,
+	                               sizeof(*adev->reg_attrs), GFP_KERNEL);
+	attrs = devm_kcalloc(adev->dev, comp->num_regs + 2, sizeof(*attrs),
+	                     GFP_KERNEL);
+	if (!adev->reg_attrs || !attrs) {
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < comp->num_regs; i++) {
+		reg = &comp->regs[i];
+		dattr = &adev->reg_attrs[i];
+
+		sysfs_attr_init(&dattr->attr);
+		dattr->attr.name = reg->name;
+		if (reg->access & AVALON_REG_R) {
+			dattr->attr.mode |= 0444;
+			dattr->show = avalon_reg_show;
+		}
+		if (reg->access & AVALON_REG_W) {
+			dattr->attr.mode |= 0200;
+			dattr->store = avalon_reg_store;
+		}
+		attrs[i] = &dattr->attr;
+	}
+	attrs[comp->num_regs] = &dev_attr_cache_bypass.attr;
+	adev->group.attrs = attrs;
+
+	// Our group first, then whatever the component adds
+	while (comp->groups && comp->groups[nextra]) {
+		nextra++;
+	}
+	adev->groups = devm_kcalloc(adev->dev, nextra + 2,
+	                            sizeof(*adev->groups), GFP_KERNEL);
+	if (!adev->groups) {
+		return -ENOMEM;
+	}
+	adev->groups[0] = &adev->group;
+	for (i = 0; i < nextra; i++) {
+		adev->groups[i + 1] = comp->groups[i];
+	}
+
+	return 0;
+}
+
+/*
+ * avalon_probe() - Set up an Avalon component
+ * @pdev: Platform device structure associated with the component; pdev
+ *        is created by the driver core from the device tree node.
+ * @comp: Description of the component.
+ *
+ * Maps the span (or takes the mapping from struct avalon_platform_data,
+ * if the device has one), creates the regmap and its flat cache (filled from the
+ * hardware), creates the sysfs attributes on the platform device and
+ * registers /dev/<comp->name>. Everything except the misc device and
+ * the debugfs directory is device managed; undo those with
+ * avalon_remove().
+ *
+ * Return: The new avalon_dev, or an ERR_PTR() on failure.
+ */
+struct avalon_dev *avalon_probe(struct platform_device *pdev,
+	const struct avalon_component *comp)
+{
+	struct regmap_config config = {
+		.name = comp->name,
+		.reg_bits = 32,
+		.val_bits = 32,
+		.reg_stride = 4,
+		.max_register = comp->span - 4,
+		.readable_reg = avalon_readable_reg,
+		.writeable_reg = avalon_writeable_reg,
+		.volatile_reg = avalon_volatile_reg,
+		.cache_type = REGCACHE_FLAT,
+		// Seed the cache by reading every register once
+		.num_reg_defaults_raw = comp->span / 4,
+	};
+	struct avalon_platform_data *pdata;
+	struct avalon_dev *adev;
+	const struct avalon_reg *reg;
+	unsigned int i;
+	int ret;
+
+	BUILD_BUG_ON(offsetof(struct avalon_dev, miscdev) != 0);
+
+	if (!comp->owner || comp->span == 0 || comp->span > AVALON_MAX_SPAN ||
+	    comp->span % sizeof(u32)) {
+		return ERR_PTR(-EINVAL);
+	}
+
+	adev = devm_kzalloc(&pdev->dev, sizeof(*adev), GFP_KERNEL);
+	if (!adev) {
+		return ERR_PTR(-ENOMEM);
+	}
+	adev->dev = &pdev->dev;
+	adev->comp = comp;
+	mutex_init(&adev->lock);
+
+	// Index the register table by word so lookups are O(1)
+	adev->slots = devm_kcalloc(&pdev->dev, comp->span / sizeof(u32),
+	                           sizeof(*adev->slots), GFP_KERNEL);
+	if (!adev->slots) {
+		return ERR_PTR(-ENOMEM);
+	}
+	for (i = 0; i < comp->num_regs; i++) {
+		reg = &comp->regs[i];
+		if (reg->offset >= comp->span || reg->offset % sizeof(u32) ||
+		    reg->width == 0 || reg->width > 32) {
+			dev_err(&pdev->dev, "bad register table entry %s\n",
+			        reg->name);
+			return ERR_PTR(-EINVAL);
+		}
+		adev->slots[reg->offset / sizeof(u32)] = reg;
+	}
+
+	pdata = dev_get_platdata(&pdev->dev);
+	if (pdata && pdata->base) {
+		// Span provided by whoever registered the device
+		adev->base_addr = pdata->base;
+		// Same memory by physical address, for mmap(); already ours
+		adev->res = platform_get_resource(pdev, IORESOURCE_MEM, 0);
+	} else {
+		/*
+		 * Request and remap the device's memory region. Requesting the
+		 * region make sure nobody else can use that memory.
+		 */
+		adev->base_addr = devm_platform_get_and_ioremap_resource(pdev,
+		                                            0, &adev->res);
+		if (IS_ERR(adev->base_addr)) {
+			return ERR_CAST(adev->base_addr);
+		}
+
+		// The cache is seeded by reading the whole span
+		if (resource_size(adev->res) < comp->span) {
+			dev_err(&pdev->dev, "%pR is smaller than the 0x%x byte span\n",
+			        adev->res, comp->span);
+			return ERR_PTR(-EINVAL);
+		}
+	}
+
+	// The regmap callbacks look us up through the platform device
+	platform_set_drvdata(pdev, adev);
+
+	adev->regmap = devm_regmap_init_mmio(&pdev->dev, adev->base_addr,
+	                                     &config);
+	if (IS_ERR(adev->regmap)) {
+		return ERR_CAST(adev->regmap);
+	}
+
+	ret = avalon_init_attrs(adev);
+	if (ret) {
+		return ERR_PTR(ret);
+	}
+
+	ret = devm_device_add_groups(&pdev->dev, adev->groups);
+	if (ret) {
+		return ERR_PTR(ret);
+	}
+
+	// Initialize the misc device parameters
+	adev->miscdev.minor = MISC_DYNAMIC_MINOR;
+	adev->miscdev.name = comp->name;
+	adev->fops = avalon_fops;
+	adev->fops.owner = comp->owner;
+	adev->miscdev.fops = &adev->fops;
+	adev->miscdev.parent = &pdev->dev;
+	adev->miscdev.groups = adev->groups;
+
+	// Register the misc device; this creates a char dev at /dev/<name>
+	ret = misc_register(&adev->miscdev);
+	if (ret) {
+		return ERR_PTR(ret);
+	}
+
+	adev->debugfs = debugfs_create_dir(dev_name(&pdev->dev),
+	                                   avalon_debugfs_root);
+	lat_hist_debugfs_create("write_latency", adev->debugfs,
+	                        &adev->write_lat);
+
+	return adev;
+}
+EXPORT_SYMBOL_GPL(avalon_probe);
+
+/*
+ * avalon_remove() - Tear down an Avalon component
+ * @pdev: Platform device structure associated with the component.
+ */
+void avalon_remove(struct platform_device *pdev)
+{
+	struct avalon_dev *adev = platform_get_drvdata(pdev);
+
+	debugfs_remove_recursive(adev->debugfs);
+
+	// Deregister the misc device and remove the /dev/<name> file.
+	misc_deregister(&adev->miscdev);
+}
+EXPORT_SYMBOL_GPL(avalon_remove);
+
+static int __init avalon_init(void)
+{
+	avalon_debugfs_root = debugfs_create_dir("avalon", NULL);
+
+	return 0;
+}
+
+static void __exit avalon_exit(void)
+{
+	debugfs_remove_recursive(avalon_debugfs_root);
+}
+
+module_init(avalon_init);
+module_exit(avalon_exit);
+
+MODULE_LICENSE("Dual MIT/GPL");
+MODULE_DESCRIPTION("Register-map core for Avalon component drivers");
+MODULE_VERSION("1.0");
@@ -0,0 +1,193 @@
+/* SPDX-License-Identifier: GPL-2.0 or MIT                               */
+/*-------------------------------------------------------------------------
+ * Description:  Register-map core shared by the Avalon component drivers
+ *               (combFilter, compFilterProcessor, wahWahEffectProcessor,
+ *               fftAnalysisSynthesisProcessor, adc_0)
+ * ------------------------------------------------------------------------
+ * License : GPL-2.0 or MIT (opensource.org / licenses / MIT, GPL-2.0)
+-------------------------------------------------------------------------*/
+#ifndef AVALON_REGMAP_H
+#define AVALON_REGMAP_H
+
+#include <linux/types.h>
+#include <linux/bits.h>
+#include <linux/mutex.h>
+#include <linux/miscdevice.h>
+#include <linux/notifier.h>
+#include <linux/platform_device.h>
+#include <linux/regmap.h>
+#include <linux/sysfs.h>
+#include "lat_hist.h"
+
+/*-----------------------------------------------------------------------*/
+/* DEFINE STATEMENTS                                                     */
+/*-----------------------------------------------------------------------*/
+/* Register access flags */
+#define AVALON_REG_R        BIT(0)  /* readable from user space */
+#define AVALON_REG_W        BIT(1)  /* writeable from user space */
+#define AVALON_REG_RW       (AVALON_REG_R | AVALON_REG_W)
+#define AVALON_REG_VOLATILE BIT(2)  /* changed by the fabric; never cached */
+
+/* Largest register span a component may declare */
+#define AVALON_MAX_SPAN 0x80
+
+/* Sample rate assumed until the codec driver reports one */
+#define AVALON_DEFAULT_RATE 48000
+
+/* Notifier action: the sample rate changed; data is a struct avalon_rate_change */
+#define AVALON_RATE_CHANGE 1
+
+/*
+ * enum avalon_parse - How a sysfs write to a register is parsed
+ */
+enum avalon_parse {
+	AVALON_PARSE_BOOL,
+	AVALON_PARSE_U8,
+	AVALON_PARSE_U16,
+	AVALON_PARSE_U32,
+};
+
+/*
+ * struct avalon_reg - One register of an Avalon component
+ * @name: Name of the register; also the name of its sysfs attribute
+ * @offset: Byte offset of the register in the component's span
+ * @width: Number of bits the register holds; sysfs writes that don't fit
+ *         are rejected and sysfs reads are masked to this width
+ * @access: AVALON_REG_* flags
+ * @parse: How sysfs writes are parsed
+ */
+struct avalon_reg {
+	const char *name;
+	unsigned int offset;
+	unsigned int width;
+	unsigned int access;
+	enum avalon_parse parse;
+};
+
+#define AVALON_REG(_name, _offset, _width, _access, _parse)	\
+	{							\
+		.name = #_name,					\
+		.offset = (_offset),				\
+		.width = (_width),				\
+		.access = (_access),				\
+		.parse = (_parse),				\
+	}
+
+struct avalon_dev;
+
+/*
+ * struct avalon_platform_data - Optional platform data for a component
+ * @base: Mapping to use instead of the device's MEM resource. Lets a
+ *        platform device that is not behind the HPS-to-FPGA bridge (e.g.
+ *        one backed by kernel memory on a build host) bind to the
+ *        unmodified component driver. It must cover the whole span.
+ *        A MEM resource, if the device has one, must describe the same
+ *        memory; it is only used by mmap() and is never requested.
+ */
+struct avalon_platform_data {
+	void __iomem *base;
+};
+
+/*
+ * struct avalon_component - Description of an Avalon component
+ * @name: Name of the misc device (/dev/<name>)
+ * @regs: Register table
+ * @num_regs: Number of entries in @regs
+ * @span: Memory span of all registers (used or not) in the component
+ * @groups: Optional NULL terminated list of extra sysfs attribute groups
+ *          for attributes that don't map 1:1 onto a register
+ * @ioctl: Optional ioctl handler for the component's char device
+ * @owner: The component driver's module (THIS_MODULE); it is pinned
+ *         while the char device is open
+ */
+struct avalon_component {
+	struct module *owner;
+	const char *name;
+	const struct avalon_reg *regs;
+	unsigned int num_regs;
+	unsigned int span;
+	const struct attribute_group **groups;
+	long (*ioctl)(struct avalon_dev *adev, unsigned int cmd,
+		      unsigned long arg);
+};
+
+/*
+ * struct avalon_dev - Private device struct of an Avalon component
+ * @miscdev: miscdevice used to create a char device for the component.
+ *           Must stay the first member: the misc device's drvdata points
+ *           at it, so dev_get_drvdata() works on both the platform
+ *           device and the misc device.
+ * @fops: File operations of @miscdev, owned by the component's module
+ * @dev: The platform device's struct device
+ * @base_addr: Base address of the component
+ * @res: Physical memory resource of the register span; used by mmap().
+ *       NULL when the span comes from struct avalon_platform_data and
+ *       the device has no MEM resource.
+ * @regmap: regmap-mmio map of the span, with a flat register cache
+ * @lock: mutex used to serialize multi-register updates
+ * @comp: The component description
+ * @slots: Register table entry for each 32-bit word of the span
+ * @reg_attrs: One sysfs attribute per register, in @comp->regs order
+ * @group: Attribute group holding @reg_attrs and cache_bypass
+ * @groups: @group followed by @comp->groups
+ * @cache_bypass: When set, reads go to the hardware instead of the cache
+ * @write_lat: Latency of sysfs stores and char device writes
+ * @debugfs: Our directory under <debugfs>/avalon
+ * @drvdata: Private data of the component driver
+ *
+ * An avalon_dev struct gets created for each component in the system.
+ */
+struct avalon_dev {
+	struct miscdevice miscdev;
+	struct file_operations fops;
+	struct device *dev;
+	void __iomem *base_addr;
+	struct resource *res;
+	struct regmap *regmap;
+	struct mutex lock;
+	const struct avalon_component *comp;
+	const struct avalon_reg **slots;
+	struct device_attribute *reg_attrs;
+	struct attribute_group group;
+	const struct attribute_group **groups;
+	bool cache_bypass;
+	struct lat_hist write_lat;
+	struct dentry *debugfs;
+	void *drvdata;
+};
+
+/*
+ * struct avalon_rate_change - Data passed to the sample rate notifier
+ * @old_rate: Sample rate in Hz the fabric ran at until now
+ * @new_rate: Sample rate in Hz it runs at from now on
+ */
+struct avalon_rate_change {
+	unsigned int old_rate;
+	unsigned int new_rate;
+};
+
+struct avalon_dev *avalon_probe(struct platform_device *pdev,
+				const struct avalon_component *comp);
+void avalon_remove(struct platform_device *pdev);
+
+int avalon_reg_read(struct avalon_dev *adev, unsigned int offset, u32 *val);
+int avalon_reg_write(struct avalon_dev *adev, unsigned int offset, u32 val);
+int avalon_multi_reg_write(struct avalon_dev *adev,
+			   const struct reg_sequence *regs, int num_regs);
+
+int avalon_rate_notifier_register(struct notifier_block *nb,
+				  unsigned int *rate);
+int avalon_rate_notifier_unregister(struct notifier_block *nb);
+int avalon_set_sample_rate(unsigned int rate);
+unsigned int avalon_get_sample_rate(void);
+
+/*
+ * avalon_get_dev() - Get the avalon_dev behind a platform or misc device
+ * @dev: The platform device's or the misc device's struct device
+ */
+static inline struct avalon_dev *avalon_get_dev(struct device *dev)
+{
+	return dev_get_drvdata(dev);
+}
+
+#endif /* AVALON_REGMAP_H */
@@ -0,0 +1,86 @@
+/* SPDX-License-Identifier: GPL-2.0 or MIT                               */
+/*-------------------------------------------------------------------------
+ * Description:  Tracepoints for the Avalon register-map core
+ * ------------------------------------------------------------------------
+ * Both events fire once the register writes have completed and carry the
+ * time taken since the driver entry point (sysfs store or char device
+ * write), lock wait and parsing included, e.g.
+ *
+ *   echo 1 > /sys/kernel/tracing/events/avalon/enable
+ * ------------------------------------------------------------------------
+ * License : GPL-2.0 or MIT (opensource.org / licenses / MIT, GPL-2.0)
+-------------------------------------------------------------------------*/
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM avalon
+
+#if !defined(AVALON_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define AVALON_TRACE_H
+
+#include <linux/tracepoint.h>
+
+TRACE_EVENT(avalon_reg_store,
+
+	TP_PROTO(const char *dev, const char *reg, unsigned int offset,
+		 u32 val, int ret, u64 ns),
+
+	TP_ARGS(dev, reg, offset, val, ret, ns),
+
+	TP_STRUCT__entry(
+		__string(dev, dev)
+		__string(reg, reg)
+		__field(unsigned int, offset)
+		__field(u32, val)
+		__field(int, ret)
+		__field(u64, ns)
+	),
+
+	TP_fast_assign(
+		__assign_str(dev, dev);
+		__assign_str(reg, reg);
+		__entry->offset = offset;
+		__entry->val = val;
+		__entry->ret = ret;
+		__entry->ns = ns;
+	),
+
+	TP_printk("%s %s @0x%02x = 0x%08x ret=%d ns=%llu",
+		  __get_str(dev), __get_str(reg), __entry->offset,
+		  __entry->val, __entry->ret, __entry->ns)
+);
+
+TRACE_EVENT(avalon_write,
+
+	TP_PROTO(const char *dev, unsigned int offset, unsigned int nregs,
+		 int ret, u64 ns),
+
+	TP_ARGS(dev, offset, nregs, ret, ns),
+
+	TP_STRUCT__entry(
+		__string(dev, dev)
+		__field(unsigned int, offset)
+		__field(unsigned int, nregs)
+		__field(int, ret)
+		__field(u64, ns)
+	),
+
+	TP_fast_assign(
+		__assign_str(dev, dev);
+		__entry->offset = offset;
+		__entry->nregs = nregs;
+		__entry->ret = ret;
+		__entry->ns = ns;
+	),
+
+	TP_printk("%s @0x%02x nregs=%u ret=%d ns=%llu",
+		  __get_str(dev), __entry->offset, __entry->nregs,
+		  __entry->ret, __entry->ns)
+);
+
+#endif /* AVALON_TRACE_H */
+
+/* This part must be outside protection */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE avalon_trace
+#include <trace/define_trace.h>
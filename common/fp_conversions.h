@@ -0,0 +1,161 @@
+/* SPDX-License-Identifier: GPL-2.0 or MIT                               */
+/*-------------------------------------------------------------------------
+ * Description:  Decimal string <-> signed fixed-point conversions
+ * ------------------------------------------------------------------------
+ * Replaces the set_fixed_num()/fp_to_string()/strcat2() copies that lived
+ * in each driver. Both directions are a single pass over the string,
+ * round to nearest (ties away from zero) and handle negative values.
+ * Values are s32 with frac_bits fractional bits, so frac_bits = 16 is
+ * Q16.16 and frac_bits = 28 is Q4.28.
+ *
+ * Header-only so that the codec drivers can use it without linking
+ * against the Avalon core.
+ * ------------------------------------------------------------------------
+ * License : GPL-2.0 or MIT (opensource.org / licenses / MIT, GPL-2.0)
+-------------------------------------------------------------------------*/
+#ifndef FP_CONVERSIONS_H
+#define FP_CONVERSIONS_H
+
+#include <linux/errno.h>
+#include <linux/kernel.h>
+#include <linux/math64.h>
+#include <linux/types.h>
+
+/* Most digits fp_format() prints after the decimal point */
+#define FP_MAX_DIGITS 9
+
+/*
+ * Fractional digits fp_parse() reads. Further ones move even a Q2.30
+ * value by only about 1e-9 of its last bit; they're ignored.
+ */
+#define FP_PARSE_DIGITS (2 * FP_MAX_DIGITS)
+
+/* Big enough for "-2147483648." plus FP_MAX_DIGITS digits and a NUL */
+#define FP_STR_MAX 24
+
+/*
+ * fp_parse() - Parse a decimal string into a fixed-point value
+ * @s: String such as "-3.75", ".5" or "48"; one trailing newline (as
+ *     written by echo into sysfs) is allowed.
+ * @frac_bits: Number of fractional bits of the result (0..30).
+ * @res: Where to store the result.
+ *
+ * Return: 0 on success, -EINVAL if @s isn't a decimal number, or -ERANGE
+ * if it doesn't fit the format.
+ */
+static inline int fp_parse(const char *s, unsigned int frac_bits, s32 *res)
+{
+	u64 ipart = 0;
+	u64 hi = 0;
+	u64 lo = 0;
+	u64 rem;
+	u64 mag;
+	unsigned int n = 0;
+	bool neg = false;
+	bool digits = false;
+
+	if (*s == '-' || *s == '+') {
+		neg = (*s == '-');
+		s++;
+	}
+
+	for (; *s >= '0' && *s <= '9'; s++) {
+		ipart = ipart * 10 + (*s - '0');
+		// -2147483648 still fits with frac_bits = 0
+		if (ipart > (u64)S32_MAX + 1) {
+			return -ERANGE;
+		}
+		digits = true;
+	}
+
+	// The fraction is hi / 10^9 + lo / 10^18
+	if (*s == '.') {
+		for (s++; *s >= '0' && *s <= '9'; s++) {
+			if (n < FP_MAX_DIGITS) {
+				hi = hi * 10 + (*s - '0');
+			} else if (n < FP_PARSE_DIGITS) {
+				lo = lo * 10 + (*s - '0');
+			}
+			if (n < FP_PARSE_DIGITS) {
+				n++;
+			}
+			digits = true;
+		}
+	}
+	for (; n < FP_PARSE_DIGITS; n++) {
+		if (n < FP_MAX_DIGITS) {
+			hi *= 10;
+		} else {
+			lo *= 10;
+		}
+	}
+
+	if (*s == '\n') {
+		s++;
+	}
+	if (*s != '\0' || !digits) {
+		return -EINVAL;
+	}
+
+	// Round the fraction to the nearest 1/2^frac_bits, in two halves so
+	// that nothing overflows 64 bits
+	mag = (ipart << frac_bits) +
+	      div64_u64_rem(hi << frac_bits, 1000000000ULL, &rem);
+	mag += div64_u64(rem * 1000000000ULL + (lo << frac_bits) +
+	                 500000000000000000ULL, 1000000000000000000ULL);
+
+	if (mag > (u64)S32_MAX + neg) {
+		return -ERANGE;
+	}
+
+	*res = neg ? (s32)-mag : (s32)mag;
+
+	return 0;
+}
+
+/*
+ * fp_format() - Format a fixed-point value as a decimal string
+ * @buf: Output buffer.
+ * @size: Size of @buf; FP_STR_MAX is always enough.
+ * @val: The value.
+ * @frac_bits: Number of fractional bits of @val (0..30).
+ * @decimals: Number of digits after the decimal point (0..FP_MAX_DIGITS).
+ *
+ * Values that round to zero print as "0.000", never "-0.000".
+ *
+ * Return: The number of characters written, not counting the NUL.
+ */
+static inline int fp_format(char *buf, size_t size, s32 val,
+	unsigned int frac_bits, unsigned int decimals)
+{
+	u64 mag = val < 0 ? -(s64)val : val;
+	u64 ipart = mag >> frac_bits;
+	u64 pow10 = 1;
+	u64 fpart;
+	const char *sign;
+	unsigned int i;
+
+	for (i = 0; i < decimals; i++) {
+		pow10 *= 10;
+	}
+
+	// Round the fraction to the nearest 10^-decimals; it may carry
+	fpart = ((mag & ((1ULL << frac_bits) - 1)) * pow10 +
+	         (1ULL << frac_bits) / 2) >> frac_bits;
+	if (fpart >= pow10) {
+		ipart++;
+		fpart -= pow10;
+	}
+
+	// A negative value that rounds to zero prints without a sign
+	sign = (val < 0 && (ipart || fpart)) ? "-" : "";
+
+	if (decimals == 0) {
+		return scnprintf(buf, size, "%s%llu", sign, ipart);
+	}
+
+	return scnprintf(buf, size, "%s%llu.%0*llu", sign, ipart, decimals,
+	                 fpart);
+}
+
+#endif /* FP_CONVERSIONS_H */
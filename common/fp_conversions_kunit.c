@@ -0,0 +1,498 @@
+/* SPDX-License-Identifier: GPL-2.0 or MIT                               */
+/*-------------------------------------------------------------------------
+ * Description:  KUnit test of fp_conversions.h
+ * ------------------------------------------------------------------------
+ * Checks fp_parse() and fp_format() at the edges: rounding of the last
+ * bit and the last printed digit, negative values, the limits of the
+ * format, and malformed input. fp_bench times both against the
+ * set_fixed_num()/fp_to_string() pair they replaced and reports ns per
+ * call; it never fails.
+ *
+ * Built as its own module when the kernel has CONFIG_KUNIT; see Kbuild.
+ * ------------------------------------------------------------------------
+ * License : GPL-2.0 or MIT (opensource.org / licenses / MIT, GPL-2.0)
+-------------------------------------------------------------------------*/
+#include <kunit/test.h>
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include <linux/ktime.h>
+#include "fp_conversions.h"
+
+/* A value fp_parse() must leave alone when it fails */
+#define FP_UNTOUCHED 0x5a5a5a5a
+
+struct fp_parse_case {
+	const char *s;
+	unsigned int frac_bits;
+	int ret;
+	s32 val;
+};
+
+static void fp_parse_check(struct kunit *test, const struct fp_parse_case *c,
+	size_t n)
+{
+	s32 val;
+	size_t i;
+
+	for (i = 0; i < n; i++) {
+		val = FP_UNTOUCHED;
+		KUNIT_EXPECT_EQ_MSG(test, fp_parse(c[i].s, c[i].frac_bits, &val),
+		                    c[i].ret, "\"%s\" Q%u", c[i].s, c[i].frac_bits);
+		KUNIT_EXPECT_EQ_MSG(test, val,
+		                    c[i].ret ? FP_UNTOUCHED : c[i].val,
+		                    "\"%s\" Q%u", c[i].s, c[i].frac_bits);
+	}
+}
+
+/* Plain values, with and without sign, point, leading digit and newline */
+static void fp_parse_values(struct kunit *test)
+{
+	static const struct fp_parse_case cases[] = {
+		{ "48", 16, 0, 48 << 16 },
+		{ "-3.75", 16, 0, -(15 << 14) },
+		{ "+3.75", 16, 0, 15 << 14 },
+		{ ".5", 16, 0, 1 << 15 },
+		{ "-.5", 16, 0, -(1 << 15) },
+		{ "1.", 16, 0, 1 << 16 },
+		{ "0", 16, 0, 0 },
+		{ "-0", 16, 0, 0 },
+		{ "-12.5\n", 16, 0, -(25 << 15) },
+		{ "0.25", 28, 0, 1 << 26 },
+		{ "-1", 0, 0, -1 },
+		{ "007.500", 16, 0, 15 << 15 },
+	};
+
+	fp_parse_check(test, cases, ARRAY_SIZE(cases));
+}
+
+/*
+ * The last bit rounds to nearest, ties away from zero. In Q16.16 half a
+ * bit is exactly 0.00000762939453125; in Q4.28 the tenth fractional digit
+ * still decides it.
+ */
+static void fp_parse_rounding(struct kunit *test)
+{
+	static const struct fp_parse_case cases[] = {
+		{ "0.00000762939453125", 16, 0, 1 },
+		{ "0.00000762939453124", 16, 0, 0 },
+		{ "-0.00000762939453125", 16, 0, -1 },
+		{ "-0.00000762939453124", 16, 0, 0 },
+		{ "1.00002288818359375", 16, 0, (1 << 16) + 2 },
+		{ "0.0000000019", 28, 0, 1 },
+		{ "0.0000000018", 28, 0, 0 },
+		{ "-0.0000000019", 28, 0, -1 },
+		{ "0.1", 16, 0, 6554 },
+		{ "-0.1", 16, 0, -6554 },
+		{ "0.000000000000000000001", 30, 0, 0 },
+	};
+
+	fp_parse_check(test, cases, ARRAY_SIZE(cases));
+}
+
+/* Values that don't fit once rounded are refused, the extremes accepted */
+static void fp_parse_range(struct kunit *test)
+{
+	static const struct fp_parse_case cases[] = {
+		{ "7.9999999999", 28, -ERANGE, 0 },
+		{ "7.999999998", 28, 0, S32_MAX },
+		{ "8", 28, -ERANGE, 0 },
+		{ "-8", 28, 0, S32_MIN },
+		{ "-8.000000002", 28, -ERANGE, 0 },
+		{ "32767.99999", 16, 0, S32_MAX },
+		{ "32768", 16, -ERANGE, 0 },
+		{ "-32768", 16, 0, S32_MIN },
+		{ "2147483647", 0, 0, S32_MAX },
+		{ "2147483648", 0, -ERANGE, 0 },
+		{ "-2147483648", 0, 0, S32_MIN },
+		{ "-2147483649", 0, -ERANGE, 0 },
+		{ "99999999999999999999", 16, -ERANGE, 0 },
+		{ "1.9999999999", 30, -ERANGE, 0 },
+	};
+
+	fp_parse_check(test, cases, ARRAY_SIZE(cases));
+}
+
+/* Anything but one optional sign, digits, one point and one newline */
+static void fp_parse_malformed(struct kunit *test)
+{
+	static const struct fp_parse_case cases[] = {
+		{ "", 16, -EINVAL, 0 },
+		{ "-", 16, -EINVAL, 0 },
+		{ ".", 16, -EINVAL, 0 },
+		{ "-.", 16, -EINVAL, 0 },
+		{ "\n", 16, -EINVAL, 0 },
+		{ "abc", 16, -EINVAL, 0 },
+		{ "1.2.3", 16, -EINVAL, 0 },
+		{ "1e3", 16, -EINVAL, 0 },
+		{ " 1", 16, -EINVAL, 0 },
+		{ "1 ", 16, -EINVAL, 0 },
+		{ "1\n\n", 16, -EINVAL, 0 },
+		{ "--1", 16, -EINVAL, 0 },
+		{ "+-1", 16, -EINVAL, 0 },
+		{ "0x10", 16, -EINVAL, 0 },
+		{ "1,5", 16, -EINVAL, 0 },
+	};
+
+	fp_parse_check(test, cases, ARRAY_SIZE(cases));
+}
+
+struct fp_format_case {
+	s32 val;
+	unsigned int frac_bits;
+	unsigned int decimals;
+	const char *s;
+};
+
+static void fp_format_check(struct kunit *test,
+	const struct fp_format_case *c, size_t n)
+{
+	char buf[FP_STR_MAX];
+	size_t i;
+	int len;
+
+	for (i = 0; i < n; i++) {
+		len = fp_format(buf, sizeof(buf), c[i].val, c[i].frac_bits,
+		                c[i].decimals);
+		KUNIT_EXPECT_STREQ_MSG(test, buf, c[i].s, "%d Q%u, %u decimals",
+		                       c[i].val, c[i].frac_bits, c[i].decimals);
+		KUNIT_EXPECT_EQ(test, len, (int)strlen(c[i].s));
+	}
+}
+
+/* The last printed digit rounds to nearest, ties away from zero, and carries */
+static void fp_format_rounding(struct kunit *test)
+{
+	static const struct fp_format_case cases[] = {
+		{ 3 << 16, 16, 1, "3.0" },
+		{ -(15 << 14), 16, 2, "-3.75" },
+		{ 5 << 14, 16, 1, "1.3" },
+		{ -(5 << 14), 16, 1, "-1.3" },
+		{ (5 << 14) - 1, 16, 1, "1.2" },
+		{ 1 << 15, 16, 0, "1" },
+		{ -(1 << 15), 16, 0, "-1" },
+		{ (1 << 15) - 1, 16, 0, "0" },
+		{ 65535, 16, 3, "1.000" },
+		{ -65535, 16, 3, "-1.000" },
+		{ (9 << 16) + 65535, 16, 2, "10.00" },
+		{ 1, 16, 9, "0.000015259" },
+	};
+
+	fp_format_check(test, cases, ARRAY_SIZE(cases));
+}
+
+/* A negative value that rounds to zero prints as zero, without a sign */
+static void fp_format_negative_zero(struct kunit *test)
+{
+	static const struct fp_format_case cases[] = {
+		{ -1, 16, 3, "0.000" },
+		{ -1, 16, 0, "0" },
+		{ -(1 << 15) + 1, 16, 0, "0" },
+		{ -32, 16, 3, "0.000" },
+		{ -33, 16, 3, "-0.001" },
+		{ -1, 28, 8, "0.00000000" },
+		{ -1, 28, 9, "-0.000000004" },
+	};
+
+	fp_format_check(test, cases, ARRAY_SIZE(cases));
+}
+
+/* The extremes of every format fit FP_STR_MAX */
+static void fp_format_limits(struct kunit *test)
+{
+	static const struct fp_format_case cases[] = {
+		{ S32_MIN, 0, 0, "-2147483648" },
+		{ S32_MIN, 0, FP_MAX_DIGITS, "-2147483648.000000000" },
+		{ S32_MAX, 0, 0, "2147483647" },
+		{ S32_MIN, 16, FP_MAX_DIGITS, "-32768.000000000" },
+		{ S32_MAX, 16, 1, "32768.0" },
+		{ S32_MAX, 28, FP_MAX_DIGITS, "7.999999996" },
+		{ S32_MIN, 30, FP_MAX_DIGITS, "-2.000000000" },
+	};
+
+	fp_format_check(test, cases, ARRAY_SIZE(cases));
+}
+
+/* Formatting with enough digits and parsing back gives the same value */
+static void fp_round_trip(struct kunit *test)
+{
+	char buf[FP_STR_MAX];
+	s32 val, back = 0;
+	s64 v;
+
+	// An odd step walks through the low bits as well as the high ones
+	for (v = S32_MIN; v <= S32_MAX; v += 65537 * 3 + 2) {
+		val = v;
+		fp_format(buf, sizeof(buf), val, 16, 6);
+		KUNIT_EXPECT_EQ_MSG(test, fp_parse(buf, 16, &back), 0, "%s", buf);
+		KUNIT_EXPECT_EQ_MSG(test, back, val, "%s", buf);
+
+		fp_format(buf, sizeof(buf), val, 28, FP_MAX_DIGITS);
+		KUNIT_EXPECT_EQ_MSG(test, fp_parse(buf, 28, &back), 0, "%s", buf);
+		KUNIT_EXPECT_EQ_MSG(test, back, val, "%s", buf);
+	}
+}
+
+/*-----------------------------------------------------------------------*/
+/* The conversions fp_conversions.h replaced, as they were in ad1939.c   */
+/*-----------------------------------------------------------------------*/
+struct fixed_num
+{
+    int integer;
+    int fraction;
+    int fraction_len;
+};
+
+static char *strcat2(char *dst, char *src)
+{
+    char *cp = dst;
+
+    while (*cp)
+        cp++; /* find end of dst */
+
+    while (( *cp++ = *src++ ) != 0); /* Copy src to end of dst */
+
+    return dst; /* return dst */
+}
+
+static uint32_t set_fixed_num(const char *s)
+{
+    struct fixed_num num = {0, 0, 0};
+    int seen_point = 0;
+    int pointIndex;
+    int i;
+    int ii;
+    int frac_comp;
+    uint32_t acc = 0;
+    char s2[80];
+    int pointsSeen = 0;
+    int charIndex = 0;
+
+    //If no leading 0, add one (eg: .25 -> 0.25)
+    if (s[0] == '.')
+    {
+        s2[0] = '0';
+        charIndex++;
+    }
+
+    //This is a strcpy() to move the data a "const char *" to a "char *" and validate the data
+    for (i = 0; i < strlen(s); i++)
+    {
+        //Make sure the string contains an non-valid char (eg: not a number or a decimal point)
+        if ((s[i] == '.') || (s[i] >= '0' && s[i] <= '9'))
+        {
+            //Copy the data over and increment the pointer
+            s2[charIndex] = s[i];
+            charIndex++;
+        }
+        else
+        {
+            pr_info("Invalid char (c:%c x:%X) in number %s\n", s[i], s[i], s);
+            return 0x00000000;
+        }
+
+        //Count the number of decimals in the string
+        if (s[i] == '.')
+            pointsSeen++;
+    }
+
+    //If multiple decimals points in the number (eg: 1.1.4)
+    if (pointsSeen > 1)
+        pr_info("Invalid number format: %s\n", s);
+
+    //Make sure the string is terminated
+    s2[i] = '\0';
+
+    //Count the fractional digits
+    for (pointIndex = 0; pointIndex < strlen(s2); pointIndex++)
+    {
+        if (s2[pointIndex] == '.')
+            break;
+    }
+
+    //String extend so that the output is accurate
+    while (strlen(s2) - pointIndex < 9)
+        strcat2(s2, "0");
+
+    //Truncate the string if its longer
+    s2[strlen(s2) - pointIndex + 9] = '\0';
+
+    //Covert to fixed point
+    for (i = 0; i < 10; i++)
+    {
+        if (s2[i] == '.')
+        {
+            seen_point = 1;
+            continue;
+        }
+        if (!seen_point)
+        {
+            num.integer *= 10;
+            num.integer += (int)(s2[i] - '0');
+        }
+        else
+        {
+            num.fraction_len++;
+            num.fraction *= 10;
+            num.fraction += (int)(s2[i] - '0');
+        }
+    }
+
+    //Turn the fixed point conversion into binary digits
+    for (ii = 0, frac_comp = 1; ii < num.fraction_len; ii++) frac_comp *= 10;
+    frac_comp /= 2;
+
+    // Get the fractional part (f28 hopefully)
+    for (ii = 0; i <= 36; i++)
+    {
+        if (num.fraction >= frac_comp)
+        {
+            acc |= 0x00000001;
+            num.fraction -= frac_comp;
+        }
+        frac_comp /= 2;
+
+        acc = acc << 1;
+    }
+
+    acc = acc >> 12;
+
+    //Combine the fractional part with the integer
+    acc += num.integer << 16;
+
+    return acc;
+}
+
+static int fp_to_string(char *buf, uint32_t fp28_num)
+{
+    int buf_pos = 0;
+    int i;
+    int fractionPart;
+    int intPart = 1;
+    int i16 = 0;
+
+    if (fp28_num & 0x80000000)
+    {
+        fp28_num *= -1;
+
+        buf[buf_pos] = '-';
+        buf_pos++;
+    }
+
+    //Convert the integer part
+    i16 = (fp28_num >> 16);
+    while ( (i16 / intPart) > 9)
+    {
+        intPart *= 10;
+    }
+
+    while (intPart > 0)
+    {
+        buf[buf_pos] = (char)((i16 / intPart) + '0');
+        buf_pos++;
+
+        i16 = i16 % intPart;
+        intPart = intPart / 10;
+    }
+
+    buf[buf_pos] = '.';
+    buf_pos++;
+
+    //Mask the integer bits and dump 1 bit to make the conversion easier....
+    fractionPart = (0x0000FFFF & fp28_num) >> 1; // 32F27 so that 0-9 can fit in the high 5 bits)
+
+    for (i = 0; i < 8; i++)
+    {
+        fractionPart *= 10;
+        buf[buf_pos] = (fractionPart >> 15) + '0';
+        buf_pos++;
+        fractionPart &= 0x00007FFF;
+    }
+
+    buf[buf_pos] = '\0';
+
+    return 0;
+}
+
+/*-----------------------------------------------------------------------*/
+/* Throughput                                                            */
+/*-----------------------------------------------------------------------*/
+#define FP_BENCH_ROUNDS 20000
+
+/* Typical sysfs input: volumes in dB and sample rates in kHz */
+static const char *const fp_bench_strings[] = {
+	"0", "12.5", "95.625", "48", "44.1", "0.375", "3.0", "60.0000001",
+};
+
+/*
+ * fp_bench() - Report ns per call of the old and the new conversions
+ *
+ * Only non-negative Q16.16 values, the one format the old pair handled.
+ * The sink keeps the compiler from dropping the calls.
+ */
+static void fp_bench(struct kunit *test)
+{
+	char buf[FP_STR_MAX];
+	unsigned int n = ARRAY_SIZE(fp_bench_strings);
+	u32 sink = 0;
+	u64 start, old_ns, new_ns;
+	s32 val = 0;
+	int i;
+
+	start = ktime_get_ns();
+	for (i = 0; i < FP_BENCH_ROUNDS; i++) {
+		sink += set_fixed_num(fp_bench_strings[i % n]);
+	}
+	old_ns = ktime_get_ns() - start;
+
+	start = ktime_get_ns();
+	for (i = 0; i < FP_BENCH_ROUNDS; i++) {
+		fp_parse(fp_bench_strings[i % n], 16, &val);
+		sink += val;
+	}
+	new_ns = ktime_get_ns() - start;
+
+	kunit_info(test, "parse: set_fixed_num %llu ns, fp_parse %llu ns per call\n",
+	           div_u64(old_ns, FP_BENCH_ROUNDS),
+	           div_u64(new_ns, FP_BENCH_ROUNDS));
+
+	start = ktime_get_ns();
+	for (i = 0; i < FP_BENCH_ROUNDS; i++) {
+		fp_to_string(buf, (u32)i << 10);
+		sink += buf[0];
+	}
+	old_ns = ktime_get_ns() - start;
+
+	start = ktime_get_ns();
+	for (i = 0; i < FP_BENCH_ROUNDS; i++) {
+		fp_format(buf, sizeof(buf), i << 10, 16, 8);
+		sink += buf[0];
+	}
+	new_ns = ktime_get_ns() - start;
+
+	kunit_info(test, "format: fp_to_string %llu ns, fp_format %llu ns per call (sink %u)\n",
+	           div_u64(old_ns, FP_BENCH_ROUNDS),
+	           div_u64(new_ns, FP_BENCH_ROUNDS), sink);
+}
+
+static struct kunit_case fp_conversions_cases[] = {
+	KUNIT_CASE(fp_parse_values),
+	KUNIT_CASE(fp_parse_rounding),
+	KUNIT_CASE(fp_parse_range),
+	KUNIT_CASE(fp_parse_malformed),
+	KUNIT_CASE(fp_format_rounding),
+	KUNIT_CASE(fp_format_negative_zero),
+	KUNIT_CASE(fp_format_limits),
+	KUNIT_CASE(fp_round_trip),
+	KUNIT_CASE(fp_bench),
+	{}
+};
+
+static struct kunit_suite fp_conversions_suite = {
+	.name = "fp_conversions",
+	.test_cases = fp_conversions_cases,
+};
+kunit_test_suite(fp_conversions_suite);
+
+MODULE_LICENSE("Dual MIT/GPL");
+MODULE_DESCRIPTION("KUnit test of the fixed-point string conversions");
@@ -0,0 +1,115 @@
+/* SPDX-License-Identifier: GPL-2.0 or MIT                               */
+/*-------------------------------------------------------------------------
+ * Description:  log2 latency histogram exported through debugfs
+ * ------------------------------------------------------------------------
+ * Header-only so that drivers which don't link against the Avalon core
+ * (tpa613a2) can use it too. Bucket n counts accesses that took
+ * [2^n, 2^(n+1)) ns; bucket 0 also holds 0 ns. Reading the debugfs file
+ * prints the non-empty buckets, writing anything to it clears them.
+ * The debugfs glue is static and __maybe_unused, so every includer gets
+ * its own copy (with its own THIS_MODULE) without W=1 warnings.
+ * ------------------------------------------------------------------------
+ * License : GPL-2.0 or MIT (opensource.org / licenses / MIT, GPL-2.0)
+-------------------------------------------------------------------------*/
+#ifndef LAT_HIST_H
+#define LAT_HIST_H
+
+#include <linux/atomic.h>
+#include <linux/bitops.h>
+#include <linux/debugfs.h>
+#include <linux/fs.h>
+#include <linux/kernel.h>
+#include <linux/seq_file.h>
+#include <linux/types.h>
+
+/* 2^31 ns is ~2 s; anything slower lands in the last bucket */
+#define LAT_HIST_BUCKETS 32
+
+/*
+ * struct lat_hist - log2 histogram of access latencies
+ * @bucket: Number of accesses per power-of-two nanosecond range
+ */
+struct lat_hist {
+	atomic_long_t bucket[LAT_HIST_BUCKETS];
+};
+
+/*
+ * lat_hist_add() - Account one access
+ * @hist: The histogram.
+ * @ns: How long the access took.
+ *
+ * Lock free, so it can be called from any context.
+ */
+static inline void lat_hist_add(struct lat_hist *hist, u64 ns)
+{
+	unsigned int b = ns ? fls64(ns) - 1 : 0;
+
+	atomic_long_inc(&hist->bucket[min_t(unsigned int, b,
+	                                    LAT_HIST_BUCKETS - 1)]);
+}
+
+static inline void lat_hist_reset(struct lat_hist *hist)
+{
+	unsigned int b;
+
+	for (b = 0; b < LAT_HIST_BUCKETS; b++) {
+		atomic_long_set(&hist->bucket[b], 0);
+	}
+}
+
+static int __maybe_unused lat_hist_show(struct seq_file *s, void *unused)
+{
+	struct lat_hist *hist = s->private;
+	unsigned long count;
+	unsigned int b;
+
+	seq_printf(s, "%12s %12s %10s\n", "from_ns", "to_ns", "count");
+	for (b = 0; b < LAT_HIST_BUCKETS; b++) {
+		count = atomic_long_read(&hist->bucket[b]);
+		if (count) {
+			seq_printf(s, "%12llu %12llu %10lu\n",
+			           b ? 1ULL << b : 0ULL, (1ULL << (b + 1)) - 1,
+			           count);
+		}
+	}
+
+	return 0;
+}
+
+static int __maybe_unused lat_hist_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, lat_hist_show, inode->i_private);
+}
+
+static ssize_t __maybe_unused lat_hist_write(struct file *file, const char __user *buf,
+	size_t count, loff_t *offset)
+{
+	struct seq_file *s = file->private_data;
+
+	lat_hist_reset(s->private);
+
+	return count;
+}
+
+static const struct file_operations lat_hist_fops __maybe_unused = {
+	.owner = THIS_MODULE,
+	.open = lat_hist_open,
+	.read = seq_read,
+	.write = lat_hist_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+/*
+ * lat_hist_debugfs_create() - Expose a histogram in debugfs
+ * @name: File name.
+ * @parent: debugfs directory to create the file in.
+ * @hist: The histogram.
+ */
+static inline void lat_hist_debugfs_create(const char *name,
+	struct dentry *parent, struct lat_hist *hist)
+{
+	debugfs_create_file(name, 0644, parent, hist, &lat_hist_fops);
+}
+
+#endif /* LAT_HIST_H */
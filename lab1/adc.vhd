@@ -10,6 +10,7 @@ entity adc is
 		sdo					: 	in		std_logic;
 		channel				:  out	std_logic_vector(3 downto 0);
 		adc_data 			:  out	std_logic_vector(11 downto 0);
+		data_valid			:  out	std_logic;	-- high for one clk when channel/adc_data hold a new sample
 		sck					: 	out 	std_logic;
 		sdi					: 	out 	std_logic; 
 		convst				: 	out	std_logic
@@ -142,6 +143,7 @@ begin
 		variable ch_data_out : std_logic_vector(3 downto 0);
 		begin
 			if (rising_edge(clk)) then
+				data_valid <= '0';
 				case (current_state) is
 					when s0 =>
 						if (cnt = 5) then
@@ -182,6 +184,7 @@ begin
 						if (cnt = 95) then
 							channel <= ch_data_out;
 							adc_data <= shift_reg;
+							data_valid <= '1';
 						end if;
 			end case;
 		end if;
@@ -1,5 +1,17 @@
 library IEEE;
 use IEEE.STD_LOGIC_1164.ALL;
+use IEEE.NUMERIC_STD.ALL;
+
+-- Register map (word addresses):
+--   0x00-0x0F  ch_config_N   most recent sample of channel N (read)
+--   0x10       config_reg    channel enable mask (read/write)
+--   0x11       fifo_data     read pops the oldest sample: bit 31 valid (0 when the FIFO was empty),
+--                            bits 19:16 channel, bits 11:0 sample
+--   0x12       fifo_status   bits 8:0 samples in the FIFO, bit 16 overflow (a sample was lost
+--                            because the FIFO was full); write 1 to bit 16 to clear it
+--   0x13       fifo_ctrl     bits 7:0 watermark, bit 30 flush (write 1, reads 0), bit 31 irq enable
+-- irq is high while it is enabled and the FIFO holds at least watermark samples. A watermark of 0
+-- never interrupts: it would hold irq high even with the FIFO drained.
 
 entity hps_adc is
     port(
@@ -13,7 +25,8 @@ entity hps_adc is
 		  sdo						: in	std_logic;
 		  sck						: out std_logic := '0';
 		  sdi						: out std_logic := '0'; 
-		  convst					: out	std_logic := '0'
+		  convst					: out	std_logic := '0';
+		  irq						: out std_logic                       -- Avalon interrupt sender (level, active high)
     );
 end entity hps_adc;
 
@@ -39,6 +52,22 @@ architecture hps_adc_arch of hps_adc is
 	signal ch_config_15  		:  std_logic_vector(11 downto 0);
 	signal config_reg 	:  std_logic_vector(15 downto 0); 
 	signal channel 	:  std_logic_vector(3 downto 0);
+	signal data_valid 	:  std_logic;
+
+	-- Sample FIFO: {channel, sample} records in arrival order
+	constant FIFO_DEPTH : integer := 256;
+	type fifo_mem_type is array (0 to FIFO_DEPTH - 1) of std_logic_vector(15 downto 0);
+	signal fifo_mem 		:  fifo_mem_type;
+	signal fifo_wr_ptr 	:  unsigned(7 downto 0) := (others => '0');
+	signal fifo_rd_ptr 	:  unsigned(7 downto 0) := (others => '0');
+	signal fifo_level 	:  unsigned(8 downto 0) := (others => '0');
+	signal fifo_overflow :  std_logic := '0';
+	signal fifo_push 		:  std_logic;
+	signal fifo_pop 		:  std_logic;
+	signal fifo_flush 	:  std_logic;
+	signal overflow_clear :  std_logic;
+	signal fifo_watermark :  std_logic_vector(7 downto 0);
+	signal irq_enable 	:  std_logic;
 	
 	-- Component Declarations
 	
@@ -50,6 +79,7 @@ architecture hps_adc_arch of hps_adc is
 		sdo					: 	in		std_logic;
 		channel				:  out	std_logic_vector(3 downto 0);
 		adc_data 			:  out	std_logic_vector(11 downto 0);
+		data_valid			:  out	std_logic;
 		sck					: 	out 	std_logic;
 		sdi					: 	out 	std_logic; 
 		convst				: 	out	std_logic
@@ -58,7 +88,7 @@ architecture hps_adc_arch of hps_adc is
 
 begin
 	adc_0 : adc port map(clk => clk, reset => reset, config_reg => config_reg, sdo => sdo, channel => channel, adc_data => adc_data,
-								sck => sck, sdi => sdi, convst => convst);
+								data_valid => data_valid, sck => sck, sdi => sdi, convst => convst);
 								
 	-- Concurrent Statements and processes (including Avalon bus interfacing and register creation)
 	process(clk)
@@ -87,6 +117,53 @@ begin
 	end process;
 		
 	
+	-- FIFO strobes: a new sample, a read of fifo_data, and the write-1 bits of fifo_status and fifo_ctrl
+	fifo_push <= data_valid;
+	fifo_pop <= '1' when (avs_s1_read = '1' and avs_s1_address = "10001" and fifo_level /= 0) else '0';
+	fifo_flush <= '1' when (avs_s1_write = '1' and avs_s1_address = "10011" and avs_s1_writedata(30) = '1') else '0';
+	overflow_clear <= '1' when (avs_s1_write = '1' and avs_s1_address = "10010" and avs_s1_writedata(16) = '1') else '0';
+
+	irq <= '1' when (irq_enable = '1' and fifo_watermark /= x"00" and fifo_level >= unsigned(fifo_watermark)) else '0';
+
+	sample_fifo : process (clk, reset)
+		variable level : unsigned(8 downto 0);
+		begin
+			if reset = '1' then
+				fifo_wr_ptr <= (others => '0');
+				fifo_rd_ptr <= (others => '0');
+				fifo_level <= (others => '0');
+				fifo_overflow <= '0';
+
+			elsif rising_edge(clk) then
+				level := fifo_level;
+
+				if (fifo_flush = '1') then
+					fifo_rd_ptr <= fifo_wr_ptr;
+					level := (others => '0');
+				elsif (fifo_pop = '1') then
+					fifo_rd_ptr <= fifo_rd_ptr + 1;
+					level := level - 1;
+				end if;
+
+				-- A sample that finds the FIFO full (after this clock's pop) is dropped
+				if (fifo_push = '1') then
+					if (level < FIFO_DEPTH) then
+						fifo_mem(to_integer(fifo_wr_ptr)) <= channel & adc_data;
+						fifo_wr_ptr <= fifo_wr_ptr + 1;
+						level := level + 1;
+					else
+						fifo_overflow <= '1';
+					end if;
+				end if;
+
+				if (overflow_clear = '1') then
+					fifo_overflow <= '0';
+				end if;
+
+				fifo_level <= level;
+			end if;
+	end process;
+
 	avalon_register_read : process (clk)
 		begin
 			if (rising_edge (clk) and avs_s1_read = '1') then
@@ -108,6 +185,15 @@ begin
 					when "01110" => avs_s1_readdata <= (31 downto 12 => '0') & ch_config_14;
 					when "01111" => avs_s1_readdata <= (31 downto 12 => '0') & ch_config_15;
 					when "10000" => avs_s1_readdata <= (31 downto 16 => '0') & config_reg;	
+					when "10001" =>
+						if (fifo_level /= 0) then
+							avs_s1_readdata <= '1' & (30 downto 20 => '0') & fifo_mem(to_integer(fifo_rd_ptr))(15 downto 12) &
+													 "0000" & fifo_mem(to_integer(fifo_rd_ptr))(11 downto 0);
+						else
+							avs_s1_readdata <= (others => '0');
+						end if;
+					when "10010" => avs_s1_readdata <= (31 downto 17 => '0') & fifo_overflow & (15 downto 9 => '0') & std_logic_vector(fifo_level);
+					when "10011" => avs_s1_readdata <= irq_enable & (30 downto 8 => '0') & fifo_watermark;
 					when others => avs_s1_readdata <= ( others =>'0'); -- return zeros for unused registers
 				end case;
 			end if;
@@ -117,10 +203,15 @@ begin
 		begin
 			if reset = '1' then
 				config_reg <= "0000000000000001";
+				fifo_watermark <= std_logic_vector(to_unsigned(64, 8));
+				irq_enable <= '0';
 				
 			elsif (rising_edge (clk) and avs_s1_write = '1') then
 				case avs_s1_address is
 					when "10000" => config_reg <= avs_s1_writedata(15 downto 0);
+					when "10011" =>
+						fifo_watermark <= avs_s1_writedata(7 downto 0);
+						irq_enable <= avs_s1_writedata(31);
 					when others => null; -- ignore writes to unused registers
 				end case;
 			end if;
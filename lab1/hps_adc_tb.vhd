@@ -0,0 +1,186 @@
+library IEEE;
+use IEEE.STD_LOGIC_1164.ALL;
+use IEEE.NUMERIC_STD.ALL;
+
+-- Testbench of the hps_adc sample FIFO: pop on read of fifo_data, the watermark interrupt, the
+-- overflow flag, flush, and watermark 0 never interrupting. sdo is held high, so every sample
+-- is taken on channel 0 (the reset value of config_reg), one per 100 clocks.
+--
+--   ghdl -a adc.vhd hps_adc.vhd hps_adc_tb.vhd && ghdl -r hps_adc_tb
+--
+-- Every check is an assert of severity error; the run ends with a note when all of them passed.
+
+entity hps_adc_tb is
+end entity hps_adc_tb;
+
+architecture hps_adc_tb_arch of hps_adc_tb is
+
+	constant CLK_PERIOD 		: time := 20 ns;    -- 50 MHz
+	constant SAMPLE_CLKS 	: integer := 100;   -- clocks per conversion (see adc.vhd)
+
+	constant ADDR_FIFO_DATA 	: std_logic_vector(4 downto 0) := "10001";
+	constant ADDR_FIFO_STATUS 	: std_logic_vector(4 downto 0) := "10010";
+	constant ADDR_FIFO_CTRL 	: std_logic_vector(4 downto 0) := "10011";
+
+	signal clk              	: std_logic := '0';
+	signal reset            	: std_logic := '1';
+	signal avs_s1_read 		: std_logic := '0';
+	signal avs_s1_write 		: std_logic := '0';
+	signal avs_s1_address 	: std_logic_vector(4 downto 0) := (others => '0');
+	signal avs_s1_writedata 	: std_logic_vector(31 downto 0) := (others => '0');
+	signal avs_s1_readdata 	: std_logic_vector(31 downto 0);
+	signal sdo 					: std_logic := '1';
+	signal sck 					: std_logic;
+	signal sdi 					: std_logic;
+	signal convst 				: std_logic;
+	signal irq 					: std_logic;
+	signal done 				: boolean := false;
+
+	component hps_adc
+		port(
+		clk              	: in  std_logic;
+		reset            	: in  std_logic;
+		avs_s1_read	 	 	: in  std_logic;
+		avs_s1_write 	 	: in  std_logic;
+		avs_s1_address 	 	: in  std_logic_vector(4 downto 0);
+		avs_s1_writedata 	: in  std_logic_vector(31 downto 0);
+		avs_s1_readdata	 	: out std_logic_vector(31 downto 0);
+		sdo					: in	std_logic;
+		sck					: out std_logic;
+		sdi					: out std_logic;
+		convst				: out	std_logic;
+		irq					: out std_logic
+	);
+	end component;
+
+begin
+
+	dut : hps_adc port map(clk => clk, reset => reset, avs_s1_read => avs_s1_read, avs_s1_write => avs_s1_write,
+								avs_s1_address => avs_s1_address, avs_s1_writedata => avs_s1_writedata,
+								avs_s1_readdata => avs_s1_readdata, sdo => sdo, sck => sck, sdi => sdi,
+								convst => convst, irq => irq);
+
+	clock : process
+		begin
+			while not done loop
+				clk <= '0';
+				wait for CLK_PERIOD / 2;
+				clk <= '1';
+				wait for CLK_PERIOD / 2;
+			end loop;
+			wait;
+	end process;
+
+	stimulus : process
+		variable data 		: std_logic_vector(31 downto 0);
+		variable level 	: integer;
+
+		-- One Avalon write: the slave takes it on the next rising edge
+		procedure avalon_write(addr : in std_logic_vector(4 downto 0); value : in std_logic_vector(31 downto 0)) is
+		begin
+			avs_s1_address <= addr;
+			avs_s1_writedata <= value;
+			avs_s1_write <= '1';
+			wait until rising_edge(clk);
+			avs_s1_write <= '0';
+			wait for 1 ns;
+		end procedure;
+
+		-- One Avalon read (read latency 1): readdata is registered on the same edge
+		procedure avalon_read(addr : in std_logic_vector(4 downto 0); value : out std_logic_vector(31 downto 0)) is
+		begin
+			avs_s1_address <= addr;
+			avs_s1_read <= '1';
+			wait until rising_edge(clk);
+			avs_s1_read <= '0';
+			wait for 1 ns;
+			value := avs_s1_readdata;
+		end procedure;
+
+		function status_level(status : std_logic_vector(31 downto 0)) return integer is
+		begin
+			return to_integer(unsigned(status(8 downto 0)));
+		end function;
+
+	begin
+		wait for 5 * CLK_PERIOD;
+		wait until falling_edge(clk);
+		reset <= '0';
+		wait until rising_edge(clk);
+		wait for 1 ns;
+
+		------------------------------------------------------------
+		-- Reset: interrupt off, empty FIFO, default watermark of 64
+		------------------------------------------------------------
+		avalon_read(ADDR_FIFO_CTRL, data);
+		assert data = x"00000040" report "fifo_ctrl reset value wrong" severity error;
+		assert irq = '0' report "irq high after reset" severity error;
+
+		------------------------------------------------------------
+		-- Watermark interrupt: fires once 4 samples are queued
+		------------------------------------------------------------
+		avalon_write(ADDR_FIFO_CTRL, x"C0000004");    -- flush, irq enable, watermark 4
+		avalon_read(ADDR_FIFO_STATUS, data);
+		assert status_level(data) <= 1 report "flush left samples in the FIFO" severity error;
+		assert irq = '0' report "irq high below the watermark" severity error;
+
+		wait until irq = '1' for 8 * SAMPLE_CLKS * CLK_PERIOD;
+		assert irq = '1' report "no irq at the watermark" severity error;
+		avalon_read(ADDR_FIFO_STATUS, data);
+		assert status_level(data) >= 4 report "irq before the watermark was reached" severity error;
+
+		------------------------------------------------------------
+		-- Pop on read: every queued sample comes out valid, tagged with
+		-- channel 0, until the FIFO is empty; irq then drops
+		------------------------------------------------------------
+		level := status_level(data);
+		for i in 1 to level loop
+			avalon_read(ADDR_FIFO_DATA, data);
+			assert data(31) = '1' report "queued sample read as not valid" severity error;
+			assert data(19 downto 16) = "0000" report "sample tagged with the wrong channel" severity error;
+			assert data(30 downto 20) = "00000000000" and data(15 downto 12) = "0000"
+				report "unused fifo_data bits set" severity error;
+		end loop;
+		avalon_read(ADDR_FIFO_STATUS, data);
+		-- A new sample may have arrived while draining, but no more than one
+		assert status_level(data) <= 1 report "reads of fifo_data didn't pop" severity error;
+		assert irq = '0' report "irq still high after draining" severity error;
+
+		-- Reading an empty FIFO returns not valid and doesn't underflow
+		avalon_write(ADDR_FIFO_CTRL, x"C0000004");
+		avalon_read(ADDR_FIFO_DATA, data);
+		avalon_read(ADDR_FIFO_DATA, data);
+		assert data(31) = '0' report "empty FIFO read as valid" severity error;
+		avalon_read(ADDR_FIFO_STATUS, data);
+		assert status_level(data) <= 1 report "read of an empty FIFO underflowed" severity error;
+
+		------------------------------------------------------------
+		-- Overflow: with nobody reading, the FIFO fills up to 256
+		-- samples and the next one sets the sticky overflow bit
+		------------------------------------------------------------
+		avalon_write(ADDR_FIFO_CTRL, x"00000004");    -- irq off
+		wait for 270 * SAMPLE_CLKS * CLK_PERIOD;
+		avalon_read(ADDR_FIFO_STATUS, data);
+		assert status_level(data) = 256 report "full FIFO doesn't report 256 samples" severity error;
+		assert data(16) = '1' report "overflow not flagged" severity error;
+
+		-- Flush empties the FIFO; writing 1 to bit 16 clears the overflow flag
+		avalon_write(ADDR_FIFO_CTRL, x"40000004");
+		avalon_write(ADDR_FIFO_STATUS, x"00010000");
+		avalon_read(ADDR_FIFO_STATUS, data);
+		assert data(16) = '0' report "overflow flag not cleared" severity error;
+		assert status_level(data) <= 1 report "flush didn't empty the FIFO" severity error;
+
+		------------------------------------------------------------
+		-- Watermark 0 never interrupts, even with samples queued
+		------------------------------------------------------------
+		avalon_write(ADDR_FIFO_CTRL, x"80000000");
+		wait for 10 * SAMPLE_CLKS * CLK_PERIOD;
+		assert irq = '0' report "irq at watermark 0" severity error;
+
+		report "hps_adc_tb done" severity note;
+		done <= true;
+		wait;
+	end process;
+
+end architecture;
@@ -14,12 +14,13 @@
 #include <linux/platform_device.h>
 #include <linux/mod_devicetable.h>
 #include <linux/types.h>
-#include <linux/io.h>
-#include <linux/mutex.h>
-#include <linux/miscdevice.h>
-#include <linux/fs.h>
 #include <linux/kernel.h>
 #include <linux/uaccess.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/notifier.h>
+#include "wahWahEffectProcessor_ioctl.h"
+#include "avalon_regmap.h"
 /*#include "fp_conversions.h"*/
 
 /*-----------------------------------------------------------------------*/
@@ -39,523 +40,234 @@
 #define SPAN 0x1C
 
 /*-----------------------------------------------------------------------*/
-/* wahWahEffectProcessor device structure                                     */
+/* wahWahEffectProcessor register map                                              */
 /*-----------------------------------------------------------------------*/
 /*
- * struct  wahWahEffectProcessor_dev - Private wahWahEffectProcessor device struct.
- * @miscdev: miscdevice used to create a char device
- *           for the wahWahEffectProcessor component
- * @base_addr: Base address of the wahWahEffectProcessor component
- * @lock: mutex used to prevent concurrent writes
- *        to the wahWahEffectProcessor component
- *
- * An wahWahEffectProcessor_dev struct gets created for each wahWahEffectProcessor
- * component in the system.
+ * Each entry becomes a sysfs attribute of the same name and a word of
+ * the /dev/wahWahEffectProcessor register window; see avalon_regmap.h.
  */
-struct wahWahEffectProcessor_dev {
-	struct miscdevice miscdev;
-	void __iomem *base_addr;
-	struct mutex lock;
+static const struct avalon_reg wahWahEffectProcessor_regs[] = {
+	AVALON_REG(enable, REG0_enable_OFFSET, 1, AVALON_REG_RW, AVALON_PARSE_BOOL),
+	AVALON_REG(volume, REG1_volume_OFFSET, 16, AVALON_REG_RW, AVALON_PARSE_U16),
+	AVALON_REG(damp, REG2_damp_OFFSET, 16, AVALON_REG_RW, AVALON_PARSE_U16),
+	AVALON_REG(minf, REG3_minf_OFFSET, 16, AVALON_REG_RW, AVALON_PARSE_U16),
+	AVALON_REG(maxf, REG4_maxf_OFFSET, 16, AVALON_REG_RW, AVALON_PARSE_U16),
+	AVALON_REG(delta, REG5_delta_OFFSET, 16, AVALON_REG_RW, AVALON_PARSE_U16),
+	AVALON_REG(wetDry, REG6_wetDry_OFFSET, 16, AVALON_REG_RW, AVALON_PARSE_U16),
 };
 
 /*-----------------------------------------------------------------------*/
-/* REG0: enable register read function show()                   */
+/* Sample rate scaling                                                   */
 /*-----------------------------------------------------------------------*/
 /*
- * enable_show() - Return the enable value
- *                          to user-space via sysfs.
- * @dev: Device structure for the wahWahEffectProcessor component. This
- *       device struct is embedded in the wahWahEffectProcessor' device struct.
- * @attr: Unused.
- * @buf: Buffer that gets returned to user-space.
- *
- * Return: The number of bytes read.
+ * minf and maxf are frequencies relative to fs, and delta is how far the
+ * center frequency moves per sample, so a sweep of a given speed in Hz/s
+ * takes a delta proportional to 1/fs^2. Each entry gives the power of fs
+ * its register is inversely proportional to.
  */
+static const struct {
+	unsigned int offset;
+	unsigned int order;
+} wahWah_rate_regs[] = {
+	{ REG3_minf_OFFSET, 1 },
+	{ REG4_maxf_OFFSET, 1 },
+	{ REG5_delta_OFFSET, 2 },
+};
 
- static ssize_t enable_show(struct device *dev,
-	struct device_attribute *attr, char *buf)
-{
-	bool enable;
-
-	// Get the private wahWahEffectProcessor data out of the dev struct
-	struct wahWahEffectProcessor_dev *priv = dev_get_drvdata(dev);
-
-	enable = ioread32(priv->base_addr + REG0_enable_OFFSET);
-
-	return scnprintf(buf, PAGE_SIZE, "%u\n", enable);
-}
+#define WAHWAH_NUM_RATE_REGS ARRAY_SIZE(wahWah_rate_regs)
 
-/*-----------------------------------------------------------------------*/
-/* REG0: enable register write function store()                 */
-/*-----------------------------------------------------------------------*/
-/**
- * enable_store() - Store the enable value.
- * @dev: Device structure for the wahWahEffectProcessor component. This
- *       device struct is embedded in the wahWahEffectProcessor'
- *       platform device struct.
- * @attr: Unused.
- * @buf: Buffer that contains the enable value being written.
- * @size: The number of bytes being written.
+/*
+ * struct wahWah_priv - Sample rate independent state of a wahWahEffectProcessor
+ * @adev: The Avalon device.
+ * @rate_nb: Subscription to the core's sample rate notifier.
+ * @rate: Sample rate in Hz that the registers are scaled for.
+ * @phys: Each of wahWah_rate_regs as register value times fs^order; this
+ *        doesn't change with the rate (minf * fs is proportional to the
+ *        frequency in Hz).
+ * @last: The register values last derived from @phys. When a register no
+ *        longer holds its value, it was written directly (sysfs, the char
+ *        device or WAHWAH_IOC_COMMIT) and @phys is re-derived from it.
  *
- * Return: The number of bytes stored.
+ * Everything but @adev and @rate_nb is protected by adev->lock.
  */
+struct wahWah_priv {
+	struct avalon_dev *adev;
+	struct notifier_block rate_nb;
+	unsigned int rate;
+	u64 phys[WAHWAH_NUM_RATE_REGS];
+	u32 last[WAHWAH_NUM_RATE_REGS];
+};
 
- static ssize_t enable_store(struct device *dev,
-	struct device_attribute *attr, const char *buf, size_t size)
-{
-	bool enable;
-	int ret;
-	struct wahWahEffectProcessor_dev *priv = dev_get_drvdata(dev);
-
-	// Parse the string we received as a bool
-	// See https://elixir.bootlin.com/linux/latest/source/lib/kstrtox.c#L289
-	ret = kstrtobool(buf, &enable);
-	if (ret < 0) {
-		// kstrtobool returned an error
-		return ret;
-	}
-
-	iowrite32(enable, priv->base_addr + REG0_enable_OFFSET);
-
-	// Write was succesful, so we return the number of bytes we wrote.
-	return size;
-}
-
-/*-----------------------------------------------------------------------*/
-/* TODO: Add show() and store() functions for                            */
-/* Registers REG1 (volume) and REG2 (bm)                    */
-/* in component wahWahEffectProcessor                                         */
-/*-----------------------------------------------------------------------*/
-/* Add here...                                                           */
-
-static ssize_t volume_show(struct device *dev,
-	struct device_attribute *attr, char *buf)
+/* fs^order */
+static u64 wahWah_rate_pow(unsigned int rate, unsigned int order)
 {
-	u16 volume;
-	struct wahWahEffectProcessor_dev *priv = dev_get_drvdata(dev);
-
-	volume = ioread32(priv->base_addr + REG1_volume_OFFSET);
-
-	return scnprintf(buf, PAGE_SIZE, "%u\n", volume);
+	return order == 2 ? (u64)rate * rate : rate;
 }
 
-static ssize_t volume_store(struct device *dev,
-	struct device_attribute *attr, const char *buf, size_t size)
+/*
+ * wahWah_rate_notify() - Rescale minf, maxf and delta to a new sample rate
+ * @nb: wahWah_priv.rate_nb.
+ * @action: AVALON_RATE_CHANGE.
+ * @data: The struct avalon_rate_change.
+ *
+ * All three registers are rewritten in one commit, so the filter never
+ * runs with a half rescaled sweep. Values that don't fit 16 bits at the
+ * new rate are clamped.
+ *
+ * Return: NOTIFY_OK, so that the other components still get the change.
+ */
+static int wahWah_rate_notify(struct notifier_block *nb,
+	unsigned long action, void *data)
 {
-	u16 volume;
-	int ret;
-	struct wahWahEffectProcessor_dev *priv = dev_get_drvdata(dev);
-
-	// Parse the string we received as a u8
-	// See https://elixir.bootlin.com/linux/latest/source/lib/kstrtox.c#L289
-	ret = kstrtou16(buf, 0, &volume);
-	if (ret < 0) {
-		// kstrtou16 returned an error
-		return ret;
+	struct wahWah_priv *priv = container_of(nb, struct wahWah_priv, rate_nb);
+	struct avalon_dev *adev = priv->adev;
+	struct avalon_rate_change *change = data;
+	struct reg_sequence seq[WAHWAH_NUM_RATE_REGS];
+	unsigned int val;
+	u64 div;
+	unsigned int i;
+	int ret = 0;
+
+	if (action != AVALON_RATE_CHANGE) {
+		return NOTIFY_DONE;
 	}
 
-	iowrite32(volume, priv->base_addr + REG1_volume_OFFSET);
-
-	// Write was succesful, so we return the number of bytes we wrote.
-	return size;
-}
-
-/*-----------------------------------------------------------------------*/
-/* TODO: Add show() and store() functions for                            */
-/* Registers REG1 (volume) and REG2 (bm)                    */
-/* in component wahWahEffectProcessor                                         */
-/*-----------------------------------------------------------------------*/
-/* Add here...                                                           */
-
-static ssize_t damp_show(struct device *dev,
-	struct device_attribute *attr, char *buf)
-{
-	u16 damp;
-	struct wahWahEffectProcessor_dev *priv = dev_get_drvdata(dev);
-
-	damp = ioread32(priv->base_addr + REG2_damp_OFFSET);
-
-	return scnprintf(buf, PAGE_SIZE, "%u\n", damp);
-}
-
-static ssize_t damp_store(struct device *dev,
-	struct device_attribute *attr, const char *buf, size_t size)
-{
-	u16 damp;
-	int ret;
-	struct wahWahEffectProcessor_dev *priv = dev_get_drvdata(dev);
-
-	// Parse the string we received as a u8
-	// See https://elixir.bootlin.com/linux/latest/source/lib/kstrtox.c#L289
-	ret = kstrtou16(buf, 0, &damp);
-	if (ret < 0) {
-		// kstrtou16 returned an error
-		return ret;
+	mutex_lock(&adev->lock);
+	for (i = 0; i < WAHWAH_NUM_RATE_REGS; i++) {
+		ret = regmap_read(adev->regmap, wahWah_rate_regs[i].offset, &val);
+		if (ret < 0) {
+			break;
+		}
+
+		val &= GENMASK(15, 0);
+		if (val != priv->last[i]) {
+			// Written behind our back; it's in units of the old rate
+			priv->phys[i] = val * wahWah_rate_pow(priv->rate,
+			                                      wahWah_rate_regs[i].order);
+		}
+
+		div = wahWah_rate_pow(change->new_rate, wahWah_rate_regs[i].order);
+		seq[i].reg = wahWah_rate_regs[i].offset;
+		seq[i].def = min_t(u64, div64_u64(priv->phys[i] + div / 2, div),
+		                   U16_MAX);
+		seq[i].delay_us = 0;
 	}
-
-	iowrite32(damp, priv->base_addr + REG2_damp_OFFSET);
-
-	// Write was succesful, so we return the number of bytes we wrote.
-	return size;
-}
-
-/*-----------------------------------------------------------------------*/
-/* TODO: Add show() and store() functions for                            */
-/* Registers REG1 (volume) and REG2 (bm)                    */
-/* in component wahWahEffectProcessor                                         */
-/*-----------------------------------------------------------------------*/
-/* Add here...                                                           */
-
-static ssize_t minf_show(struct device *dev,
-	struct device_attribute *attr, char *buf)
-{
-	u16 minf;
-	struct wahWahEffectProcessor_dev *priv = dev_get_drvdata(dev);
-
-	minf = ioread32(priv->base_addr + REG3_minf_OFFSET);
-
-	return scnprintf(buf, PAGE_SIZE, "%u\n", minf);
-}
-
-static ssize_t minf_store(struct device *dev,
-	struct device_attribute *attr, const char *buf, size_t size)
-{
-	u16 minf;
-	int ret;
-	struct wahWahEffectProcessor_dev *priv = dev_get_drvdata(dev);
-
-	// Parse the string we received as a u8
-	// See https://elixir.bootlin.com/linux/latest/source/lib/kstrtox.c#L289
-	ret = kstrtou16(buf, 0, &minf);
-	if (ret < 0) {
-		// kstrtou16 returned an error
-		return ret;
+	if (ret == 0) {
+		ret = regmap_multi_reg_write(adev->regmap, seq, ARRAY_SIZE(seq));
 	}
-
-	iowrite32(minf, priv->base_addr + REG3_minf_OFFSET);
-
-	// Write was succesful, so we return the number of bytes we wrote.
-	return size;
-}
-
-/*-----------------------------------------------------------------------*/
-/* TODO: Add show() and store() functions for                            */
-/* Registers REG1 (volume) and REG2 (bm)                    */
-/* in component wahWahEffectProcessor                                         */
-/*-----------------------------------------------------------------------*/
-/* Add here...                                                           */
-
-static ssize_t maxf_show(struct device *dev,
-	struct device_attribute *attr, char *buf)
-{
-	u16 maxf;
-	struct wahWahEffectProcessor_dev *priv = dev_get_drvdata(dev);
-
-	maxf = ioread32(priv->base_addr + REG4_maxf_OFFSET);
-
-	return scnprintf(buf, PAGE_SIZE, "%u\n", maxf);
-}
-
-static ssize_t maxf_store(struct device *dev,
-	struct device_attribute *attr, const char *buf, size_t size)
-{
-	u16 maxf;
-	int ret;
-	struct wahWahEffectProcessor_dev *priv = dev_get_drvdata(dev);
-
-	// Parse the string we received as a u8
-	// See https://elixir.bootlin.com/linux/latest/source/lib/kstrtox.c#L289
-	ret = kstrtou16(buf, 0, &maxf);
-	if (ret < 0) {
-		// kstrtou16 returned an error
-		return ret;
+	// On failure the registers still hold values for the old rate
+	if (ret == 0) {
+		priv->rate = change->new_rate;
+		for (i = 0; i < WAHWAH_NUM_RATE_REGS; i++) {
+			priv->last[i] = seq[i].def;
+		}
 	}
+	mutex_unlock(&adev->lock);
 
-	iowrite32(maxf, priv->base_addr + REG4_maxf_OFFSET);
-
-	// Write was succesful, so we return the number of bytes we wrote.
-	return size;
-}
-
-/*-----------------------------------------------------------------------*/
-/* TODO: Add show() and store() functions for                            */
-/* Registers REG1 (volume) and REG2 (bm)                    */
-/* in component wahWahEffectProcessor                                         */
-/*-----------------------------------------------------------------------*/
-/* Add here...                                                           */
-
-static ssize_t delta_show(struct device *dev,
-	struct device_attribute *attr, char *buf)
-{
-	u16 delta;
-	struct wahWahEffectProcessor_dev *priv = dev_get_drvdata(dev);
-
-	delta = ioread32(priv->base_addr + REG5_delta_OFFSET);
-
-	return scnprintf(buf, PAGE_SIZE, "%u\n", delta);
-}
-
-static ssize_t delta_store(struct device *dev,
-	struct device_attribute *attr, const char *buf, size_t size)
-{
-	u16 delta;
-	int ret;
-	struct wahWahEffectProcessor_dev *priv = dev_get_drvdata(dev);
-
-	// Parse the string we received as a u8
-	// See https://elixir.bootlin.com/linux/latest/source/lib/kstrtox.c#L289
-	ret = kstrtou16(buf, 0, &delta);
-	if (ret < 0) {
-		// kstrtou16 returned an error
-		return ret;
-	}
-
-	iowrite32(delta, priv->base_addr + REG5_delta_OFFSET);
-
-	// Write was succesful, so we return the number of bytes we wrote.
-	return size;
-}
-
-
-/*-----------------------------------------------------------------------*/
-/* TODO: Add show() and store() functions for                            */
-/* Registers REG1 (volume) and REG2 (bm)                    */
-/* in component wahWahEffectProcessor                                         */
-/*-----------------------------------------------------------------------*/
-/* Add here...                                                           */
-
-static ssize_t wetDry_show(struct device *dev,
-	struct device_attribute *attr, char *buf)
-{
-	u16 wetDry;
-	struct wahWahEffectProcessor_dev *priv = dev_get_drvdata(dev);
-
-	wetDry = ioread32(priv->base_addr + REG6_wetDry_OFFSET);
-
-	return scnprintf(buf, PAGE_SIZE, "%u\n", wetDry);
-}
-
-static ssize_t wetDry_store(struct device *dev,
-	struct device_attribute *attr, const char *buf, size_t size)
-{
-	u16 wetDry;
-	int ret;
-	struct wahWahEffectProcessor_dev *priv = dev_get_drvdata(dev);
-
-	// Parse the string we received as a u8
-	// See https://elixir.bootlin.com/linux/latest/source/lib/kstrtox.c#L289
-	ret = kstrtou16(buf, 0, &wetDry);
 	if (ret < 0) {
-		// kstrtou16 returned an error
-		return ret;
+		dev_warn(adev->dev, "minf/maxf/delta not rescaled to %u Hz (%d)\n",
+		         change->new_rate, ret);
 	}
 
-	iowrite32(wetDry, priv->base_addr + REG6_wetDry_OFFSET);
-
-	// Write was succesful, so we return the number of bytes we wrote.
-	return size;
+	return NOTIFY_OK;
 }
-/*-----------------------------------------------------------------------*/
-/* sysfs Attributes                                                      */
-/*-----------------------------------------------------------------------*/
-// Define sysfs attributes
-static DEVICE_ATTR_RW(enable);    // Attribute for REG0
-/* TODO: Add the attributes for REG1 and REG2 using register names       */
-static DEVICE_ATTR_RW(volume);		// Attribute for REG1
-static DEVICE_ATTR_RW(damp);		// Attribute for REG1
-static DEVICE_ATTR_RW(minf);		// Attribute for REG1
-static DEVICE_ATTR_RW(maxf);		// Attribute for REG1
-static DEVICE_ATTR_RW(delta);		// Attribute for REG1
-static DEVICE_ATTR_RW(wetDry);		// Attribute for REG1
-
-// Create an atribute group so the device core can
-// export the attributes for us.
-static struct attribute *wahWahEffectProcessor_attrs[] = {
-	&dev_attr_enable.attr,
-/* TODO: Add the attribute entries for REG1 and REG2 using register names*/
-	&dev_attr_volume.attr,
-	&dev_attr_damp.attr,
-	&dev_attr_minf.attr,
-	&dev_attr_maxf.attr,
-	&dev_attr_delta.attr,
-	&dev_attr_wetDry.attr,
-	NULL,
-};
-ATTRIBUTE_GROUPS(wahWahEffectProcessor);
 
 /*-----------------------------------------------------------------------*/
-/* File Operations read()                                                */
+/* ioctl()                                                               */
 /*-----------------------------------------------------------------------*/
 /*
- * wahWahEffectProcessor_read() - Read method for the wahWahEffectProcessor char device
- * @file: Pointer to the char device file struct.
- * @buf: User-space buffer to read the value into.
- * @count: The number of bytes being requested.
- * @offset: The byte offset in the file being read from.
+ * wahWah_reg_fits() - Check a value against the width of its register
+ * @offset: Register offset, as in wahWahEffectProcessor_regs.
+ * @val: Value to be written.
  *
- * Return: On success, the number of bytes written is returned and the
- * offset @offset is advanced by this number. On error, a negative error
- * value is returned.
+ * Return: true if @val fits, the same rule the sysfs attributes apply.
  */
-
- static ssize_t wahWahEffectProcessor_read(struct file *file, char __user *buf,
-	size_t count, loff_t *offset)
+static bool wahWah_reg_fits(unsigned int offset, u32 val)
 {
-	size_t ret;
-	u32 val;
-
-	loff_t pos = *offset;
-
-	/*
-	 * Get the device's private data from the file struct's private_data
-	 * field. The private_data field is equal to the miscdev field in the
-	 * wahWahEffectProcessor_dev struct. container_of returns the
-     * wahWahEffectProcessor_dev struct that contains the miscdev in private_data.
-	 */
-	struct wahWahEffectProcessor_dev *priv = container_of(file->private_data,
-	                            struct wahWahEffectProcessor_dev, miscdev);
-
-	// Check file offset to make sure we are reading to a valid location.
-	if (pos < 0) {
-		// We can't read from a negative file position.
-		return -EINVAL;
-	}
-	if (pos >= SPAN) {
-		// We can't read from a position past the end of our device.
-		return 0;
-	}
-	if ((pos % 0x4) != 0) {
-		/*
-		 * Prevent unaligned access. Even though the hardware
-		 * technically supports unaligned access, we want to
-		 * ensure that we only access 32-bit-aligned addresses
-		 * because our registers are 32-bit-aligned.
-		 */
-		pr_warn("wahWahEffectProcessor_read: unaligned access\n");
-		return -EFAULT;
-	}
+	unsigned int i;
 
-	// If the user didn't request any bytes, don't return any bytes :)
-	if (count == 0) {
-		return 0;
+	for (i = 0; i < ARRAY_SIZE(wahWahEffectProcessor_regs); i++) {
+		if (wahWahEffectProcessor_regs[i].offset == offset) {
+			return wahWahEffectProcessor_regs[i].width >= 32 ||
+			       !(val >> wahWahEffectProcessor_regs[i].width);
+		}
 	}
 
-	// Read the value at offset pos.
-	val = ioread32(priv->base_addr + pos);
-
-	ret = copy_to_user(buf, &val, sizeof(val));
-	if (ret == sizeof(val)) {
-		// Nothing was copied to the user.
-		pr_warn("wahWahEffectProcessor_read: nothing copied\n");
-		return -EFAULT;
-	}
-
-	// Increment the file offset by the number of bytes we read.
-	*offset = pos + sizeof(val);
-
-	return sizeof(val);
+	return false;
 }
 
-/*-----------------------------------------------------------------------*/
-/* File Operations write()                                               */
-/*-----------------------------------------------------------------------*/
 /*
- * wahWahEffectProcessor_write() - Write method for the wahWahEffectProcessor char device
- * @file: Pointer to the char device file struct.
- * @buf: User-space buffer to read the value from.
- * @count: The number of bytes being written.
- * @offset: The byte offset in the file being written to.
+ * wahWahEffectProcessor_ioctl() - ioctl method for the wahWahEffectProcessor char device
+ * @adev: The Avalon device behind the char device.
+ * @cmd: The ioctl command; see wahWahEffectProcessor_ioctl.h.
+ * @arg: User-space pointer to a struct wahWah_params.
+ *
+ * WAHWAH_IOC_COMMIT writes all seven registers as one commit, so a
+ * preset change is never seen by the filter half applied and no other
+ * writer can sneak in between. The time taken by the register writes
+ * is returned in commit_ns. Nothing is written unless every field fits
+ * its register (1 bit for enable, 16 bits for the rest).
  *
- * Return: On success, the number of bytes written is returned and the
- * offset @offset is advanced by this number. On error, a negative error
- * value is returned.
+ * Return: 0 on success, -ERANGE if a field is too wide, or another
+ * negative error value.
  */
-
- static ssize_t wahWahEffectProcessor_write(struct file *file, const char __user *buf,
-	size_t count, loff_t *offset)
+static long wahWahEffectProcessor_ioctl(struct avalon_dev *adev,
+	unsigned int cmd, unsigned long arg)
 {
-	size_t ret;
-	u32 val;
-
-	loff_t pos = *offset;
-
-	/*
-	 * Get the device's private data from the file struct's private_data
-	 * field. The private_data field is equal to the miscdev field in the
-	 * wahWahEffectProcessor_dev struct. container_of returns the
-     * wahWahEffectProcessor_dev struct that contains the miscdev in private_data.
-	 */
-	struct wahWahEffectProcessor_dev *priv = container_of(file->private_data,
-	                              struct wahWahEffectProcessor_dev, miscdev);
-
-// Check file offset to make sure we are writing to a valid location.
-	if (pos < 0) {
-		// We can't write to a negative file position.
-		return -EINVAL;
-	}
-	if (pos >= SPAN) {
-		// We can't write to a position past the end of our device.
-		return 0;
+	struct wahWah_params params;
+	struct reg_sequence seq[7];
+	void __user *uarg = (void __user *)arg;
+	u64 start;
+	unsigned int i;
+	int ret;
+
+	if (cmd != WAHWAH_IOC_COMMIT) {
+		return -ENOTTY;
 	}
-	if ((pos % 0x4) != 0) {
-		/*
-		 * Prevent unaligned access. Even though the hardware
-		 * technically supports unaligned access, we want to
-		 * ensure that we only access 32-bit-aligned addresses
-		 * because our registers are 32-bit-aligned.
-		 */
-		pr_warn("wahWahEffectProcessor_write: unaligned access\n");
+
+	if (copy_from_user(&params, uarg, sizeof(params))) {
 		return -EFAULT;
 	}
 
-	// If the user didn't request to write anything, return 0.
-	if (count == 0) {
-		return 0;
+	seq[0] = (struct reg_sequence){ REG0_enable_OFFSET, params.enable };
+	seq[1] = (struct reg_sequence){ REG1_volume_OFFSET, params.volume };
+	seq[2] = (struct reg_sequence){ REG2_damp_OFFSET, params.damp };
+	seq[3] = (struct reg_sequence){ REG3_minf_OFFSET, params.minf };
+	seq[4] = (struct reg_sequence){ REG4_maxf_OFFSET, params.maxf };
+	seq[5] = (struct reg_sequence){ REG5_delta_OFFSET, params.delta };
+	seq[6] = (struct reg_sequence){ REG6_wetDry_OFFSET, params.wetDry };
+
+	for (i = 0; i < ARRAY_SIZE(seq); i++) {
+		if (!wahWah_reg_fits(seq[i].reg, seq[i].def)) {
+			return -ERANGE;
+		}
 	}
 
-	mutex_lock(&priv->lock);
-
-	ret = copy_from_user(&val, buf, sizeof(val));
-	if (ret == sizeof(val)) {
-		// Nothing was copied from the user.
-		pr_warn("wahWahEffectProcessor_write: nothing copied from user space\n");
-		ret = -EFAULT;
-		goto unlock;
+	start = ktime_get_ns();
+	ret = avalon_multi_reg_write(adev, seq, ARRAY_SIZE(seq));
+	params.commit_ns = ktime_get_ns() - start;
+	if (ret < 0) {
+		return ret;
 	}
 
-	// Write the value we were given at the address offset given by pos.
-	iowrite32(val, priv->base_addr + pos);
-
-	// Increment the file offset by the number of bytes we wrote.
-	*offset = pos + sizeof(val);
-
-	// Return the number of bytes we wrote.
-	ret = sizeof(val);
+	if (copy_to_user(uarg, &params, sizeof(params))) {
+		return -EFAULT;
+	}
 
-unlock:
-	mutex_unlock(&priv->lock);
-	return ret;
+	return 0;
 }
 
-/*-----------------------------------------------------------------------*/
-/* File Operations Supported                                             */
-/*-----------------------------------------------------------------------*/
 /*
- *  wahWahEffectProcessor_fops - File operations supported by the
- *                          wahWahEffectProcessor driver
- * @owner: The wahWahEffectProcessor driver owns the file operations; this
- *         ensures that the driver can't be removed while the
- *         character device is still in use.
- * @read: The read function.
- * @write: The write function.
- * @llseek: We use the kernel's default_llseek() function; this allows
- *          users to change what position they are writing/reading to/from.
+ * wahWahEffectProcessor_component - Description of the wahWahEffectProcessor component
+ *                   for the Avalon register-map core
  */
-static const struct file_operations  wahWahEffectProcessor_fops = {
+static const struct avalon_component wahWahEffectProcessor_component = {
 	.owner = THIS_MODULE,
-	.read = wahWahEffectProcessor_read,
-	.write = wahWahEffectProcessor_write,
-	.llseek = default_llseek,
+	.name = "wahWahEffectProcessor",
+	.regs = wahWahEffectProcessor_regs,
+	.num_regs = ARRAY_SIZE(wahWahEffectProcessor_regs),
+	.span = SPAN,
+	.ioctl = wahWahEffectProcessor_ioctl,
 };
 
 /*-----------------------------------------------------------------------*/
@@ -568,57 +280,41 @@ static const struct file_operations  wahWahEffectProcessor_fops = {
  *        driver core based upon our wahWahEffectProcessor device tree node.
  *
  * When a device that is compatible with this wahWahEffectProcessor driver
- * is found, the driver's probe function is called. This probe function
- * gets called by the kernel when an wahWahEffectProcessor device is found
- * in the device tree.
+ * is found, the driver's probe function is called. The register-map
+ * core maps the registers, creates the sysfs attributes and registers
+ * the /dev/wahWahEffectProcessor char device for us. We then subscribe
+ * to sample rate changes so that the sweep keeps its sound.
  */
 static int wahWahEffectProcessor_probe(struct platform_device *pdev)
 {
-	struct wahWahEffectProcessor_dev *priv;
+	struct wahWah_priv *priv;
+	struct avalon_dev *adev;
+	unsigned int i;
 	int ret;
 
-/*
-	 * Allocate kernel memory for the wahWahEffectProcessor device and set it to 0.
-	 * GFP_KERNEL specifies that we are allocating normal kernel RAM;
-	 * see the kmalloc documentation for more info. The allocated memory
-	 * is automatically freed when the device is removed.
-	 */
-	priv = devm_kzalloc(&pdev->dev, sizeof(struct wahWahEffectProcessor_dev), GFP_KERNEL);
+	priv = devm_kzalloc(&pdev->dev, sizeof(*priv), GFP_KERNEL);
 	if (!priv) {
-		pr_err("Failed to allocate kernel memory for hps_led_pattern\n");
 		return -ENOMEM;
 	}
 
-	/*
-	 * Request and remap the device's memory region. Requesting the region
-	 * make sure nobody else can use that memory. The memory is remapped
-	 * into the kernel's virtual address space becuase we don't have access
-	 * to physical memory locations.
-	 */
-	priv->base_addr = devm_platform_ioremap_resource(pdev, 0);
-	if (IS_ERR(priv->base_addr)) {
-		pr_err("Failed to request/remap platform device resource (wahWahEffectProcessor)\n");
-		return PTR_ERR(priv->base_addr);
+	adev = avalon_probe(pdev, &wahWahEffectProcessor_component);
+	if (IS_ERR(adev)) {
+		pr_err("Failed to set up wahWahEffectProcessor (%ld)\n", PTR_ERR(adev));
+		return PTR_ERR(adev);
 	}
 
-	// Initialize the misc device parameters
-	priv->miscdev.minor = MISC_DYNAMIC_MINOR;
-	priv->miscdev.name = "wahWahEffectProcessor";
-	priv->miscdev.fops = &wahWahEffectProcessor_fops;
-	priv->miscdev.parent = &pdev->dev;
-	priv->miscdev.groups = wahWahEffectProcessor_groups;
-
-	// Register the misc device; this creates a char dev at
-    // /dev/wahWahEffectProcessor
-	ret = misc_register(&priv->miscdev);
+	// The registers as found are scaled for the current rate
+	priv->adev = adev;
+	for (i = 0; i < WAHWAH_NUM_RATE_REGS; i++) {
+		priv->last[i] = U32_MAX;
+	}
+	priv->rate_nb.notifier_call = wahWah_rate_notify;
+	ret = avalon_rate_notifier_register(&priv->rate_nb, &priv->rate);
 	if (ret) {
-		pr_err("Failed to register misc device for wahWahEffectProcessor\n");
+		avalon_remove(pdev);
 		return ret;
 	}
-
-		// Attach the wahWahEffectProcessor' private data to the
-    // platform device's struct.
-	platform_set_drvdata(pdev, priv);
+	adev->drvdata = priv;
 
 	pr_info("wahWahEffectProcessor_probe successful\n");
 
@@ -637,11 +333,13 @@ static int wahWahEffectProcessor_probe(struct platform_device *pdev)
  */
 static int wahWahEffectProcessor_remove(struct platform_device *pdev)
 {
-	// Get thewahWahEffectProcessor' private data from the platform device.
-	struct wahWahEffectProcessor_dev *priv = platform_get_drvdata(pdev);
+	struct avalon_dev *adev = platform_get_drvdata(pdev);
+	struct wahWah_priv *priv = adev->drvdata;
+
+	avalon_rate_notifier_unregister(&priv->rate_nb);
 
 	// Deregister the misc device and remove the /dev/wahWahEffectProcessor file.
-	misc_deregister(&priv->miscdev);
+	avalon_remove(pdev);
 
 	pr_info("wahWahEffectProcessor_remove successful\n");
 
@@ -657,8 +355,7 @@ static int wahWahEffectProcessor_remove(struct platform_device *pdev)
  * device to be matched with this driver, its device tree node must use the
  * same compatible string as defined here.
  */
-
- static const struct of_device_id wahWahEffectProcessor_of_match[] = {
+static const struct of_device_id wahWahEffectProcessor_of_match[] = {
     // ****Note:**** This .compatible string must be identical to the
     // .compatible string in the Device Tree Node for wahWahEffectProcessor
 	{ .compatible = "SQ,wahWahEffectProcessor", },
@@ -677,9 +374,8 @@ MODULE_DEVICE_TABLE(of, wahWahEffectProcessor_of_match);
  * @driver.owner: Which module owns this driver
  * @driver.name: Name of the wahWahEffectProcessor driver
  * @driver.of_match_table: Device tree match table
- * @driver.dev_groups: wahWahEffectProcessor sysfs attribute group; this
- *                     allows the driver core to create the
- *                     attribute(s) without race conditions.
+ * @driver.suppress_bind_attrs: No unbinding through sysfs; an open
+ *                              /dev/<name> would outlive our data
  */
 static struct platform_driver wahWahEffectProcessor_driver = {
 	.probe = wahWahEffectProcessor_probe,
@@ -688,7 +384,7 @@ static struct platform_driver wahWahEffectProcessor_driver = {
 		.owner = THIS_MODULE,
 		.name = "wahWahEffectProcessor",
 		.of_match_table = wahWahEffectProcessor_of_match,
-		.dev_groups = wahWahEffectProcessor_groups,
+		.suppress_bind_attrs = true,
 	},
 };
 
@@ -0,0 +1,48 @@
+/* SPDX-License-Identifier: GPL-2.0 or MIT                               */
+/*-------------------------------------------------------------------------
+ * Description:  ioctl interface of the wahWahEffectProcessor char device.
+ *               Shared between the driver and user-space programs.
+ * ------------------------------------------------------------------------
+ * License : GPL-2.0 or MIT (opensource.org / licenses / MIT, GPL-2.0)
+-------------------------------------------------------------------------*/
+#ifndef WAHWAHEFFECTPROCESSOR_IOCTL_H
+#define WAHWAHEFFECTPROCESSOR_IOCTL_H
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+/*
+ * struct wahWah_params - Every wahWahEffectProcessor register at once.
+ * @enable: REG0 enable (0 or 1)
+ * @volume: REG1 volume
+ * @damp: REG2 damp
+ * @minf: REG3 minf
+ * @maxf: REG4 maxf
+ * @delta: REG5 delta
+ * @wetDry: REG6 wetDry
+ * @commit_ns: Filled in by the driver: how long the seven register
+ *             writes took, in nanoseconds. Ignored on input; it is the
+ *             only field the driver writes back, the register fields
+ *             come back as they were passed in.
+ *
+ * The register fields are in register order, so the first 28 bytes of
+ * this struct have the same layout as the char device's register span.
+ * A field wider than its register fails the whole commit with ERANGE.
+ */
+struct wahWah_params {
+	__u32 enable;
+	__u32 volume;
+	__u32 damp;
+	__u32 minf;
+	__u32 maxf;
+	__u32 delta;
+	__u32 wetDry;
+	__u64 commit_ns;
+} __attribute__((packed));
+
+#define WAHWAH_IOC_MAGIC 'w'
+
+/* Write all seven registers under one lock hold; returns commit_ns */
+#define WAHWAH_IOC_COMMIT _IOWR(WAHWAH_IOC_MAGIC, 1, struct wahWah_params)
+
+#endif /* WAHWAHEFFECTPROCESSOR_IOCTL_H */
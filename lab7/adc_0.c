@@ -14,12 +14,15 @@
 #include <linux/platform_device.h>
 #include <linux/mod_devicetable.h>
 #include <linux/types.h>
-#include <linux/io.h>
-#include <linux/mutex.h>
-#include <linux/miscdevice.h>
-#include <linux/fs.h>
 #include <linux/kernel.h>
-#include <linux/uaccess.h>
+#include <linux/bitfield.h>
+#include <linux/fs.h>
+#include <linux/interrupt.h>
+#include <linux/kfifo.h>
+#include <linux/poll.h>
+#include <linux/wait.h>
+#include "avalon_regmap.h"
+#include "adc_0_stream.h"
 /*#include "fp_conversions.h"*/
 
 /*-----------------------------------------------------------------------*/
@@ -32,438 +35,454 @@
 #define REG3_P3_OFFSET 0x0c
 #define REG4_P4_OFFSET 0x10
 #define REG5_P5_OFFSET 0x14
+#define REG6_P6_OFFSET 0x18
+#define REG7_P7_OFFSET 0x1c
+#define REG8_P8_OFFSET 0x20
+#define REG9_P9_OFFSET 0x24
+#define REG10_P10_OFFSET 0x28
+#define REG11_P11_OFFSET 0x2c
+#define REG12_P12_OFFSET 0x30
+#define REG13_P13_OFFSET 0x34
+#define REG14_P14_OFFSET 0x38
+#define REG15_P15_OFFSET 0x3c
+#define CONFIG_OFFSET 0x40
+#define FIFO_DATA_OFFSET 0x44
+#define FIFO_STATUS_OFFSET 0x48
+#define FIFO_CTRL_OFFSET 0x4c
 
 /* Memory span of all registers (used or not) in the                     */
 /* component adc_0                                            */
-#define SPAN 0x18
+#define SPAN 0x50
+
+/* Sample FIFO register fields; see lab1/hps_adc.vhd */
+#define FIFO_DATA_VALID BIT(31)
+#define FIFO_DATA_CHANNEL GENMASK(19, 16)
+#define FIFO_DATA_SAMPLE GENMASK(11, 0)
+#define FIFO_STATUS_LEVEL GENMASK(8, 0)
+#define FIFO_STATUS_OVERFLOW BIT(16)
+#define FIFO_CTRL_WATERMARK GENMASK(7, 0)
+#define FIFO_CTRL_FLUSH BIT(30)
+#define FIFO_CTRL_IRQ_EN BIT(31)
+
+/*
+ * Watermark used when fifo_ctrl holds none (the fabric never interrupts
+ * at watermark 0): half of the 256-sample FIFO
+ */
+#define FIFO_DEFAULT_WATERMARK 128
+
+/* Records the ring buffer holds between reads; a power of two for kfifo */
+#define RING_RECORDS 4096
 
 /*-----------------------------------------------------------------------*/
-/* adc_0 device structure                                     */
+/* adc_0 register map                                              */
 /*-----------------------------------------------------------------------*/
 /*
- * struct  adc_0_dev - Private adc_0 device struct.
- * @miscdev: miscdevice used to create a char device
- *           for the adc_0 component
- * @base_addr: Base address of the adc_0 component
- * @lock: mutex used to prevent concurrent writes
- *        to the adc_0 component
- *
- * An adc_0_dev struct gets created for each adc_0
- * component in the system.
+ * Each entry becomes a sysfs attribute of the same name and a word of
+ * the /dev/adc_0 register window; see avalon_regmap.h.
  */
-struct adc_0_dev {
-	struct miscdevice miscdev;
-	void __iomem *base_addr;
-	struct mutex lock;
+static const struct avalon_reg adc_0_regs[] = {
+	// Updated by the fabric, so they are volatile and never cached
+	AVALON_REG(p0, REG0_P0_OFFSET, 32, AVALON_REG_RW | AVALON_REG_VOLATILE, AVALON_PARSE_U32),
+	AVALON_REG(p1, REG1_P1_OFFSET, 32, AVALON_REG_RW | AVALON_REG_VOLATILE, AVALON_PARSE_U32),
+	AVALON_REG(p2, REG2_P2_OFFSET, 32, AVALON_REG_RW | AVALON_REG_VOLATILE, AVALON_PARSE_U32),
+	AVALON_REG(p3, REG3_P3_OFFSET, 32, AVALON_REG_RW | AVALON_REG_VOLATILE, AVALON_PARSE_U32),
+	AVALON_REG(p4, REG4_P4_OFFSET, 32, AVALON_REG_RW | AVALON_REG_VOLATILE, AVALON_PARSE_U32),
+	AVALON_REG(p5, REG5_P5_OFFSET, 32, AVALON_REG_RW | AVALON_REG_VOLATILE, AVALON_PARSE_U32),
+	AVALON_REG(p6, REG6_P6_OFFSET, 32, AVALON_REG_RW | AVALON_REG_VOLATILE, AVALON_PARSE_U32),
+	AVALON_REG(p7, REG7_P7_OFFSET, 32, AVALON_REG_RW | AVALON_REG_VOLATILE, AVALON_PARSE_U32),
+	AVALON_REG(p8, REG8_P8_OFFSET, 32, AVALON_REG_RW | AVALON_REG_VOLATILE, AVALON_PARSE_U32),
+	AVALON_REG(p9, REG9_P9_OFFSET, 32, AVALON_REG_RW | AVALON_REG_VOLATILE, AVALON_PARSE_U32),
+	AVALON_REG(p10, REG10_P10_OFFSET, 32, AVALON_REG_RW | AVALON_REG_VOLATILE, AVALON_PARSE_U32),
+	AVALON_REG(p11, REG11_P11_OFFSET, 32, AVALON_REG_RW | AVALON_REG_VOLATILE, AVALON_PARSE_U32),
+	AVALON_REG(p12, REG12_P12_OFFSET, 32, AVALON_REG_RW | AVALON_REG_VOLATILE, AVALON_PARSE_U32),
+	AVALON_REG(p13, REG13_P13_OFFSET, 32, AVALON_REG_RW | AVALON_REG_VOLATILE, AVALON_PARSE_U32),
+	AVALON_REG(p14, REG14_P14_OFFSET, 32, AVALON_REG_RW | AVALON_REG_VOLATILE, AVALON_PARSE_U32),
+	AVALON_REG(p15, REG15_P15_OFFSET, 32, AVALON_REG_RW | AVALON_REG_VOLATILE, AVALON_PARSE_U32),
+	AVALON_REG(config, CONFIG_OFFSET, 16, AVALON_REG_RW, AVALON_PARSE_U16),
+	/*
+	 * fifo_data is left out on purpose: reading it pops a sample, so
+	 * neither the cache nor sysfs may touch it. The IRQ thread reads it
+	 * directly, and reads of the /dev/adc_0 window stop short of it.
+	 */
+	AVALON_REG(fifo_status, FIFO_STATUS_OFFSET, 17, AVALON_REG_RW | AVALON_REG_VOLATILE, AVALON_PARSE_U32),
+	/*
+	 * fifo_ctrl belongs to the stream: IRQ_EN and FLUSH set from user
+	 * space would race the ring reset in open(). It is read-only here,
+	 * the driver writes it directly, and the watermark attribute sets
+	 * the watermark.
+	 */
+	AVALON_REG(fifo_ctrl, FIFO_CTRL_OFFSET, 32, AVALON_REG_R | AVALON_REG_VOLATILE, AVALON_PARSE_U32),
 };
 
 /*-----------------------------------------------------------------------*/
-/* REG0: p0 register read function show()                   */
+/* Sample stream                                                         */
 /*-----------------------------------------------------------------------*/
 /*
- * p0_show() - Return the red value
- *                          to user-space via sysfs.
- * @dev: Device structure for the adc_0 component. This
- *       device struct is embedded in the adc_0' device struct.
- * @attr: Unused.
- * @buf: Buffer that gets returned to user-space.
+ * struct adc_0_priv - Sample stream of an adc_0
+ * @adev: The Avalon device.
+ * @miscdev: /dev/adc_0_stream; read() and poll() the samples there.
+ * @irq: The FIFO watermark interrupt.
+ * @busy: Bit 0 is set while /dev/adc_0_stream is open.
+ * @ring: Samples drained from the FIFO and not read yet. The IRQ thread
+ *        is the only producer and read() (under @read_lock) the only
+ *        consumer, so the kfifo needs no further locking.
+ * @read_lock: Serializes readers.
+ * @wait: Readers and pollers waiting for samples.
+ * @dropped: Samples lost because @ring was full.
+ * @overflows: Times the fabric FIFO overflowed and lost samples.
  *
- * Return: The number of bytes read.
+ * The FIFO interrupt is only enabled while the stream is open.
  */
-static ssize_t p0_show(struct device *dev,
-	struct device_attribute *attr, char *buf)
-{
-	u32 p0;
-
-	// Get the private adc_0 data out of the dev struct
-	struct adc_0_dev *priv = dev_get_drvdata(dev);
-
-	p0 = ioread32(priv->base_addr + REG0_P0_OFFSET);
-
-	return scnprintf(buf, PAGE_SIZE, "%u\n", p0);
-}
+struct adc_0_priv {
+	struct avalon_dev *adev;
+	struct miscdevice miscdev;
+	int irq;
+	unsigned long busy;
+	DECLARE_KFIFO(ring, struct adc_0_sample, RING_RECORDS);
+	struct mutex read_lock;
+	wait_queue_head_t wait;
+	unsigned long dropped;
+	unsigned long overflows;
+};
 
-static ssize_t p0_store(struct device *dev,
-	struct device_attribute *attr, const char *buf, size_t size)
+/*
+ * adc_0_irq_thread() - Drain the sample FIFO into the ring buffer
+ * @irq: The FIFO watermark interrupt.
+ * @data: The struct adc_0_priv.
+ *
+ * Pops as many samples as the FIFO held when we looked. The interrupt is
+ * level triggered, so samples that arrive meanwhile bring us back if
+ * they reach the watermark.
+ *
+ * Return: IRQ_HANDLED.
+ */
+static irqreturn_t adc_0_irq_thread(int irq, void *data)
 {
-	u32 p0;
-	int ret;
-	struct adc_0_dev *priv = dev_get_drvdata(dev);
+	struct adc_0_priv *priv = data;
+	struct adc_0_sample rec;
+	u32 status;
+	u32 level;
+	u32 word;
+
+	if (avalon_reg_read(priv->adev, FIFO_STATUS_OFFSET, &status) < 0) {
+		return IRQ_HANDLED;
+	}
 
-	// Parse the string we received as a u8
-	// See https://elixir.bootlin.com/linux/latest/source/lib/kstrtox.c#L289
-	ret = kstrtou32(buf, 0, &p0);
-	if (ret < 0) {
-		// kstrtou16 returned an error
-		return ret;
+	if (status & FIFO_STATUS_OVERFLOW) {
+		priv->overflows++;
+		avalon_reg_write(priv->adev, FIFO_STATUS_OFFSET,
+		                 FIFO_STATUS_OVERFLOW);
 	}
 
-	iowrite32(p0, priv->base_addr + REG0_P0_OFFSET);
+	for (level = FIELD_GET(FIFO_STATUS_LEVEL, status); level; level--) {
+		word = readl(priv->adev->base_addr + FIFO_DATA_OFFSET);
+		if (!(word & FIFO_DATA_VALID)) {
+			break;
+		}
+
+		rec.channel = FIELD_GET(FIFO_DATA_CHANNEL, word);
+		rec.sample = FIELD_GET(FIFO_DATA_SAMPLE, word);
+		if (!kfifo_put(&priv->ring, rec)) {
+			priv->dropped++;
+		}
+	}
 
-	// Write was succesful, so we return the number of bytes we wrote.
-	return size;
-}
+	wake_up_interruptible(&priv->wait);
 
+	return IRQ_HANDLED;
+}
 
-static ssize_t p1_show(struct device *dev,
-	struct device_attribute *attr, char *buf)
+/*
+ * adc_0_stream_enable() - Start or stop the FIFO interrupt
+ * @priv: The adc_0.
+ * @enable: Flush the FIFO and enable the interrupt, or disable it.
+ *
+ * The watermark in fifo_ctrl is kept; an unset one gets
+ * FIFO_DEFAULT_WATERMARK. fifo_ctrl is read-only in the register map, so
+ * it is written directly; it is volatile, so there is no cached copy to
+ * keep in step.
+ */
+static void adc_0_stream_enable(struct adc_0_priv *priv, bool enable)
 {
-	u32 p1;
-	struct adc_0_dev *priv = dev_get_drvdata(dev);
-
-	p1 = ioread32(priv->base_addr + REG1_P1_OFFSET);
+	void __iomem *reg = priv->adev->base_addr + FIFO_CTRL_OFFSET;
+	u32 ctrl;
 
-	return scnprintf(buf, PAGE_SIZE, "%u\n", p1);
+	mutex_lock(&priv->adev->lock);
+	ctrl = readl(reg) & FIFO_CTRL_WATERMARK;
+	if (ctrl == 0) {
+		ctrl = FIFO_DEFAULT_WATERMARK;
+	}
+	if (enable) {
+		ctrl |= FIFO_CTRL_FLUSH | FIFO_CTRL_IRQ_EN;
+	}
+	writel(ctrl, reg);
+	mutex_unlock(&priv->adev->lock);
 }
 
-static ssize_t p1_store(struct device *dev,
-	struct device_attribute *attr, const char *buf, size_t size)
+/*
+ * adc_0_stream_open() - Start streaming samples
+ * @inode: Unused.
+ * @file: The file being opened.
+ *
+ * One reader at a time; the stream starts from an empty FIFO.
+ *
+ * Return: 0 on success, or -EBUSY if the stream is already open.
+ */
+static int adc_0_stream_open(struct inode *inode, struct file *file)
 {
-	u32 p1;
-	int ret;
-	struct adc_0_dev *priv = dev_get_drvdata(dev);
+	struct adc_0_priv *priv = container_of(file->private_data,
+	                                       struct adc_0_priv, miscdev);
 
-	// Parse the string we received as a u8
-	// See https://elixir.bootlin.com/linux/latest/source/lib/kstrtox.c#L289
-	ret = kstrtou32(buf, 0, &p1);
-	if (ret < 0) {
-		// kstrtou16 returned an error
-		return ret;
+	if (test_and_set_bit(0, &priv->busy)) {
+		return -EBUSY;
 	}
 
-	iowrite32(p1, priv->base_addr + REG1_P1_OFFSET);
+	/*
+	 * The interrupt is off (only open() turns it on), so nothing is
+	 * filling the ring
+	 */
+	kfifo_reset(&priv->ring);
+	adc_0_stream_enable(priv, true);
 
-	// Write was succesful, so we return the number of bytes we wrote.
-	return size;
+	return 0;
 }
 
-static ssize_t p2_show(struct device *dev,
-	struct device_attribute *attr, char *buf)
+/*
+ * adc_0_stream_release() - Stop streaming samples
+ * @inode: Unused.
+ * @file: The file being closed.
+ *
+ * Return: 0.
+ */
+static int adc_0_stream_release(struct inode *inode, struct file *file)
 {
-	u32 p2;
-	struct adc_0_dev *priv = dev_get_drvdata(dev);
+	struct adc_0_priv *priv = container_of(file->private_data,
+	                                       struct adc_0_priv, miscdev);
+
+	adc_0_stream_enable(priv, false);
 
-	p2 = ioread32(priv->base_addr + REG2_P2_OFFSET);
+	// Let a running IRQ thread finish before the next open resets the ring
+	synchronize_irq(priv->irq);
+	clear_bit(0, &priv->busy);
 
-	return scnprintf(buf, PAGE_SIZE, "%u\n", p2);
+	return 0;
 }
 
-static ssize_t p2_store(struct device *dev,
-	struct device_attribute *attr, const char *buf, size_t size)
+/*
+ * adc_0_stream_read() - Read samples as struct adc_0_sample records
+ * @file: The stream file.
+ * @buf: User-space buffer to copy the records into.
+ * @count: Size of @buf; only whole records are returned.
+ * @offset: Unused; the stream has no position.
+ *
+ * Blocks until at least one sample is available, unless the file was
+ * opened with O_NONBLOCK.
+ *
+ * Return: The number of bytes read, or a negative error value.
+ */
+static ssize_t adc_0_stream_read(struct file *file, char __user *buf,
+	size_t count, loff_t *offset)
 {
-	u32 p2;
+	struct adc_0_priv *priv = container_of(file->private_data,
+	                                       struct adc_0_priv, miscdev);
+	unsigned int copied;
 	int ret;
-	struct adc_0_dev *priv = dev_get_drvdata(dev);
 
-	// Parse the string we received as a u8
-	// See https://elixir.bootlin.com/linux/latest/source/lib/kstrtox.c#L289
-	ret = kstrtou32(buf, 0, &p2);
-	if (ret < 0) {
-		// kstrtou16 returned an error
-		return ret;
+	count = rounddown(count, sizeof(struct adc_0_sample));
+	if (count == 0) {
+		return -EINVAL;
 	}
 
-	iowrite32(p2, priv->base_addr + REG2_P2_OFFSET);
-
-	// Write was succesful, so we return the number of bytes we wrote.
-	return size;
-}
+	if (mutex_lock_interruptible(&priv->read_lock)) {
+		return -ERESTARTSYS;
+	}
 
-static ssize_t p3_show(struct device *dev,
-	struct device_attribute *attr, char *buf)
-{
-	u32 p3;
-	struct adc_0_dev *priv = dev_get_drvdata(dev);
+	while (kfifo_is_empty(&priv->ring)) {
+		mutex_unlock(&priv->read_lock);
 
-	p3 = ioread32(priv->base_addr + REG3_P3_OFFSET);
+		if (file->f_flags & O_NONBLOCK) {
+			return -EAGAIN;
+		}
+		if (wait_event_interruptible(priv->wait,
+		                             !kfifo_is_empty(&priv->ring))) {
+			return -ERESTARTSYS;
+		}
 
-	return scnprintf(buf, PAGE_SIZE, "%u\n", p3);
-}
-
-static ssize_t p3_store(struct device *dev,
-	struct device_attribute *attr, const char *buf, size_t size)
-{
-	u32 p3;
-	int ret;
-	struct adc_0_dev *priv = dev_get_drvdata(dev);
+		if (mutex_lock_interruptible(&priv->read_lock)) {
+			return -ERESTARTSYS;
+		}
+	}
 
-	// Parse the string we received as a u8
-	// See https://elixir.bootlin.com/linux/latest/source/lib/kstrtox.c#L289
-	ret = kstrtou32(buf, 0, &p3);
+	ret = kfifo_to_user(&priv->ring, buf, count, &copied);
+	mutex_unlock(&priv->read_lock);
 	if (ret < 0) {
-		// kstrtou16 returned an error
 		return ret;
 	}
 
-	iowrite32(p3, priv->base_addr + REG3_P3_OFFSET);
-
-	// Write was succesful, so we return the number of bytes we wrote.
-	return size;
-}
-
-static ssize_t p4_show(struct device *dev,
-	struct device_attribute *attr, char *buf)
-{
-	u32 p4;
-	struct adc_0_dev *priv = dev_get_drvdata(dev);
-
-	p4 = ioread32(priv->base_addr + REG4_P4_OFFSET);
-
-	return scnprintf(buf, PAGE_SIZE, "%u\n", p4);
+	return copied;
 }
 
-static ssize_t p4_store(struct device *dev,
-	struct device_attribute *attr, const char *buf, size_t size)
+/*
+ * adc_0_stream_poll() - Wait for samples with poll()/select()/epoll
+ * @file: The stream file.
+ * @wait: The poll table.
+ *
+ * Return: EPOLLIN | EPOLLRDNORM when samples can be read without
+ * blocking.
+ */
+static __poll_t adc_0_stream_poll(struct file *file, poll_table *wait)
 {
-	u32 p4;
-	int ret;
-	struct adc_0_dev *priv = dev_get_drvdata(dev);
+	struct adc_0_priv *priv = container_of(file->private_data,
+	                                       struct adc_0_priv, miscdev);
 
-	// Parse the string we received as a u8
-	// See https://elixir.bootlin.com/linux/latest/source/lib/kstrtox.c#L289
-	ret = kstrtou32(buf, 0, &p4);
-	if (ret < 0) {
-		// kstrtou16 returned an error
-		return ret;
-	}
+	poll_wait(file, &priv->wait, wait);
 
-	iowrite32(p4, priv->base_addr + REG4_P4_OFFSET);
-
-	// Write was succesful, so we return the number of bytes we wrote.
-	return size;
+	return kfifo_is_empty(&priv->ring) ? 0 : EPOLLIN | EPOLLRDNORM;
 }
 
+/*
+ * adc_0_stream_fops - File operations of /dev/adc_0_stream
+ */
+static const struct file_operations adc_0_stream_fops = {
+	.owner = THIS_MODULE,
+	.open = adc_0_stream_open,
+	.release = adc_0_stream_release,
+	.read = adc_0_stream_read,
+	.poll = adc_0_stream_poll,
+	.llseek = no_llseek,
+};
 
-static ssize_t p5_show(struct device *dev,
+/*
+ * dropped_show() - Samples lost because nobody read the ring buffer in time
+ * @dev: Device structure for the component (platform or misc device).
+ * @attr: Unused.
+ * @buf: Buffer that gets returned to user-space.
+ *
+ * Return: The number of bytes read.
+ */
+static ssize_t dropped_show(struct device *dev,
 	struct device_attribute *attr, char *buf)
 {
-	u32 p5;
-	struct adc_0_dev *priv = dev_get_drvdata(dev);
+	struct adc_0_priv *priv = READ_ONCE(avalon_get_dev(dev)->drvdata);
 
-	p5 = ioread32(priv->base_addr + REG5_P5_OFFSET);
+	if (!priv) {
+		return -ENODEV;
+	}
 
-	return scnprintf(buf, PAGE_SIZE, "%u\n", p5);
+	return sprintf(buf, "%lu\n", READ_ONCE(priv->dropped));
 }
 
-static ssize_t p5_store(struct device *dev,
-	struct device_attribute *attr, const char *buf, size_t size)
+/*
+ * overflows_show() - Times the fabric FIFO lost samples
+ * @dev: Device structure for the component (platform or misc device).
+ * @attr: Unused.
+ * @buf: Buffer that gets returned to user-space.
+ *
+ * A watermark too close to the FIFO depth for the interrupt latency
+ * shows up here.
+ *
+ * Return: The number of bytes read.
+ */
+static ssize_t overflows_show(struct device *dev,
+	struct device_attribute *attr, char *buf)
 {
-	u32 p5;
-	int ret;
-	struct adc_0_dev *priv = dev_get_drvdata(dev);
+	struct adc_0_priv *priv = READ_ONCE(avalon_get_dev(dev)->drvdata);
 
-	// Parse the string we received as a u8
-	// See https://elixir.bootlin.com/linux/latest/source/lib/kstrtox.c#L289
-	ret = kstrtou32(buf, 0, &p5);
-	if (ret < 0) {
-		// kstrtou16 returned an error
-		return ret;
+	if (!priv) {
+		return -ENODEV;
 	}
 
-	iowrite32(p5, priv->base_addr + REG5_P5_OFFSET);
-
-	// Write was succesful, so we return the number of bytes we wrote.
-	return size;
+	return sprintf(buf, "%lu\n", READ_ONCE(priv->overflows));
 }
-/*-----------------------------------------------------------------------*/
-/* sysfs Attributes                                                      */
-/*-----------------------------------------------------------------------*/
-// Define sysfs attributes
-static DEVICE_ATTR_RW(p0);    // Attribute for REG0
-/* TODO: Add the attributes for REG1 and REG2 using register names       */
-static DEVICE_ATTR_RW(p1);		// Attribute for REG1
-static DEVICE_ATTR_RW(p2);            // Attribute for REG2
-static DEVICE_ATTR_RW(p3);
-static DEVICE_ATTR_RW(p4);
-static DEVICE_ATTR_RW(p5);
-
-// Create an atribute group so the device core can
-// export the attributes for us.
-static struct attribute *adc_0_attrs[] = {
-	&dev_attr_p0.attr,
-/* TODO: Add the attribute entries for REG1 and REG2 using register names*/
-	&dev_attr_p1.attr,
-	&dev_attr_p2.attr,
-	&dev_attr_p3.attr,
-	&dev_attr_p4.attr,
-	&dev_attr_p5.attr,
-	NULL,
-};
-ATTRIBUTE_GROUPS(adc_0);
-
 
-/*-----------------------------------------------------------------------*/
-/* File Operations read()                                                */
-/*-----------------------------------------------------------------------*/
 /*
- * adc_0_read() - Read method for the adc_0 char device
- * @file: Pointer to the char device file struct.
- * @buf: User-space buffer to read the value into.
- * @count: The number of bytes being requested.
- * @offset: The byte offset in the file being read from.
+ * watermark_show() - FIFO level that interrupts the stream
+ * @dev: Device structure for the component (platform or misc device).
+ * @attr: Unused.
+ * @buf: Buffer that gets returned to user-space.
  *
- * Return: On success, the number of bytes written is returned and the
- * offset @offset is advanced by this number. On error, a negative error
- * value is returned.
+ * Return: The number of bytes read.
  */
-
-static ssize_t adc_0_read(struct file *file, char __user *buf,
-	size_t count, loff_t *offset)
+static ssize_t watermark_show(struct device *dev,
+	struct device_attribute *attr, char *buf)
 {
-	size_t ret;
-	u32 val;
-
-	loff_t pos = *offset;
-
-	/*
-	 * Get the device's private data from the file struct's private_data
-	 * field. The private_data field is equal to the miscdev field in the
-	 * adc_0_dev struct. container_of returns the
-     * adc_0_dev struct that contains the miscdev in private_data.
-	 */
-	struct adc_0_dev *priv = container_of(file->private_data,
-	                            struct adc_0_dev, miscdev);
-
-	// Check file offset to make sure we are reading to a valid location.
-	if (pos < 0) {
-		// We can't read from a negative file position.
-		return -EINVAL;
-	}
-	if (pos >= SPAN) {
-		// We can't read from a position past the end of our device.
-		return 0;
-	}
-	if ((pos % 0x4) != 0) {
-		/*
-		 * Prevent unaligned access. Even though the hardware
-		 * technically supports unaligned access, we want to
-		 * ensure that we only access 32-bit-aligned addresses
-		 * because our registers are 32-bit-aligned.
-		 */
-		pr_warn("adc_0_read: unaligned access\n");
-		return -EFAULT;
-	}
-
-	// If the user didn't request any bytes, don't return any bytes :)
-	if (count == 0) {
-		return 0;
-	}
-
-	// Read the value at offset pos.
-	val = ioread32(priv->base_addr + pos);
+	struct avalon_dev *adev = avalon_get_dev(dev);
+	u32 ctrl = readl(adev->base_addr + FIFO_CTRL_OFFSET);
 
-	ret = copy_to_user(buf, &val, sizeof(val));
-	if (ret == sizeof(val)) {
-		// Nothing was copied to the user.
-		pr_warn("adc_0_read: nothing copied\n");
-		return -EFAULT;
-	}
-
-	// Increment the file offset by the number of bytes we read.
-	*offset = pos + sizeof(val);
-
-	return sizeof(val);
+	return sprintf(buf, "%lu\n", FIELD_GET(FIFO_CTRL_WATERMARK, ctrl));
 }
 
-/*-----------------------------------------------------------------------*/
-/* File Operations write()                                               */
-/*-----------------------------------------------------------------------*/
 /*
- * adc_0_write() - Write method for the adc_0 char device
- * @file: Pointer to the char device file struct.
- * @buf: User-space buffer to read the value from.
- * @count: The number of bytes being written.
- * @offset: The byte offset in the file being written to.
+ * watermark_store() - Set the FIFO level that interrupts the stream
+ * @dev: Device structure for the component (platform or misc device).
+ * @attr: Unused.
+ * @buf: 1..255 samples.
+ * @count: The number of bytes in @buf.
  *
- * Return: On success, the number of bytes written is returned and the
- * offset @offset is advanced by this number. On error, a negative error
- * value is returned.
+ * Takes effect immediately, also while the stream is open. A low
+ * watermark costs interrupts; a high one leaves less room for the
+ * interrupt latency before the FIFO overflows.
+ *
+ * Return: The number of bytes stored.
  */
-static ssize_t adc_0_write(struct file *file, const char __user *buf,
-	size_t count, loff_t *offset)
+static ssize_t watermark_store(struct device *dev,
+	struct device_attribute *attr, const char *buf, size_t count)
 {
-	size_t ret;
-	u32 val;
-
-	loff_t pos = *offset;
-
-	/*
-	 * Get the device's private data from the file struct's private_data
-	 * field. The private_data field is equal to the miscdev field in the
-	 * adc_0_dev struct. container_of returns the
-     * adc_0_dev struct that contains the miscdev in private_data.
-	 */
-	struct adc_0_dev *priv = container_of(file->private_data,
-	                              struct adc_0_dev, miscdev);
+	struct avalon_dev *adev = avalon_get_dev(dev);
+	void __iomem *reg = adev->base_addr + FIFO_CTRL_OFFSET;
+	u32 ctrl;
+	u32 wm;
+	int ret;
 
-	// Check file offset to make sure we are writing to a valid location.
-	if (pos < 0) {
-		// We can't write to a negative file position.
-		return -EINVAL;
-	}
-	if (pos >= SPAN) {
-		// We can't write to a position past the end of our device.
-		return 0;
-	}
-	if ((pos % 0x4) != 0) {
-		/*
-		 * Prevent unaligned access. Even though the hardware
-		 * technically supports unaligned access, we want to
-		 * ensure that we only access 32-bit-aligned addresses
-		 * because our registers are 32-bit-aligned.
-		 */
-		pr_warn("adc_0_write: unaligned access\n");
-		return -EFAULT;
+	ret = kstrtou32(buf, 0, &wm);
+	if (ret < 0) {
+		return ret;
 	}
-	// If the user didn't request to write anything, return 0.
-	if (count == 0) {
-		return 0;
+	// The fabric never interrupts at 0
+	if (wm == 0 || wm > FIELD_MAX(FIFO_CTRL_WATERMARK)) {
+		return -EINVAL;
 	}
 
-	mutex_lock(&priv->lock);
-
-	ret = copy_from_user(&val, buf, sizeof(val));
-	if (ret == sizeof(val)) {
-		// Nothing was copied from the user.
-		pr_warn("adc_0_write: nothing copied from user space\n");
-		ret = -EFAULT;
-		goto unlock;
-	}
+	// Keep IRQ_EN as it is; FLUSH is never written back from a read
+	mutex_lock(&adev->lock);
+	ctrl = readl(reg) & ~(FIFO_CTRL_WATERMARK | FIFO_CTRL_FLUSH);
+	writel(ctrl | wm, reg);
+	mutex_unlock(&adev->lock);
 
-	// Write the value we were given at the address offset given by pos.
-	iowrite32(val, priv->base_addr + pos);
+	return count;
+}
 
-	// Increment the file offset by the number of bytes we wrote.
-	*offset = pos + sizeof(val);
+static DEVICE_ATTR_RO(dropped);
+static DEVICE_ATTR_RO(overflows);
+static DEVICE_ATTR_RW(watermark);
 
-	// Return the number of bytes we wrote.
-	ret = sizeof(val);
+static struct attribute *adc_0_attrs[] = {
+	&dev_attr_dropped.attr,
+	&dev_attr_overflows.attr,
+	&dev_attr_watermark.attr,
+	NULL
+};
 
-unlock:
-	mutex_unlock(&priv->lock);
-	return ret;
-}
+static const struct attribute_group adc_0_group = {
+	.attrs = adc_0_attrs,
+};
 
+static const struct attribute_group *adc_0_groups[] = {
+	&adc_0_group,
+	NULL
+};
 
-/*-----------------------------------------------------------------------*/
-/* File Operations Supported                                             */
-/*-----------------------------------------------------------------------*/
 /*
- *  adc_0_fops - File operations supported by the
- *                          adc_0 driver
- * @owner: The adc_0 driver owns the file operations; this
- *         ensures that the driver can't be removed while the
- *         character device is still in use.
- * @read: The read function.
- * @write: The write function.
- * @llseek: We use the kernel's default_llseek() function; this allows
- *          users to change what position they are writing/reading to/from.
+ * adc_0_component - Description of the adc_0 component
+ *                   for the Avalon register-map core
  */
-static const struct file_operations  adc_0_fops = {
+static const struct avalon_component adc_0_component = {
 	.owner = THIS_MODULE,
-	.read = adc_0_read,
-	.write = adc_0_write,
-	.llseek = default_llseek,
+	.name = "adc_0",
+	.regs = adc_0_regs,
+	.num_regs = ARRAY_SIZE(adc_0_regs),
+	.span = SPAN,
+	.groups = adc_0_groups,
 };
 
 /*-----------------------------------------------------------------------*/
@@ -476,57 +495,59 @@ static const struct file_operations  adc_0_fops = {
  *        driver core based upon our adc_0 device tree node.
  *
  * When a device that is compatible with this adc_0 driver
- * is found, the driver's probe function is called. This probe function
- * gets called by the kernel when an adc_0 device is found
- * in the device tree.
+ * is found, the driver's probe function is called. The register-map
+ * core maps the registers, creates the sysfs attributes and registers
+ * the /dev/adc_0 char device for us. We then register /dev/adc_0_stream
+ * and the FIFO interrupt, which stays disabled until the stream is
+ * opened.
  */
 static int adc_0_probe(struct platform_device *pdev)
 {
-	struct adc_0_dev *priv;
+	struct adc_0_priv *priv;
+	struct avalon_dev *adev;
 	int ret;
 
-	/*
-	 * Allocate kernel memory for the adc_0 device and set it to 0.
-	 * GFP_KERNEL specifies that we are allocating normal kernel RAM;
-	 * see the kmalloc documentation for more info. The allocated memory
-	 * is automatically freed when the device is removed.
-	 */
-	priv = devm_kzalloc(&pdev->dev, sizeof(struct adc_0_dev), GFP_KERNEL);
+	priv = devm_kzalloc(&pdev->dev, sizeof(*priv), GFP_KERNEL);
 	if (!priv) {
-		pr_err("Failed to allocate kernel memory for hps_led_pattern\n");
 		return -ENOMEM;
 	}
 
-	/*
-	 * Request and remap the device's memory region. Requesting the region
-	 * make sure nobody else can use that memory. The memory is remapped
-	 * into the kernel's virtual address space becuase we don't have access
-	 * to physical memory locations.
-	 */
-	priv->base_addr = devm_platform_ioremap_resource(pdev, 0);
-	if (IS_ERR(priv->base_addr)) {
-		pr_err("Failed to request/remap platform device resource (adc_0)\n");
-		return PTR_ERR(priv->base_addr);
+	priv->irq = platform_get_irq(pdev, 0);
+	if (priv->irq < 0) {
+		return priv->irq;
+	}
+
+	adev = avalon_probe(pdev, &adc_0_component);
+	if (IS_ERR(adev)) {
+		pr_err("Failed to set up adc_0 (%ld)\n", PTR_ERR(adev));
+		return PTR_ERR(adev);
+	}
+
+	priv->adev = adev;
+	INIT_KFIFO(priv->ring);
+	mutex_init(&priv->read_lock);
+	init_waitqueue_head(&priv->wait);
+
+	// A FIFO left running by a previous load must not interrupt us
+	adc_0_stream_enable(priv, false);
+	ret = devm_request_threaded_irq(&pdev->dev, priv->irq, NULL,
+	                                adc_0_irq_thread, IRQF_ONESHOT,
+	                                "adc_0", priv);
+	if (ret < 0) {
+		avalon_remove(pdev);
+		return ret;
 	}
 
-	// Initialize the misc device parameters
 	priv->miscdev.minor = MISC_DYNAMIC_MINOR;
-	priv->miscdev.name = "adc_0";
-	priv->miscdev.fops = &adc_0_fops;
+	priv->miscdev.name = "adc_0_stream";
+	priv->miscdev.fops = &adc_0_stream_fops;
 	priv->miscdev.parent = &pdev->dev;
-	priv->miscdev.groups = adc_0_groups;
-
-	// Register the misc device; this creates a char dev at
-    // /dev/adc_0
 	ret = misc_register(&priv->miscdev);
-	if (ret) {
-		pr_err("Failed to register misc device for adc_0\n");
+	if (ret < 0) {
+		avalon_remove(pdev);
 		return ret;
 	}
-
-	// Attach the adc_0' private data to the
-    // platform device's struct.
-	platform_set_drvdata(pdev, priv);
+	WRITE_ONCE(adev->drvdata, priv);
 
 	pr_info("adc_0_probe successful\n");
 
@@ -545,11 +566,15 @@ static int adc_0_probe(struct platform_device *pdev)
  */
 static int adc_0_remove(struct platform_device *pdev)
 {
-	// Get theadc_0' private data from the platform device.
-	struct adc_0_dev *priv = platform_get_drvdata(pdev);
+	struct avalon_dev *adev = platform_get_drvdata(pdev);
+	struct adc_0_priv *priv = adev->drvdata;
 
-	// Deregister the misc device and remove the /dev/adc_0 file.
+	// Remove /dev/adc_0_stream and make sure the FIFO stops interrupting
 	misc_deregister(&priv->miscdev);
+	adc_0_stream_enable(priv, false);
+
+	// Deregister the misc device and remove the /dev/adc_0 file.
+	avalon_remove(pdev);
 
 	pr_info("adc_0_remove successful\n");
 
@@ -584,9 +609,8 @@ MODULE_DEVICE_TABLE(of, adc_0_of_match);
  * @driver.owner: Which module owns this driver
  * @driver.name: Name of the adc_0 driver
  * @driver.of_match_table: Device tree match table
- * @driver.dev_groups: adc_0 sysfs attribute group; this
- *                     allows the driver core to create the
- *                     attribute(s) without race conditions.
+ * @driver.suppress_bind_attrs: No unbinding through sysfs; an open
+ *                              /dev/<name> would outlive our data
  */
 static struct platform_driver adc_0_driver = {
 	.probe = adc_0_probe,
@@ -595,7 +619,7 @@ static struct platform_driver adc_0_driver = {
 		.owner = THIS_MODULE,
 		.name = "adc_0",
 		.of_match_table = adc_0_of_match,
-		.dev_groups = adc_0_groups,
+		.suppress_bind_attrs = true,
 	},
 };
 
@@ -608,4 +632,4 @@ module_platform_driver(adc_0_driver);
 MODULE_LICENSE("Dual MIT/GPL");
 MODULE_AUTHOR("Huiwen Zhang");  // Adapted from Trevor Vannoy's Echo Driver
 MODULE_DESCRIPTION("adc_0 driver");
-MODULE_VERSION("1.0");
\ No newline at end of file
+MODULE_VERSION("1.0");
@@ -0,0 +1,26 @@
+/* SPDX-License-Identifier: GPL-2.0 or MIT                               */
+/*-------------------------------------------------------------------------
+ * Description:  Records read from /dev/adc_0_stream. Shared between the
+ *               adc_0 driver and user-space programs.
+ * ------------------------------------------------------------------------
+ * License : GPL-2.0 or MIT (opensource.org / licenses / MIT, GPL-2.0)
+-------------------------------------------------------------------------*/
+#ifndef ADC_0_STREAM_H
+#define ADC_0_STREAM_H
+
+#include <linux/types.h>
+
+/*
+ * struct adc_0_sample - One conversion, in the order the ADC made them
+ * @channel: ADC channel the sample was taken on (0..15)
+ * @sample: The 12-bit conversion result
+ *
+ * read() returns whole records only, so the buffer must hold at least
+ * one.
+ */
+struct adc_0_sample {
+	__u16 channel;
+	__u16 sample;
+};
+
+#endif /* ADC_0_STREAM_H */
@@ -0,0 +1,238 @@
+/* SPDX-License-Identifier: GPL-2.0 or MIT                               */
+/*-------------------------------------------------------------------------
+ * Description:  Test /dev/adc_0_stream against the mocked sample FIFO
+ * ------------------------------------------------------------------------
+ * Needs avalon_mock.ko and adc_0.ko loaded and debugfs mounted. Fills
+ * the mocked FIFO through /sys/kernel/debug/avalon_mock/adc_0_fill and
+ * checks what adc_0_irq_thread() and adc_0_stream_read() make of it:
+ * O_NONBLOCK reads of an empty stream, the watermark, the records
+ * themselves, overflow and dropped accounting, short reads, one reader
+ * at a time, fifo_ctrl being read-only, and a closed stream leaving the
+ * interrupt off. Leaves the watermark at 128.
+ * ------------------------------------------------------------------------
+ * License : GPL-2.0 or MIT (opensource.org / licenses / MIT, GPL-2.0)
+-------------------------------------------------------------------------*/
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "adc_0_stream.h"
+
+#define STREAM "/dev/adc_0_stream"
+#define REGS "/dev/adc_0"
+#define SYSFS "/sys/class/misc/adc_0/"
+#define FILL "/sys/kernel/debug/avalon_mock/adc_0_fill"
+
+/* As in lab7/adc_0.c */
+#define RING_RECORDS 4096
+#define FIFO_CTRL_OFFSET 0x4c
+#define FIFO_CTRL_IRQ_EN (1U << 31)
+
+static int failures;
+
+#define CHECK(cond, ...) do {                 \
+	if (cond) {                               \
+		printf("ok   " __VA_ARGS__);          \
+	} else {                                  \
+		printf("FAIL " __VA_ARGS__);          \
+		failures++;                           \
+	}                                         \
+	printf("\n");                             \
+} while (0)
+
+static int write_str(const char *path, const char *str)
+{
+	ssize_t len = strlen(str);
+	int fd;
+
+	fd = open(path, O_WRONLY);
+	if (fd < 0) {
+		return -errno;
+	}
+	len = write(fd, str, len) == len ? 0 : -errno;
+	close(fd);
+
+	return len;
+}
+
+static unsigned long read_ul(const char *path)
+{
+	char buf[32];
+	ssize_t len;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		perror(path);
+		exit(1);
+	}
+	len = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (len < 0) {
+		perror(path);
+		exit(1);
+	}
+	buf[len] = '\0';
+
+	return strtoul(buf, NULL, 0);
+}
+
+static void fill(unsigned int level, unsigned int channel,
+	unsigned int sample, int overflow)
+{
+	char buf[64];
+	int ret;
+
+	snprintf(buf, sizeof(buf), "%u %u %u %d\n", level, channel, sample,
+	         overflow);
+	ret = write_str(FILL, buf);
+	if (ret) {
+		fprintf(stderr, "%s: %s\n", FILL, strerror(-ret));
+		exit(1);
+	}
+}
+
+/*
+ * drain() - Read the stream until it's empty
+ *
+ * Return: The number of records read; each is checked against @channel
+ * and @sample unless @channel is negative.
+ */
+static unsigned long drain(int fd, int channel, unsigned int sample)
+{
+	struct adc_0_sample rec[256];
+	unsigned long total = 0;
+	unsigned long bad = 0;
+	ssize_t len;
+	size_t i;
+
+	while ((len = read(fd, rec, sizeof(rec))) > 0) {
+		for (i = 0; i < len / sizeof(rec[0]); i++) {
+			if (channel >= 0 && (rec[i].channel != channel ||
+			                     rec[i].sample != sample)) {
+				bad++;
+			}
+		}
+		total += len / sizeof(rec[0]);
+	}
+	CHECK(len < 0 && errno == EAGAIN, "drained to EAGAIN");
+	if (channel >= 0) {
+		CHECK(bad == 0, "%lu records hold %d/%u", total, channel, sample);
+	}
+
+	return total;
+}
+
+int main(void)
+{
+	struct adc_0_sample rec, recs[2];
+	struct pollfd pfd;
+	unsigned long before;
+	unsigned long n;
+	unsigned int ctrl;
+	int fd, fd2, regs;
+	ssize_t len;
+
+	if (write_str(SYSFS "watermark", "16")) {
+		perror(SYSFS "watermark");
+		return 1;
+	}
+
+	fd = open(STREAM, O_RDONLY | O_NONBLOCK);
+	if (fd < 0) {
+		perror(STREAM);
+		return 1;
+	}
+
+	fd2 = open(STREAM, O_RDONLY | O_NONBLOCK);
+	CHECK(fd2 < 0 && errno == EBUSY, "second open: EBUSY");
+	if (fd2 >= 0) {
+		close(fd2);
+	}
+
+	CHECK(read_ul(SYSFS "fifo_ctrl") & FIFO_CTRL_IRQ_EN,
+	      "open enables the interrupt");
+	len = read(fd, &rec, sizeof(rec));
+	CHECK(len < 0 && errno == EAGAIN, "empty stream: EAGAIN");
+
+	// Below the watermark nothing interrupts
+	fill(15, 3, 100, 0);
+	len = read(fd, &rec, sizeof(rec));
+	CHECK(len < 0 && errno == EAGAIN, "15 samples, watermark 16: EAGAIN");
+
+	fill(16, 3, 100, 0);
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	CHECK(poll(&pfd, 1, 1000) == 1 && (pfd.revents & POLLIN),
+	      "16 samples, watermark 16: POLLIN");
+	len = read(fd, recs, sizeof(recs[0]) + 2);
+	CHECK(len == sizeof(recs[0]) && recs[0].channel == 3 &&
+	      recs[0].sample == 100, "partial record rounded down");
+	n = 1 + drain(fd, 3, 100);
+	CHECK(n == 16, "%lu records, expected 16", n);
+
+	len = read(fd, &rec, sizeof(rec) - 1);
+	CHECK(len < 0 && errno == EINVAL, "read smaller than a record: EINVAL");
+
+	// Overflow is counted and the samples still arrive
+	before = read_ul(SYSFS "overflows");
+	fill(20, 7, 4095, 1);
+	n = read_ul(SYSFS "overflows") - before;
+	CHECK(n == 1, "overflows went up by %lu", n);
+	n = drain(fd, 7, 4095);
+	CHECK(n == 20, "%lu records after overflow, expected 20", n);
+
+	// Nobody reading: the ring fills up and the rest is dropped
+	before = read_ul(SYSFS "dropped");
+	for (n = 0; n < RING_RECORDS / 255 + 1; n++) {
+		fill(255, 1, 1, 0);
+	}
+	n = read_ul(SYSFS "dropped") - before;
+	CHECK(n == (RING_RECORDS / 255 + 1) * 255 - RING_RECORDS,
+	      "dropped went up by %lu", n);
+	n = drain(fd, 1, 1);
+	CHECK(n == RING_RECORDS, "%lu records from a full ring", n);
+
+	// Neither sysfs nor /dev/adc_0 may touch fifo_ctrl
+	CHECK(write_str(SYSFS "fifo_ctrl", "0x80000010") < 0,
+	      "fifo_ctrl sysfs write refused");
+	regs = open(REGS, O_RDWR);
+	if (regs < 0) {
+		perror(REGS);
+		return 1;
+	}
+	ctrl = FIFO_CTRL_IRQ_EN | 16;
+	len = pwrite(regs, &ctrl, sizeof(ctrl), FIFO_CTRL_OFFSET);
+	CHECK(len < 0, "fifo_ctrl write through %s refused", REGS);
+
+	CHECK(write_str(SYSFS "watermark", "0") < 0, "watermark 0 refused");
+	CHECK(write_str(SYSFS "watermark", "256") < 0, "watermark 256 refused");
+
+	// Closed: the interrupt stays off and the next open starts empty
+	close(fd);
+	CHECK(!(read_ul(SYSFS "fifo_ctrl") & FIFO_CTRL_IRQ_EN),
+	      "close disables the interrupt");
+	len = pwrite(regs, &ctrl, sizeof(ctrl), FIFO_CTRL_OFFSET);
+	CHECK(len < 0 && !(read_ul(SYSFS "fifo_ctrl") & FIFO_CTRL_IRQ_EN),
+	      "closed stream: interrupt can't be enabled through %s", REGS);
+	close(regs);
+	fill(200, 2, 2, 0);
+
+	fd = open(STREAM, O_RDONLY | O_NONBLOCK);
+	if (fd < 0) {
+		perror(STREAM);
+		return 1;
+	}
+	len = read(fd, &rec, sizeof(rec));
+	CHECK(len < 0 && errno == EAGAIN, "reopened stream is empty");
+	CHECK(read_ul(SYSFS "watermark") == 16, "watermark kept across close");
+	close(fd);
+
+	write_str(SYSFS "watermark", "128");
+
+	printf("%s\n", failures ? "FAILED" : "PASSED");
+	return failures ? 1 : 0;
+}
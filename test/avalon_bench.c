@@ -0,0 +1,285 @@
+/* SPDX-License-Identifier: GPL-2.0 or MIT                               */
+/*-------------------------------------------------------------------------
+ * Description:  Threaded load generator for the Avalon component drivers
+ * ------------------------------------------------------------------------
+ * Starts N threads that hammer one access path of a component at the
+ * same time and reports the aggregate rate and the latency percentiles
+ * of a single access. The paths are
+ *   sysfs  /sys/class/misc/<name>/<reg>, one register per access
+ *   word   /dev/<name>, one 32-bit pread()/pwrite() at -o
+ *   bulk   /dev/<name>, one pread()/pwrite() of -s bytes at -o
+ * Writes store back the value read before the run, so the component
+ * keeps its settings. Works the same against real hardware and against
+ * the devices registered by avalon_mock.ko.
+ *
+ *   avalon_bench [-t threads] [-n ops] [-w] [-o offset] [-s bytes]
+ *                sysfs|word|bulk <name> [reg]
+ * ------------------------------------------------------------------------
+ * License : GPL-2.0 or MIT (opensource.org / licenses / MIT, GPL-2.0)
+-------------------------------------------------------------------------*/
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// AVALON_MAX_SPAN in avalon_regmap.h
+#define MAX_SPAN 0x80
+
+enum bench_mode { MODE_SYSFS, MODE_WORD, MODE_BULK };
+
+/*
+ * struct bench - Parameters shared by every thread
+ * @path: File every thread opens
+ * @mode: Access path under test
+ * @write: Store instead of load
+ * @offset: Byte offset of the access in /dev/<name>
+ * @len: Bytes per access
+ * @val: What a store writes
+ * @ops: Accesses per thread
+ * @start: Released once every thread has opened its file
+ */
+struct bench {
+	char path[256];
+	enum bench_mode mode;
+	int write;
+	off_t offset;
+	size_t len;
+	char val[MAX_SPAN];
+	unsigned long ops;
+	pthread_barrier_t start;
+};
+
+/*
+ * struct worker - One thread's state
+ * @b: The shared parameters
+ * @lat: Latency of each access in ns
+ * @done: Number of accesses that succeeded
+ * @err: errno of the first failed access, 0 if none failed
+ */
+struct worker {
+	struct bench *b;
+	uint64_t *lat;
+	unsigned long done;
+	int err;
+};
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a;
+	uint64_t y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void *worker_run(void *arg)
+{
+	struct worker *w = arg;
+	struct bench *b = w->b;
+	char buf[MAX_SPAN];
+	unsigned long i;
+	uint64_t t0;
+	ssize_t ret;
+	int fd;
+
+	fd = open(b->path, b->write ? O_WRONLY : O_RDONLY);
+	if (fd < 0) {
+		w->err = errno;
+	}
+	pthread_barrier_wait(&b->start);
+	if (fd < 0) {
+		return NULL;
+	}
+
+	for (i = 0; i < b->ops; i++, w->done++) {
+		t0 = now_ns();
+		// sysfs attributes are reread from offset 0 as well
+		if (b->write) {
+			ret = pwrite(fd, b->val, b->len, b->offset);
+		} else {
+			ret = pread(fd, buf, b->len, b->offset);
+		}
+		w->lat[i] = now_ns() - t0;
+
+		// A short sysfs read is the whole value; elsewhere it's an error
+		if (ret < 0 || (b->mode != MODE_SYSFS && (size_t)ret != b->len)) {
+			w->err = ret < 0 ? errno : EIO;
+			break;
+		}
+	}
+
+	close(fd);
+	return NULL;
+}
+
+/*
+ * Read the value the stores will write back, so that a write run leaves
+ * the component as it found it.
+ */
+static int bench_load_value(struct bench *b)
+{
+	ssize_t ret;
+	int fd;
+
+	fd = open(b->path, O_RDONLY);
+	if (fd < 0) {
+		return -errno;
+	}
+	ret = pread(fd, b->val, b->mode == MODE_SYSFS ? sizeof(b->val) - 1 : b->len,
+	            b->offset);
+	close(fd);
+	if (ret < 0) {
+		return -errno;
+	}
+	if (b->mode == MODE_SYSFS) {
+		b->len = ret;
+	} else if ((size_t)ret != b->len) {
+		return -EIO;
+	}
+
+	return 0;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+	        "usage: %s [-t threads] [-n ops] [-w] [-o offset] [-s bytes]\n"
+	        "       %*s sysfs|word|bulk <name> [reg]\n",
+	        prog, (int)strlen(prog), "");
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	struct bench b = { .len = 4, .ops = 10000 };
+	unsigned long threads = 1;
+	unsigned long t, done = 0;
+	struct worker *w;
+	pthread_t *tid;
+	uint64_t *all, t0, wall;
+	int opt, ret;
+
+	while ((opt = getopt(argc, argv, "t:n:wo:s:")) != -1) {
+		switch (opt) {
+		case 't':
+			threads = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			b.ops = strtoul(optarg, NULL, 0);
+			break;
+		case 'w':
+			b.write = 1;
+			break;
+		case 'o':
+			b.offset = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			b.len = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (argc - optind < 2 || threads == 0 || b.ops == 0) {
+		usage(argv[0]);
+	}
+
+	if (!strcmp(argv[optind], "sysfs")) {
+		if (argc - optind < 3) {
+			usage(argv[0]);
+		}
+		b.mode = MODE_SYSFS;
+		b.offset = 0;
+		snprintf(b.path, sizeof(b.path), "/sys/class/misc/%s/%s",
+		         argv[optind + 1], argv[optind + 2]);
+	} else if (!strcmp(argv[optind], "word") ||
+	           !strcmp(argv[optind], "bulk")) {
+		b.mode = argv[optind][0] == 'w' ? MODE_WORD : MODE_BULK;
+		if (b.mode == MODE_WORD) {
+			b.len = 4;
+		}
+		snprintf(b.path, sizeof(b.path), "/dev/%s", argv[optind + 1]);
+	} else {
+		usage(argv[0]);
+	}
+	if (b.len == 0 || b.len > MAX_SPAN || b.len % 4 || b.offset % 4) {
+		fprintf(stderr, "offset and size must be words within 0x%x bytes\n",
+		        MAX_SPAN);
+		return 2;
+	}
+
+	if (b.write) {
+		ret = bench_load_value(&b);
+		if (ret) {
+			fprintf(stderr, "%s: %s\n", b.path, strerror(-ret));
+			return 1;
+		}
+	}
+
+	w = calloc(threads, sizeof(*w));
+	tid = calloc(threads, sizeof(*tid));
+	all = calloc(threads * b.ops, sizeof(*all));
+	if (!w || !tid || !all) {
+		perror("calloc");
+		return 1;
+	}
+
+	// The main thread joins the barrier to take the start time
+	pthread_barrier_init(&b.start, NULL, threads + 1);
+	for (t = 0; t < threads; t++) {
+		w[t].b = &b;
+		w[t].lat = all + t * b.ops;
+		ret = pthread_create(&tid[t], NULL, worker_run, &w[t]);
+		if (ret) {
+			fprintf(stderr, "pthread_create: %s\n", strerror(ret));
+			return 1;
+		}
+	}
+	pthread_barrier_wait(&b.start);
+	t0 = now_ns();
+	for (t = 0; t < threads; t++) {
+		pthread_join(tid[t], NULL);
+	}
+	wall = now_ns() - t0;
+
+	// Pack the latencies of the accesses that succeeded
+	ret = 0;
+	for (t = 0; t < threads; t++) {
+		if (w[t].err) {
+			fprintf(stderr, "thread %lu: %s: %s\n", t, b.path,
+			        strerror(w[t].err));
+			ret = 1;
+		}
+		memmove(all + done, w[t].lat, w[t].done * sizeof(*all));
+		done += w[t].done;
+	}
+	if (done == 0) {
+		return 1;
+	}
+	qsort(all, done, sizeof(*all), cmp_u64);
+
+	printf("%s %s x%lu: %lu ops in %.3f s, %.0f ops/s\n",
+	       b.write ? "write" : "read", b.path, threads, done, wall / 1e9,
+	       done / (wall / 1e9));
+	printf("latency ns: p50 %llu  p99 %llu  max %llu\n",
+	       (unsigned long long)all[done / 2],
+	       (unsigned long long)all[done * 99 / 100],
+	       (unsigned long long)all[done - 1]);
+
+	free(all);
+	free(tid);
+	free(w);
+	return ret;
+}
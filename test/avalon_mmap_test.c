@@ -0,0 +1,175 @@
+/* SPDX-License-Identifier: GPL-2.0 or MIT                               */
+/*-------------------------------------------------------------------------
+ * Description:  Check that mmap() of /dev/<name> reaches the registers
+ * ------------------------------------------------------------------------
+ * Maps the register window, checks that the device switched to
+ * cache_bypass, stores patterns through the mapping and reads them back
+ * through the driver: the sysfs attribute (which goes through
+ * avalon_reg_read()) and a pread() of /dev/<name>. Then it writes the
+ * attribute and loads the word through the mapping. The register keeps
+ * its original value afterwards. Meant for the RAM-backed devices of
+ * avalon_mock.ko but works on hardware too; avalon_regmap must be loaded
+ * with allow_mmap=1.
+ *
+ *   avalon_mmap_test [-o offset] [-b width] <name> <reg>
+ * ------------------------------------------------------------------------
+ * License : GPL-2.0 or MIT (opensource.org / licenses / MIT, GPL-2.0)
+-------------------------------------------------------------------------*/
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+static const uint32_t patterns[] = { 0x1234, 0xa5a5a5a5, 0xffffffff, 0 };
+
+static int failures;
+
+static void check(const char *what, uint32_t got, uint32_t want)
+{
+	if (got != want) {
+		printf("FAIL %s: 0x%x, expected 0x%x\n", what, got, want);
+		failures++;
+	} else {
+		printf("ok   %s: 0x%x\n", what, got);
+	}
+}
+
+static int sysfs_read(const char *path, uint32_t *val)
+{
+	char buf[32];
+	ssize_t len;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		return -errno;
+	}
+	len = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (len < 0) {
+		return -errno;
+	}
+	buf[len] = '\0';
+	*val = strtoul(buf, NULL, 0);
+
+	return 0;
+}
+
+static int sysfs_write(const char *path, uint32_t val)
+{
+	char buf[32];
+	ssize_t len;
+	int fd;
+
+	fd = open(path, O_WRONLY);
+	if (fd < 0) {
+		return -errno;
+	}
+	len = snprintf(buf, sizeof(buf), "%u\n", val);
+	len = write(fd, buf, len) == len ? 0 : -errno;
+	close(fd);
+
+	return len;
+}
+
+int main(int argc, char **argv)
+{
+	char dev[256], attr[256], bypass[256];
+	volatile uint32_t *regs;
+	unsigned int width = 16;
+	uint32_t mask, orig, val;
+	long offset = 0;
+	size_t page;
+	unsigned int i;
+	int opt, fd, ret;
+
+	while ((opt = getopt(argc, argv, "o:b:")) != -1) {
+		switch (opt) {
+		case 'o':
+			offset = strtol(optarg, NULL, 0);
+			break;
+		case 'b':
+			width = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			goto usage;
+		}
+	}
+	page = sysconf(_SC_PAGESIZE);
+	if (argc - optind != 2 || offset < 0 || offset % 4 ||
+	    (size_t)offset >= page || width == 0 || width > 32) {
+		goto usage;
+	}
+	mask = width < 32 ? (1U << width) - 1 : ~0U;
+
+	snprintf(dev, sizeof(dev), "/dev/%s", argv[optind]);
+	snprintf(attr, sizeof(attr), "/sys/class/misc/%s/%s", argv[optind],
+	         argv[optind + 1]);
+	snprintf(bypass, sizeof(bypass), "/sys/class/misc/%s/cache_bypass",
+	         argv[optind]);
+
+	fd = open(dev, O_RDWR | O_SYNC);
+	if (fd < 0) {
+		perror(dev);
+		return 1;
+	}
+	regs = mmap(NULL, page, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (regs == MAP_FAILED) {
+		fprintf(stderr, "%s: mmap: %s%s\n", dev, strerror(errno),
+		        errno == EPERM ? " (load avalon_regmap allow_mmap=1)" : "");
+		return 1;
+	}
+	regs += offset / 4;
+	orig = *regs;
+
+	ret = sysfs_read(bypass, &val);
+	if (ret) {
+		fprintf(stderr, "%s: %s\n", bypass, strerror(-ret));
+		return 1;
+	}
+	check("cache_bypass after mmap", val, 1);
+
+	// Stores through the mapping, loads through the driver
+	for (i = 0; i < sizeof(patterns) / sizeof(patterns[0]); i++) {
+		*regs = patterns[i];
+
+		ret = sysfs_read(attr, &val);
+		if (ret) {
+			fprintf(stderr, "%s: %s\n", attr, strerror(-ret));
+			return 1;
+		}
+		check("mmap store, sysfs load", val, patterns[i] & mask);
+
+		if (pread(fd, &val, sizeof(val), offset) != sizeof(val)) {
+			perror(dev);
+			return 1;
+		}
+		check("mmap store, pread", val & mask, patterns[i] & mask);
+	}
+
+	// And the other way round
+	for (i = 0; i < sizeof(patterns) / sizeof(patterns[0]); i++) {
+		ret = sysfs_write(attr, patterns[i] & mask);
+		if (ret) {
+			fprintf(stderr, "%s: %s\n", attr, strerror(-ret));
+			return 1;
+		}
+		check("sysfs store, mmap load", *regs & mask, patterns[i] & mask);
+	}
+
+	*regs = orig;
+	munmap((void *)(regs - offset / 4), page);
+	close(fd);
+
+	printf("%s\n", failures ? "FAILED" : "PASSED");
+	return failures ? 1 : 0;
+
+usage:
+	fprintf(stderr, "usage: %s [-o offset] [-b width] <name> <reg>\n",
+	        argv[0]);
+	return 2;
+}
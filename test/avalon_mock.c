@@ -0,0 +1,263 @@
+/* SPDX-License-Identifier: GPL-2.0 or MIT                               */
+/*-------------------------------------------------------------------------
+ * Description:  Mock Avalon bus for the effect and adc_0 drivers
+ * ------------------------------------------------------------------------
+ * Registers one platform device per component, each backed by a zeroed
+ * page of kernel memory handed over in struct avalon_platform_data, with
+ * a MEM resource for the same page so that mmap() works too (load
+ * avalon_regmap with allow_mmap=1 for avalon_mmap_test). The unmodified
+ * component drivers bind to them by driver name, so sysfs, /dev/<name>
+ * and the bulk paths can be exercised (and benchmarked) on a board
+ * without the FPGA image loaded. Registers read back whatever was last
+ * written; there is no DSP behind them.
+ *
+ * adc_0 also gets an interrupt and a stand-in for its sample FIFO,
+ * driven from debugfs (see avalon_mock_fill_write()) by
+ * adc_0_stream_test. Close and unmap every /dev/<name> before unloading
+ * this module.
+ * ------------------------------------------------------------------------
+ * License : GPL-2.0 or MIT (opensource.org / licenses / MIT, GPL-2.0)
+-------------------------------------------------------------------------*/
+#include <linux/module.h>
+#include <linux/platform_device.h>
+#include <linux/gfp.h>
+#include <linux/io.h>
+#include <linux/kernel.h>
+#include <linux/err.h>
+#include <linux/bitfield.h>
+#include <linux/debugfs.h>
+#include <linux/fs.h>
+#include <linux/uaccess.h>
+#include <linux/irq.h>
+#include <linux/interrupt.h>
+#include "avalon_regmap.h"
+
+/* adc_0 sample FIFO registers, as in lab7/adc_0.c; see lab1/hps_adc.vhd */
+#define FIFO_DATA_OFFSET 0x44
+#define FIFO_STATUS_OFFSET 0x48
+#define FIFO_CTRL_OFFSET 0x4c
+#define FIFO_DATA_VALID BIT(31)
+#define FIFO_DATA_CHANNEL GENMASK(19, 16)
+#define FIFO_DATA_SAMPLE GENMASK(11, 0)
+#define FIFO_STATUS_LEVEL GENMASK(8, 0)
+#define FIFO_STATUS_OVERFLOW BIT(16)
+#define FIFO_CTRL_WATERMARK GENMASK(7, 0)
+#define FIFO_CTRL_IRQ_EN BIT(31)
+
+/*
+ * struct avalon_mock - One mocked component
+ * @compatible: Device tree compatible of the real component
+ * @driver: Name of the platform driver that binds to it
+ * @fifo: Give the device an interrupt and a debugfs FIFO fill file
+ * @mem: Page standing in for the register span
+ * @irq: The interrupt, when @fifo is set
+ * @pdev: The registered platform device
+ */
+struct avalon_mock {
+	const char *compatible;
+	const char *driver;
+	bool fifo;
+	unsigned long mem;
+	int irq;
+	struct platform_device *pdev;
+};
+
+/*
+ * Without a device tree node the drivers match on the platform device
+ * name, so it has to be the driver's name rather than the compatible.
+ */
+static struct avalon_mock avalon_mocks[] = {
+	{ "SQ,combFilterProcessor", "CombFilter" },
+	{ "SQ,compFilterProcessor", "compFilterProcessor" },
+	{ "SQ,fftAnalysisSynthesisProcessor", "fftAnalysisSynthesisProcessor" },
+	{ "SQ,wahWahEffectProcessor", "wahWahEffectProcessor" },
+	{ "SQ,adc_0", "adc_0", .fifo = true },
+};
+
+// debugfs directory holding the FIFO fill files
+static struct dentry *avalon_mock_debugfs;
+
+/*
+ * avalon_mock_fill_write() - Make the mocked sample FIFO hold samples
+ * @file: The fill file; its private data is the struct avalon_mock.
+ * @ubuf: "<level> <channel> <sample> [overflow]"
+ * @count: The number of bytes in @ubuf.
+ * @ppos: Unused.
+ *
+ * The FIFO reports @level samples, every one of them @sample on @channel
+ * (fifo_data is plain memory, so each pop reads the same word), and
+ * flags an overflow when asked. Like the fabric, the interrupt fires
+ * when fifo_ctrl has IRQ_EN set and the level reaches a non-zero
+ * watermark. Unlike the fabric it fires once per write rather than
+ * staying asserted, and the write returns only after the driver's IRQ
+ * thread has drained the FIFO, so tests see its effect right away.
+ *
+ * Return: @count, or a negative error value.
+ */
+static ssize_t avalon_mock_fill_write(struct file *file,
+	const char __user *ubuf, size_t count, loff_t *ppos)
+{
+	struct avalon_mock *mock = file->private_data;
+	void __iomem *base = (void __iomem *)mock->mem;
+	unsigned int level, channel, sample, overflow = 0;
+	unsigned long flags;
+	char buf[64];
+	u32 ctrl;
+
+	if (count >= sizeof(buf)) {
+		return -EINVAL;
+	}
+	if (copy_from_user(buf, ubuf, count)) {
+		return -EFAULT;
+	}
+	buf[count] = '\0';
+
+	if (sscanf(buf, "%u %u %u %u", &level, &channel, &sample,
+	           &overflow) < 3) {
+		return -EINVAL;
+	}
+	if (level > FIELD_MAX(FIFO_STATUS_LEVEL) ||
+	    channel > FIELD_MAX(FIFO_DATA_CHANNEL) ||
+	    sample > FIELD_MAX(FIFO_DATA_SAMPLE)) {
+		return -EINVAL;
+	}
+
+	writel(FIFO_DATA_VALID | FIELD_PREP(FIFO_DATA_CHANNEL, channel) |
+	       FIELD_PREP(FIFO_DATA_SAMPLE, sample), base + FIFO_DATA_OFFSET);
+	writel(FIELD_PREP(FIFO_STATUS_LEVEL, level) |
+	       (overflow ? FIFO_STATUS_OVERFLOW : 0), base + FIFO_STATUS_OFFSET);
+
+	ctrl = readl(base + FIFO_CTRL_OFFSET);
+	if ((ctrl & FIFO_CTRL_IRQ_EN) && FIELD_GET(FIFO_CTRL_WATERMARK, ctrl) &&
+	    level >= FIELD_GET(FIFO_CTRL_WATERMARK, ctrl)) {
+		// What the interrupt controller would do for the wire
+		local_irq_save(flags);
+		generic_handle_irq(mock->irq);
+		local_irq_restore(flags);
+		synchronize_irq(mock->irq);
+	}
+
+	return count;
+}
+
+static const struct file_operations avalon_mock_fill_fops = {
+	.owner = THIS_MODULE,
+	.open = simple_open,
+	.write = avalon_mock_fill_write,
+	.llseek = no_llseek,
+};
+
+/*
+ * avalon_mock_add() - Register one mocked component
+ * @mock: The component.
+ *
+ * Return: 0 on success, or a negative error value.
+ */
+static int avalon_mock_add(struct avalon_mock *mock)
+{
+	struct resource res[] = {
+		DEFINE_RES_MEM(0, PAGE_SIZE),
+		DEFINE_RES_IRQ(0),
+	};
+	struct avalon_platform_data pdata;
+	char name[32];
+
+	mock->mem = get_zeroed_page(GFP_KERNEL);
+	if (!mock->mem) {
+		return -ENOMEM;
+	}
+	res[0].start = virt_to_phys((void *)mock->mem);
+	res[0].end = res[0].start + PAGE_SIZE - 1;
+
+	if (mock->fifo) {
+		// An interrupt nothing but avalon_mock_fill_write() raises
+		mock->irq = irq_alloc_desc(NUMA_NO_NODE);
+		if (mock->irq < 0) {
+			free_page(mock->mem);
+			return mock->irq;
+		}
+		irq_set_chip_and_handler(mock->irq, &dummy_irq_chip,
+		                         handle_simple_irq);
+		irq_clear_status_flags(mock->irq, IRQ_NOREQUEST | IRQ_NOPROBE);
+		res[1].start = mock->irq;
+		res[1].end = mock->irq;
+	}
+
+	// Both are copied by the platform core, so the stack is fine
+	pdata.base = (void __iomem *)mock->mem;
+	mock->pdev = platform_device_register_resndata(NULL, mock->driver,
+	                                               PLATFORM_DEVID_NONE,
+	                                               res, mock->fifo ? 2 : 1,
+	                                               &pdata, sizeof(pdata));
+	if (IS_ERR(mock->pdev)) {
+		if (mock->fifo) {
+			irq_free_desc(mock->irq);
+		}
+		free_page(mock->mem);
+		return PTR_ERR(mock->pdev);
+	}
+
+	if (mock->fifo) {
+		snprintf(name, sizeof(name), "%s_fill", mock->driver);
+		debugfs_create_file(name, 0200, avalon_mock_debugfs, mock,
+		                    &avalon_mock_fill_fops);
+	}
+
+	pr_info("avalon_mock: %s as %s\n", mock->compatible,
+	        dev_name(&mock->pdev->dev));
+
+	return 0;
+}
+
+static void avalon_mock_remove_all(unsigned int count)
+{
+	struct avalon_mock *mock;
+
+	// No fill can raise the interrupt once the files are gone
+	debugfs_remove_recursive(avalon_mock_debugfs);
+
+	while (count--) {
+		mock = &avalon_mocks[count];
+		platform_device_unregister(mock->pdev);
+		if (mock->fifo) {
+			irq_free_desc(mock->irq);
+		}
+		free_page(mock->mem);
+	}
+}
+
+static int __init avalon_mock_init(void)
+{
+	unsigned int i;
+	int ret;
+
+	// A page covers AVALON_MAX_SPAN and is what mmap() hands out
+	BUILD_BUG_ON(AVALON_MAX_SPAN > PAGE_SIZE);
+
+	avalon_mock_debugfs = debugfs_create_dir("avalon_mock", NULL);
+
+	for (i = 0; i < ARRAY_SIZE(avalon_mocks); i++) {
+		ret = avalon_mock_add(&avalon_mocks[i]);
+		if (ret) {
+			pr_err("avalon_mock: %s failed: %d\n",
+			       avalon_mocks[i].compatible, ret);
+			avalon_mock_remove_all(i);
+			return ret;
+		}
+	}
+
+	return 0;
+}
+
+static void __exit avalon_mock_exit(void)
+{
+	avalon_mock_remove_all(ARRAY_SIZE(avalon_mocks));
+}
+
+module_init(avalon_mock_init);
+module_exit(avalon_mock_exit);
+
+MODULE_LICENSE("Dual MIT/GPL");
+MODULE_AUTHOR("Soos Qasem");
+MODULE_DESCRIPTION("Memory-backed Avalon components for testing");
+MODULE_VERSION("1.0");
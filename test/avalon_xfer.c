@@ -0,0 +1,169 @@
+/* SPDX-License-Identifier: GPL-2.0 or MIT                               */
+/*-------------------------------------------------------------------------
+ * Description:  Registers-per-second microbenchmark for /dev/<name>
+ * ------------------------------------------------------------------------
+ * Moves the same register window through the char device twice, once
+ * with one pread()/pwrite() per 32-bit register (what the drivers did
+ * before the bulk paths, and what callers still do word by word) and once
+ * with a single call covering the whole window, then prints the rate of
+ * each in registers per second. Writes store back the values read
+ * first. The window defaults to the whole readable span; pass -o and -s
+ * to pick a writeable range for -w.
+ *
+ *   avalon_xfer [-n iterations] [-w] [-o offset] [-s bytes] <name>
+ * ------------------------------------------------------------------------
+ * License : GPL-2.0 or MIT (opensource.org / licenses / MIT, GPL-2.0)
+-------------------------------------------------------------------------*/
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// AVALON_MAX_SPAN in avalon_regmap.h
+#define MAX_SPAN 0x80
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * xfer() - Move @len bytes at @offset, @step bytes per syscall
+ *
+ * Return: 0 on success, or a negative errno.
+ */
+static int xfer(int fd, int write, uint32_t *buf, size_t len, off_t offset,
+	size_t step)
+{
+	size_t done;
+	ssize_t ret;
+
+	for (done = 0; done < len; done += step) {
+		if (write) {
+			ret = pwrite(fd, (char *)buf + done, step, offset + done);
+		} else {
+			ret = pread(fd, (char *)buf + done, step, offset + done);
+		}
+		if (ret < 0) {
+			return -errno;
+		}
+		if ((size_t)ret != step) {
+			return -EIO;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * run() - Time @iters transfers of the window and print registers/s
+ *
+ * Return: Registers per second, or a negative errno.
+ */
+static double run(const char *what, int fd, int write, uint32_t *buf,
+	size_t len, off_t offset, size_t step, unsigned long iters)
+{
+	unsigned long i;
+	uint64_t t0, ns;
+	double rate;
+	int ret;
+
+	t0 = now_ns();
+	for (i = 0; i < iters; i++) {
+		ret = xfer(fd, write, buf, len, offset, step);
+		if (ret) {
+			fprintf(stderr, "%s: %s\n", what, strerror(-ret));
+			return ret;
+		}
+	}
+	ns = now_ns() - t0;
+
+	rate = (double)iters * (len / 4) * 1e9 / ns;
+	printf("%-9s %3zu syscall(s)/window  %8.0f ns/window  %10.0f regs/s\n",
+	       what, len / step, (double)ns / iters, rate);
+	return rate;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned long iters = 100000;
+	uint32_t buf[MAX_SPAN / 4];
+	char path[256];
+	double word, bulk;
+	off_t offset = 0;
+	size_t len = 0;
+	int write = 0;
+	ssize_t ret;
+	int opt, fd;
+
+	while ((opt = getopt(argc, argv, "n:wo:s:")) != -1) {
+		switch (opt) {
+		case 'n':
+			iters = strtoul(optarg, NULL, 0);
+			break;
+		case 'w':
+			write = 1;
+			break;
+		case 'o':
+			offset = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			len = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			goto usage;
+		}
+	}
+	if (argc - optind != 1 || iters == 0 || offset % 4 || len % 4 ||
+	    offset + len > MAX_SPAN) {
+		goto usage;
+	}
+
+	snprintf(path, sizeof(path), "/dev/%s", argv[optind]);
+	fd = open(path, O_RDWR);
+	if (fd < 0) {
+		perror(path);
+		return 1;
+	}
+
+	// A bulk read stops at the end of the span or at the first hole
+	ret = pread(fd, buf, len ? len : sizeof(buf) - offset, offset);
+	if (ret < 0) {
+		perror(path);
+		return 1;
+	}
+	if (len && (size_t)ret != len) {
+		fprintf(stderr, "%s: only 0x%zx bytes readable at 0x%lx\n", path,
+		        (size_t)ret, (long)offset);
+		return 1;
+	}
+	len = ret & ~3;
+	if (len == 0) {
+		fprintf(stderr, "%s: nothing to transfer\n", path);
+		return 1;
+	}
+
+	printf("%s %s 0x%zx bytes at 0x%lx, %lu iterations\n", path,
+	       write ? "write" : "read", len, (long)offset, iters);
+	word = run("per-word", fd, write, buf, len, offset, 4, iters);
+	bulk = run("bulk", fd, write, buf, len, offset, len, iters);
+	close(fd);
+	if (word < 0 || bulk < 0) {
+		return 1;
+	}
+	printf("bulk/per-word: %.2fx\n", bulk / word);
+
+	return 0;
+
+usage:
+	fprintf(stderr, "usage: %s [-n iterations] [-w] [-o offset] [-s bytes] <name>\n",
+	        argv[0]);
+	return 2;
+}
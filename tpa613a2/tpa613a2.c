@@ -5,7 +5,6 @@
 */
 
 #include <linux/module.h>
-#include <linux/platform_device.h>
 #include <linux/io.h>
 #include <linux/fs.h>
 #include <linux/types.h>
@@ -14,7 +13,24 @@
 #include <linux/cdev.h>
 #include <linux/regmap.h>
 #include <linux/i2c.h>
-
+#include <linux/ktime.h>
+#include <linux/debugfs.h>
+#include <linux/workqueue.h>
+#include <linux/completion.h>
+#include <linux/mutex.h>
+#include <linux/pm_runtime.h>
+#include <linux/hrtimer.h>
+#include <linux/math64.h>
+#include <linux/idr.h>
+#include <linux/of.h>
+#include <sound/soc.h>
+#include "lat_hist.h"
+#include "fp_conversions.h"
+#include "tpa613a2_volume.h"
+#include "tpa613a2_channels.h"
+
+#define CREATE_TRACE_POINTS
+#include "tpa613a2_trace.h"
 
 // Define information about this kernel module
 MODULE_LICENSE("GPL");
@@ -22,202 +38,489 @@ MODULE_AUTHOR("Soos Qasem");
 MODULE_DESCRIPTION("Loadable kernel module for the tpa613a2");
 MODULE_VERSION("1.0");
 
-// Index of the first negative value in the look up table below
-#define PN_INDEX 54
+// TPA6130A2 registers
+#define TPA_REG_CONTROL 0x01    // Channel enables, mode and software shutdown
+#define TPA_REG_VOLUME  0x02    // Mute bits and volume
+#define TPA_REG_HIZ     0x03    // High impedance and thermal
+#define TPA_REG_VERSION 0x04    // Read-only version
+#define TPA_NUM_REGS    4
 
-struct fixed_num
-{
-    int integer;
-    int fraction;
-    int fraction_len;
-};
+// Software shutdown bit of the control register
+#define TPA_SWS         0x01
 
-// Volume levels defined in Raymond Weber's userspace code (multiplied by ten to elimiate the
-// decimal and with the negative values multiplied by negative one)
-/** Typedef for a single volume level to hold the db volume level and the matching register value */
-typedef struct
-{
-    uint16_t value;
-    uint8_t code;
-} volumeLevel;
-
-/** Structure with all possible volume level codes to use in TPA6130_register0.volume 
-    See the TPA6130A2 datasheet, pg 17 Table 2 in section 8.4.9 Volume Control.
-    The value comes from column 2 in the table.  These volume levels are the absolute 
-    value of the table values multipled by 10  The code field is the register control word*/
-static volumeLevel VolumeLevels[] =
-{
-    {.value = 1000,  .code = 0xFF},
-    {.value = 595, .code = 0x00},
-    {.value = 535, .code = 0x01},
-    {.value = 500, .code = 0x02},
-    {.value = 475, .code = 0x03},
-    {.value = 455, .code = 0x04},
-    {.value = 439, .code = 0x05},
-    {.value = 414, .code = 0x06},
-    {.value = 395, .code = 0x07},
-    {.value = 365, .code = 0x08},
-    {.value = 353, .code = 0x09},
-    {.value = 333, .code = 0x0A},
-    {.value = 317, .code = 0x0B},
-    {.value = 304, .code = 0x0C},
-    {.value = 286, .code = 0x0D},
-    {.value = 271, .code = 0x0E},
-    {.value = 263, .code = 0x0F},
-    {.value = 247, .code = 0x10},
-    {.value = 237, .code = 0x11},
-    {.value = 225, .code = 0x12},
-    {.value = 217, .code = 0x13},
-    {.value = 205, .code = 0x14},
-    {.value = 196, .code = 0x15},
-    {.value = 188, .code = 0x16},
-    {.value = 178, .code = 0x17},
-    {.value = 170, .code = 0x18},
-    {.value = 162, .code = 0x19},
-    {.value = 152, .code = 0x1A},
-    {.value = 145, .code = 0x1B},
-    {.value = 137, .code = 0x1C},
-    {.value = 130, .code = 0x1D},
-    {.value = 123, .code = 0x1E},
-    {.value = 116, .code = 0x1F},
-    {.value = 109, .code = 0x20},
-    {.value = 103, .code = 0x21},
-    {.value = 97,  .code = 0x22},
-    {.value = 90,  .code = 0x23},
-    {.value = 85,  .code = 0x24},
-    {.value = 78,  .code = 0x25},
-    {.value = 72,  .code = 0x26},
-    {.value = 67,  .code = 0x27},
-    {.value = 61,  .code = 0x28},
-    {.value = 56,  .code = 0x29},
-    {.value = 51,  .code = 0x2A},
-    {.value = 45,  .code = 0x2B},
-    {.value = 41,  .code = 0x2C},
-    {.value = 35,  .code = 0x2D},
-    {.value = 31,  .code = 0x1E},
-    {.value = 26,  .code = 0x1F},
-    {.value = 21,  .code = 0x30},
-    {.value = 17,  .code = 0x31},
-    {.value = 12,  .code = 0x32},
-    {.value = 8,   .code = 0x33},
-    {.value = 3,   .code = 0x34},
-    {.value = 1,   .code = 0x35},
-    {.value = 5,   .code = 0x36},
-    {.value = 9,   .code = 0x37},
-    {.value = 14,  .code = 0x38},
-    {.value = 17,  .code = 0x39},
-    {.value = 21,  .code = 0x3A},
-    {.value = 25,  .code = 0x3B},
-    {.value = 29,  .code = 0x3C},
-    {.value = 33,  .code = 0x3D},
-    {.value = 36,  .code = 0x3E},
-    {.value = 40,  .code = 0x3F}
-};
+// How long the amplifier stays on once idle, when runtime PM is allowed
+#define TPA_AUTOSUSPEND_MS 2000
+
+// Fades advance at most once per tick, or slower when the bus can't keep up
+#define TPA_FADE_TICK_NS (2 * NSEC_PER_MSEC)
+
+// Most amplifiers that can be bound at once (one char device minor each)
+#define TPA_MAX_DEVICES 4
 
-static struct class *cl; // Global variable for the device class
-static dev_t dev_num;
+static struct class *cl; // Device class shared by all amplifiers
+static dev_t dev_num;    // First of the TPA_MAX_DEVICES reserved minors
+static DEFINE_IDA(tpa_minors);
 
-// Define some I2C stuff
-struct i2c_driver tpa_i2c_driver;
-struct i2c_client *tpa_i2c_client;
-static const unsigned short normal_i2c[]=
-  { 0x35, I2C_CLIENT_END }; // remove?
+// <debugfs>/tpa613a2, with one directory per amplifier
+static struct dentry *tpa613a2_debugfs;
+
+/* Reset values of the amplifier (both channels muted). Register 0 doesn't exist. */
+static const uint8_t tpa_reg_defaults[TPA_NUM_REGS] = {0x00, 0x00, 0xC0, 0x00};
 
 // Function Prototypes
-static int tpa613a2_probe(struct platform_device *pdev);
-static int tpa613a2_remove(struct platform_device *pdev);
+static int tpa_i2c_probe(struct i2c_client *client, const struct i2c_device_id *id);
+static int tpa_i2c_remove(struct i2c_client *client);
 static ssize_t tpa613a2_read(struct file *file, char *buffer, size_t len, loff_t *offset);
 static ssize_t tpa613a2_write(struct file *file, const char *buffer, size_t len, loff_t *offset);
 static int tpa613a2_open(struct inode *inode, struct file *file);
 static int tpa613a2_release(struct inode *inode, struct file *file);
+static int tpa_suspend(struct device *dev);
+static int tpa_resume(struct device *dev);
 static ssize_t name_show(struct device *dev, struct device_attribute *attr, char *buf);
+static ssize_t init_time_show(struct device *dev, struct device_attribute *attr, char *buf);
+static ssize_t resume_time_show(struct device *dev, struct device_attribute *attr, char *buf);
 
 // I2C operation prototypes
 static ssize_t volume_write(struct device *dev, struct device_attribute *attr, const char *buf, size_t count);
 static ssize_t volume_read(struct device *dev, struct device_attribute *attr, char *buf);
-
-// Custom function declarations
-char *strcat2(char *dst, char *src);
-uint32_t set_fixed_num(const char *s);
-int fp_to_string(char *buf, uint32_t fp28_num);
-uint8_t find_volume_level(uint32_t fp28_num, uint8_t pn);
-uint32_t decode_volume(uint8_t code);
+static ssize_t fade_write(struct device *dev, struct device_attribute *attr, const char *buf, size_t count);
+static ssize_t fade_read(struct device *dev, struct device_attribute *attr, char *buf);
+static ssize_t channels_write(struct device *dev, struct device_attribute *attr, const char *buf, size_t count);
+static ssize_t channels_read(struct device *dev, struct device_attribute *attr, char *buf);
 
 //Create the attributes that show up in /sys/class
 static DEVICE_ATTR(volume,          0664, volume_read,          volume_write);
+static DEVICE_ATTR(fade,            0664, fade_read,            fade_write);
+static DEVICE_ATTR(channels,        0664, channels_read,        channels_write);
 
 static DEVICE_ATTR(name, 0444, name_show, NULL);
+static DEVICE_ATTR(init_time, 0444, init_time_show, NULL);
+static DEVICE_ATTR(resume_time, 0444, resume_time_show, NULL);
+
+/** A volume fade
+
+    The gain moves linearly in dB and in time from one level to another. Each tick sends the level
+    for the time it runs at, so a late tick skips the levels in between instead of stretching the fade.
+*/
+struct tpa_fade
+{
+    bool active;                ///< A fade is running
+    int16_t from;               ///< Gain when the fade started, in 0.1 dB
+    int16_t to;                 ///< Gain the fade moves to, in 0.1 dB (the lowest level for a fade to mute)
+    uint8_t code;               ///< Volume register value to end on
+    ktime_t start;              ///< When the fade started
+    unsigned int ms;            ///< Duration of the fade
+};
 
-/** An instance of this structure will be created for every al_HA IP in the system
-    This structure holds the linux driver structure as well as a memory pointer to the hardwar and
-    shadow registers with the data stored on the device.
+/** An instance of this structure will be created for every TPA6130A2 in the system
+    This structure holds the linux driver structure as well as the I2C client, the register map and
+    its cache, and the state of the asynchronous bring-up.
 */
 struct al_tpa613a2_dev
 {
     struct cdev cdev;           ///< The driver structure containing major/minor, etc
-    char *name;                 ///< This gets the name of the device when loading the driver
-    void __iomem *regs;         ///< Pointer to the registers on the device
-    uint32_t volume;
+    char *name;                 ///< This gets the name of the device tree node when loading the driver
+    struct i2c_client *client;  ///< The amplifier's I2C client
+    dev_t devt;                 ///< Major/minor of this amplifier's char device
+    struct regmap *regmap;      ///< regmap-i2c map with a cache of every register
+    struct mutex lock;          ///< Serializes register updates against suspend and resume
+    struct lat_hist i2c_send_lat;   ///< Latency of every command that reached the bus
+    struct dentry *debugfs;     ///< <debugfs>/tpa613a2/<i2c client>
+    struct work_struct init_work;   ///< Runs tpa_bringup() so probing doesn't wait for the bus
+    struct completion ready;    ///< Completed when init_work is done, whether it succeeded or not
+    int init_status;            ///< Result of init_work
+    u64 probe_start;            ///< When probe was entered
+    u64 init_ns;                ///< From probe_start to the end of init_work
+    bool suspended;             ///< Amplifier shut down; updates only go to the cache. Protected by lock
+    u64 resume_ns;              ///< How long the last resume took
+    uint8_t suspend_regs[TPA_NUM_REGS]; ///< What the amplifier held when it was shut down
+    u64 send_ns;                ///< How long the last write that reached the bus took; protected by lock
+    struct tpa_fade fade;       ///< Volume fade; protected by lock
+    struct hrtimer fade_timer;  ///< Ticks while the volume is fading
+    struct work_struct fade_work;   ///< Sends the next level of the fade
 };
 
 
 /** Typedef of the driver structure */
 typedef struct al_tpa613a2_dev al_tpa613a2_dev_t;   //Annoying but makes sonarqube not crash during the analysis in the container_of() lines
 
-/** Id matching structure for use in driver/device matching */
-static struct of_device_id al_tpa613a2_dt_ids[] =
+/** Id matching structure for use in driver/device matching
+
+    Every amplifier is a child node of its I2C controller, e.g. for two headphone amplifiers on
+    separate buses (the TPA6130A2 has a fixed address):
+
+        &i2c0 { amp0: tpa6130a2@60 { compatible = "ti,tpa6130a2"; reg = <0x60>; }; };
+        &i2c1 { amp1: tpa6130a2@60 { compatible = "ti,tpa6130a2"; reg = <0x60>; }; };
+*/
+static const struct of_device_id al_tpa613a2_dt_ids[] =
 {
     {
-        .compatible = "dev,al-tpa613a2"
+        .compatible = "ti,tpa6130a2"
     },
     { }
 };
 
-static struct i2c_device_id tpa_id[] = {
+/** Notify the kernel about the driver matching structure information */
+MODULE_DEVICE_TABLE(of, al_tpa613a2_dt_ids);
+
+static const struct i2c_device_id tpa_id[] = {
     {
-        "tpa_i2c",0x60
+        "tpa6130a2", 0
     },
     {}
 };
+MODULE_DEVICE_TABLE(i2c, tpa_id);
 
-// create the board info and set the register for the ADC (0x60)
-static struct i2c_board_info tpa_i2c_info = {
-  I2C_BOARD_INFO("tpa_i2c",0x60),
-};
+static bool tpa_readable_reg(struct device *dev, unsigned int reg)
+{
+    return reg >= TPA_REG_CONTROL && reg <= TPA_REG_VERSION;
+}
 
-static int tpa_i2c_probe(struct i2c_client *client,
-                         const struct i2c_device_id *id)
+static bool tpa_writeable_reg(struct device *dev, unsigned int reg)
 {
-  return 0;
+    return reg >= TPA_REG_CONTROL && reg <= TPA_REG_HIZ;
 }
 
-static int tpa_i2c_remove(struct i2c_client *client)
+static bool tpa_volatile_reg(struct device *dev, unsigned int reg)
 {
-  return 0;
+    return reg == TPA_REG_VERSION;
 }
-struct i2c_driver tpa_i2c_driver = {
-    .driver = { 
-        .name="tpa_i2c",
-      },
-    .probe = tpa_i2c_probe,
-    .remove = tpa_i2c_remove,
-    .id_table = tpa_id,
+
+/** Register map of the amplifier
+
+    Every write goes through the cache, so regmap_update_bits() leaves the bus alone when the value
+    doesn't change, and reads never touch the bus.
+*/
+static const struct regmap_config tpa_regmap_config = {
+    .name = "tpa6130a2",
+    .reg_bits = 8,
+    .val_bits = 8,
+    .max_register = TPA_REG_VERSION,
+    .readable_reg = tpa_readable_reg,
+    .writeable_reg = tpa_writeable_reg,
+    .volatile_reg = tpa_volatile_reg,
+    .cache_type = REGCACHE_FLAT,
+    // No defaults table: read the registers back from the amplifier to seed the cache
+    .num_reg_defaults_raw = TPA_NUM_REGS,
 };
 
+/** Update bits of one register
 
-/** Notify the kernel about the driver matching structure information */
-MODULE_DEVICE_TABLE(of, al_tpa613a2_dt_ids);
+    Every register write of the driver goes through here. Bits that are already set in the cache
+    cost no bus transaction; writes that do reach the bus show up in the tpa613a2_i2c_send
+    tracepoint and in the i2c_send_latency histogram. While the amplifier is suspended only the
+    cache is updated and tpa_resume() sends it.
+    Must be called with the amplifier's lock held.
 
-// Data structure with pointers to the externally important functions to be able to load the module
-static struct platform_driver tpa613a2_platform =
-{
-      .probe = tpa613a2_probe,
-      .remove = tpa613a2_remove,
-      .driver = {
-      .name = "Audio Logic tpa613a2 Driver",
-      .owner = THIS_MODULE,
-      .of_match_table = al_tpa613a2_dt_ids
+    @param devp The amplifier
+    @param reg Register address
+    @param mask Bits to update
+    @param val New value of the bits in mask
+    @returns 0 on success, or a negative error code
+*/
+static int tpa_update_bits(al_tpa613a2_dev_t *devp, unsigned int reg, unsigned int mask, unsigned int val)
+{
+    u64 start = ktime_get_ns();
+    unsigned int new_val;
+    bool changed = false;
+    u64 ns;
+    int ret_val;
+
+    lockdep_assert_held(&devp->lock);
+
+    ret_val = regmap_update_bits_check(devp->regmap, reg, mask, val, &changed);
+    if (!changed || devp->suspended)
+        return ret_val;
+
+    ns = ktime_get_ns() - start;
+    devp->send_ns = ns;
+    lat_hist_add(&devp->i2c_send_lat, ns);
+    regmap_read(devp->regmap, reg, &new_val);
+    trace_tpa613a2_i2c_send(dev_name(&devp->client->dev), reg, new_val, ret_val, ns);
+
+    return ret_val;
+}
+
+/** Set the channel enables and the volume register in one transfer
+
+    The control and volume registers are adjacent and the amplifier increments the register address
+    after every byte, so both go out in a single I2C write. Nothing is sent if neither changes.
+    Must be called with the amplifier's lock held.
+
+    @param devp The amplifier
+    @param mask Bits of the control register to update
+    @param control New value of the bits in mask
+    @param volume New value of the volume register
+    @returns 0 on success, or a negative error code
+*/
+static int tpa_write_channels(al_tpa613a2_dev_t *devp, unsigned int mask, unsigned int control, unsigned int volume)
+{
+    const char *name = dev_name(&devp->client->dev);
+    unsigned int old[2];
+    u8 vals[2];
+    u64 start;
+    u64 ns;
+    int ret_val;
+
+    lockdep_assert_held(&devp->lock);
+
+    ret_val = regmap_read(devp->regmap, TPA_REG_CONTROL, &old[0]);
+    if (!ret_val)
+        ret_val = regmap_read(devp->regmap, TPA_REG_VOLUME, &old[1]);
+    if (ret_val)
+        return ret_val;
+
+    vals[0] = (old[0] & ~mask) | (control & mask);
+    vals[1] = volume;
+    if (vals[0] == old[0] && vals[1] == old[1])
+        return 0;
+
+    start = ktime_get_ns();
+    ret_val = regmap_bulk_write(devp->regmap, TPA_REG_CONTROL, vals, ARRAY_SIZE(vals));
+    if (devp->suspended)
+        return ret_val;
+
+    ns = ktime_get_ns() - start;
+    devp->send_ns = ns;
+    lat_hist_add(&devp->i2c_send_lat, ns);
+    trace_tpa613a2_i2c_send(name, TPA_REG_CONTROL, vals[0], ret_val, ns);
+    trace_tpa613a2_i2c_send(name, TPA_REG_VOLUME, vals[1], ret_val, ns);
+
+    return ret_val;
+}
+
+/*------------------------------------------------------------------
+  Volume fades
+
+  A fade is started with a target gain and a duration. The fade timer
+  queues fade_work, which sends the volume level for the time it runs
+  at and re-arms the timer. The next tick comes TPA_FADE_TICK_NS
+  later, or as long as the last write took when the bus is slower, so
+  a fade never queues up writes or overruns its duration. Levels
+  that the time says are already past are skipped, and a level that
+  doesn't change costs nothing thanks to the register cache.
+------------------------------------------------------------------*/
+
+static enum hrtimer_restart tpa_fade_tick(struct hrtimer *timer)
+{
+    al_tpa613a2_dev_t *devp = container_of(timer, al_tpa613a2_dev_t, fade_timer);
+
+    // The I2C transfer sleeps, so the step runs from a work item
+    schedule_work(&devp->fade_work);
+
+    return HRTIMER_NORESTART;
+}
+
+/** Send the volume level the running fade has reached */
+static void tpa_fade_step(struct work_struct *work)
+{
+    al_tpa613a2_dev_t *devp = container_of(work, al_tpa613a2_dev_t, fade_work);
+    struct tpa_fade *f = &devp->fade;
+    ktime_t now = ktime_get();
+    unsigned int old;
+    bool fading;
+    u64 tick;
+    s64 elapsed;
+    int code;
+
+    mutex_lock(&devp->lock);
+    if (!f->active)
+    {
+        mutex_unlock(&devp->lock);
+        return;
     }
+
+    elapsed = ktime_ms_delta(now, f->start);
+    code = tpa_fade_code(f->from, f->to, f->code, elapsed, f->ms);
+    if (elapsed >= f->ms)
+        f->active = false;
+
+    if (!regmap_read(devp->regmap, TPA_REG_VOLUME, &old))
+        tpa_update_bits(devp, TPA_REG_VOLUME, 0xFF, tpa_keep_mutes(old, code));
+    fading = f->active;
+    tick = max_t(u64, TPA_FADE_TICK_NS, devp->send_ns);
+    mutex_unlock(&devp->lock);
+
+    if (fading)
+        hrtimer_start(&devp->fade_timer, ns_to_ktime(tick), HRTIMER_MODE_REL);
+}
+
+/** Start fading the volume
+
+    Replaces a fade already running, starting from wherever it got to, so fades requested faster
+    than they can run merge into one.
+
+    @param devp The amplifier
+    @param code Volume register value to end on, as from find_volume_level()
+    @param ms Duration of the fade; 0 sets the target on the next tick
+    @returns 0 on success, or a negative error code
+*/
+static int tpa_fade_start(al_tpa613a2_dev_t *devp, uint8_t code, unsigned int ms)
+{
+    struct tpa_fade *f = &devp->fade;
+    unsigned int val;
+    int ret_val;
+
+    mutex_lock(&devp->lock);
+    ret_val = regmap_read(devp->regmap, TPA_REG_VOLUME, &val);
+    if (!ret_val)
+    {
+        f->from = tpa_fade_db10(val);
+        f->to = tpa_fade_db10(code);
+        f->code = code;
+        f->start = ktime_get();
+        f->ms = ms;
+        f->active = true;
+    }
+    mutex_unlock(&devp->lock);
+
+    if (!ret_val)
+        schedule_work(&devp->fade_work);
+
+    return ret_val;
+}
+
+/** Stop a fade where it is */
+static void tpa_fade_stop(al_tpa613a2_dev_t *devp)
+{
+    mutex_lock(&devp->lock);
+    devp->fade.active = false;
+    mutex_unlock(&devp->lock);
+
+    // The work can re-arm the timer once more
+    hrtimer_cancel(&devp->fade_timer);
+    cancel_work_sync(&devp->fade_work);
+    hrtimer_cancel(&devp->fade_timer);
+}
+
+/** Shut the amplifier down
+
+    Only the amplifier gets the software shutdown bit; the cache keeps the running value for
+    tpa_resume(). Until then, register updates only go to the cache, and suspend_regs remembers
+    what the amplifier itself holds.
+*/
+static int tpa_suspend(struct device *dev)
+{
+    al_tpa613a2_dev_t *devp = dev_get_drvdata(dev);
+    unsigned int reg, val;
+    char cmd[2];
+    int ret_val = 0;
+
+    mutex_lock(&devp->lock);
+    for (reg = TPA_REG_CONTROL; reg <= TPA_REG_HIZ && !ret_val; reg++)
+    {
+        ret_val = regmap_read(devp->regmap, reg, &val);
+        devp->suspend_regs[reg] = val;
+    }
+    if (!ret_val)
+    {
+        cmd[0] = TPA_REG_CONTROL;
+        cmd[1] = devp->suspend_regs[TPA_REG_CONTROL] | TPA_SWS;
+        ret_val = i2c_master_send(devp->client, cmd, 2);
+    }
+    if (ret_val >= 0)
+    {
+        regcache_cache_only(devp->regmap, true);
+        devp->suspended = true;
+    }
+    mutex_unlock(&devp->lock);
+
+    return ret_val < 0 ? ret_val : 0;
+}
+
+/** Turn the amplifier back on and restore its registers from the cache
+
+    The registers that differ from what the amplifier holds, and always the control register (to clear
+    the shutdown bit, last so the volume is in place before the outputs come on), go out in a single
+    i2c_transfer(): one START, a repeated START per register and one STOP. The shutdown bit read back
+    from the amplifier tells what it holds: still set, it kept suspend_regs; clear, it lost power and
+    holds the reset values. If the read fails, every register is sent.
+*/
+static int tpa_resume(struct device *dev)
+{
+    static const uint8_t order[] = {TPA_REG_VOLUME, TPA_REG_HIZ, TPA_REG_CONTROL};
+    al_tpa613a2_dev_t *devp = dev_get_drvdata(dev);
+    u64 start = ktime_get_ns();
+    struct i2c_msg msgs[ARRAY_SIZE(order)];
+    char cmd[ARRAY_SIZE(order)][2];
+    const uint8_t *held = NULL;
+    unsigned int val;
+    u64 ns;
+    int ret_val = 0;
+    int i, n = 0;
+
+    mutex_lock(&devp->lock);
+
+    // The cache is cache-only now, so ask the amplifier directly
+    ret_val = i2c_smbus_read_byte_data(devp->client, TPA_REG_CONTROL);
+    if (ret_val >= 0)
+        held = (ret_val & TPA_SWS) ? devp->suspend_regs : tpa_reg_defaults;
+    ret_val = 0;
+
+    for (i = 0; i < ARRAY_SIZE(order) && !ret_val; i++)
+    {
+        ret_val = regmap_read(devp->regmap, order[i], &val);
+        if (ret_val || (order[i] != TPA_REG_CONTROL && held && val == held[order[i]]))
+            continue;
+
+        cmd[n][0] = order[i];
+        cmd[n][1] = val;
+        msgs[n].addr = devp->client->addr;
+        msgs[n].flags = 0;
+        msgs[n].len = 2;
+        msgs[n].buf = cmd[n];
+        n++;
+    }
+
+    if (!ret_val)
+    {
+        ret_val = i2c_transfer(devp->client->adapter, msgs, n);
+
+        ns = ktime_get_ns() - start;
+        lat_hist_add(&devp->i2c_send_lat, ns);
+        for (i = 0; i < n; i++)
+            trace_tpa613a2_i2c_send(dev_name(dev), cmd[i][0], cmd[i][1], ret_val, ns);
+
+        if (ret_val >= 0)
+            ret_val = (ret_val == n) ? 0 : -EIO;
+    }
+
+    if (!ret_val)
+    {
+        regcache_cache_only(devp->regmap, false);
+        devp->suspended = false;
+    }
+    mutex_unlock(&devp->lock);
+
+    devp->resume_ns = ktime_get_ns() - start;
+
+    return ret_val;
+}
+
+/** Power management of the amplifier's I2C client
+
+    Runtime PM shuts the amplifier down once the char device is closed. The FPGA can drive it with
+    nobody holding the char device, so runtime PM starts out forbidden; allow it with
+    "echo auto > /sys/bus/i2c/devices/<client>/power/control". System sleep uses the same callbacks.
+*/
+static const struct dev_pm_ops tpa_pm_ops =
+{
+    SET_SYSTEM_SLEEP_PM_OPS(pm_runtime_force_suspend, pm_runtime_force_resume)
+    SET_RUNTIME_PM_OPS(tpa_suspend, tpa_resume, NULL)
+};
+
+// Data structure with pointers to the externally important functions to be able to load the module
+static struct i2c_driver tpa_i2c_driver = {
+    .driver = {
+        .name = "al_tpa613a2",
+        .owner = THIS_MODULE,
+        .of_match_table = al_tpa613a2_dt_ids,
+        .probe_type = PROBE_PREFER_ASYNCHRONOUS,
+        .pm = &tpa_pm_ops,
+      },
+    .probe = tpa_i2c_probe,
+    .remove = tpa_i2c_remove,
+    .id_table = tpa_id,
 };
 
 /** Structure containing pointers to the functions the driver can load */
@@ -232,143 +535,312 @@ static const struct file_operations al_tpa613a2_fops =
 
 
 
+/** Wait for tpa_bringup() to finish
+
+    The sysfs entries can appear before the amplifier has been set up. Every access waits here first.
+
+    @param devp The amplifier
+    @returns 0 when the amplifier is ready, -ERESTARTSYS when interrupted, or the bring-up's error code
+*/
+static int tpa_wait_ready(al_tpa613a2_dev_t *devp)
+{
+    if (wait_for_completion_interruptible(&devp->ready))
+        return -ERESTARTSYS;
+
+    return devp->init_status;
+}
+
+/*------------------------------------------------------------------
+  ASoC component
+
+  Each amplifier registers an ASoC component without DAIs on its I2C
+  device, so a machine driver can add it as an auxiliary device (e.g.
+  "aux-devs" of simple-audio-card) and its controls show up in the
+  card's mixer. The volume is shared by both channels in hardware;
+  enable and mute are per channel. "Headphone Channels" sets all of
+  them in one I2C transfer (see TPA_PACK).
+------------------------------------------------------------------*/
+
+static unsigned int tpa_component_read(struct snd_soc_component *component, unsigned int reg)
+{
+    al_tpa613a2_dev_t *devp = snd_soc_component_get_drvdata(component);
+    unsigned int val = 0;
+
+    regmap_read(devp->regmap, reg, &val);
+
+    return val;
+}
+
+static int tpa_component_write(struct snd_soc_component *component, unsigned int reg, unsigned int val)
+{
+    al_tpa613a2_dev_t *devp = snd_soc_component_get_drvdata(component);
+    int ret_val;
+
+    // A mixer change of the volume wins over a running fade
+    mutex_lock(&devp->lock);
+    if (reg == TPA_REG_VOLUME)
+        devp->fade.active = false;
+    ret_val = tpa_update_bits(devp, reg, 0xFF, val);
+    mutex_unlock(&devp->lock);
+
+    return ret_val;
+}
+
+static int tpa_channels_info(struct snd_kcontrol *kcontrol, struct snd_ctl_elem_info *uinfo)
+{
+    uinfo->type = SNDRV_CTL_ELEM_TYPE_INTEGER;
+    uinfo->count = 1;
+    uinfo->value.integer.min = 0;
+    uinfo->value.integer.max = TPA_PACK_MASK;
+
+    return 0;
+}
+
+static int tpa_channels_get(struct snd_kcontrol *kcontrol, struct snd_ctl_elem_value *ucontrol)
+{
+    struct snd_soc_component *component = snd_kcontrol_chip(kcontrol);
+    al_tpa613a2_dev_t *devp = snd_soc_component_get_drvdata(component);
+    unsigned int control;
+    unsigned int volume;
+    int ret_val;
+
+    ret_val = regmap_read(devp->regmap, TPA_REG_CONTROL, &control);
+    if (!ret_val)
+        ret_val = regmap_read(devp->regmap, TPA_REG_VOLUME, &volume);
+    if (ret_val)
+        return ret_val;
+
+    ucontrol->value.integer.value[0] = TPA_PACK(control, volume);
+
+    return 0;
+}
+
+static int tpa_channels_put(struct snd_kcontrol *kcontrol, struct snd_ctl_elem_value *ucontrol)
+{
+    struct snd_soc_component *component = snd_kcontrol_chip(kcontrol);
+    al_tpa613a2_dev_t *devp = snd_soc_component_get_drvdata(component);
+    long packed = ucontrol->value.integer.value[0];
+    int ret_val;
+
+    if (packed < 0 || (packed & ~TPA_PACK_MASK))
+        return -EINVAL;
+
+    mutex_lock(&devp->lock);
+    devp->fade.active = false;
+    ret_val = tpa_write_channels(devp, TPA_CH_BITS, packed >> 8, packed & 0xFF);
+    mutex_unlock(&devp->lock);
+
+    return ret_val;
+}
+
+static const struct snd_kcontrol_new tpa_snd_controls[] =
+{
+    SOC_SINGLE_TLV("Headphone Playback Volume", TPA_REG_VOLUME, 0, TPA_VOL_BITS, 0, tpa_volume_tlv),
+    SOC_DOUBLE("Headphone Playback Switch", TPA_REG_VOLUME, 7, 6, 1, 1),
+    SOC_DOUBLE("Headphone Enable Switch", TPA_REG_CONTROL, 7, 6, 1, 0),
+    {
+        .iface = SNDRV_CTL_ELEM_IFACE_MIXER,
+        .name = "Headphone Channels",
+        .info = tpa_channels_info,
+        .get = tpa_channels_get,
+        .put = tpa_channels_put,
+    },
+};
+
+static const struct snd_soc_component_driver tpa_component_driver =
+{
+    .read = tpa_component_read,
+    .write = tpa_component_write,
+    .controls = tpa_snd_controls,
+    .num_controls = ARRAY_SIZE(tpa_snd_controls),
+    .non_legacy_dai_naming = 1,
+};
+
+/** Seed the register cache and send the initialization commands
+
+    Runs from devp->init_work, scheduled by tpa_i2c_probe(), and completes devp->ready either way.
+    Settings the amplifier already has (e.g. after reloading the module) aren't sent again.
+*/
+static void tpa_bringup(struct work_struct *work)
+{
+    al_tpa613a2_dev_t *devp = container_of(work, al_tpa613a2_dev_t, init_work);
+    struct i2c_client *client = devp->client;
+    int ret_val = 0;
+
+    // Read the amplifier's registers back to seed the register cache
+    devp->regmap = devm_regmap_init_i2c(client, &tpa_regmap_config);
+    if (IS_ERR(devp->regmap))
+    {
+      dev_err(&client->dev, "FAILED to set up the register map.\n");
+      ret_val = PTR_ERR(devp->regmap);
+      goto done;
+    }
+
+    //Send some initialization commands
+    mutex_lock(&devp->lock);
+
+    // Enable both channels and set -.3dB gain on both (closest value to unity), in one transfer
+    ret_val = tpa_write_channels(devp, 0xFF, TPA_CH_BITS, 0x34);
+
+    mutex_unlock(&devp->lock);
+    if (ret_val)
+    {
+      dev_err(&client->dev, "initialization commands failed (%d)\n", ret_val);
+      goto done;
+    }
+
+    ret_val = snd_soc_register_component(&client->dev, &tpa_component_driver, NULL, 0);
+    if (ret_val)
+    {
+      dev_err(&client->dev, "FAILED to register the ASoC component.\n");
+      goto done;
+    }
+
+    // On now; shutting down when idle is up to user space (see tpa_pm_ops)
+    pm_runtime_set_active(&client->dev);
+    pm_runtime_set_autosuspend_delay(&client->dev, TPA_AUTOSUSPEND_MS);
+    pm_runtime_use_autosuspend(&client->dev);
+    pm_runtime_forbid(&client->dev);
+    pm_runtime_enable(&client->dev);
+
+done:
+    devp->init_ns = ktime_get_ns() - devp->probe_start;
+    devp->init_status = ret_val;
+    complete_all(&devp->ready);
+}
+
 /** Function called initially on the driver loads
 
-    This function is called by the kernel when the driver module is loaded and currently just calls tpa613a2_probe()
+    This function is called by the kernel when the driver module is loaded. It reserves the char device
+    minors and the device class shared by all amplifiers, then registers the I2C driver, which calls
+    tpa_i2c_probe() for every TPA6130A2 node in the device tree.
 
-    @returns SUCCESS
+    @returns SUCCESS or error code
 */
 static int tpa613a2_init(void)
 {
     int ret_val = 0;
-    struct i2c_adapter *i2c_adapt;
-    struct i2c_board_info i2c_info;
-    
-    pr_info("Initializing the Audio Logic tpa613a2 module\n");
 
-    // Register our driver with the "Platform Driver" bus
-    ret_val = platform_driver_register(&tpa613a2_platform);
+    //Request a Major/Minor number range for all amplifiers
+    ret_val = alloc_chrdev_region(&dev_num, 0, TPA_MAX_DEVICES, "al_tpa613a2");
     if (ret_val != 0)
     {
-        pr_err("platform_driver_register returned %d\n", ret_val);
+        pr_err("alloc_chrdev_region returned %d\n", ret_val);
         return ret_val;
     }
-    
+
+    //Create sysfs entries
+    cl = class_create(THIS_MODULE, "al_tpa613a2");
+    if (IS_ERR(cl))
+    {
+        ret_val = PTR_ERR(cl);
+        goto bad_class_create;
+    }
+
+    tpa613a2_debugfs = debugfs_create_dir("tpa613a2", NULL);
+
     /*------------------------------------------------------------------
       I2C communication
     ------------------------------------------------------------------*/
-    
-    // Register the device
+
+    // Register the driver; every amplifier is probed from the device tree
     ret_val = i2c_add_driver(&tpa_i2c_driver);
     if (ret_val < 0)
     {
-      pr_err("Failed to register I2C driver");
-      return ret_val;
-    }
-    
-    i2c_adapt = i2c_get_adapter(0);
-    memset(&i2c_info,0,sizeof(struct i2c_board_info));    
-    strlcpy(i2c_info.type, "tpa_i2c",I2C_NAME_SIZE);
-    
-    tpa_i2c_client = i2c_new_client_device(i2c_adapt,&tpa_i2c_info);
-    
-    i2c_put_adapter(i2c_adapt);
-
-    if (!tpa_i2c_client)
-    {
-      pr_err("Failed to connect to I2C client\n");
-      ret_val = -ENODEV;
-      return ret_val;
+        pr_err("Failed to register I2C driver");
+        goto bad_i2c_add_driver;
     }
 
-    //Send some initialization commands
-
-    // Enable both channels
-    char cmd[2] = {0x01, 0xc0};
-    i2c_master_send(tpa_i2c_client,&cmd[0],2);
+    return 0;
 
-    // Set -.3dB gain on both channels (closest value to unity)
-    cmd[0] = 0x02;
-    cmd[1] = 0x34;
-    i2c_master_send(tpa_i2c_client,&cmd[0],2);
+bad_i2c_add_driver:
+    debugfs_remove_recursive(tpa613a2_debugfs);
+    class_destroy(cl);
 
-    /*------------------------------------------------------------------
-    --------------------------------------------------------------------
-    ------------------------------------------------------------------*/
-    
-    pr_info("Audio Logic TPA6130A2 module successfully initialized!\n");
+bad_class_create:
+    unregister_chrdev_region(dev_num, TPA_MAX_DEVICES);
 
-    return 0;
+    return ret_val;
 }
 
 
 
-/** Kernel module loading for platform devices
+/** Kernel module loading for I2C devices
 
-    Called by the kernel when a module is loaded which matches a device tree overlay entry.
-    This function does all the setup of the device driver and creates the sysfs entries.
+    Called by the kernel for every TPA6130A2 child node of an I2C controller, asynchronously to other
+    drivers. Creates the amplifier's char device (/dev/al_tpa613a2_<n>) and sysfs entries, then leaves
+    all bus traffic to tpa_bringup() so that boot doesn't wait for it. Everything an amplifier needs
+    lives in its own al_tpa613a2_dev, so several amplifiers (up to TPA_MAX_DEVICES) work independently.
 
-    @param pdev Pointer to a platform_device structure containing information from the overlay about the device to load
+    @param client Pointer to the I2C client created from the device tree node
+    @param id Matching entry of tpa_id, when not matched through the device tree
     @returns SUCCESS or error code
 */
-static int tpa613a2_probe(struct platform_device *pdev)
+static int tpa_i2c_probe(struct i2c_client *client, const struct i2c_device_id *id)
 {
     int ret_val = -EBUSY;
 
-    char deviceName[20] = "al_TPA6130A2_";
-    char deviceMinor[20];
+    char deviceName[20];
     int status;
+    int minor;
 
     struct device *deviceObj;
     al_tpa613a2_dev_t *al_tpa613a2_devp;
-
-    pr_info("tpa613a2_probe enter\n");
-
-    // Create structure to hold device-specific information (like the registers). Make size of &pdev->dev + sizeof(struct(al_tpa613a2_dev)).
-    al_tpa613a2_devp = devm_kzalloc(&pdev->dev, sizeof(al_tpa613a2_dev_t), GFP_KERNEL);
-
-    // Give a pointer to the instance-specific data to the generic platform_device structure
-    // so we can access this data later on (for instance, in the read and write functions)
-    platform_set_drvdata(pdev, (void *)al_tpa613a2_devp);
-
-    //Create a memory region to store the device name
-    al_tpa613a2_devp->name = devm_kzalloc(&pdev->dev, 50, GFP_KERNEL);
+    u64 start = ktime_get_ns();
+
+    // Create structure to hold device-specific information (the I2C client, register map and lock)
+    al_tpa613a2_devp = devm_kzalloc(&client->dev, sizeof(al_tpa613a2_dev_t), GFP_KERNEL);
+    if (al_tpa613a2_devp == NULL)
+        return -ENOMEM;
+
+    al_tpa613a2_devp->client = client;
+    al_tpa613a2_devp->probe_start = start;
+    INIT_WORK(&al_tpa613a2_devp->init_work, tpa_bringup);
+    init_completion(&al_tpa613a2_devp->ready);
+    mutex_init(&al_tpa613a2_devp->lock);
+    INIT_WORK(&al_tpa613a2_devp->fade_work, tpa_fade_step);
+    hrtimer_init(&al_tpa613a2_devp->fade_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+    al_tpa613a2_devp->fade_timer.function = tpa_fade_tick;
+
+    // Give a pointer to the instance-specific data to the I2C client
+    // so we can access this data later on (power management and remove)
+    i2c_set_clientdata(client, al_tpa613a2_devp);
+
+    //Name the device after its device tree node
+    al_tpa613a2_devp->name = devm_kstrdup(&client->dev, client->dev.of_node ? client->dev.of_node->name : dev_name(&client->dev), GFP_KERNEL);
     if (al_tpa613a2_devp->name == NULL)
-        goto bad_mem_alloc;
+        return -ENOMEM;
 
-    //Copy the name from the overlay and stick it in the created memory region
-    strcpy(al_tpa613a2_devp->name, (char *)pdev->name);
-    pr_info("%s\n", (char *)pdev->name);
+    // Latency of every command sent to this amplifier
+    al_tpa613a2_devp->debugfs = debugfs_create_dir(dev_name(&client->dev), tpa613a2_debugfs);
+    lat_hist_debugfs_create("i2c_send_latency", al_tpa613a2_devp->debugfs, &al_tpa613a2_devp->i2c_send_lat);
 
-    //Request a Major/Minor number for the driver
-    status = alloc_chrdev_region(&dev_num, 0, 1, "al_TPA6130A2_");
-    if (status != 0)
-        goto bad_alloc_chrdev_region;
+    //Request a minor number for the char device
+    minor = ida_simple_get(&tpa_minors, 0, TPA_MAX_DEVICES, GFP_KERNEL);
+    if (minor < 0)
+    {
+        ret_val = minor;
+        goto bad_ida_get;
+    }
+    al_tpa613a2_devp->devt = MKDEV(MAJOR(dev_num), minor);
 
     //Create the device name with the information reserved above
-    sprintf(deviceMinor, "%d", MAJOR(dev_num));
-    strcat(deviceName, deviceMinor);
-    pr_info("%s\n", deviceName);
-
-    //Create sysfs entries
-    cl = class_create(THIS_MODULE, deviceName);
-    if (cl == NULL)
-        goto bad_class_create;
+    snprintf(deviceName, sizeof(deviceName), "al_tpa613a2_%d", minor);
 
     //Initialize a char dev structure
     cdev_init(&al_tpa613a2_devp->cdev, &al_tpa613a2_fops);
 
     //Registers the char driver with the kernel
-    status = cdev_add(&al_tpa613a2_devp->cdev, dev_num, 1);
+    status = cdev_add(&al_tpa613a2_devp->cdev, al_tpa613a2_devp->devt, 1);
     if (status != 0)
         goto bad_cdev_add;
 
     //Creates the device entries in sysfs
-    deviceObj = device_create(cl, NULL, dev_num, NULL, deviceName);
-    if (deviceObj == NULL)
+    deviceObj = device_create(cl, &client->dev, al_tpa613a2_devp->devt, NULL, deviceName);
+    if (IS_ERR(deviceObj))
         goto bad_device_create;
 
-    //Put a pointer to the al_fir_dev struct that is created into the driver object so it can be accessed uniquely from elsewhere
+    //Put a pointer to the al_tpa613a2_dev struct that is created into the driver object so it can be accessed uniquely from elsewhere
     dev_set_drvdata(deviceObj, al_tpa613a2_devp);
 
     //---------------------------------------------------------
@@ -376,40 +848,71 @@ static int tpa613a2_probe(struct platform_device *pdev)
     if (status)
         goto bad_device_create_file_1;
 
-    //---------------------------------------------------------    
+    //---------------------------------------------------------
     status = device_create_file(deviceObj, &dev_attr_name);
     if (status)
         goto bad_device_create_file_2;
 
-    pr_info("tpa613a2_probe exit\n");
+    //---------------------------------------------------------
+    status = device_create_file(deviceObj, &dev_attr_init_time);
+    if (status)
+        goto bad_device_create_file_3;
+
+    //---------------------------------------------------------
+    status = device_create_file(deviceObj, &dev_attr_resume_time);
+    if (status)
+        goto bad_device_create_file_4;
+
+    //---------------------------------------------------------
+    status = device_create_file(deviceObj, &dev_attr_fade);
+    if (status)
+        goto bad_device_create_file_5;
+
+    //---------------------------------------------------------
+    status = device_create_file(deviceObj, &dev_attr_channels);
+    if (status)
+        goto bad_device_create_file_6;
+
+    // The I2C traffic happens in the background; the sysfs entries wait for it
+    schedule_work(&al_tpa613a2_devp->init_work);
 
     return 0;
 
+  bad_device_create_file_6:
+      device_remove_file(deviceObj, &dev_attr_channels);
+
+  bad_device_create_file_5:
+      device_remove_file(deviceObj, &dev_attr_fade);
+
+  bad_device_create_file_4:
+      device_remove_file(deviceObj, &dev_attr_resume_time);
+
+  bad_device_create_file_3:
+      device_remove_file(deviceObj, &dev_attr_init_time);
+
   bad_device_create_file_2:
       device_remove_file(deviceObj, &dev_attr_name);
-          
+
   bad_device_create_file_1:
-      device_remove_file(deviceObj, &dev_attr_volume); 
-      
+      device_remove_file(deviceObj, &dev_attr_volume);
+      device_destroy(cl, al_tpa613a2_devp->devt);
+
   bad_device_create:
       cdev_del(&al_tpa613a2_devp->cdev);
 
   bad_cdev_add:
-      class_destroy(cl);
-
-  bad_class_create:
-      unregister_chrdev_region(dev_num, 1);
+      ida_simple_remove(&tpa_minors, minor);
 
-  bad_alloc_chrdev_region:
-  bad_mem_alloc:
+  bad_ida_get:
+      debugfs_remove_recursive(al_tpa613a2_devp->debugfs);
 
     return ret_val;
 }
 
 /** Run when the device opens to create the file structure to read and write
 
-    Beyond creating a structure which the other functions ca use to access the device, this function loads
-    the initial values into the shadow registers
+    Creates a structure which the other functions can use to access the device. The register values
+    come from the register cache, so nothing is reset here.
 
     @param inode Pointer to the instance of the hardware driver to use
     @param file Pointer to the file object opened
@@ -419,13 +922,23 @@ static int tpa613a2_open(struct inode *inode, struct file *file)
 {
     //Create a pointer to the driver instance
     al_tpa613a2_dev_t *devp;
+    int ret_val;
 
     //Put it in the container_of structure so it can be used from anywhere
     devp = container_of(inode->i_cdev, al_tpa613a2_dev_t, cdev);
     file->private_data = devp;
 
-    //Instantiate default values for the codec
-    devp->volume       = 0;
+    ret_val = tpa_wait_ready(devp);
+    if (ret_val)
+        return ret_val;
+
+    // The amplifier stays on while the char device is open
+    ret_val = pm_runtime_get_sync(&devp->client->dev);
+    if (ret_val < 0)
+    {
+        pm_runtime_put_noidle(&devp->client->dev);
+        return ret_val;
+    }
 
     return 0;
 }
@@ -434,7 +947,7 @@ static int tpa613a2_open(struct inode *inode, struct file *file)
 
 /** Called when the device is closed
 
-    Currently this doesn't do anything, but as it is the opposite of open I created it for future use
+    Drops the runtime PM reference taken in tpa613a2_open()
 
     @param inode Instance of the driver opened
     @param file Pointer to the file for this operation
@@ -442,6 +955,11 @@ static int tpa613a2_open(struct inode *inode, struct file *file)
 */
 static int tpa613a2_release(struct inode *inode, struct file *file)
 {
+    al_tpa613a2_dev_t *devp = file->private_data;
+
+    pm_runtime_mark_last_busy(&devp->client->dev);
+    pm_runtime_put_autosuspend(&devp->client->dev);
+
     return 0;
 }
 
@@ -486,30 +1004,44 @@ static ssize_t tpa613a2_write(struct file *file, const char *buffer, size_t len,
 
 
 
-/** Function called when the platform device driver is deleted
+/** Function called when an amplifier is unbound
 
-    This function is called when the device driver is deleted.  It should cleans up the driver memory structures,
-    deallocate the driver addresses reserved for the driver, unallocate memory and the io mapping functions to the
-    hardware.  After this function, the device should be able to be added cleanly again without contention or memory
-    leaks.
+    Removes the amplifier's char device and sysfs entries and gives its minor back. The register map and
+    the instance structure are device managed and freed after this returns. After this function, the
+    device should be able to be added cleanly again without contention or memory leaks.
 
-    @param platform_device Pointer to the device structure being deleted
+    @param client Pointer to the I2C client being removed
     @returns SUCCESS
 */
-static int tpa613a2_remove(struct platform_device *pdev)
+static int tpa_i2c_remove(struct i2c_client *client)
 {
-    // Grab the instance-specific information out of the platform device
-    al_tpa613a2_dev_t *dev = (al_tpa613a2_dev_t *)platform_get_drvdata(pdev);
+    // Grab the instance-specific information out of the I2C client
+    al_tpa613a2_dev_t *dev = (al_tpa613a2_dev_t *)i2c_get_clientdata(client);
 
-    pr_info("tpa613a2_remove enter\n");
+    // Let the bring-up finish; anyone waiting in tpa_wait_ready() has to get out before the files go
+    flush_work(&dev->init_work);
+    if (dev->init_status == 0)
+    {
+        snd_soc_unregister_component(&client->dev);
+
+        // Leave the amplifier on
+        pm_runtime_get_sync(&client->dev);
+        pm_runtime_disable(&client->dev);
+        pm_runtime_put_noidle(&client->dev);
+        pm_runtime_dont_use_autosuspend(&client->dev);
+    }
 
-    // Unregister the character file (remove it from /dev)
+    // Remove the sysfs entries and unregister the character file (remove it from /dev)
+    device_destroy(cl, dev->devt);
     cdev_del(&dev->cdev);
 
-    //Tell the os that the major/minor pair is avalible again
-    unregister_chrdev_region(dev_num, 2);
+    // No new fade can start once the files are gone
+    tpa_fade_stop(dev);
 
-    pr_info("tpa613a2_remove exit\n");
+    //Tell the os that the minor is available again
+    ida_simple_remove(&tpa_minors, MINOR(dev->devt));
+
+    debugfs_remove_recursive(dev->debugfs);
 
     return 0;
 }
@@ -521,10 +1053,15 @@ static void tpa613a2_exit(void)
 {
     pr_info("Audio Logic tpa613a2 module exit\n");
 
-    // Unregister our driver from the "Platform Driver" bus
-    // This will cause "tpa613a2_remove" to be called for each connected device
-    platform_driver_unregister(&tpa613a2_platform);
- 
+    // Unregister our driver from the I2C bus
+    // This will cause "tpa_i2c_remove" to be called for each bound amplifier
+    i2c_del_driver(&tpa_i2c_driver);
+
+    debugfs_remove_recursive(tpa613a2_debugfs);
+    class_destroy(cl);
+    unregister_chrdev_region(dev_num, TPA_MAX_DEVICES);
+    ida_destroy(&tpa_minors);
+
     pr_info("Audio Logic TPA6130A2 module successfully unregistered\n");
 }
 
@@ -548,369 +1085,209 @@ static ssize_t name_show(struct device *dev, struct device_attribute *attr, char
     return strlen(buf);
 }
 
-static ssize_t volume_write(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+/** Time from probing the amplifier until it was ready (or failed), in ns */
+static ssize_t init_time_show(struct device *dev, struct device_attribute *attr, char *buf)
 {
-    // Initialize some variables
-    uint32_t tempValue = 0;
-    char substring[80];
-    int substring_count = 0;
-    int i;
-    char cmd[2] = {0x02,0x00};
-    uint8_t code = 0x00;
+    al_tpa613a2_dev_t *devp = dev_get_drvdata(dev);
 
-    // Create a new instance of the TPA
-    al_tpa613a2_dev_t *devp = (al_tpa613a2_dev_t *)dev_get_drvdata(dev);
+    if (wait_for_completion_interruptible(&devp->ready))
+        return -ERESTARTSYS;
 
-    for (i = 0; i < count; i++)
-    {
-        //If its not a space or a comma, add the digit to the substring
-        if ((buf[i] != ',') && (buf[i] != ' ') && (buf[i] != '\0') && (buf[i] != '\r') && (buf[i] != '\n'))
-        {
-            substring[substring_count] = buf[i];
-            substring_count++;
-        }
-    }
+    return sprintf(buf, "%llu\n", devp->init_ns);
+}
 
-    substring[substring_count] = '\0';
-    
-    // If the first character is a negative sign
-    if (buf[0] == '-')
-    {
-      // Shift all the values "left" to remove it
-      for (i=0;i<79;i++)
-        substring[i] = substring[i+1];
+/** How long the last resume took, including the register restore, in ns */
+static ssize_t resume_time_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    al_tpa613a2_dev_t *devp = dev_get_drvdata(dev);
 
-      // Find the fp28 number
-      tempValue = set_fixed_num(substring);
+    return sprintf(buf, "%llu\n", devp->resume_ns);
+}
 
-      // Determine the code for the volume level
-      code = find_volume_level(tempValue,0);
-    }
-    // Otherwise, 
-    else
-    {
-      // Calculate the fp28 number
-      tempValue = set_fixed_num(substring);
+static ssize_t volume_write(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+    // Initialize some variables
+    int32_t value;
+    int ret_val;
+    uint8_t code = 0x00;
+    unsigned int old;
 
-      // Determine the code for the volume level
-      code = find_volume_level(tempValue,1);
-    }
+    // Get the instance of the TPA
+    al_tpa613a2_dev_t *devp = (al_tpa613a2_dev_t *)dev_get_drvdata(dev);
 
-    // Determine the closest volume level
-    tempValue = decode_volume(code);
+    ret_val = tpa_wait_ready(devp);
+    if (ret_val)
+        return ret_val;
 
-    // Record the volume level to the volume variable
-    devp->volume = tempValue;
+    // Calculate the fp16 number
+    ret_val = fp_parse(buf, 16, &value);
+    if (ret_val)
+        return ret_val;
 
-    // Send the I2C commands
-    cmd[1] = code;
-    i2c_master_send(tpa_i2c_client,&cmd[0],2);
+    // Determine the code of the closest volume level
+    code = find_volume_level(value);
+
+    // Send the I2C command (nothing is sent if the level doesn't change); a running fade stops here
+    mutex_lock(&devp->lock);
+    devp->fade.active = false;
+    ret_val = regmap_read(devp->regmap, TPA_REG_VOLUME, &old);
+    if (!ret_val)
+        ret_val = tpa_update_bits(devp, TPA_REG_VOLUME, 0xFF, tpa_keep_mutes(old, code));
+    mutex_unlock(&devp->lock);
+    if (ret_val)
+        return ret_val;
 
     return count;
 }
 static ssize_t volume_read(struct device *dev, struct device_attribute *attr, char *buf)
 {
     al_tpa613a2_dev_t *devp = (al_tpa613a2_dev_t *)dev_get_drvdata(dev);
+    unsigned int code;
+    int len;
 
-    fp_to_string(buf, devp->volume);
-
-    strcat2(buf, "\n");
-
-    //Return the length of the buffer so it will print in the console
-    return strlen(buf);
-}
+    len = tpa_wait_ready(devp);
+    if (len)
+        return len;
 
-char *strcat2(char *dst, char *src)
-{
-    char *cp = dst;
+    // Served from the register cache
+    len = regmap_read(devp->regmap, TPA_REG_VOLUME, &code);
+    if (len)
+        return len;
 
-    while (*cp)
-        cp++; /* find end of dst */
+    len = fp_format(buf, PAGE_SIZE, decode_volume(code), 16, 8);
 
-    while (( *cp++ = *src++ ) != 0); /* Copy src to end of dst */
+    buf[len++] = '\n';
 
-    return dst; /* return dst */
+    //Return the length of the buffer so it will print in the console
+    return len;
 }
 
-/** Convert a string to a fixed point number structure
-    @param s String containing the string to convert to 32F16 representation
-    @return SUCCESS
+/** Fade the volume
 
-    @todo This function is really ugly and could be cleaned up to make it clear what is happening....
+    Takes "<dB> <ms>", e.g. "-40 500" fades to -40 dB over half a second. A gain nearer -100 dB
+    than the lowest level fades down to the lowest level and then mutes.
 */
-uint32_t set_fixed_num(const char *s)
+static ssize_t fade_write(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
 {
-    struct fixed_num num = {0, 0, 0};
-    int seen_point = 0;
-    int pointIndex;
-    int i;
-    int ii;
-    int frac_comp;
-    uint32_t acc = 0;
-    char s2[80];
-    int pointsSeen = 0;
-    int charIndex = 0;
-
-    //If no leading 0, add one (eg: .25 -> 0.25)
-    if (s[0] == '.')
-    {
-        s2[0] = '0';
-        charIndex++;
-    }
-
-    //This is a strcpy() to move the data a "const char *" to a "char *" and validate the data
-    for (i = 0; i < strlen(s); i++)
-    {
-        //Make sure the string contains an non-valid char (eg: not a number or a decimal point)
-        if ((s[i] == '.') || (s[i] >= '0' && s[i] <= '9'))
-        {
-            //Copy the data over and increment the pointer
-            s2[charIndex] = s[i];
-            charIndex++;
-        }
-        else
-        {
-            pr_info("Invalid char (c:%c x:%X) in number %s\n", s[i], s[i], s);
-            return 0x00000000;
-        }
-
-        //Count the number of decimals in the string
-        if (s[i] == '.')
-            pointsSeen++;
-    }
+    al_tpa613a2_dev_t *devp = dev_get_drvdata(dev);
+    char level[FP_STR_MAX];
+    unsigned int ms;
+    int32_t value;
+    int ret_val;
+
+    ret_val = tpa_wait_ready(devp);
+    if (ret_val)
+        return ret_val;
 
-    //If multiple decimals points in the number (eg: 1.1.4)
-    if (pointsSeen > 1)
-        pr_info("Invalid number format: %s\n", s);
-
-    //Turn 1 into 1.0
-    //if (pointsSeen == 0)
-    // {
-    //    printk("Adding the decimal...\n");
-    //    s2[i] = char(".");
-    //    s2[i+1] = char("0");
-    //    //strcat2(".0",s2);
-    //    i=i+2;
-    // }
-    //Make sure the string is terminated
-    s2[i] = '\0';
-
-    //Count the fractional digits
-    for (pointIndex = 0; pointIndex < strlen(s2); pointIndex++)
-    {
-        if (s2[pointIndex] == '.')
-            break;
-    }
+    if (sscanf(buf, "%23s %u", level, &ms) != 2)
+        return -EINVAL;
+    if (ms > TPA_FADE_MAX_MS)
+        return -ERANGE;
 
-    //String extend so that the output is accurate
-    while (strlen(s2) - pointIndex < 9)
-        strcat2(s2, "0");
+    ret_val = fp_parse(level, 16, &value);
+    if (ret_val)
+        return ret_val;
 
-    //Truncate the string if its longer
-    s2[strlen(s2) - pointIndex + 9] = '\0';
+    ret_val = tpa_fade_start(devp, find_volume_level(value), ms);
+    if (ret_val)
+        return ret_val;
 
-    //Covert to fixed point
-    for (i = 0; i < 10; i++)
-    {
-        if (s2[i] == '.')
-        {
-            seen_point = 1;
-            continue;
-        }
-        if (!seen_point)
-        {
-            num.integer *= 10;
-            num.integer += (int)(s2[i] - '0');
-        }
-        else
-        {
-            num.fraction_len++;
-            num.fraction *= 10;
-            num.fraction += (int)(s2[i] - '0');
-        }
-    }
+    return count;
+}
 
-    //Turn the fixed point conversion into binary digits
-    for (ii = 0, frac_comp = 1; ii < num.fraction_len; ii++) frac_comp *= 10;
-    frac_comp /= 2;
+/** Show the running fade as "<target dB> <ms left>", or nothing */
+static ssize_t fade_read(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    al_tpa613a2_dev_t *devp = dev_get_drvdata(dev);
+    struct tpa_fade *f = &devp->fade;
+    s64 left;
+    int len = 0;
 
-    // Get the fractional part (f28 hopefully)
-    for (ii = 0; i <= 36; i++)
+    mutex_lock(&devp->lock);
+    if (f->active)
     {
-        if (num.fraction >= frac_comp)
-        {
-            acc |= 0x00000001;
-            num.fraction -= frac_comp;
-        }
-        frac_comp /= 2;
-
-        acc = acc << 1;
+        left = max_t(s64, f->ms - ktime_ms_delta(ktime_get(), f->start), 0);
+        len = fp_format(buf, PAGE_SIZE, decode_volume(f->code), 16, 1);
+        len += scnprintf(buf + len, PAGE_SIZE - len, " %lld\n", left);
     }
+    mutex_unlock(&devp->lock);
 
-    acc = acc >> 12;
-
-    //Combine the fractional part with the integer
-    acc += num.integer << 16;
-
-    return acc;
+    return len;
 }
 
-/** Function to convert a fp16 to a string representation
-    @todo doesn't handle negative numbers
+/** Set both channels and the volume at once
+
+    Takes "<left> <right> <dB>", each channel being on, mute or off, e.g. "on mute -12" plays the
+    left channel only at -12 dB. Everything goes out in one I2C transfer. The volume is shared by
+    both channels in hardware.
 */
-int fp_to_string(char *buf, uint32_t fp28_num)
+static ssize_t channels_write(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
 {
-    int buf_pos = 0;
+    al_tpa613a2_dev_t *devp = dev_get_drvdata(dev);
+    static const unsigned int bits[] = {TPA_CH_L, TPA_CH_R};
+    char state[2][8];
+    char level[FP_STR_MAX];
+    unsigned int control = 0;
+    unsigned int volume;
+    int32_t value;
+    int ret_val;
     int i;
-    int fractionPart;
-    //int isNegative = 0;
-    int intPart = 1;
-    int i16 = 0;
-
-    if (fp28_num & 0x80000000)
-    {
-        fp28_num *= -1;
-
-        buf[buf_pos] = '-';
-        buf_pos++;
-    }
-
-    //Convert the integer part
-    i16 = (fp28_num >> 16);
-    while ( (i16 / intPart) > 9)
-    {
-        intPart *= 10;
-    }
 
-    while (intPart > 0)
-    {
-        buf[buf_pos] = (char)((i16 / intPart) + '0');
-        buf_pos++;
-
-        i16 = i16 % intPart;
-        intPart = intPart / 10;
-    }
-
-    //buf[buf_pos] = (char)((fp28_num>>16) + '0');
-    //buf_pos++;
+    ret_val = tpa_wait_ready(devp);
+    if (ret_val)
+        return ret_val;
 
-    buf[buf_pos] = '.';
-    buf_pos++;
+    if (sscanf(buf, "%7s %7s %23s", state[0], state[1], level) != 3)
+        return -EINVAL;
 
-    //Mask the integer bits and dump 1 bit to make the conversion easier....
-    fractionPart = (0x0000FFFF & fp28_num) >> 1; // 32F27 so that 0-9 can fit in the high 5 bits)
+    ret_val = fp_parse(level, 16, &value);
+    if (ret_val)
+        return ret_val;
+    volume = find_volume_level(value);
 
-    for (i = 0; i < 8; i++)
+    for (i = 0; i < ARRAY_SIZE(bits); i++)
     {
-        fractionPart *= 10;
-        buf[buf_pos] = (fractionPart >> 15) + '0';
-        buf_pos++;
-        fractionPart &= 0x00007FFF;
+        ret_val = tpa_ch_encode(match_string(tpa_ch_states, ARRAY_SIZE(tpa_ch_states), state[i]), bits[i], &control, &volume);
+        if (ret_val)
+            return ret_val;
     }
 
-    buf[buf_pos] = '\0';
+    mutex_lock(&devp->lock);
+    devp->fade.active = false;
+    ret_val = tpa_write_channels(devp, TPA_CH_BITS, control, volume);
+    mutex_unlock(&devp->lock);
+    if (ret_val)
+        return ret_val;
 
-    return 0;
-}
-uint8_t find_volume_level(uint32_t fp28_num, uint8_t pn)
-{
-  // Instantiate some variables
-  uint8_t return_code = 0;
-  int start_index;
-  int stop_index;
-  int16_t diff = 10000;
-  int16_t curDiff = 10000;
-  uint32_t inputnum = fp28_num*10;
-  uint16_t intval = (uint16_t)((inputnum)>>=16);
-  int i;
-  uint16_t return_value = 0;
-
-  // Find the length of the array
-  size_t n = sizeof(VolumeLevels)/sizeof(VolumeLevels[0]);
-  
-  // Set the start and stop search values depending on whether
-  // a negative sign was detected
-  if (pn == 1)
-  {
-    start_index = PN_INDEX;
-    stop_index = n;
-  }
-  else
-  {  
-    start_index = 0;
-    stop_index = PN_INDEX - 1;  
-  } 
-      
-  // Determine whether the negative dB bound has been exceeded
-  if ((intval > VolumeLevels[0].value) && (pn == 0))
-  { 
-    printk("Maximum attenuation exceeded.\n");
-    printk("Setting attenuation to -100 dB.\n");
-    return VolumeLevels[0].code;
-  }
-
-  // Determine whether the positive dB bound has been exceeded
-  if ((intval > VolumeLevels[n-1].value) && (pn == 1))
-  {
-    printk("Maximum amplification exceeded.\n");
-    printk("Setting amplification to 4 dB.\n");
-    return VolumeLevels[n-1].code;
-  }  
-
-  // Search for the closest value (above or below)
-  for (i = start_index; i < stop_index; i++)
-  {
-    // calculate the difference values 
-    if (intval > VolumeLevels[i].value)
-      diff = intval - VolumeLevels[i].value;
-    else
-      diff = VolumeLevels[i].value - intval;
-
-    // If the calculated difference is smaller than the calculated
-    // current best (smallest) difference set the new current difference
-    if (diff < curDiff)
-    {
-      curDiff = diff;
-      return_code = VolumeLevels[i].code;
-      return_value = VolumeLevels[i].value;
-    }
-    // Otherwise, stop.  (it only gets worse from here)
-    else
-      break;
-  }
-  
-  // Return the correct volume code
-  return return_code;
+    return count;
 }
 
-uint32_t decode_volume(uint8_t code)
+/** Show both channels and the volume as "<left> <right> <dB>" */
+static ssize_t channels_read(struct device *dev, struct device_attribute *attr, char *buf)
 {
-  // Initialize some variables
-  int i;
-  size_t n = sizeof(VolumeLevels)/sizeof(VolumeLevels[0]);
-  uint32_t decodedDB = 0;
-
-  // Find the correct volume level
-  for (i=0;i<n;i++)
-  {
-    if (code == VolumeLevels[i].code)
-      break; 
-  }
-
-  // If it's in the negative portion, multiply by -1  
-  if (i < PN_INDEX)
-  {    
-    decodedDB = VolumeLevels[i].value;
-    decodedDB = (decodedDB<<=16)/10;
-    return -1*decodedDB;
-  }  
-  else
-  {
-    decodedDB = VolumeLevels[i].value;
-    return (decodedDB<<=16)/10;
-  }  
-
-
+    al_tpa613a2_dev_t *devp = dev_get_drvdata(dev);
+    unsigned int control;
+    unsigned int volume;
+    int len;
+
+    len = tpa_wait_ready(devp);
+    if (len)
+        return len;
+
+    mutex_lock(&devp->lock);
+    len = regmap_read(devp->regmap, TPA_REG_CONTROL, &control);
+    if (!len)
+        len = regmap_read(devp->regmap, TPA_REG_VOLUME, &volume);
+    mutex_unlock(&devp->lock);
+    if (len)
+        return len;
+
+    len = scnprintf(buf, PAGE_SIZE, "%s %s ", tpa_ch_states[tpa_ch_state(control, volume, TPA_CH_L)],
+                    tpa_ch_states[tpa_ch_state(control, volume, TPA_CH_R)]);
+    len += fp_format(buf + len, PAGE_SIZE - len, decode_volume(volume), 16, 1);
+    buf[len++] = '\n';
+
+    return len;
 }
 
 /** Tell the kernel what the initialization function is */
@@ -918,45 +1295,3 @@ module_init(tpa613a2_init);
 
 /** Tell the kernel what the delete function is */
 module_exit(tpa613a2_exit);
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
@@ -0,0 +1,86 @@
+/** @file
+
+    Channel enable and mute encoding of the TPA6130A2 (control register 1 and volume register 2).
+
+    Each channel has an enable bit in the control register and a mute bit in the volume register,
+    in the same bit position. Shared by the driver and its KUnit test.
+*/
+
+#ifndef TPA613A2_CHANNELS_H
+#define TPA613A2_CHANNELS_H
+
+#include <linux/errno.h>
+#include "tpa613a2_volume.h"
+
+// Left and right channel enable bits of the control register, and left and right mute bits of the volume register
+#define TPA_CH_L        0x80
+#define TPA_CH_R        0x40
+#define TPA_CH_BITS     (TPA_CH_L | TPA_CH_R)
+#define TPA_VOL_BITS    0x3F
+
+/* The "Headphone Channels" control packs both registers into one value: the enable bits of the
+   control register in bits 15:14 and the volume register (mute bits and volume) in bits 7:0. */
+#define TPA_PACK(control, volume) ((((control) & TPA_CH_BITS) << 8) | (volume))
+#define TPA_PACK_MASK   TPA_PACK(TPA_CH_BITS, 0xFF)
+
+// States of a channel in the channels attribute: enabled, enabled but muted, and disabled
+static const char * const tpa_ch_states[] = {"on", "mute", "off"};
+
+/** State of one channel
+    @param control The control register value
+    @param volume The volume register value
+    @param bit TPA_CH_L or TPA_CH_R
+    @returns An index into tpa_ch_states[]
+*/
+static inline int tpa_ch_state(unsigned int control, unsigned int volume, unsigned int bit)
+{
+    if (!(control & bit))
+        return 2;
+
+    return (volume & bit) ? 1 : 0;
+}
+
+/** Add one channel's state to the register values
+
+    @param state An index into tpa_ch_states[], or a negative error from match_string()
+    @param bit TPA_CH_L or TPA_CH_R
+    @param control The control register value, to which the enable bit is added
+    @param volume The volume register value, to which the mute bit is added
+    @returns 0, or -EINVAL for an unknown state
+*/
+static inline int tpa_ch_encode(int state, unsigned int bit, unsigned int *control, unsigned int *volume)
+{
+    switch (state)
+    {
+    case 0:
+        *control |= bit;
+        return 0;
+    case 1:
+        *control |= bit;
+        *volume |= bit;
+        return 0;
+    case 2:
+        return 0;
+    default:
+        return -EINVAL;
+    }
+}
+
+/** Volume register value for a new level that leaves single-channel mutes alone
+
+    Both mute bits set is how the volume and fade attributes mute, so that state is replaced.
+    A channel muted on its own (channels attribute or mixer) stays muted.
+
+    @param old The volume register value now
+    @param code The new level, as from find_volume_level()
+    @returns The volume register value to send
+*/
+static inline unsigned int tpa_keep_mutes(unsigned int old, unsigned int code)
+{
+    if ((code & TPA_MUTE_BITS) == TPA_MUTE_BITS || (old & TPA_MUTE_BITS) == TPA_MUTE_BITS)
+        return code;
+
+    return code | (old & TPA_MUTE_BITS);
+}
+
+#endif // TPA613A2_CHANNELS_H
@@ -0,0 +1,322 @@
+/** @file
+
+    KUnit test of the TPA6130A2 volume tables, conversions and fade steps in tpa613a2_volume.h
+    and the channel enable and mute encoding in tpa613a2_channels.h.
+
+    Built as its own module when the kernel has CONFIG_KUNIT; see Kbuild.
+*/
+
+#include <kunit/test.h>
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include "tpa613a2_volume.h"
+#include "tpa613a2_channels.h"
+
+// Words of one tpa_volume_tlv range: first code, last code and a TLV_DB_SCALE_ITEM
+#define TPA_TLV_RANGE_WORDS 6
+
+// A gain in 0.1 dB as Q16.16, truncated like decode_volume() does
+#define TPA_Q16(db10) ((int32_t)(db10) * (1 << 16) / 10)
+
+/** The gains rise with the code and span TPA_DB10_MIN to TPA_DB10_MAX */
+static void tpa_code_to_db10_order(struct kunit *test)
+{
+    int code;
+
+    KUNIT_EXPECT_EQ(test, (int)tpa_code_to_db10[0], TPA_DB10_MIN);
+    KUNIT_EXPECT_EQ(test, (int)tpa_code_to_db10[TPA_NUM_CODES - 1], TPA_DB10_MAX);
+    for (code = 1; code < TPA_NUM_CODES; code++)
+        KUNIT_EXPECT_GT(test, tpa_code_to_db10[code], tpa_code_to_db10[code - 1]);
+}
+
+/** Every gain maps to the nearest code, the quieter one on a tie, and every code's own gain to itself */
+static void tpa_db10_to_code_nearest(struct kunit *test)
+{
+    int db10, code, best;
+
+    KUNIT_EXPECT_EQ(test, ARRAY_SIZE(tpa_db10_to_code), (size_t)(TPA_DB10_MAX - TPA_DB10_MIN + 1));
+
+    for (db10 = TPA_DB10_MIN; db10 <= TPA_DB10_MAX; db10++)
+    {
+        // The gains rise with the code, so a strict compare keeps the quieter one on a tie
+        best = 0;
+        for (code = 1; code < TPA_NUM_CODES; code++)
+            if (abs(db10 - tpa_code_to_db10[code]) < abs(db10 - tpa_code_to_db10[best]))
+                best = code;
+
+        KUNIT_EXPECT_EQ_MSG(test, (int)tpa_db10_to_code[db10 - TPA_DB10_MIN], best, "at %d/10 dB", db10);
+    }
+
+    for (code = 0; code < TPA_NUM_CODES; code++)
+        KUNIT_EXPECT_EQ(test, (int)tpa_db10_to_code[tpa_code_to_db10[code] - TPA_DB10_MIN], code);
+}
+
+/** tpa_volume_tlv gives ALSA exactly the gains of tpa_code_to_db10[], one range per code */
+static void tpa_volume_tlv_matches(struct kunit *test)
+{
+    const unsigned int *range;
+    int code;
+
+    KUNIT_ASSERT_EQ(test, ARRAY_SIZE(tpa_volume_tlv), (size_t)(2 + TPA_NUM_CODES * TPA_TLV_RANGE_WORDS));
+    KUNIT_EXPECT_EQ(test, tpa_volume_tlv[0], (unsigned int)SNDRV_CTL_TLVT_DB_RANGE);
+    KUNIT_EXPECT_EQ(test, tpa_volume_tlv[1], (unsigned int)(TPA_NUM_CODES * TPA_TLV_RANGE_WORDS * sizeof(unsigned int)));
+
+    for (code = 0; code < TPA_NUM_CODES; code++)
+    {
+        range = &tpa_volume_tlv[2 + code * TPA_TLV_RANGE_WORDS];
+        KUNIT_EXPECT_EQ(test, range[0], (unsigned int)code);
+        KUNIT_EXPECT_EQ(test, range[1], (unsigned int)code);
+        KUNIT_EXPECT_EQ(test, range[2], (unsigned int)SNDRV_CTL_TLVT_DB_SCALE);
+        KUNIT_EXPECT_EQ(test, range[3], (unsigned int)(2 * sizeof(unsigned int)));
+        KUNIT_EXPECT_EQ(test, (int)range[4], tpa_code_to_db10[code] * 10);
+        KUNIT_EXPECT_EQ(test, range[5], 0u);
+    }
+}
+
+/** Every code's gain converts back to the code, and the mute value to mute */
+static void tpa_volume_round_trip(struct kunit *test)
+{
+    int code;
+
+    for (code = 0; code < TPA_NUM_CODES; code++)
+    {
+        KUNIT_EXPECT_EQ(test, decode_volume(code), TPA_Q16(tpa_code_to_db10[code]));
+        KUNIT_EXPECT_EQ(test, (int)find_volume_level(decode_volume(code)), code);
+    }
+
+    KUNIT_EXPECT_EQ(test, decode_volume(TPA_MUTE_CODE), TPA_Q16(TPA_MUTE_DB10));
+    KUNIT_EXPECT_EQ(test, (int)find_volume_level(decode_volume(TPA_MUTE_CODE)), TPA_MUTE_CODE);
+}
+
+/** Gains mute once they are nearer to -100 dB than to the lowest level, -59.5 dB; the midpoint mutes */
+static void tpa_volume_mute_threshold(struct kunit *test)
+{
+    // -79.75 dB, the exact midpoint, is a Q16.16 value of its own
+    int32_t mid = -(7975 << 16) / 100;
+
+    KUNIT_EXPECT_EQ(test, (int)find_volume_level(mid), TPA_MUTE_CODE);
+    KUNIT_EXPECT_EQ(test, (int)find_volume_level(mid - 1), TPA_MUTE_CODE);
+    KUNIT_EXPECT_EQ(test, (int)find_volume_level(mid + 1), 0);
+    KUNIT_EXPECT_EQ(test, (int)find_volume_level(TPA_Q16(-797)), 0);
+    KUNIT_EXPECT_EQ(test, (int)find_volume_level(TPA_Q16(-798)), TPA_MUTE_CODE);
+    KUNIT_EXPECT_EQ(test, (int)find_volume_level(TPA_Q16(TPA_MUTE_DB10)), TPA_MUTE_CODE);
+    KUNIT_EXPECT_EQ(test, (int)find_volume_level(TPA_Q16(-1200)), TPA_MUTE_CODE);
+    KUNIT_EXPECT_EQ(test, (int)find_volume_level(S32_MIN), TPA_MUTE_CODE);
+}
+
+/** Gains between -79.7 dB and the lowest level, or above +4 dB, clamp to the end codes */
+static void tpa_volume_clamp(struct kunit *test)
+{
+    KUNIT_EXPECT_EQ(test, (int)find_volume_level(TPA_Q16(TPA_DB10_MIN)), 0);
+    KUNIT_EXPECT_EQ(test, (int)find_volume_level(TPA_Q16(TPA_DB10_MIN - 1)), 0);
+    KUNIT_EXPECT_EQ(test, (int)find_volume_level(TPA_Q16(-700)), 0);
+
+    KUNIT_EXPECT_EQ(test, (int)find_volume_level(TPA_Q16(TPA_DB10_MAX)), TPA_NUM_CODES - 1);
+    KUNIT_EXPECT_EQ(test, (int)find_volume_level(TPA_Q16(TPA_DB10_MAX + 1)), TPA_NUM_CODES - 1);
+    KUNIT_EXPECT_EQ(test, (int)find_volume_level(TPA_Q16(200)), TPA_NUM_CODES - 1);
+    KUNIT_EXPECT_EQ(test, (int)find_volume_level(S32_MAX), TPA_NUM_CODES - 1);
+}
+
+/** A gain exactly between two levels goes to the quieter one; a hair above it, to the louder */
+static void tpa_volume_midpoints(struct kunit *test)
+{
+    int code, sum;
+    int32_t mid;
+
+    for (code = 1; code < TPA_NUM_CODES; code++)
+    {
+        // The midpoint in Q16.16 is sum / 20 dB; it is exact when sum * 2^16 divides by 20
+        sum = tpa_code_to_db10[code - 1] + tpa_code_to_db10[code];
+        if (sum % 5)
+            continue;
+        mid = sum * (1 << 16) / 20;
+
+        KUNIT_EXPECT_EQ_MSG(test, (int)find_volume_level(mid), code - 1, "between codes %d and %d", code - 1, code);
+        KUNIT_EXPECT_EQ_MSG(test, (int)find_volume_level(mid + TPA_Q16(1)), code, "above codes %d and %d", code - 1, code);
+    }
+}
+
+/** Muted ends of a fade count as the lowest level; every other value as its code's gain */
+static void tpa_fade_ends(struct kunit *test)
+{
+    int code;
+
+    for (code = 0; code < TPA_NUM_CODES; code++)
+        KUNIT_EXPECT_EQ(test, tpa_fade_db10(code), (int)tpa_code_to_db10[code]);
+
+    KUNIT_EXPECT_EQ(test, tpa_fade_db10(TPA_MUTE_CODE), TPA_DB10_MIN);
+    KUNIT_EXPECT_EQ(test, tpa_fade_db10(TPA_MUTE_BITS | 0x20), TPA_DB10_MIN);
+
+    // One muted channel is not a muted fade end
+    KUNIT_EXPECT_EQ(test, tpa_fade_db10(0x80 | 0x20), (int)tpa_code_to_db10[0x20]);
+}
+
+/** A fade starts at its first level and lands exactly on its register value, mute included */
+static void tpa_fade_start_end(struct kunit *test)
+{
+    int from = tpa_code_to_db10[0x10], to = tpa_code_to_db10[0x30];
+
+    KUNIT_EXPECT_EQ(test, (int)tpa_fade_code(from, to, 0x30, 0, 1000), 0x10);
+    KUNIT_EXPECT_EQ(test, (int)tpa_fade_code(from, to, 0x30, 1, 1000), 0x10);
+    KUNIT_EXPECT_EQ(test, (int)tpa_fade_code(from, to, 0x30, 1000, 1000), 0x30);
+    KUNIT_EXPECT_EQ(test, (int)tpa_fade_code(from, to, 0x30, 0, 0), 0x30);
+
+    // A fade to mute runs down to the lowest level, then mutes
+    to = tpa_fade_db10(TPA_MUTE_CODE);
+    KUNIT_EXPECT_EQ(test, (int)tpa_fade_code(from, to, TPA_MUTE_CODE, 999, 1000), 0);
+    KUNIT_EXPECT_EQ(test, (int)tpa_fade_code(from, to, TPA_MUTE_CODE, 1000, 1000), TPA_MUTE_CODE);
+}
+
+/** Halfway through in time is halfway in dB, and a late tick catches up */
+static void tpa_fade_linear(struct kunit *test)
+{
+    int from = TPA_DB10_MIN, to = TPA_DB10_MAX;
+    int half = (TPA_DB10_MIN + TPA_DB10_MAX) / 2;
+
+    KUNIT_EXPECT_EQ(test, (int)tpa_fade_code(from, to, TPA_NUM_CODES - 1, 500, 1000),
+                    (int)tpa_db10_to_code[half - TPA_DB10_MIN]);
+    KUNIT_EXPECT_EQ(test, (int)tpa_fade_code(to, from, 0, 500, 1000),
+                    (int)tpa_db10_to_code[half - TPA_DB10_MIN]);
+    KUNIT_EXPECT_EQ(test, (int)tpa_fade_code(from, to, TPA_NUM_CODES - 1, 5000, 1000), TPA_NUM_CODES - 1);
+}
+
+/** Every millisecond of the longest fade over the full range moves monotonically and stays in range */
+static void tpa_fade_monotonic(struct kunit *test)
+{
+    int up = 0, down = TPA_NUM_CODES - 1, code;
+    s64 t;
+
+    for (t = 0; t <= TPA_FADE_MAX_MS; t++)
+    {
+        code = tpa_fade_code(TPA_DB10_MIN, TPA_DB10_MAX, TPA_NUM_CODES - 1, t, TPA_FADE_MAX_MS);
+        if (code < up || code >= TPA_NUM_CODES)
+        {
+            KUNIT_FAIL(test, "fade up went to %d after %d at %lld ms", code, up, t);
+            return;
+        }
+        up = code;
+
+        code = tpa_fade_code(TPA_DB10_MAX, TPA_DB10_MIN, 0, t, TPA_FADE_MAX_MS);
+        if (code > down)
+        {
+            KUNIT_FAIL(test, "fade down went to %d after %d at %lld ms", code, down, t);
+            return;
+        }
+        down = code;
+    }
+    KUNIT_EXPECT_EQ(test, up, TPA_NUM_CODES - 1);
+    KUNIT_EXPECT_EQ(test, down, 0);
+}
+
+/** The channel bits sit where the mixer switches (bits 7 and 6) and the mute value expect them */
+static void tpa_ch_bits(struct kunit *test)
+{
+    KUNIT_EXPECT_EQ(test, TPA_CH_L, 1 << 7);
+    KUNIT_EXPECT_EQ(test, TPA_CH_R, 1 << 6);
+    KUNIT_EXPECT_EQ(test, TPA_CH_BITS, TPA_MUTE_BITS);
+    KUNIT_EXPECT_EQ(test, TPA_CH_BITS | TPA_VOL_BITS, TPA_MUTE_CODE);
+    KUNIT_EXPECT_EQ(test, TPA_PACK_MASK, 0xC0FF);
+}
+
+/** Every pair of channel states at every level encodes, packs and decodes back to itself */
+static void tpa_ch_round_trip(struct kunit *test)
+{
+    static const unsigned int bits[] = {TPA_CH_L, TPA_CH_R};
+    unsigned int control, volume, packed;
+    int state[2], code, i;
+
+    for (state[0] = 0; state[0] < ARRAY_SIZE(tpa_ch_states); state[0]++)
+    {
+        for (state[1] = 0; state[1] < ARRAY_SIZE(tpa_ch_states); state[1]++)
+        {
+            for (code = 0; code < TPA_NUM_CODES; code++)
+            {
+                control = 0;
+                volume = code;
+                for (i = 0; i < 2; i++)
+                    KUNIT_EXPECT_EQ(test, tpa_ch_encode(state[i], bits[i], &control, &volume), 0);
+
+                KUNIT_EXPECT_EQ(test, control & ~TPA_CH_BITS, 0U);
+                KUNIT_EXPECT_EQ(test, volume & TPA_VOL_BITS, (unsigned int)code);
+                for (i = 0; i < 2; i++)
+                    KUNIT_EXPECT_EQ_MSG(test, tpa_ch_state(control, volume, bits[i]), state[i],
+                                        "%s %s at code %d", tpa_ch_states[state[0]], tpa_ch_states[state[1]], code);
+
+                packed = TPA_PACK(control, volume);
+                KUNIT_EXPECT_EQ(test, packed & ~TPA_PACK_MASK, 0U);
+                KUNIT_EXPECT_EQ(test, packed >> 8, control);
+                KUNIT_EXPECT_EQ(test, packed & 0xFF, volume);
+            }
+        }
+    }
+}
+
+/** "mute mute" is the mute value the volume attribute uses; "off" leaves the mute bit clear */
+static void tpa_ch_mute_both(struct kunit *test)
+{
+    unsigned int control = 0, volume = TPA_VOL_BITS;
+
+    tpa_ch_encode(1, TPA_CH_L, &control, &volume);
+    tpa_ch_encode(1, TPA_CH_R, &control, &volume);
+    KUNIT_EXPECT_EQ(test, volume, (unsigned int)TPA_MUTE_CODE);
+    KUNIT_EXPECT_EQ(test, decode_volume(volume), TPA_Q16(TPA_MUTE_DB10));
+
+    control = 0;
+    volume = 0x20;
+    tpa_ch_encode(2, TPA_CH_L, &control, &volume);
+    tpa_ch_encode(2, TPA_CH_R, &control, &volume);
+    KUNIT_EXPECT_EQ(test, control, 0U);
+    KUNIT_EXPECT_EQ(test, volume, 0x20U);
+}
+
+/** Unknown states are refused without touching the registers */
+static void tpa_ch_rejects(struct kunit *test)
+{
+    unsigned int control = 0, volume = 0x20;
+
+    KUNIT_EXPECT_EQ(test, tpa_ch_encode(-EINVAL, TPA_CH_L, &control, &volume), -EINVAL);
+    KUNIT_EXPECT_EQ(test, tpa_ch_encode(ARRAY_SIZE(tpa_ch_states), TPA_CH_R, &control, &volume), -EINVAL);
+    KUNIT_EXPECT_EQ(test, control, 0U);
+    KUNIT_EXPECT_EQ(test, volume, 0x20U);
+}
+
+/** A new level keeps a single channel's mute; muting both, or leaving both muted, takes the new value */
+static void tpa_ch_keep_mutes(struct kunit *test)
+{
+    KUNIT_EXPECT_EQ(test, tpa_keep_mutes(0x10, 0x20), 0x20U);
+    KUNIT_EXPECT_EQ(test, tpa_keep_mutes(TPA_CH_L | 0x10, 0x20), TPA_CH_L | 0x20U);
+    KUNIT_EXPECT_EQ(test, tpa_keep_mutes(TPA_CH_R | 0x10, 0x20), TPA_CH_R | 0x20U);
+    KUNIT_EXPECT_EQ(test, tpa_keep_mutes(TPA_MUTE_CODE, 0x20), 0x20U);
+    KUNIT_EXPECT_EQ(test, tpa_keep_mutes(TPA_CH_L | 0x10, TPA_MUTE_CODE), (unsigned int)TPA_MUTE_CODE);
+}
+
+static struct kunit_case tpa_volume_cases[] =
+{
+    KUNIT_CASE(tpa_code_to_db10_order),
+    KUNIT_CASE(tpa_db10_to_code_nearest),
+    KUNIT_CASE(tpa_volume_tlv_matches),
+    KUNIT_CASE(tpa_volume_round_trip),
+    KUNIT_CASE(tpa_volume_mute_threshold),
+    KUNIT_CASE(tpa_volume_clamp),
+    KUNIT_CASE(tpa_volume_midpoints),
+    KUNIT_CASE(tpa_fade_ends),
+    KUNIT_CASE(tpa_fade_start_end),
+    KUNIT_CASE(tpa_fade_linear),
+    KUNIT_CASE(tpa_fade_monotonic),
+    KUNIT_CASE(tpa_ch_bits),
+    KUNIT_CASE(tpa_ch_round_trip),
+    KUNIT_CASE(tpa_ch_mute_both),
+    KUNIT_CASE(tpa_ch_rejects),
+    KUNIT_CASE(tpa_ch_keep_mutes),
+    {}
+};
+
+static struct kunit_suite tpa_volume_suite =
+{
+    .name = "tpa613a2_volume",
+    .test_cases = tpa_volume_cases,
+};
+kunit_test_suite(tpa_volume_suite);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("KUnit test of the tpa613a2 volume, fade and channel encoding");
@@ -0,0 +1,53 @@
+/** @file
+
+    Tracepoints for the I2C traffic of the tpa613a2 driver
+
+    tpa613a2_i2c_send fires after every command that reached a headphone
+    amplifier (writes the register cache absorbed don't), with the time the
+    I2C transfer took (bus lock wait included). dev is the amplifier's I2C
+    client, e.g. 0-0060:
+
+        echo 1 > /sys/kernel/tracing/events/tpa613a2/enable
+*/
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM tpa613a2
+
+#if !defined(TPA613A2_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define TPA613A2_TRACE_H
+
+#include <linux/tracepoint.h>
+
+TRACE_EVENT(tpa613a2_i2c_send,
+
+    TP_PROTO(const char *dev, u8 reg, u8 val, int ret, u64 ns),
+
+    TP_ARGS(dev, reg, val, ret, ns),
+
+    TP_STRUCT__entry(
+        __string(dev, dev)
+        __field(u8, reg)
+        __field(u8, val)
+        __field(int, ret)
+        __field(u64, ns)
+    ),
+
+    TP_fast_assign(
+        __assign_str(dev, dev);
+        __entry->reg = reg;
+        __entry->val = val;
+        __entry->ret = ret;
+        __entry->ns = ns;
+    ),
+
+    TP_printk("%s reg=0x%02x val=0x%02x ret=%d ns=%llu",
+              __get_str(dev), __entry->reg, __entry->val, __entry->ret, __entry->ns)
+);
+
+#endif /* TPA613A2_TRACE_H */
+
+/* This part must be outside protection */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE tpa613a2_trace
+#include <trace/define_trace.h>
@@ -0,0 +1,244 @@
+/** @file
+
+    Volume tables of the TPA6130A2 (datasheet table 2, section 8.4.9 Volume Control).
+
+    Generated from tpa_code_to_db10[]: tpa_db10_to_code[] maps every gain from
+    TPA_DB10_MIN to TPA_DB10_MAX in 0.1 dB steps to the code of the nearest level,
+    the quieter one on a tie, and tpa_volume_tlv gives ALSA the same gains.
+    Regenerate all three tables together if one changes; tpa613a2_kunit.c checks that they agree.
+
+    find_volume_level() and decode_volume() convert between Q16.16 gains and register values
+    with these tables, and the fade engine steps through them with tpa_fade_code(); they live
+    here so the KUnit test can reach them.
+*/
+
+#ifndef TPA613A2_VOLUME_H
+#define TPA613A2_VOLUME_H
+
+#include <linux/types.h>
+#include <linux/printk.h>
+#include <linux/math64.h>
+#include <sound/tlv.h>
+
+// Number of volume codes (register 2 bits 5:0)
+#define TPA_NUM_CODES   64
+
+// Gain range of the codes in 0.1 dB
+#define TPA_DB10_MIN    (-595)
+#define TPA_DB10_MAX    40
+
+// Register value that mutes both channels, its mute bits, and the gain it stands for in 0.1 dB
+#define TPA_MUTE_CODE   0xFF
+#define TPA_MUTE_BITS   0xC0
+#define TPA_MUTE_DB10   (-1000)
+
+// Longest fade accepted, in ms
+#define TPA_FADE_MAX_MS 600000
+
+/** Gain of every volume code in 0.1 dB, in code order */
+static const int16_t tpa_code_to_db10[TPA_NUM_CODES] =
+{
+    -595, -535, -500, -475, -455, -439, -414, -395,   // 0x00
+    -365, -353, -333, -317, -304, -286, -271, -263,   // 0x08
+    -247, -237, -225, -217, -205, -196, -188, -178,   // 0x10
+    -170, -162, -152, -145, -137, -130, -123, -116,   // 0x18
+    -109, -103,  -97,  -90,  -85,  -78,  -72,  -67,   // 0x20
+     -61,  -56,  -51,  -45,  -41,  -35,  -31,  -26,   // 0x28
+     -21,  -17,  -12,   -8,   -3,    1,    5,    9,   // 0x30
+      14,   17,   21,   25,   29,   33,   36,   40,   // 0x38
+};
+
+/** Nearest volume code for every gain in 0.1 dB, indexed by gain - TPA_DB10_MIN */
+static const uint8_t tpa_db10_to_code[TPA_DB10_MAX - TPA_DB10_MIN + 1] =
+{
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,   // -59.5 dB
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01,   // -57.9 dB
+    0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01,   // -56.3 dB
+    0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01,   // -54.7 dB
+    0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x02, 0x02,   // -53.1 dB
+    0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02,   // -51.5 dB
+    0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x03, 0x03, 0x03, 0x03,   // -49.9 dB
+    0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03, 0x03,   // -48.3 dB
+    0x03, 0x03, 0x03, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04,   // -46.7 dB
+    0x04, 0x04, 0x04, 0x04, 0x04, 0x05, 0x05, 0x05, 0x05, 0x05, 0x05, 0x05, 0x05, 0x05, 0x05, 0x05,   // -45.1 dB
+    0x05, 0x05, 0x05, 0x05, 0x05, 0x05, 0x05, 0x05, 0x05, 0x06, 0x06, 0x06, 0x06, 0x06, 0x06, 0x06,   // -43.5 dB
+    0x06, 0x06, 0x06, 0x06, 0x06, 0x06, 0x06, 0x06, 0x06, 0x06, 0x06, 0x06, 0x06, 0x06, 0x06, 0x07,   // -41.9 dB
+    0x07, 0x07, 0x07, 0x07, 0x07, 0x07, 0x07, 0x07, 0x07, 0x07, 0x07, 0x07, 0x07, 0x07, 0x07, 0x07,   // -40.3 dB
+    0x07, 0x07, 0x07, 0x07, 0x07, 0x07, 0x07, 0x07, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08,   // -38.7 dB
+    0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x09, 0x09, 0x09,   // -37.1 dB
+    0x09, 0x09, 0x09, 0x09, 0x09, 0x09, 0x09, 0x09, 0x09, 0x09, 0x09, 0x09, 0x09, 0x0A, 0x0A, 0x0A,   // -35.5 dB
+    0x0A, 0x0A, 0x0A, 0x0A, 0x0A, 0x0A, 0x0A, 0x0A, 0x0A, 0x0A, 0x0A, 0x0A, 0x0A, 0x0A, 0x0A, 0x0B,   // -33.9 dB
+    0x0B, 0x0B, 0x0B, 0x0B, 0x0B, 0x0B, 0x0B, 0x0B, 0x0B, 0x0B, 0x0B, 0x0B, 0x0B, 0x0C, 0x0C, 0x0C,   // -32.3 dB
+    0x0C, 0x0C, 0x0C, 0x0C, 0x0C, 0x0C, 0x0C, 0x0C, 0x0C, 0x0C, 0x0C, 0x0C, 0x0C, 0x0D, 0x0D, 0x0D,   // -30.7 dB
+    0x0D, 0x0D, 0x0D, 0x0D, 0x0D, 0x0D, 0x0D, 0x0D, 0x0D, 0x0D, 0x0D, 0x0D, 0x0D, 0x0E, 0x0E, 0x0E,   // -29.1 dB
+    0x0E, 0x0E, 0x0E, 0x0E, 0x0E, 0x0E, 0x0E, 0x0E, 0x0E, 0x0F, 0x0F, 0x0F, 0x0F, 0x0F, 0x0F, 0x0F,   // -27.5 dB
+    0x0F, 0x0F, 0x0F, 0x0F, 0x0F, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,   // -25.9 dB
+    0x10, 0x10, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x12, 0x12, 0x12,   // -24.3 dB
+    0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13,   // -22.7 dB
+    0x13, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x15, 0x15, 0x15, 0x15, 0x15,   // -21.1 dB
+    0x15, 0x15, 0x15, 0x15, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x17, 0x17, 0x17,   // -19.5 dB
+    0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x19, 0x19,   // -17.9 dB
+    0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x1A, 0x1A, 0x1A, 0x1A, 0x1A, 0x1A, 0x1A, 0x1A, 0x1B,   // -16.3 dB
+    0x1B, 0x1B, 0x1B, 0x1B, 0x1B, 0x1B, 0x1B, 0x1C, 0x1C, 0x1C, 0x1C, 0x1C, 0x1C, 0x1C, 0x1D, 0x1D,   // -14.7 dB
+    0x1D, 0x1D, 0x1D, 0x1D, 0x1D, 0x1E, 0x1E, 0x1E, 0x1E, 0x1E, 0x1E, 0x1E, 0x1F, 0x1F, 0x1F, 0x1F,   // -13.1 dB
+    0x1F, 0x1F, 0x1F, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21,   // -11.5 dB
+    0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x23, 0x23, 0x23, 0x23, 0x23, 0x23, 0x24, 0x24, 0x24, 0x24,   // -9.9 dB
+    0x24, 0x24, 0x25, 0x25, 0x25, 0x25, 0x25, 0x25, 0x25, 0x26, 0x26, 0x26, 0x26, 0x26, 0x27, 0x27,   // -8.3 dB
+    0x27, 0x27, 0x27, 0x27, 0x28, 0x28, 0x28, 0x28, 0x28, 0x29, 0x29, 0x29, 0x29, 0x29, 0x2A, 0x2A,   // -6.7 dB
+    0x2A, 0x2A, 0x2A, 0x2A, 0x2B, 0x2B, 0x2B, 0x2B, 0x2B, 0x2C, 0x2C, 0x2C, 0x2C, 0x2C, 0x2D, 0x2D,   // -5.1 dB
+    0x2D, 0x2D, 0x2D, 0x2E, 0x2E, 0x2E, 0x2E, 0x2F, 0x2F, 0x2F, 0x2F, 0x2F, 0x30, 0x30, 0x30, 0x30,   // -3.5 dB
+    0x30, 0x31, 0x31, 0x31, 0x31, 0x32, 0x32, 0x32, 0x32, 0x32, 0x33, 0x33, 0x33, 0x33, 0x34, 0x34,   // -1.9 dB
+    0x34, 0x34, 0x34, 0x35, 0x35, 0x35, 0x35, 0x36, 0x36, 0x36, 0x36, 0x37, 0x37, 0x37, 0x37, 0x38,   // -0.3 dB
+    0x38, 0x38, 0x38, 0x39, 0x39, 0x39, 0x39, 0x3A, 0x3A, 0x3A, 0x3A, 0x3B, 0x3B, 0x3B, 0x3B, 0x3C,   // +1.3 dB
+    0x3C, 0x3C, 0x3C, 0x3D, 0x3D, 0x3D, 0x3E, 0x3E, 0x3E, 0x3E, 0x3F, 0x3F,   // +2.9 dB
+};
+
+/** The gain of every volume code for ALSA mixers (0.01 dB), one range per code so it is exact */
+static const DECLARE_TLV_DB_RANGE(tpa_volume_tlv,
+     0,  0, TLV_DB_SCALE_ITEM(-5950, 0, 0),
+     1,  1, TLV_DB_SCALE_ITEM(-5350, 0, 0),
+     2,  2, TLV_DB_SCALE_ITEM(-5000, 0, 0),
+     3,  3, TLV_DB_SCALE_ITEM(-4750, 0, 0),
+     4,  4, TLV_DB_SCALE_ITEM(-4550, 0, 0),
+     5,  5, TLV_DB_SCALE_ITEM(-4390, 0, 0),
+     6,  6, TLV_DB_SCALE_ITEM(-4140, 0, 0),
+     7,  7, TLV_DB_SCALE_ITEM(-3950, 0, 0),
+     8,  8, TLV_DB_SCALE_ITEM(-3650, 0, 0),
+     9,  9, TLV_DB_SCALE_ITEM(-3530, 0, 0),
+    10, 10, TLV_DB_SCALE_ITEM(-3330, 0, 0),
+    11, 11, TLV_DB_SCALE_ITEM(-3170, 0, 0),
+    12, 12, TLV_DB_SCALE_ITEM(-3040, 0, 0),
+    13, 13, TLV_DB_SCALE_ITEM(-2860, 0, 0),
+    14, 14, TLV_DB_SCALE_ITEM(-2710, 0, 0),
+    15, 15, TLV_DB_SCALE_ITEM(-2630, 0, 0),
+    16, 16, TLV_DB_SCALE_ITEM(-2470, 0, 0),
+    17, 17, TLV_DB_SCALE_ITEM(-2370, 0, 0),
+    18, 18, TLV_DB_SCALE_ITEM(-2250, 0, 0),
+    19, 19, TLV_DB_SCALE_ITEM(-2170, 0, 0),
+    20, 20, TLV_DB_SCALE_ITEM(-2050, 0, 0),
+    21, 21, TLV_DB_SCALE_ITEM(-1960, 0, 0),
+    22, 22, TLV_DB_SCALE_ITEM(-1880, 0, 0),
+    23, 23, TLV_DB_SCALE_ITEM(-1780, 0, 0),
+    24, 24, TLV_DB_SCALE_ITEM(-1700, 0, 0),
+    25, 25, TLV_DB_SCALE_ITEM(-1620, 0, 0),
+    26, 26, TLV_DB_SCALE_ITEM(-1520, 0, 0),
+    27, 27, TLV_DB_SCALE_ITEM(-1450, 0, 0),
+    28, 28, TLV_DB_SCALE_ITEM(-1370, 0, 0),
+    29, 29, TLV_DB_SCALE_ITEM(-1300, 0, 0),
+    30, 30, TLV_DB_SCALE_ITEM(-1230, 0, 0),
+    31, 31, TLV_DB_SCALE_ITEM(-1160, 0, 0),
+    32, 32, TLV_DB_SCALE_ITEM(-1090, 0, 0),
+    33, 33, TLV_DB_SCALE_ITEM(-1030, 0, 0),
+    34, 34, TLV_DB_SCALE_ITEM(-970, 0, 0),
+    35, 35, TLV_DB_SCALE_ITEM(-900, 0, 0),
+    36, 36, TLV_DB_SCALE_ITEM(-850, 0, 0),
+    37, 37, TLV_DB_SCALE_ITEM(-780, 0, 0),
+    38, 38, TLV_DB_SCALE_ITEM(-720, 0, 0),
+    39, 39, TLV_DB_SCALE_ITEM(-670, 0, 0),
+    40, 40, TLV_DB_SCALE_ITEM(-610, 0, 0),
+    41, 41, TLV_DB_SCALE_ITEM(-560, 0, 0),
+    42, 42, TLV_DB_SCALE_ITEM(-510, 0, 0),
+    43, 43, TLV_DB_SCALE_ITEM(-450, 0, 0),
+    44, 44, TLV_DB_SCALE_ITEM(-410, 0, 0),
+    45, 45, TLV_DB_SCALE_ITEM(-350, 0, 0),
+    46, 46, TLV_DB_SCALE_ITEM(-310, 0, 0),
+    47, 47, TLV_DB_SCALE_ITEM(-260, 0, 0),
+    48, 48, TLV_DB_SCALE_ITEM(-210, 0, 0),
+    49, 49, TLV_DB_SCALE_ITEM(-170, 0, 0),
+    50, 50, TLV_DB_SCALE_ITEM(-120, 0, 0),
+    51, 51, TLV_DB_SCALE_ITEM(-80, 0, 0),
+    52, 52, TLV_DB_SCALE_ITEM(-30, 0, 0),
+    53, 53, TLV_DB_SCALE_ITEM(10, 0, 0),
+    54, 54, TLV_DB_SCALE_ITEM(50, 0, 0),
+    55, 55, TLV_DB_SCALE_ITEM(90, 0, 0),
+    56, 56, TLV_DB_SCALE_ITEM(140, 0, 0),
+    57, 57, TLV_DB_SCALE_ITEM(170, 0, 0),
+    58, 58, TLV_DB_SCALE_ITEM(210, 0, 0),
+    59, 59, TLV_DB_SCALE_ITEM(250, 0, 0),
+    60, 60, TLV_DB_SCALE_ITEM(290, 0, 0),
+    61, 61, TLV_DB_SCALE_ITEM(330, 0, 0),
+    62, 62, TLV_DB_SCALE_ITEM(360, 0, 0),
+    63, 63, TLV_DB_SCALE_ITEM(400, 0, 0)
+);
+
+/** Find the register value of the volume level closest to a gain
+
+    A constant time lookup in tpa_db10_to_code[]. Gains nearer to -100 dB than to the lowest
+    volume level mute the outputs.
+
+    @param fp16_num Gain in dB, Q16.16
+    @return The register value: a volume code, or TPA_MUTE_CODE
+*/
+static inline uint8_t find_volume_level(int32_t fp16_num)
+{
+  // Round to the nearest 0.1 dB, halves away from zero
+  int32_t db10 = div_s64((s64)fp16_num * 10 + (fp16_num < 0 ? -(1 << 15) : (1 << 15)), 1 << 16);
+
+  // Determine whether the negative dB bound has been exceeded
+  if (db10 < TPA_MUTE_DB10)
+  {
+    printk("Maximum attenuation exceeded.\n");
+    printk("Setting attenuation to -100 dB.\n");
+  }
+  if (2 * db10 < TPA_MUTE_DB10 + TPA_DB10_MIN)
+    return TPA_MUTE_CODE;
+  if (db10 < TPA_DB10_MIN)
+    return tpa_db10_to_code[0];
+
+  // Determine whether the positive dB bound has been exceeded
+  if (db10 > TPA_DB10_MAX)
+  {
+    printk("Maximum amplification exceeded.\n");
+    printk("Setting amplification to 4 dB.\n");
+    db10 = TPA_DB10_MAX;
+  }
+
+  return tpa_db10_to_code[db10 - TPA_DB10_MIN];
+}
+
+/** Gain of a register value
+    @param code A volume register value; both mute bits set reads as -100 dB
+    @return The gain in dB, Q16.16
+*/
+static inline int32_t decode_volume(uint8_t code)
+{
+  int32_t db10 = ((code & TPA_MUTE_BITS) == TPA_MUTE_BITS) ? TPA_MUTE_DB10 : tpa_code_to_db10[code % TPA_NUM_CODES];
+
+  return db10 * (1 << 16) / 10;
+}
+
+/** Gain a fade runs from or to
+    @param code A volume register value
+    @return Its gain in 0.1 dB; muted ends of a fade run from or to the lowest level
+*/
+static inline int tpa_fade_db10(unsigned int code)
+{
+  return ((code & TPA_MUTE_BITS) == TPA_MUTE_BITS) ? TPA_DB10_MIN : tpa_code_to_db10[code % TPA_NUM_CODES];
+}
+
+/** Volume register value a fade is at after some time
+
+    The gain moves linearly in 0.1 dB from the start, so a late tick skips the levels that are
+    already past, and each step is the level nearest to that gain. Once the time is up the fade
+    lands on its own register value, which may be the mute value.
+
+    @param from Gain when the fade started, in 0.1 dB, as from tpa_fade_db10()
+    @param to Gain the fade moves to, in 0.1 dB, as from tpa_fade_db10()
+    @param code Volume register value to end on
+    @param elapsed Time since the fade started, in ms
+    @param ms Duration of the fade
+    @return The volume register value to send
+*/
+static inline uint8_t tpa_fade_code(int from, int to, uint8_t code, s64 elapsed, unsigned int ms)
+{
+  int db10;
+
+  if (elapsed >= ms)
+    return code;
+
+  db10 = from + div_s64((s64)(to - from) * elapsed, ms);
+
+  return tpa_db10_to_code[db10 - TPA_DB10_MIN];
+}
+
+#endif // TPA613A2_VOLUME_H